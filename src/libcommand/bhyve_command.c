@@ -60,6 +60,48 @@ struct nvlistitem_mapping bhyve_command_nv[] = {
 		.value_type = DYNAMICSTRING,
 		.size = sizeof(char*),
 		.varname = "reply"
+	},
+	{
+		.offset = offsetof(struct bhyve_usercommand, states),
+		.value_type = DYNAMICSTRING,
+		.size = sizeof(char*),
+		.varname = "states"
+	},
+	{
+		.offset = offsetof(struct bhyve_usercommand, timeout),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "timeout"
+	},
+	{
+		.offset = offsetof(struct bhyve_usercommand, source),
+		.value_type = DYNAMICSTRING,
+		.size = sizeof(char*),
+		.varname = "source"
+	},
+	{
+		.offset = offsetof(struct bhyve_usercommand, since),
+		.value_type = UINT64,
+		.size = sizeof(uint64_t),
+		.varname = "since"
+	},
+	{
+		.offset = offsetof(struct bhyve_usercommand, until),
+		.value_type = UINT64,
+		.size = sizeof(uint64_t),
+		.varname = "until"
+	},
+	{
+		.offset = offsetof(struct bhyve_usercommand, follow),
+		.value_type = BOOLEAN,
+		.size = sizeof(bool),
+		.varname = "follow"
+	},
+	{
+		.offset = offsetof(struct bhyve_usercommand, backlog),
+		.value_type = BOOLEAN,
+		.size = sizeof(bool),
+		.varname = "backlog"
 	}
 };
 
@@ -256,6 +298,8 @@ bcmd_freestatic(struct bhyve_usercommand *bcmd)
 	free(bcmd->cmd);
 	free(bcmd->vmname);
 	free(bcmd->reply);
+	free(bcmd->states);
+	free(bcmd->source);
 }
 
 /*
@@ -30,6 +30,7 @@
 
 #include <sys/nv.h>
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -57,6 +58,15 @@ struct bhyve_usercommand {
 
 	void *blob;       /* blob reply data */
 	size_t bloblen;   /* blob length */
+
+	char *states;     /* comma separated state names to wait for */
+	uint32_t timeout; /* seconds to wait, 0 waits forever */
+
+	char *source;     /* source of log records to show, NULL for all */
+	uint64_t since;   /* oldest log records to show, seconds since epoch */
+	uint64_t until;   /* newest log records to show, 0 for all */
+	bool follow;      /* keep sending log records as they are written */
+	bool backlog;     /* when following, start with recent records */
 };
 
 int bcmd_parse_nvlistcmd(const char *buffer, size_t bufferlen, struct bhyve_usercommand *bc);
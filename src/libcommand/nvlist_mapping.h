@@ -33,21 +33,18 @@
 
 #define nvlistitem_mapping parser_mapping
 
-#define nvlistitem_mapping_lookupfunc(v, funcname) \
+/*
+ * defines funcname looking up a mapping through the parser_mapping_index
+ * index
+ */
+#define nvlistitem_mapping_lookupfunc(index, funcname) \
 	struct nvlistitem_mapping * \
 	funcname(const char *input) \
 	{ \
 		if (!input) \
 			return NULL; \
 		\
-		size_t configcount = sizeof(v) / sizeof(struct nvlistitem_mapping); \
-		size_t counter = 0; \
-		\
-		for (counter = 0; counter < configcount; counter++) { \
-			if (!strcmp(v[counter].varname, input)) \
-				return &v[counter]; \
-		} \
-		return NULL; \
+		return pmi_lookup(&index, input); \
 	}
 
 #endif /* __NVLIST_MAPPING_H__ */
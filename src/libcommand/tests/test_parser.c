@@ -73,9 +73,85 @@ ATF_TC_BODY(tc_bc_parsenvcmd, tc)
 	nvlist_destroy(nvl);
 }
 
+ATF_TC(tc_bc_parsewaitstate);
+ATF_TC_HEAD(tc_bc_parsewaitstate, tc)
+{
+}
+ATF_TC_BODY(tc_bc_parsewaitstate, tc)
+{
+	nvlist_t *nvl = 0;
+	void *buffer = 0;
+	size_t buflen = 0;
+	struct bhyve_usercommand bcf = {0};
+
+	ATF_REQUIRE(0 != (nvl = nvlist_create(0)));
+
+	bcf.cmd = strdup("waitstate");
+	bcf.vmname = strdup("vm1,vm2");
+	bcf.states = strdup("running,failed");
+	bcf.timeout = 30;
+
+	ATF_REQUIRE_EQ(0, bcmd_encodenvlist_command(&bcf, nvl));
+	bcmd_freestatic(&bcf);
+	bzero(&bcf, sizeof(struct bhyve_usercommand));
+
+	ATF_REQUIRE(0 != (buffer = nvlist_pack(nvl, &buflen)));
+	ATF_REQUIRE_EQ(0, bcmd_parse_nvlistcmd(buffer, buflen, &bcf));
+	ATF_REQUIRE_STREQ("waitstate", bcf.cmd);
+	ATF_REQUIRE_STREQ("vm1,vm2", bcf.vmname);
+	ATF_REQUIRE_STREQ("running,failed", bcf.states);
+	ATF_REQUIRE_EQ(30, bcf.timeout);
+
+	bcmd_freestatic(&bcf);
+	free(buffer);
+
+	nvlist_destroy(nvl);
+}
+
+ATF_TC(tc_bc_parselogs);
+ATF_TC_HEAD(tc_bc_parselogs, tc)
+{
+}
+ATF_TC_BODY(tc_bc_parselogs, tc)
+{
+	nvlist_t *nvl = 0;
+	void *buffer = 0;
+	size_t buflen = 0;
+	struct bhyve_usercommand bcf = {0};
+
+	ATF_REQUIRE(0 != (nvl = nvlist_create(0)));
+
+	bcf.cmd = strdup("logs");
+	bcf.vmname = strdup("vm1");
+	bcf.source = strdup("start_storage");
+	bcf.since = 1700000000;
+	bcf.until = 1700003600;
+	bcf.follow = true;
+
+	ATF_REQUIRE_EQ(0, bcmd_encodenvlist_command(&bcf, nvl));
+	bcmd_freestatic(&bcf);
+	bzero(&bcf, sizeof(struct bhyve_usercommand));
+
+	ATF_REQUIRE(0 != (buffer = nvlist_pack(nvl, &buflen)));
+	ATF_REQUIRE_EQ(0, bcmd_parse_nvlistcmd(buffer, buflen, &bcf));
+	ATF_REQUIRE_STREQ("logs", bcf.cmd);
+	ATF_REQUIRE_STREQ("start_storage", bcf.source);
+	ATF_REQUIRE_EQ(1700000000, bcf.since);
+	ATF_REQUIRE_EQ(1700003600, bcf.until);
+	ATF_REQUIRE(bcf.follow);
+	ATF_REQUIRE(!bcf.backlog);
+
+	bcmd_freestatic(&bcf);
+	free(buffer);
+
+	nvlist_destroy(nvl);
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_bc_parsenvcmd);
+	ATF_TP_ADD_TC(testplan, tc_bc_parsewaitstate);
+	ATF_TP_ADD_TC(testplan, tc_bc_parselogs);
 
 	return atf_no_error();
 }
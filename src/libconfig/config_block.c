@@ -25,40 +25,71 @@
  * SUCH DAMAGE.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "config_block.h"
 
+/*
+ * release the strings of a block device
+ */
+void
+bpp_block_release(struct bhyve_parameters_block *block)
+{
+	if (!block)
+		return;
+
+	switch (block->block_type) {
+	case TYPE_BLOCK_VIRTIO:
+		free(block->data.virtio_blk.storage_path);
+		break;
+	case TYPE_BLOCK_NVME:
+		free(block->data.nvme.storage_path);
+		break;
+	case TYPE_BLOCK_VIRTIO_SCSI:
+		free(block->data.scsi.iid);
+		break;
+	case TYPE_BLOCK_AHCI_HD:
+		free(block->data.ahci_hd.storage_path);
+		break;
+	default:
+		break;
+	}
+}
+
 int
 bpp_new_block_generic(struct bhyve_parameters_block *block, const char *storage_path,
 		      bhyve_parameters_block_t block_type)
 {
+	char *path = NULL;
+
 	if (!block || !storage_path) {
 		errno = EINVAL;
 		return -1;
 	}
 
+	if (block_type != TYPE_BLOCK_VIRTIO && block_type != TYPE_BLOCK_NVME &&
+	    block_type != TYPE_BLOCK_AHCI_HD) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!(path = strdup(storage_path)))
+		return -1;
+
+	bpp_block_release(block);
 	bzero(block, sizeof(struct bhyve_parameters_block));
 	block->block_type = block_type;
 	switch (block_type) {
 	case TYPE_BLOCK_VIRTIO:
-		strncpy(block->data.virtio_blk.storage_path,
-			storage_path,
-			PATH_MAX);
+		block->data.virtio_blk.storage_path = path;
 		break;
 	case TYPE_BLOCK_NVME:
-		strncpy(block->data.nvme.storage_path,
-			storage_path,
-			PATH_MAX);
-		break;
-	case TYPE_BLOCK_AHCI_HD:
-		strncpy(block->data.ahci_hd.storage_path,
-			storage_path,
-			PATH_MAX);
+		block->data.nvme.storage_path = path;
 		break;
 	default:
-		errno = EINVAL;
-		return -1;
+		block->data.ahci_hd.storage_path = path;
+		break;
 	}
 
 	return 0;
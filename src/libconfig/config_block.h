@@ -50,7 +50,7 @@ typedef enum {
  * virtio-blk configuration
  */
 struct bhyve_parameters_block_virtioblk {
-	char storage_path[PATH_MAX];
+	char *storage_path;
 
 	bool nocache;
 	bool direct;
@@ -64,7 +64,7 @@ struct bhyve_parameters_block_virtioblk {
  * nvme configuration
  */
 struct bhyve_parameters_block_nvme {
-	char storage_path[PATH_MAX];
+	char *storage_path;
 
 	uint16_t max_queues;
 	uint16_t queue_size;
@@ -82,11 +82,11 @@ struct bhyve_parameters_block_nvme {
 struct bhyve_parameters_block_scsi {
 	uint16_t pp;
 	uint16_t vp;
-	char iid[BPC_PARM_MAX];
+	char *iid;
 };
 
 struct bhyve_parameters_block_ahcihd {
-	char storage_path[PATH_MAX];
+	char *storage_path;
 	
 	uint16_t nmrr;
 	char serial_number[21];
@@ -95,7 +95,8 @@ struct bhyve_parameters_block_ahcihd {
 };
 
 /*
- * defines a block device and its controller
+ * defines a block device and its controller; its strings are allocated
+ * and released by bpp_block_release
  */
 struct bhyve_parameters_block {
 	bhyve_parameters_block_t block_type;
@@ -111,5 +112,6 @@ struct bhyve_parameters_block {
 int bpp_new_block_virtioblk(struct bhyve_parameters_block *block, const char *storage_path);
 int bpp_new_block_nvme(struct bhyve_parameters_block *block, const char *storage_path);
 int bpp_new_block_ahcihd(struct bhyve_parameters_block *block, const char *storage_path);
+void bpp_block_release(struct bhyve_parameters_block *block);
 
 #endif /* __CONFIG_BLOCK_H__ */
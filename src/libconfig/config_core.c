@@ -46,6 +46,11 @@
 #include "parser_offsets.h"
 
 #include "../libutils/bhyve_utils.h"
+#include "../libutils/memory_arena.h"
+#include "../libutils/string_pool.h"
+
+/* arena chunk size of a parameter config and its strings */
+#define BPC_ARENA_SIZE 512
 
 #define BPC_SETTER_FUNC(varname, vartype)		\
 	int \
@@ -96,22 +101,27 @@ struct bhyve_parameters_pcislot_iter {
 };
 
 /*
- * core parameters specific to a virtual machine
+ * core parameters specific to a virtual machine; the structure and its
+ * strings are allocated from an arena released by bpc_free
  */
 struct bhyve_parameters_core {
-	bool generate_acpi_tables;
 	uint32_t memory;
 	uint16_t numcpus;
 	uint16_t sockets;
 	uint16_t cores;
+	bool generate_acpi_tables;
 	bool yield_on_hlt;
 	bool wire_memory;
 	bool rtc_keeps_utc;
 	bool x2apic_mode;
-	char vmname[BPC_NAME_MAX];
+	const char *vmname;
 
 	struct bhyve_parameters_comport comport[4];
 	struct bhyve_parameters_bootrom bootrom;
+
+	/* backing storage of the strings above */
+	struct memory_arena *arena;
+	struct string_pool *strings;
 	
 	SLIST_HEAD(, bhyve_parameters_pcislot) pcislots;
 };
@@ -129,12 +139,39 @@ struct bhyve_parameters_parser_info mapping_vars2core[] = {
 	{
 		.mapping = {
 			.offset = offsetof(struct bhyve_parameters_core, memory),
-			.value_type = UINT64,
-			.size = sizeof(uint64_t),
+			.value_type = UINT32,
+			.size = sizeof(uint32_t),
 			.varname = "memory.size"
 		},
 		.filter = po_filter_memory
 	},
+	{
+		.mapping = {
+			.offset = offsetof(struct bhyve_parameters_core, numcpus),
+			.value_type = UINT16,
+			.size = sizeof(uint16_t),
+			.varname = "cpus"
+		},
+		.filter = po_filter_uint16
+	},
+	{
+		.mapping = {
+			.offset = offsetof(struct bhyve_parameters_core, sockets),
+			.value_type = UINT16,
+			.size = sizeof(uint16_t),
+			.varname = "sockets"
+		},
+		.filter = po_filter_uint16
+	},
+	{
+		.mapping = {
+			.offset = offsetof(struct bhyve_parameters_core, cores),
+			.value_type = UINT16,
+			.size = sizeof(uint16_t),
+			.varname = "cores"
+		},
+		.filter = po_filter_uint16
+	},
 	{
 		.mapping = {
 			.offset = offsetof(struct bhyve_parameters_core, yield_on_hlt),
@@ -155,6 +192,70 @@ bpc_get_parsermapping()
 	return mapping_vars2core;
 }
 
+/*
+ * get number of entries in parser mapping
+ */
+size_t
+bpc_get_parsermappingcount()
+{
+	return sizeof(mapping_vars2core) /
+		sizeof(struct bhyve_parameters_parser_info);
+}
+
+/*
+ * set a parameter from a key and value of a bhyve config file, neither
+ * of which needs to be NUL terminated; the value is converted by the
+ * filter of the key's mapping
+ *
+ * returns 0 on success, -1 with errno ENOENT if the key has no mapping
+ * or EDOM if the value is invalid
+ */
+int
+bpc_set_parameter(struct bhyve_parameters_core *bpc,
+		  const char *key, size_t keylen,
+		  const char *value, size_t valuelen)
+{
+	const struct bhyve_parameters_parser_info *info = NULL;
+	char buffer[BPC_PARM_MAX + 1] = {0};
+	void *filtered = NULL;
+	size_t counter = 0;
+
+	if (!bpc || !key || !value) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (counter = 0; counter < bpc_get_parsermappingcount(); counter++) {
+		if (strlen(mapping_vars2core[counter].mapping.varname) ==
+		    keylen &&
+		    !memcmp(mapping_vars2core[counter].mapping.varname, key,
+			    keylen)) {
+			info = &mapping_vars2core[counter];
+			break;
+		}
+	}
+
+	if (!info) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (valuelen > BPC_PARM_MAX) {
+		errno = EDOM;
+		return -1;
+	}
+
+	/* filters take a NUL terminated string */
+	memcpy(buffer, value, valuelen);
+	if (!(filtered = info->filter(buffer)))
+		return -1;
+
+	memcpy((char *) bpc + info->mapping.offset, filtered,
+	       info->mapping.size);
+
+	return 0;
+}
+
 /* TODO implement method to get next available slot id */
 
 /*
@@ -183,10 +284,15 @@ bpc_set_bootrom(struct bhyve_parameters_core *bpc,
 		return -1;
 	}
 
-	strncpy(bpc->bootrom.bootrom, bootrom, PATH_MAX);
+	if (!(bootrom = spl_intern(bpc->strings, bootrom)))
+		return -1;
+	if (with_vars && !(varsfile = spl_intern(bpc->strings, varsfile)))
+		return -1;
+
+	bpc->bootrom.bootrom = bootrom;
 	bpc->bootrom.with_vars = with_vars;
 	if (with_vars)
-		strncpy(bpc->bootrom.varsfile, varsfile, PATH_MAX);
+		bpc->bootrom.varsfile = varsfile;
 
 	return 0;
 }
@@ -222,8 +328,11 @@ bpc_enable_comport(struct bhyve_parameters_core *bpc,
 		return -1;
 	}
 
+	if (!(portname = spl_intern(bpc->strings, portname)))
+		return -1;
+
 	bpc->comport[comport].enabled = enabled;
-	strncpy(bpc->comport[comport].portname, portname, BPC_NAME_MAX);
+	bpc->comport[comport].portname = portname;
 
 	return 0;
 }
@@ -240,7 +349,10 @@ bpc_set_comport_backend(struct bhyve_parameters_core *bpc,
 		return -1;
 	}
 
-	strncpy(bpc->comport[comport].backend, backend, PATH_MAX);
+	if (!(backend = spl_intern(bpc->strings, backend)))
+		return -1;
+
+	bpc->comport[comport].backend = backend;
 
 	return 0;
 }
@@ -252,21 +364,41 @@ struct bhyve_parameters_core *
 bpc_new(const char *vmname)
 {
 	struct bhyve_parameters_core *bpc = 0;
+	struct memory_arena *ma = NULL;
+	const char *empty = NULL;
+	size_t counter = 0;
 
 	if (!vmname) {
 		errno = EINVAL;
 		return NULL;
 	}
 
-	if (!(bpc = malloc(sizeof(struct bhyve_parameters_core))))
+	if (!(ma = ma_new(BPC_ARENA_SIZE)))
 		return NULL;
 
-	bzero(bpc, sizeof(struct bhyve_parameters_core));
-
-	strncpy(bpc->vmname, vmname, BPC_NAME_MAX);
+	if (!(bpc = ma_alloc(ma, sizeof(struct bhyve_parameters_core)))) {
+		ma_free(ma);
+		return NULL;
+	}
 
+	bpc->arena = ma;
 	SLIST_INIT(&bpc->pcislots);
 
+	if (!(bpc->strings = spl_new(ma)) ||
+	    !(empty = spl_intern(bpc->strings, "")) ||
+	    !(bpc->vmname = spl_intern(bpc->strings, vmname))) {
+		bpc_free(bpc);
+		return NULL;
+	}
+
+	/* unset strings are empty */
+	for (counter = 0; counter < 4; counter++) {
+		bpc->comport[counter].portname = empty;
+		bpc->comport[counter].backend = empty;
+	}
+	bpc->bootrom.bootrom = empty;
+	bpc->bootrom.varsfile = empty;
+
 	return bpc;
 }
 
@@ -391,6 +523,20 @@ bpp_free(struct bhyve_parameters_pcislot *bpp)
 	if (!bpp)
 		return;
 
+	switch (bpp->slot_type) {
+	case TYPE_BLOCK:
+		bpp_block_release(&bpp->data.block);
+		break;
+	case TYPE_NET:
+		bpp_network_release(&bpp->data.network);
+		break;
+	case TYPE_VNC:
+		free(bpp->data.vnc.password);
+		break;
+	default:
+		break;
+	}
+
 	free(bpp);
 }
 
@@ -410,8 +556,9 @@ bpc_free(struct bhyve_parameters_core *bpc)
 		SLIST_REMOVE_HEAD(&bpc->pcislots, entries);
 		bpp_free(bpp);
 	}
-	
-	free(bpc);
+
+	/* releases bpc itself along with its strings */
+	ma_free(bpc->arena);
 }
 
 /*
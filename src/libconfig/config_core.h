@@ -49,17 +49,21 @@ typedef enum {
 	TYPE_INVALID = 999
 } bhyve_parameters_pcislot_t;
 
+/*
+ * strings of the core parameters are interned in the string pool of
+ * struct bhyve_parameters_core and are empty if not set
+ */
 struct bhyve_parameters_comport {
-	char portname[BPC_NAME_MAX];
-	bool enabled;
+	const char *portname;
 	/* device name to attach to, i.e. /dev/nmdb0 */
-	char backend[PATH_MAX];
+	const char *backend;
+	bool enabled;
 };
 
 struct bhyve_parameters_bootrom {
-	char bootrom[PATH_MAX];
+	const char *bootrom;
+	const char *varsfile;
 	bool with_vars;
-	char varsfile[PATH_MAX];
 };
 
 /* the core configuration structure
@@ -118,6 +122,11 @@ bpp_get_pciid(const struct bhyve_parameters_pcislot *bpp,
 	      uint8_t *function);
 
 const struct bhyve_parameters_parser_info *bpc_get_parsermapping();
+size_t		bpc_get_parsermappingcount();
+int
+bpc_set_parameter(struct bhyve_parameters_core *bpc,
+		  const char *key, size_t keylen,
+		  const char *value, size_t valuelen);
 
 int
 bpc_set_cpulayout(struct bhyve_parameters_core *bpc,
@@ -29,6 +29,21 @@
 
 #include "config_network.h"
 
+/*
+ * release the strings of a network interface
+ */
+void
+bpp_network_release(struct bhyve_parameters_network *network)
+{
+	if (!network || network->backend_type != TYPE_NET_BACKEND_NETGRAPH)
+		return;
+
+	free(network->data.netgraph.path);
+	free(network->data.netgraph.peerhook);
+	free(network->data.netgraph.socket);
+	free(network->data.netgraph.hook);
+}
+
 int
 bpp_new_network_generic(struct bhyve_parameters_network *network,
 			bhyve_parameters_network_t interface_type,
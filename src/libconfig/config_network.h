@@ -53,14 +53,15 @@ struct bhyve_parameters_network_vmnet {
 };
 
 struct bhyve_parameters_network_netgraph {
-	char path[PATH_MAX];
-	char peerhook[PATH_MAX];
-	char socket[PATH_MAX];
-	char hook[PATH_MAX];
+	char *path;
+	char *peerhook;
+	char *socket;
+	char *hook;
 };
 
 /*
- * represents a network interface
+ * represents a network interface; its strings are released by
+ * bpp_network_release
  */
 struct bhyve_parameters_network {
 	bhyve_parameters_network_t network_type;
@@ -83,5 +84,6 @@ int bpp_new_network_tap(struct bhyve_parameters_network *network,
 int bpp_new_network_vmnet(struct bhyve_parameters_network *network,
 			  bhyve_parameters_network_t interface_type,
 			  uint16_t tap_id);
+void bpp_network_release(struct bhyve_parameters_network *network);
 
 #endif /* __CONFIG_NETWORK_H__ */
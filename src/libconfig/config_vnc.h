@@ -41,7 +41,8 @@ struct bhyve_parameters_vnc {
 	uint16_t width;
 	uint16_t height;
 	uint16_t port;
-	char password[BPC_PASS_MAX];
+	/* allocated, released with the pci slot */
+	char *password;
 };
 
 #endif /* __CONFIG_VNC_H__ */
@@ -68,24 +68,25 @@ fm_new(const char *filename)
 	strncpy(fm->filename, filename, PATH_MAX);
 
 	if ((fm->filefd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
-		free(fm->filename);
 		free(fm);
 		return NULL;
 	}
 
 	if ((offset = lseek(fm->filefd, 0, SEEK_END)) < 0) {
 		close(fm->filefd);
-		free(fm->filename);
 		free(fm);
 		return NULL;
 	}
 	fm->filesize = offset;
 
+	/* an empty file cannot be mapped */
+	if (!fm->filesize)
+		return fm;
+
 	fm->memory = mmap(NULL, fm->filesize, PROT_READ, MAP_PRIVATE,
 			  fm->filefd, 0);
 	if (MAP_FAILED == fm->memory) {
 		close(fm->filefd);
-		free(fm->filename);
 		free(fm);
 		return NULL;
 	}
@@ -94,7 +95,7 @@ fm_new(const char *filename)
 }
 
 /*
- * get file contents
+ * get file contents; they are not NUL terminated
  */
 const char *
 fm_get_memory(const struct file_memory *fm)
@@ -102,6 +103,15 @@ fm_get_memory(const struct file_memory *fm)
 	return fm->memory;
 }
 
+/*
+ * get number of bytes in file contents
+ */
+size_t
+fm_get_size(const struct file_memory *fm)
+{
+	return fm->filesize;
+}
+
 /*
  * free previously allocated file memory
  */
@@ -111,7 +121,8 @@ fm_free(struct file_memory *fm)
 	if (!fm)
 		return;
 
-	munmap(fm->memory, fm->filesize);
+	if (fm->memory)
+		munmap(fm->memory, fm->filesize);
 
 	close(fm->filefd);
 	free(fm);
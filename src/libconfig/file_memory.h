@@ -28,11 +28,14 @@
 #ifndef __FILE_MEMORY_H__
 #define __FILE_MEMORY_H__
 
+#include <stddef.h>
+
 struct file_memory;
 
 struct file_memory *fm_new(const char *filename);
 void		    fm_free(struct file_memory *fm);
 
 const char *        fm_get_memory(const struct file_memory *fm);
+size_t		    fm_get_size(const struct file_memory *fm);
 
 #endif /* __FILE_MEMORY_H__ */
@@ -25,30 +25,28 @@
  * SUCH DAMAGE.
  */
 
-#include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <unistd.h>
 
+#include "../libutils/daemon_log.h"
+
 #include "config_core.h"
 #include "file_memory.h"
 #include "output_bhyve_core.h"
 
-/*
- * A configuration line generated from a config_core object
- */
-struct output_bhyve_core_configline {
-	char *configline;
-
-	SLIST_ENTRY(output_bhyve_core_configline) entries;
-};
+/* initial size of the buffer holding generated config lines */
+#define OBC_BUFFER_SIZE 1024
 
 /*
  * Central object for translating a config_core and its substructures
@@ -61,23 +59,43 @@ struct output_bhyve_core {
 	/* the input data holding configuration */
 	const struct bhyve_parameters_core *bpc;
 
-	/* list of generated config records */
-	SLIST_HEAD(, output_bhyve_core_configline) lines;
+	/* generated config lines in the order they were added */
+	char *buffer;
+	/* bytes of config lines in buffer */
+	size_t length;
+	/* bytes allocated for buffer */
+	size_t size;
 };
 
 /*
- * free config line
+ * make room for length more bytes and a terminating NUL in the buffer
+ *
+ * returns 0 on success.
  */
-void
-obcc_free(struct output_bhyve_core_configline *obcc)
+int
+obc_reserve(struct output_bhyve_core *obc, size_t length)
 {
-	if (!obcc) {
-		errno = EINVAL;
-		return;
+	char *buffer = NULL;
+	size_t size = obc->size ? obc->size : OBC_BUFFER_SIZE;
+
+	while (size - obc->length <= length) {
+		if (size > SIZE_MAX / 2) {
+			errno = ENOMEM;
+			return -1;
+		}
+		size *= 2;
 	}
 
-	free(obcc->configline);
-	free(obcc);
+	if (size == obc->size)
+		return 0;
+
+	if (!(buffer = realloc(obc->buffer, size)))
+		return -1;
+
+	obc->buffer = buffer;
+	obc->size = size;
+
+	return 0;
 }
 
 /*
@@ -86,32 +104,23 @@ obcc_free(struct output_bhyve_core_configline *obcc)
 int
 obc_add(struct output_bhyve_core *obc, const char *key, const char *value)
 {
-	struct output_bhyve_core_configline *obcc = 0;
-	size_t len_key = 0, len_val = 0, len_new = 0;
+	size_t len_new = 0;
 
-	if (!key || !value) {
+	if (!obc || !key || !value) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	if (!(obcc = malloc(sizeof(struct output_bhyve_core_configline))))
-		return -1;
+	/* key=value and a newline */
+	len_new = strlen(key) + strlen(value) + 2;
 
-	obcc->configline = 0;
-	
-	len_key = strlen(key);
-	len_val = strlen(value);
-	len_new = len_key + len_val + 2;
-	
-	if (!(obcc->configline = malloc(len_new))) {
-		obcc_free(obcc);
+	if (obc_reserve(obc, len_new))
 		return -1;
-	}
 
-	snprintf(obcc->configline, len_new, "%s=%s", key, value);
+	snprintf(obc->buffer + obc->length, len_new + 1, "%s=%s\n",
+		 key, value);
+	obc->length += len_new;
 
-	SLIST_INSERT_HEAD(&obc->lines, obcc,entries);
-	
 	return 0;
 }
 
@@ -142,7 +151,7 @@ obc_set_pcislots(struct output_bhyve_core *obc)
 		return -1;
 	}
 
-	syslog(LOG_INFO, "Constructing pci data");
+	dlog(LOG_DEBUG, "Constructing pci data");
 
 	while (bppi_next(bppi)) {
 		bpp = bppi_item(bppi);
@@ -163,8 +172,8 @@ obc_set_pcislots(struct output_bhyve_core *obc)
 		snprintf(pci_backend, sizeof(pci_backend),
 			 "pci.%d.%d.%d.backend", bus, pcislot, function);
 
-		syslog(LOG_INFO, "Looking at pci slot type %d",
-		       bpp_get_slottype(bpp));
+		dlog(LOG_DEBUG, "Looking at pci slot type %d",
+		     bpp_get_slottype(bpp));
 
 		switch (bpp_get_slottype(bpp)) {
 		case TYPE_ISABRIDGE:
@@ -198,7 +207,7 @@ obc_set_pcislots(struct output_bhyve_core *obc)
 
 	bppi_free(bppi);
 
-	syslog(LOG_INFO, "Completed pci data construction");
+	dlog(LOG_DEBUG, "Completed pci data construction");
 
 	return 0;
 }
@@ -265,7 +274,7 @@ obc_set_core(struct output_bhyve_core *obc)
 
 	if (bpc_get_cores(obc->bpc)) {
 		snprintf(numvar, 32, "%d", bpc_get_cores(obc->bpc));
-		if ((result = obc_add(obc, "sockets", numvar)))
+		if ((result = obc_add(obc, "cores", numvar)))
 			return result;
 	}
 
@@ -298,12 +307,13 @@ obc_set_core(struct output_bhyve_core *obc)
 }
 
 /*
- * Construct a new output helper
+ * Construct a new output helper; configfile may be NULL if the output
+ * is only rendered into arguments
  */
 struct output_bhyve_core *
 obc_new(const char *configfile, const struct bhyve_parameters_core *bpc)
 {
-	if (!configfile || !bpc) {
+	if (!bpc) {
 		errno = EINVAL;
 		return NULL;
 	}
@@ -314,17 +324,15 @@ obc_new(const char *configfile, const struct bhyve_parameters_core *bpc)
 		return NULL;
 
 	bzero(obc, sizeof(struct output_bhyve_core));
-	if (!(obc->configfile = strdup(configfile))) {
+	if (configfile && !(obc->configfile = strdup(configfile))) {
 		free(obc);
 		return NULL;
 	}
 
 	obc->bpc = bpc;
 
-	SLIST_INIT(&obc->lines);
-
-	syslog(LOG_INFO, "Building bhyve_config for file %s",
-	       configfile);
+	dlog(LOG_DEBUG, "Building bhyve_config for file %s",
+	     configfile ? configfile : "arguments");
 
 	if (obc_set_core(obc)) {
 		obc_free(obc);
@@ -335,64 +343,93 @@ obc_new(const char *configfile, const struct bhyve_parameters_core *bpc)
 }
 
 /*
- * Generate output from input file and data in this config object
+ * write all bytes described by iov, continuing after short writes
+ *
+ * returns 0 on success.
+ */
+int
+obc_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t written = 0;
+
+	while (iovcnt > 0) {
+		if ((written = writev(fd, iov, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/* skip what has been written */
+		while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Generate output from input file and data in this config object; the
+ * result is written to a temporary file in one call, synced and renamed
+ * to the config file, so it is never seen partially written
  */
 int
 obc_combine_with(struct output_bhyve_core *obc, const char *file_in)
 {
 	struct file_memory *fm = 0;
-	int filefd = 0;
-	size_t file_len = 0, line_len = 0;
-	int result = 0;
-	struct output_bhyve_core_configline *obcc = 0;
+	struct iovec iov[3];
+	char tmpfile[PATH_MAX] = {0};
+	int filefd = -1;
+	int result = -1;
 
-	if (!obc || !file_in) {
+	if (!obc || !file_in || !obc->configfile) {
 		errno = EINVAL;
 		return -1;
 	}
 
+	if (snprintf(tmpfile, sizeof(tmpfile), "%s.XXXXXX",
+		     obc->configfile) >= (int) sizeof(tmpfile)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
 	if (!(fm = fm_new(file_in)))
 		return -1;
 
-	file_len = strlen(fm_get_memory(fm));
+	/* template, separating newline, generated lines */
+	iov[0].iov_base = (void *) fm_get_memory(fm);
+	iov[0].iov_len = fm_get_size(fm);
+	iov[1].iov_base = "\n";
+	iov[1].iov_len = 1;
+	iov[2].iov_base = obc->buffer;
+	iov[2].iov_len = obc->length;
 
 	do {
-	
-		if ((filefd = open(obc->configfile, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC)) < 0) {
-			result = -1;
+		if ((filefd = mkostemp(tmpfile, O_CLOEXEC)) < 0)
 			break;
-		}
 
-		if (fchmod(filefd, S_IRUSR | S_IWUSR | S_IRGRP ) < 0) {
-			result = -1;
+		/* flush before the rename so a crash cannot leave an empty file */
+		if (fchmod(filefd, S_IRUSR | S_IWUSR | S_IRGRP) < 0 ||
+		    obc_writev(filefd, iov, 3) || fsync(filefd) < 0) {
+			close(filefd);
+			unlink(tmpfile);
 			break;
 		}
 
-		do {
-			if (write(filefd, fm_get_memory(fm), file_len) < file_len) {
-				result = -1;
-				break;
-			}
-
-			if (write(filefd, "\n", 1) < 0) {
-				result = -1;
-				break;
-			}
-
-			SLIST_FOREACH(obcc, &obc->lines, entries) {
-				line_len = strlen(obcc->configline);
-				if (write(filefd, obcc->configline, line_len) < line_len) {
-					result = -1;
-					break;
-				}
-				if (write(filefd, "\n", 1) < 0) {
-					result = -1;
-					break;
-				}
-			}
-		} while(0);
+		if (close(filefd) < 0 ||
+		    rename(tmpfile, obc->configfile) < 0) {
+			unlink(tmpfile);
+			break;
+		}
 
-		close(filefd);
+		result = 0;
 	} while(0);
 
 	fm_free(fm);
@@ -400,6 +437,61 @@ obc_combine_with(struct output_bhyve_core *obc, const char *file_in)
 	return result;
 }
 
+/*
+ * Render the config lines as bhyve arguments: the template is passed
+ * with -k, each generated line follows as -o key=value. The list and
+ * its strings are a single allocation, released with free().
+ */
+char **
+obc_get_args(const struct output_bhyve_core *obc, const char *file_in)
+{
+	char **args = NULL;
+	char *strings = NULL;
+	const char *line = NULL, *end = NULL;
+	size_t count = 0, index = 0;
+
+	if (!obc || !file_in) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* every config line ends in a newline */
+	for (line = obc->buffer, end = line + obc->length;
+	     line && (line = memchr(line, '\n', end - line)); line++)
+		count++;
+
+	/* -k, template, -o and a line each, terminating NULL */
+	if (!(args = malloc((2 * count + 3) * sizeof(char *) +
+			    sizeof("-k") + sizeof("-o") +
+			    strlen(file_in) + 1 + obc->length)))
+		return NULL;
+
+	strings = (char *) (args + 2 * count + 3);
+	args[index++] = strings;
+	strings = stpcpy(strings, "-k") + 1;
+	args[index++] = strings;
+	strings = stpcpy(strings, file_in) + 1;
+
+	/* all -o share one string */
+	memcpy(strings, "-o", sizeof("-o"));
+	line = strings;
+	strings += sizeof("-o");
+
+	/* lines are copied as a whole, each newline becomes a NUL */
+	if (obc->length)
+		memcpy(strings, obc->buffer, obc->length);
+	end = strings + obc->length;
+	while (count--) {
+		args[index++] = (char *) line;
+		args[index++] = strings;
+		strings = memchr(strings, '\n', end - strings);
+		*strings++ = '\0';
+	}
+	args[index] = NULL;
+
+	return args;
+}
+
 /*
  * Release perviously allocated output helper
  */
@@ -411,14 +503,7 @@ obc_free(struct output_bhyve_core *obc)
 		return;
 	}
 
-	struct output_bhyve_core_configline *obcc = 0;
-
-	while (!SLIST_EMPTY(&obc->lines)) {
-		obcc = SLIST_FIRST(&obc->lines);
-		SLIST_REMOVE_HEAD(&obc->lines, entries);
-		obcc_free(obcc);
-	}
-
+	free(obc->buffer);
 	free(obc->configfile);
 	free(obc);
 }
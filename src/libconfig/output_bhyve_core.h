@@ -35,5 +35,7 @@ struct output_bhyve_core *obc_new(const char *configfile,
 void		obc_free(struct output_bhyve_core *obc);
 int
 		obc_combine_with(struct output_bhyve_core *obc, const char *file_in);
+char	      **obc_get_args(const struct output_bhyve_core *obc,
+			     const char *file_in);
 
 #endif				/* __OUTPUT_BHYVE_CORE_H__ */
@@ -28,6 +28,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -35,49 +36,95 @@
 
 #include "parser_offsets.h"
 
-bool parser_bool_reg;
-uint64_t parser_uint64_reg;
+/* filters return pointers to these, one set per thread */
+_Thread_local bool parser_bool_reg;
+_Thread_local uint16_t parser_uint16_reg;
+_Thread_local uint32_t parser_uint32_reg;
+_Thread_local uint64_t parser_uint64_reg;
 
 /*
- * filter a memory string into uint64_t of megabytes
+ * filter a memory string with a size suffix into uint32_t of megabytes
  */
 void *
 po_filter_memory(void *data)
 {
 	const char *val = data;
-	char *memstring = 0;
-	size_t memstring_len = 0;
-	char sizing = 0;
-	uint16_t multiplier = 0;
+	char *end = NULL;
+	unsigned long long memory = 0;
+	uint32_t multiplier = 0;
 
 	if (!data) {
 		errno = EINVAL;
 		return NULL;
 	}
 
-	memstring = strdup(val);
-	memstring_len = strlen(memstring);
-	sizing = toupper(memstring[memstring_len-1]);
+	if (!isdigit((unsigned char) *val)) {
+		errno = EDOM;
+		return NULL;
+	}
 
-	switch (sizing) {
+	errno = 0;
+	memory = strtoull(val, &end, 10);
+	if (errno) {
+		errno = EDOM;
+		return NULL;
+	}
+
+	switch (toupper((unsigned char) *end)) {
+	case 'T':
+		multiplier = 1024 * 1024;
+		break;
 	case 'G':
 		multiplier = 1024;
 		break;
 	case 'M':
 		multiplier = 1;
+		break;
 	default:
 		errno = EDOM;
 		return NULL;
 	}
 
-	memstring[memstring_len-1] = 0;
+	if (end[1] || memory > UINT32_MAX / multiplier) {
+		errno = EDOM;
+		return NULL;
+	}
+
+	parser_uint32_reg = memory * multiplier;
+
+	return &parser_uint32_reg;
+}
+
+/*
+ * filter a decimal string into uint16_t
+ */
+void *
+po_filter_uint16(void *data)
+{
+	const char *val = data;
+	char *end = NULL;
+	unsigned long number = 0;
+
+	if (!data) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!isdigit((unsigned char) *val)) {
+		errno = EDOM;
+		return NULL;
+	}
+
 	errno = 0;
-	
-	parser_uint64_reg = atoll(memstring);
-	if (errno)
+	number = strtoul(val, &end, 10);
+	if (errno || *end || number > UINT16_MAX) {
+		errno = EDOM;
 		return NULL;
+	}
+
+	parser_uint16_reg = number;
 
-	return &parser_uint64_reg;
+	return &parser_uint16_reg;
 }
 
 /*
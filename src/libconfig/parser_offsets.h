@@ -37,5 +37,6 @@ struct bhyve_parameters_parser_info {
 
 void *po_filter_bool(void *data);
 void *po_filter_memory(void *data);
+void *po_filter_uint16(void *data);
 
 #endif /* __PARSER_OFFSETS_H__*/
@@ -25,34 +25,36 @@
  * SUCH DAMAGE.
  */
 
-#include <sys/mman.h>
-#include <sys/queue.h>
-
+#include <ctype.h>
 #include <errno.h>
-#include <fcntl.h>
-#include <limits.h>
-#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
+#include "config_core.h"
+#include "file_memory.h"
 #include "parser_reader.h"
 
-/*
- * a line that was not parsed or converted
- */
-struct parser_reader_unparsed {
-	char *line;
-};
+/* initial number of entries held by a parser reader */
+#define PR_ENTRIES_SIZE 64
 
 /*
  * encapsulates a reading parser for a bhyve config file
+ *
+ * keys and values are views into the mapped file, nothing is copied
  */
 struct parser_reader {
-	char filename[PATH_MAX];
-	int filefd;
-	size_t filesize;
-	void *memory;
+	struct file_memory *fm;
+
+	/* key=value lines in the order of the file */
+	struct parser_reader_entry *entries;
+	size_t count;
+	size_t size;
+
+	/* core parameters set by the lines */
+	struct bhyve_parameters_core *bpc;
+	/* line that failed to parse */
+	size_t errorline;
 };
 
 /*
@@ -62,7 +64,6 @@ struct parser_reader *
 pr_new(const char *filename)
 {
 	struct parser_reader *pr = 0;
-	off_t offset = 0;
 
 	if (!filename) {
 		errno = EINVAL;
@@ -73,31 +74,12 @@ pr_new(const char *filename)
 		return NULL;
 
 	bzero(pr, sizeof(struct parser_reader));
-	strncpy(pr->filename, filename, PATH_MAX);
-
-	if ((pr->filefd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
-		free(pr->filename);
-		free(pr);
-		return NULL;
-	}
 
-	if ((offset = lseek(pr->filefd, 0, SEEK_END)) < 0) {
-		close(pr->filefd);
-		free(pr->filename);
+	if (!(pr->fm = fm_new(filename))) {
 		free(pr);
 		return NULL;
 	}
-	pr->filesize = offset;
 
-	pr->memory = mmap(NULL, pr->filesize, PROT_READ, 0,
-			  pr->filefd, 0);
-	if (!pr->memory) {
-		close(pr->filefd);
-		free(pr->filename);
-		free(pr);
-		return NULL;
-	}
-	
 	return pr;
 }
 
@@ -112,113 +94,228 @@ pr_free(struct parser_reader *pr)
 		return;
 	}
 
-	munmap(pr->memory, pr->filesize);
-	
-	close(pr->filefd);
-	free(pr->filename);
+	bpc_free(pr->bpc);
+	free(pr->entries);
+	fm_free(pr->fm);
 	free(pr);
 }
 
 /*
- * parses key and value
+ * adds a key and value
  */
 int
-pr_parsekeyval(struct parser_reader *pr, const char *key, const char *value)
+pr_addkeyval(struct parser_reader *pr, const char *key, size_t keylen,
+	     const char *value, size_t valuelen, size_t line)
 {
+	struct parser_reader_entry *entries = NULL;
+	size_t size = pr->size ? pr->size : PR_ENTRIES_SIZE;
+
+	if (pr->count == pr->size) {
+		if (pr->size) {
+			if (size > SIZE_MAX / 2 / sizeof(*entries)) {
+				errno = ENOMEM;
+				return -1;
+			}
+			size *= 2;
+		}
+
+		if (!(entries = realloc(pr->entries, size * sizeof(*entries))))
+			return -1;
+
+		pr->entries = entries;
+		pr->size = size;
+	}
+
+	pr->entries[pr->count].key.data = key;
+	pr->entries[pr->count].key.length = keylen;
+	pr->entries[pr->count].value.data = value;
+	pr->entries[pr->count].value.length = valuelen;
+	pr->entries[pr->count].line = line;
+	pr->count++;
+
 	return 0;
 }
 
 /*
- * parses a single line
+ * parses a single line; blank lines and comments are skipped
  */
 int
-pr_parseline(struct parser_reader *pr, const char *line)
+pr_parseline(struct parser_reader *pr, const char *line, size_t length,
+	     size_t lineno)
 {
 	const char *equals = 0;
-	char *key = 0, *value = 0;
-	size_t line_len = 0;
-	int result = 0;
 
-	if (!pr || !line) {
-		errno = EINVAL;
-		return -1;
+	while (length && isblank((unsigned char) *line)) {
+		line++;
+		length--;
 	}
 
-	line_len = strlen(line);
-	equals = strchr(line, '=');
-	if (!equals) {
+	if (!length || *line == '#')
+		return 0;
+
+	if (!(equals = memchr(line, '=', length)) || equals == line) {
+		pr->errorline = lineno;
 		errno = EFTYPE;
 		return -1;
 	}
 
-	key = malloc(equals - line + 1);
-	value = malloc(line + line_len - equals + 1);
-	if (!key || !value) {
-		free(key);
-		free(value);
-		return -1;
+	return pr_addkeyval(pr, line, equals - line, equals + 1,
+			    line + length - equals - 1, lineno);
+}
+
+/*
+ * sets the core parameters from the lines read; later lines override
+ * earlier ones like they do in bhyve
+ */
+int
+pr_setparameters(struct parser_reader *pr)
+{
+	const struct parser_reader_entry *entry = NULL;
+	char name[BPC_NAME_MAX + 1] = {0};
+	size_t counter = 0;
+
+	if ((entry = pr_find(pr, "name"))) {
+		if (entry->value.length > BPC_NAME_MAX) {
+			pr->errorline = entry->line;
+			errno = EFTYPE;
+			return -1;
+		}
+		memcpy(name, entry->value.data, entry->value.length);
 	}
-	bzero(key, equals - line + 1);
-	bzero(value, line + line_len - equals + 1);
-	strncpy(key, line, equals - line);
-	strncpy(value, equals + 1, line + line_len - equals - 1);
 
-	result = pr_parsekeyval(pr, key, value);
+	if (!(pr->bpc = bpc_new(name)))
+		return -1;
+
+	for (counter = 0; counter < pr->count; counter++) {
+		entry = &pr->entries[counter];
+
+		if (!bpc_set_parameter(pr->bpc, entry->key.data,
+				       entry->key.length, entry->value.data,
+				       entry->value.length))
+			continue;
 
-	free(key);
-	free(value);
-	return result;
+		/* keys without mapping are only kept as views */
+		if (errno == ENOENT)
+			continue;
+
+		pr->errorline = entry->line;
+		bpc_free(pr->bpc);
+		pr->bpc = NULL;
+		errno = EFTYPE;
+		return -1;
+	}
+
+	return 0;
 }
 
 /*
  * parses the contents of the file
+ *
+ * returns 0 on success, -1 with errno EFTYPE if a line is not a valid
+ * key=value pair; its number is available from pr_get_errorline
  */
 int
 pr_parsefile(struct parser_reader *pr)
 {
-	const char *start, *end, *next;
-	char *linebuf = 0;
-	size_t linebuf_len = 0;
-	int result = 0;
-	
+	const char *start, *end, *eol;
+	size_t lineno = 0;
+
 	if (!pr) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	start = end = next = 0;
-	start = pr->memory;
+	/* parsing again starts over */
+	bpc_free(pr->bpc);
+	pr->bpc = NULL;
+	pr->count = 0;
+	pr->errorline = 0;
 
-	while(start) {
-		end = strchr(start, '\n');
-		if (!end) {
-			/* last line without newline */
+	start = fm_get_memory(pr->fm);
+	end = start + fm_get_size(pr->fm);
 
-			start = 0;
-			break;
-		}
+	while (start < end) {
+		/* the last line may lack its newline */
+		if (!(eol = memchr(start, '\n', end - start)))
+			eol = end;
 
-		if ((end - start) > linebuf_len) {
-			linebuf_len = (end - start) * 2;
-			if (linebuf)
-				free(linebuf);
-			
-			linebuf = malloc(linebuf_len);
-			if (!linebuf) {
-				result = -1;
-				break;
-			}
+		if (pr_parseline(pr, start, eol - start, ++lineno))
+			return -1;
 
-			if (pr_parseline(pr, linebuf)) {
-				result = -1;
-				break;
-			}
-		}
-		strncpy(linebuf, start, end-start);
-		linebuf[end-start] = 0;
+		start = eol < end ? eol + 1 : end;
+	}
+
+	return pr_setparameters(pr);
+}
+
+/*
+ * get number of key=value lines read
+ */
+size_t
+pr_get_count(const struct parser_reader *pr)
+{
+	return pr ? pr->count : 0;
+}
+
+/*
+ * get a key=value line by its index
+ */
+const struct parser_reader_entry *
+pr_get_entry(const struct parser_reader *pr, size_t index)
+{
+	if (!pr || index >= pr->count) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return &pr->entries[index];
+}
+
+/*
+ * find the line that sets a key; if it is set more than once, the last
+ * line is returned as it is the one in effect
+ */
+const struct parser_reader_entry *
+pr_find(const struct parser_reader *pr, const char *key)
+{
+	size_t counter = 0, keylen = 0;
+
+	if (!pr || !key) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	keylen = strlen(key);
+
+	for (counter = pr->count; counter > 0; counter--) {
+		if (pr->entries[counter - 1].key.length == keylen &&
+		    !memcmp(pr->entries[counter - 1].key.data, key, keylen))
+			return &pr->entries[counter - 1];
+	}
+
+	errno = ENOENT;
+	return NULL;
+}
+
+/*
+ * get the core parameters set by the file after it was parsed
+ */
+const struct bhyve_parameters_core *
+pr_get_parameters(const struct parser_reader *pr)
+{
+	if (!pr || !pr->bpc) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	free(linebuf);
+	return pr->bpc;
+}
 
-	return result;
+/*
+ * get number of the line that failed to parse, starting at 1
+ */
+size_t
+pr_get_errorline(const struct parser_reader *pr)
+{
+	return pr ? pr->errorline : 0;
 }
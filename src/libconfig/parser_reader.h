@@ -28,9 +28,40 @@
 #ifndef __PARSER_READER_H__
 #define __PARSER_READER_H__
 
+#include <stddef.h>
+
+struct bhyve_parameters_core;
 struct parser_reader;
 
+/*
+ * a part of the file contents; it is not NUL terminated and valid until
+ * the parser reader is released
+ */
+struct parser_reader_view {
+	const char *data;
+	size_t length;
+};
+
+/*
+ * a key=value line of a bhyve config file
+ */
+struct parser_reader_entry {
+	struct parser_reader_view key;
+	struct parser_reader_view value;
+	/* line number, starting at 1 */
+	size_t line;
+};
+
 struct parser_reader *pr_new(const char *filename);
 void pr_free(struct parser_reader *pr);
+int pr_parsefile(struct parser_reader *pr);
+size_t pr_get_count(const struct parser_reader *pr);
+const struct parser_reader_entry *
+pr_get_entry(const struct parser_reader *pr, size_t index);
+const struct parser_reader_entry *
+pr_find(const struct parser_reader *pr, const char *key);
+const struct bhyve_parameters_core *
+pr_get_parameters(const struct parser_reader *pr);
+size_t pr_get_errorline(const struct parser_reader *pr);
 
 #endif /* __PARSER_READER_H__ */
@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 
 #include <atf-c.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -35,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../config_block.h"
 #include "../config_core.h"
@@ -92,11 +94,11 @@ lpc.com1.path=/dev/nmdm0A\n\
 lpc.bootrom=/usr/local/share/uefi-firmware/BHYVE_UEFI.fd\n\
 name=testvm\n\
 \n\
-acpi_tables=true\n\
-x86.vmexit_on_hlt=true\n\
-cpus=4\n\
+name=testvm\n\
 memory.size=4096M\n\
-name=testvm";
+cpus=4\n\
+x86.vmexit_on_hlt=true\n\
+acpi_tables=true\n";
 	size_t len = strlen(contents);
 
 	file_out = open("combine_file2", O_CREAT | O_RDWR);
@@ -161,9 +163,126 @@ ATF_TC_CLEANUP(tc_obc_output, tc)
 	unlink("combine_file2");
 }
 
+ATF_TC(tc_obc_atomic);
+ATF_TC_HEAD(tc_obc_atomic, tc)
+{
+}
+ATF_TC_BODY(tc_obc_atomic, tc)
+{
+	const char *crosscheck = "x86.strictmsr=true\n\
+\n\
+name=testvm\n\
+memory.size=2048M\n\
+cpus=2\n\
+x86.vmexit_on_hlt=false\n\
+acpi_tables=true\n\
+lpc.bootrom=bootrom\n\
+lpc.com1.path=/dev/nmdm0A\n\
+pci.0.1.0.device=lpc\n\
+pci.0.0.0.device=hostbridge\n";
+	struct bhyve_parameters_core *bpc = 0;
+	struct output_bhyve_core *obc = 0;
+	struct dirent *entry = 0;
+	char buffer[32] = {0};
+	DIR *dir = 0;
+	int fd = 0;
+
+	atf_utils_create_file("template", "x86.strictmsr=true\n");
+	atf_utils_create_file("output", "previous");
+
+	ATF_REQUIRE(0 != (bpc = bpc_new("testvm")));
+	ATF_REQUIRE_EQ(0, bpc_set_bootrom(bpc, "bootrom", false, NULL));
+	ATF_REQUIRE_EQ(0, bpc_enable_comport(bpc, "console0", 0, true));
+	ATF_REQUIRE_EQ(0, bpc_set_comport_backend(bpc, 0, "/dev/nmdm0A"));
+	ATF_REQUIRE_EQ(0, bpc_set_cpulayout(bpc, 2, 0, 0));
+	ATF_REQUIRE_EQ(0, bpc_set_memory(bpc, 2048));
+	ATF_REQUIRE_EQ(0, bpc_set_generateacpi(bpc, true));
+	ATF_REQUIRE_EQ(0, bpc_addpcislot_at(bpc, 0, 0, 0,
+					    bpp_new_hostbridge(HOSTBRIDGE)));
+	ATF_REQUIRE_EQ(0, bpc_addpcislot_at(bpc, 0, 1, 0, bpp_new_isabridge()));
+
+	/* a reader of the previous file keeps seeing its contents */
+	ATF_REQUIRE((fd = open("output", O_RDONLY)) >= 0);
+
+	ATF_REQUIRE(0 != (obc = obc_new("output", bpc)));
+	ATF_REQUIRE_EQ(0, obc_combine_with(obc, "template"));
+	ATF_REQUIRE(atf_utils_compare_file("output", crosscheck));
+
+	ATF_REQUIRE_EQ(8, read(fd, buffer, sizeof(buffer)));
+	ATF_REQUIRE_STREQ("previous", buffer);
+	close(fd);
+
+	/* generating again yields the same file */
+	ATF_REQUIRE_EQ(0, obc_combine_with(obc, "template"));
+	ATF_REQUIRE(atf_utils_compare_file("output", crosscheck));
+
+	/* no temporary file is left behind */
+	ATF_REQUIRE(0 != (dir = opendir(".")));
+	while ((entry = readdir(dir)))
+		ATF_REQUIRE(strncmp(entry->d_name, "output.", 7));
+	closedir(dir);
+
+	/* a missing template leaves the config untouched */
+	ATF_REQUIRE_EQ(-1, obc_combine_with(obc, "missing"));
+	ATF_REQUIRE(atf_utils_compare_file("output", crosscheck));
+
+	obc_free(obc);
+	bpc_free(bpc);
+}
+
+ATF_TC(tc_obc_args);
+ATF_TC_HEAD(tc_obc_args, tc)
+{
+}
+ATF_TC_BODY(tc_obc_args, tc)
+{
+	const char *crosscheck[] = {
+		"-k", "template",
+		"-o", "name=testvm",
+		"-o", "memory.size=2048M",
+		"-o", "cpus=2",
+		"-o", "x86.vmexit_on_hlt=false",
+		"-o", "acpi_tables=true",
+		"-o", "lpc.bootrom=bootrom",
+		"-o", "lpc.com1.path=/dev/nmdm0A",
+		"-o", "pci.0.0.0.device=hostbridge",
+		NULL
+	};
+	struct bhyve_parameters_core *bpc = 0;
+	struct output_bhyve_core *obc = 0;
+	char **args = NULL;
+	int counter = 0;
+
+	ATF_REQUIRE(0 != (bpc = bpc_new("testvm")));
+	ATF_REQUIRE_EQ(0, bpc_set_bootrom(bpc, "bootrom", false, NULL));
+	ATF_REQUIRE_EQ(0, bpc_enable_comport(bpc, "console0", 0, true));
+	ATF_REQUIRE_EQ(0, bpc_set_comport_backend(bpc, 0, "/dev/nmdm0A"));
+	ATF_REQUIRE_EQ(0, bpc_set_cpulayout(bpc, 2, 0, 0));
+	ATF_REQUIRE_EQ(0, bpc_set_memory(bpc, 2048));
+	ATF_REQUIRE_EQ(0, bpc_set_generateacpi(bpc, true));
+	ATF_REQUIRE_EQ(0, bpc_addpcislot_at(bpc, 0, 0, 0,
+					    bpp_new_hostbridge(HOSTBRIDGE)));
+
+	/* arguments need no output file */
+	ATF_REQUIRE(0 != (obc = obc_new(NULL, bpc)));
+	ATF_REQUIRE_EQ(-1, obc_combine_with(obc, "template"));
+	ATF_REQUIRE_EQ(EINVAL, errno);
+
+	ATF_REQUIRE(0 != (args = obc_get_args(obc, "template")));
+	for (counter = 0; crosscheck[counter]; counter++)
+		ATF_REQUIRE_STREQ(crosscheck[counter], args[counter]);
+	ATF_REQUIRE_EQ(NULL, args[counter]);
+
+	free(args);
+	obc_free(obc);
+	bpc_free(bpc);
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_obc_output);
+	ATF_TP_ADD_TC(testplan, tc_obc_atomic);
+	ATF_TP_ADD_TC(testplan, tc_obc_args);
 
 	return atf_no_error();
 }
@@ -0,0 +1,256 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atf-c.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../config_core.h"
+#include "../output_bhyve_core.h"
+#include "../parser_reader.h"
+
+/* lines in the generated file read by tc_pr_bench */
+#define TC_PR_LINES	250000
+
+/*
+ * compare a view against a string
+ */
+bool
+tc_pr_viewequals(const struct parser_reader_view *view, const char *string)
+{
+	return view->length == strlen(string) &&
+		!memcmp(view->data, string, view->length);
+}
+
+ATF_TC_WITH_CLEANUP(tc_pr_parse);
+ATF_TC_HEAD(tc_pr_parse, tc)
+{
+}
+ATF_TC_BODY(tc_pr_parse, tc)
+{
+	const char *teststring = "# hand-written config\n" \
+		"name=testvm\n" \
+		"\n" \
+		"memory.size=2G\n" \
+		"cpus=4\n" \
+		"  sockets=2\n" \
+		"acpi_tables=true\n" \
+		"lpc.com1.path=/dev/nmdm0A\n" \
+		"cpus=8";
+	const struct parser_reader_entry *entry = NULL;
+	const struct bhyve_parameters_core *bpc = NULL;
+	struct parser_reader *pr = NULL;
+
+	atf_utils_create_file("pr_parse", "%s", teststring);
+
+	ATF_REQUIRE(0 != (pr = pr_new("pr_parse")));
+	ATF_REQUIRE_EQ(0, pr_parsefile(pr));
+
+	/* blank lines and comments are skipped */
+	ATF_REQUIRE_EQ(7, pr_get_count(pr));
+	ATF_REQUIRE(0 != (entry = pr_get_entry(pr, 4)));
+	ATF_REQUIRE(tc_pr_viewequals(&entry->key, "acpi_tables"));
+	ATF_REQUIRE(tc_pr_viewequals(&entry->value, "true"));
+	ATF_REQUIRE_EQ(7, entry->line);
+
+	/* keys without mapping are kept, the last line of a key counts */
+	ATF_REQUIRE(0 != (entry = pr_find(pr, "lpc.com1.path")));
+	ATF_REQUIRE(tc_pr_viewequals(&entry->value, "/dev/nmdm0A"));
+	ATF_REQUIRE(0 != (entry = pr_find(pr, "cpus")));
+	ATF_REQUIRE(tc_pr_viewequals(&entry->value, "8"));
+	ATF_REQUIRE_EQ(9, entry->line);
+	ATF_REQUIRE_EQ(0, pr_find(pr, "cores"));
+	ATF_REQUIRE_EQ(ENOENT, errno);
+
+	ATF_REQUIRE(0 != (bpc = pr_get_parameters(pr)));
+	ATF_REQUIRE_STREQ("testvm", bpc_get_vmname(bpc));
+	ATF_REQUIRE_EQ(2048, bpc_get_memory(bpc));
+	ATF_REQUIRE_EQ(8, bpc_get_numcpus(bpc));
+	ATF_REQUIRE_EQ(2, bpc_get_sockets(bpc));
+	ATF_REQUIRE_EQ(0, bpc_get_cores(bpc));
+	ATF_REQUIRE_EQ(true, bpc_get_generateacpi(bpc));
+	ATF_REQUIRE_EQ(false, bpc_get_yieldonhlt(bpc));
+
+	pr_free(pr);
+}
+ATF_TC_CLEANUP(tc_pr_parse, tc)
+{
+	unlink("pr_parse");
+}
+
+ATF_TC_WITH_CLEANUP(tc_pr_invalid);
+ATF_TC_HEAD(tc_pr_invalid, tc)
+{
+}
+ATF_TC_BODY(tc_pr_invalid, tc)
+{
+	struct parser_reader *pr = NULL;
+
+	/* a line without a key */
+	atf_utils_create_file("pr_invalid", "name=testvm\n=true\n");
+	ATF_REQUIRE(0 != (pr = pr_new("pr_invalid")));
+	ATF_REQUIRE_EQ(-1, pr_parsefile(pr));
+	ATF_REQUIRE_EQ(EFTYPE, errno);
+	ATF_REQUIRE_EQ(2, pr_get_errorline(pr));
+	ATF_REQUIRE_EQ(0, pr_get_parameters(pr));
+	pr_free(pr);
+
+	/* a value its mapping rejects */
+	atf_utils_create_file("pr_invalid", "name=testvm\ncpus=4\n" \
+			      "memory.size=lots\n");
+	ATF_REQUIRE(0 != (pr = pr_new("pr_invalid")));
+	ATF_REQUIRE_EQ(-1, pr_parsefile(pr));
+	ATF_REQUIRE_EQ(EFTYPE, errno);
+	ATF_REQUIRE_EQ(3, pr_get_errorline(pr));
+	pr_free(pr);
+
+	/* an empty file is valid */
+	atf_utils_create_file("pr_invalid", "");
+	ATF_REQUIRE(0 != (pr = pr_new("pr_invalid")));
+	ATF_REQUIRE_EQ(0, pr_parsefile(pr));
+	ATF_REQUIRE_EQ(0, pr_get_count(pr));
+	pr_free(pr);
+}
+ATF_TC_CLEANUP(tc_pr_invalid, tc)
+{
+	unlink("pr_invalid");
+}
+
+ATF_TC_WITH_CLEANUP(tc_pr_generated);
+ATF_TC_HEAD(tc_pr_generated, tc)
+{
+}
+ATF_TC_BODY(tc_pr_generated, tc)
+{
+	struct bhyve_parameters_core *bpc = 0;
+	const struct bhyve_parameters_core *bpc_read = 0;
+	struct output_bhyve_core *obc = 0;
+	struct parser_reader *pr = NULL;
+
+	atf_utils_create_file("pr_template", "x86.strictmsr=true\n");
+
+	ATF_REQUIRE(0 != (bpc = bpc_new("testvm")));
+	ATF_REQUIRE_EQ(0, bpc_set_cpulayout(bpc, 4, 2, 2));
+	ATF_REQUIRE_EQ(0, bpc_set_memory(bpc, 4096));
+	ATF_REQUIRE_EQ(0, bpc_set_yieldonhlt(bpc, true));
+	ATF_REQUIRE(0 != (obc = obc_new("pr_generated", bpc)));
+	ATF_REQUIRE_EQ(0, obc_combine_with(obc, "pr_template"));
+	obc_free(obc);
+
+	/* a generated config reads back into the same parameters */
+	ATF_REQUIRE(0 != (pr = pr_new("pr_generated")));
+	ATF_REQUIRE_EQ(0, pr_parsefile(pr));
+	ATF_REQUIRE(0 != (bpc_read = pr_get_parameters(pr)));
+	ATF_REQUIRE_STREQ(bpc_get_vmname(bpc), bpc_get_vmname(bpc_read));
+	ATF_REQUIRE_EQ(bpc_get_memory(bpc), bpc_get_memory(bpc_read));
+	ATF_REQUIRE_EQ(bpc_get_numcpus(bpc), bpc_get_numcpus(bpc_read));
+	ATF_REQUIRE_EQ(bpc_get_sockets(bpc), bpc_get_sockets(bpc_read));
+	ATF_REQUIRE_EQ(bpc_get_cores(bpc), bpc_get_cores(bpc_read));
+	ATF_REQUIRE_EQ(bpc_get_yieldonhlt(bpc), bpc_get_yieldonhlt(bpc_read));
+	ATF_REQUIRE_EQ(bpc_get_generateacpi(bpc),
+		       bpc_get_generateacpi(bpc_read));
+	ATF_REQUIRE(0 != pr_find(pr, "x86.strictmsr"));
+
+	pr_free(pr);
+	bpc_free(bpc);
+}
+ATF_TC_CLEANUP(tc_pr_generated, tc)
+{
+	unlink("pr_template");
+	unlink("pr_generated");
+}
+
+ATF_TC_WITH_CLEANUP(tc_pr_bench);
+ATF_TC_HEAD(tc_pr_bench, tc)
+{
+}
+ATF_TC_BODY(tc_pr_bench, tc)
+{
+	struct timespec start = {0}, end = {0};
+	struct parser_reader *pr = NULL;
+	char *line = NULL, *key = NULL, *value = NULL;
+	size_t linesize = 0, bytes = 0, count = 0, counter = 0;
+	ssize_t length = 0;
+	double copied = 0, viewed = 0;
+	FILE *f = NULL;
+
+	ATF_REQUIRE(0 != (f = fopen("pr_bench", "w")));
+	fprintf(f, "name=benchvm\n");
+	for (counter = 0; counter < TC_PR_LINES; counter++)
+		fprintf(f, "pci.%zu.%zu.0.path=/dev/zvol/tank/vm/disk%zu\n",
+			counter / 32, counter % 32, counter);
+	bytes = ftell(f);
+	fclose(f);
+
+	/* reading lines into copies of their keys and values */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ATF_REQUIRE(0 != (f = fopen("pr_bench", "r")));
+	while ((length = getline(&line, &linesize, f)) > 0) {
+		ATF_REQUIRE(0 != (value = strchr(line, '=')));
+		ATF_REQUIRE(0 != (key = strndup(line, value - line)));
+		ATF_REQUIRE(0 != (value = strdup(value + 1)));
+		free(key);
+		free(value);
+		count++;
+	}
+	fclose(f);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	copied = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	ATF_REQUIRE_EQ(TC_PR_LINES + 1, count);
+	free(line);
+
+	/* reading views into the mapped file */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ATF_REQUIRE(0 != (pr = pr_new("pr_bench")));
+	ATF_REQUIRE_EQ(0, pr_parsefile(pr));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	viewed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	ATF_REQUIRE_EQ(TC_PR_LINES + 1, pr_get_count(pr));
+	pr_free(pr);
+
+	printf("%zu lines, %zu bytes: copied %.1f MB/s, viewed %.1f MB/s\n",
+	       count, bytes, bytes / copied / 1e6, bytes / viewed / 1e6);
+}
+ATF_TC_CLEANUP(tc_pr_bench, tc)
+{
+	unlink("pr_bench");
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_pr_parse);
+	ATF_TP_ADD_TC(testplan, tc_pr_invalid);
+	ATF_TP_ADD_TC(testplan, tc_pr_generated);
+	ATF_TP_ADD_TC(testplan, tc_pr_bench);
+
+	return atf_no_error();
+}
@@ -28,24 +28,136 @@
 #include <sys/event.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
+#include <sys/rtprio.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "log_director.h"
+#include "log_store.h"
+
+#include "../libutils/daemon_log.h"
+
+/* upper limit of ingest shards */
+#define LD_SHARDS_MAX 16
+/* number of kevents handled in one go */
+#define LD_EVENTS_MAX 64
+/* rounds of pending events handled after the shutdown event */
+#define LD_DRAIN_ROUNDS 16
+/* initial and maximum size of a redirector buffer */
+#define LD_BUFFER_INITIAL 4096
+#define LD_BUFFER_MAX (1024 * 1024)
+/* source of records written by the director itself */
+#define LD_SOURCE_SELF "vmstated"
+/* room for a suppression marker record */
+#define LD_MARKER_MAX (64 + sizeof(struct log_store_record) + \
+		       sizeof(LD_SOURCE_SELF))
+/* source of clients not naming one */
+#define LD_SOURCE_DEFAULT "output"
+/* record payloads written to the log file in one go */
+#define LD_IOV_MAX 64
+/* bytes of recent records kept for new subscribers */
+#define LD_BACKLOG_MAX (64 * 1024)
+/* records queued for a subscriber: the backlog and a full buffer */
+#define LD_SUBSCRIBER_MAX (LD_BACKLOG_MAX + LD_BUFFER_MAX)
+/* chunk size used when compressing rotated segments */
+#define LD_COMPRESS_CHUNK (64 * 1024)
+
+struct log_director_shard;
 
 int
 ld_register_pipe(struct log_director *ld, struct log_director_redirector *ldr,
 		 struct log_director_redirector_client *ldrd);
+void ldsh_queuewrite(struct log_director_shard *ldsh,
+		     struct log_director_redirector *ldr);
+int ld_compress_stop(struct log_director *ld);
+void ld_queuesegment(struct log_director *ld, const char *logfile);
+
+/*
+ * a growing buffer collecting pipe data until it is written out
+ */
+struct log_director_buffer {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+/*
+ * an ingest shard; each has its own kqueue, event thread and write
+ * thread serving the redirectors hashed to it
+ */
+struct log_director_shard {
+	struct log_director *ld;
+	uint32_t index;
+
+	int kqueuefd;
+	pthread_mutex_t mtx;
+	pthread_t event_thread;
+
+	/* writes buffered pipe data to the log files */
+	pthread_t write_thread;
+	pthread_cond_t write_ready;
+	bool write_stop;
+	TAILQ_HEAD(, log_director_redirector) writequeue;
+
+	/* ingest counters */
+	atomic_uint_least32_t redirectors;
+	atomic_uint_least64_t wakeups;
+	atomic_uint_least64_t events;
+	atomic_uint_least64_t bytes;
+};
+
+/*
+ * a rotated log segment waiting to be moved into place
+ */
+struct log_director_segment {
+	char *logfile;
+	uint32_t keep;
+	bool compress;
+
+	TAILQ_ENTRY(log_director_segment) entries;
+};
+
+/*
+ * a reader following the output of a redirector as it is written
+ *
+ * the write thread queues records; a subscriber falling more than
+ * LD_SUBSCRIBER_MAX bytes behind is dropped instead of holding up ingest.
+ * ldr_free detaches subscribers under their mtx, so ldr stays valid
+ * while it is held.
+ */
+struct log_director_subscriber {
+	struct log_director_redirector *ldr;
+
+	pthread_mutex_t mtx;
+	pthread_cond_t ready;
+
+	/* records queued, and those being handed to the reader */
+	struct log_director_buffer queue;
+	struct log_director_buffer reading;
+	/* fell behind; nothing more is queued */
+	bool dropped;
+	/* the redirector went away */
+	bool closed;
+
+	LIST_ENTRY(log_director_subscriber) entries;
+};
 
 /*
  * a client connecting to a redirector
@@ -56,6 +168,12 @@ struct log_director_redirector_client {
 	bool other_end_closed;
 	bool this_accepted;
 	bool closed;
+	/* reading is disabled until the buffer was written out */
+	bool paused;
+
+	/* name recorded with the output of this client */
+	char source[LST_SOURCE_MAX];
+	size_t sourcelen;
 
 	struct log_director_redirector *ldr;
 
@@ -67,15 +185,54 @@ struct log_director_redirector_client {
  */
 struct log_director_redirector {
 	char *logname;
+	char *logfile;
 
 	int logfilefd;
-	
+	/* bytes in the current log file; write thread only */
+	off_t logsize;
+
+	/* indexed records of the output; written by the write thread */
+	struct log_store *store;
+	char *storename;
+	/* timestamp of the last record, so records never go back in time */
+	int64_t lasttime;
+
+	/* recent records and readers following new ones */
+	pthread_mutex_t submtx;
+	struct log_director_buffer backlog;
+	LIST_HEAD(, log_director_subscriber) subscribers;
+
 	struct log_director *ld;
+	struct log_director_shard *shard;
 
 	pthread_mutex_t mtx;
 
+	/* the event thread fills one buffer while the other is written */
+	struct log_director_buffer buffers[2];
+	int fill;
+	/* waiting in the write queue of its shard */
+	bool queued;
+	/* clients paused because the fill buffer is full */
+	size_t paused;
+	/* pipe reads and log file writes done */
+	uint64_t reads;
+	uint64_t writes;
+
+	/* token bucket limiting the bytes logged; a rate of 0 disables */
+	uint32_t rate;
+	uint32_t burst;
+	uint64_t tokens;
+	struct timespec refilled;
+	/* bytes dropped since the last suppression marker */
+	uint64_t suppressed;
+	/* bytes read, bytes dropped and periods of dropping */
+	uint64_t bytes;
+	uint64_t dropped;
+	uint64_t dropbursts;
+
 	LIST_ENTRY(log_director_redirector) entries;
 	LIST_HEAD(, log_director_redirector_client) clients;
+	TAILQ_ENTRY(log_director_redirector) writeq;
 };
 
 /*
@@ -85,84 +242,805 @@ struct log_director {
 	int log_level;
 	char *log_directory;
 
-	int kqueuefd;
-
 	pthread_mutex_t mtx;	
-	pthread_t event_thread;
 	pthread_cond_t event_ready;
 	bool thread_started;
 
+	/* redirectors are spread across shards by name */
+	struct log_director_shard *shards;
+	uint32_t shardcount;
+
+	/* per redirector rate limit in bytes per second, 0 disables */
+	uint32_t limit_rate;
+	uint32_t limit_burst;
+
+	/* rotate log files exceeding rotate_maxsize bytes, 0 disables */
+	atomic_uint_least32_t rotate_maxsize;
+	uint32_t rotate_keep;
+	bool rotate_compress;
+
+	/* moves rotated segments into place at idle priority */
+	pthread_t compress_thread;
+	pthread_cond_t compress_ready;
+	bool compress_stop;
+	TAILQ_HEAD(, log_director_segment) compressqueue;
+
 	LIST_HEAD(,log_director_redirector) redirects;
 };
 
-/*
- * get sending end of redirector
- */
-int
-ldrd_get_senderpipe(struct log_director_redirector_client *ldrd)
-{
-	if (ldrd) {
-		errno = EINVAL;
-		return -1;
+/*
+ * get sending end of redirector
+ */
+int
+ldrd_get_senderpipe(struct log_director_redirector_client *ldrd)
+{
+	if (ldrd) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return ldrd->pipefd[1];
+}
+
+/*
+ * make room for want more bytes in a buffer, growing it up to max
+ *
+ * returns the number of bytes available, 0 if the buffer is full.
+ */
+size_t
+ldb_reserve_max(struct log_director_buffer *ldb, size_t want, size_t max)
+{
+	size_t size = ldb->size ? ldb->size : LD_BUFFER_INITIAL;
+	char *data = NULL;
+
+	while ((size - ldb->len < want) && (size < max))
+		size *= 2;
+	if (size > max)
+		size = max;
+
+	if (size != ldb->size) {
+		if (!(data = realloc(ldb->data, size)))
+			return ldb->size - ldb->len;
+		ldb->data = data;
+		ldb->size = size;
+	}
+
+	return ldb->size - ldb->len;
+}
+
+/*
+ * make room for want more bytes in a buffer, growing it up to
+ * LD_BUFFER_MAX
+ */
+size_t
+ldb_reserve(struct log_director_buffer *ldb, size_t want)
+{
+	return ldb_reserve_max(ldb, want, LD_BUFFER_MAX);
+}
+
+/*
+ * take up to bytes tokens from the bucket of a redirector, refilling it
+ * for the time passed until now on the monotonic clock
+ *
+ * only the time converted into whole tokens is taken off the clock, so
+ * frequent small reads at a low rate still accumulate credit.
+ *
+ * returns the number of bytes that may be logged.
+ */
+uint64_t
+ldr_ratelimit_at(struct log_director_redirector *ldr, uint64_t bytes,
+		 const struct timespec *now)
+{
+	const uint64_t nsec = 1000000000;
+	int64_t elapsed = 0;
+	uint64_t gained = 0, spent = 0;
+
+	if (!ldr->rate)
+		return bytes;
+
+	elapsed = (int64_t) (now->tv_sec - ldr->refilled.tv_sec) * nsec +
+		(now->tv_nsec - ldr->refilled.tv_nsec);
+
+	if (elapsed > 0)
+		gained = (elapsed / nsec) * ldr->rate +
+			(elapsed % nsec) * ldr->rate / nsec;
+
+	if (gained >= ldr->burst - ldr->tokens) {
+		ldr->tokens = ldr->burst;
+		ldr->refilled = *now;
+	} else if (gained) {
+		/* keep the remainder that did not make up a whole token */
+		ldr->tokens += gained;
+		spent = (gained * nsec + ldr->rate - 1) / ldr->rate;
+		ldr->refilled.tv_sec += spent / nsec;
+		ldr->refilled.tv_nsec += spent % nsec;
+		if (ldr->refilled.tv_nsec >= (long) nsec) {
+			ldr->refilled.tv_sec++;
+			ldr->refilled.tv_nsec -= nsec;
+		}
+	}
+
+	if (bytes > ldr->tokens)
+		bytes = ldr->tokens;
+	ldr->tokens -= bytes;
+
+	return bytes;
+}
+
+/*
+ * take up to bytes tokens from the bucket of a redirector
+ */
+uint64_t
+ldr_ratelimit(struct log_director_redirector *ldr, uint64_t bytes)
+{
+	struct timespec now = {0};
+
+	if (!ldr->rate)
+		return bytes;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ldr_ratelimit_at(ldr, bytes, &now);
+}
+
+/*
+ * get the time to record new output with; never earlier than the last
+ * record, so the records of a store stay ordered
+ */
+int64_t
+ldr_timestamp(struct log_director_redirector *ldr)
+{
+	struct timespec now = {0};
+	int64_t timestamp = 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	timestamp = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+	if (timestamp < ldr->lasttime)
+		timestamp = ldr->lasttime;
+	ldr->lasttime = timestamp;
+
+	return timestamp;
+}
+
+/*
+ * format the record noting suppressed output into buffer
+ *
+ * returns the length of the record.
+ */
+size_t
+ldr_suppressmarker(struct log_director_redirector *ldr, char *buffer,
+		   size_t size)
+{
+	size_t framesize = lst_framesize(sizeof(LD_SOURCE_SELF) - 1);
+	int len = 0;
+
+	if (size <= framesize)
+		return 0;
+
+	len = snprintf(buffer + framesize, size - framesize,
+		       "\n[vmstated: %ju bytes suppressed]\n",
+		       (uintmax_t) ldr->suppressed);
+	if ((len <= 0) || ((size_t) len >= size - framesize))
+		return 0;
+
+	return lst_frame(buffer, ldr_timestamp(ldr), LD_SOURCE_SELF,
+			 sizeof(LD_SOURCE_SELF) - 1, len) + len;
+}
+
+/*
+ * called when data is ready to be read from pipe and posted to log
+ *
+ * the data is appended as a record to the fill buffer of the
+ * redirector, which is queued for writing. If the buffer is full,
+ * reading from the pipe is paused until the buffer was written out.
+ * Data beyond the rate limit is read and dropped; a marker noting how
+ * much was dropped precedes the next data logged.
+ *
+ * returns the number of bytes read or -1 on error.
+ */
+ssize_t
+ldr_recv_ondata(struct log_director_redirector_client *ldrd, int64_t bytes_ready)
+{
+	struct log_director_redirector *ldr = ldrd->ldr;
+	struct log_director_buffer *ldb = NULL;
+	struct kevent event = {0};
+	char marker[LD_MARKER_MAX] = {0};
+	size_t framesize = lst_framesize(ldrd->sourcelen);
+	ssize_t done_bytes = 0;
+	size_t avail = 0, accepted = 0, markerlen = 0;
+
+	if (pthread_mutex_lock(&ldr->mtx))
+		return -1;
+
+	ldb = &ldr->buffers[ldr->fill];
+	avail = ldb_reserve(ldb, framesize + (bytes_ready > 0 ? bytes_ready : 1));
+
+	if (avail <= framesize) {
+		/* the writer is behind; leave the data in the pipe */
+		EV_SET(&event, ldrd->pipefd[0], EVFILT_READ, EV_DISABLE, 0, 0, ldrd);
+		if (!ldrd->paused && (kevent(ldr->shard->kqueuefd, &event, 1, NULL, 0, NULL) == 0)) {
+			ldrd->paused = true;
+			ldr->paused++;
+		}
+		pthread_mutex_unlock(&ldr->mtx);
+		return 0;
+	}
+
+	/* the output is read right behind the room left for its frame */
+	avail -= framesize;
+	if ((bytes_ready > 0) && ((size_t) bytes_ready < avail))
+		avail = bytes_ready;
+
+	do {
+		done_bytes = read(ldrd->pipefd[0], ldb->data + ldb->len + framesize,
+				  avail);
+	} while ((done_bytes < 0) && (EINTR == errno));
+
+	if (done_bytes > 0) {
+		ldr->reads++;
+		ldr->bytes += done_bytes;
+		atomic_fetch_add_explicit(&ldr->shard->bytes, done_bytes,
+					  memory_order_relaxed);
+
+		if ((accepted = ldr_ratelimit(ldr, done_bytes)) < (size_t) done_bytes) {
+			if (!ldr->suppressed)
+				ldr->dropbursts++;
+			ldr->suppressed += done_bytes - accepted;
+			ldr->dropped += done_bytes - accepted;
+		}
+
+		/* the marker goes in front of the data just read */
+		if (accepted && ldr->suppressed &&
+		    (markerlen = ldr_suppressmarker(ldr, marker, sizeof(marker))) &&
+		    (ldb_reserve(ldb, markerlen + framesize + accepted) >=
+		     markerlen + framesize + accepted)) {
+			memmove(ldb->data + ldb->len + markerlen + framesize,
+				ldb->data + ldb->len + framesize, accepted);
+			memcpy(ldb->data + ldb->len, marker, markerlen);
+			ldb->len += markerlen;
+			ldr->suppressed = 0;
+		}
+
+		if (accepted) {
+			lst_frame(ldb->data + ldb->len, ldr_timestamp(ldr),
+				  ldrd->source, ldrd->sourcelen, accepted);
+			ldb->len += framesize + accepted;
+		}
+	}
+
+	if (ldb->len && !ldr->queued) {
+		ldr->queued = true;
+		ldsh_queuewrite(ldr->shard, ldr);
+	}
+
+	pthread_mutex_unlock(&ldr->mtx);
+
+	if ((done_bytes < 0) && (EAGAIN != errno))
+		return -1;
+
+	return (done_bytes > 0) ? done_bytes : 0;
+}
+
+/*
+ * switch a redirector to a fresh log file, handing the full one to the
+ * compress thread; called by the write thread only
+ *
+ * the new file is dup2'ed onto the existing descriptor, so the switch
+ * is atomic for anyone holding logfilefd.
+ */
+int
+ldr_rotate(struct log_director_redirector *ldr)
+{
+	char segment[PATH_MAX] = {0};
+	int logfd = -1;
+
+	snprintf(segment, PATH_MAX, "%s.0", ldr->logfile);
+
+	/* the previous segment was not moved yet; keep writing */
+	if (!access(segment, F_OK))
+		return 0;
+
+	if (rename(ldr->logfile, segment) < 0) {
+		syslog(LOG_ERR, "Failed to rotate log %s: %m", ldr->logname);
+		return -1;
+	}
+
+	if ((logfd = open(ldr->logfile, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND |
+			  O_CLOEXEC, S_IRUSR | S_IWUSR)) < 0) {
+		syslog(LOG_ERR, "Failed to open new log %s: %m", ldr->logname);
+		rename(segment, ldr->logfile);
+		return -1;
+	}
+
+	if (dup2(logfd, ldr->logfilefd) < 0) {
+		syslog(LOG_ERR, "Failed to switch log %s: %m", ldr->logname);
+		close(logfd);
+		rename(segment, ldr->logfile);
+		return -1;
+	}
+	close(logfd);
+
+	ldr->logsize = 0;
+	ld_queuesegment(ldr->ld, ldr->logfile);
+
+	return 0;
+}
+
+/*
+ * write the output carried by the records in buffer to the log file
+ * and the records to the store
+ *
+ * returns the number of bytes written to the log file.
+ */
+size_t
+ldr_writerecords(struct log_director_redirector *ldr, const char *buffer,
+		 size_t len)
+{
+	struct iovec iov[LD_IOV_MAX];
+	struct log_store_entry entry = {0};
+	size_t offset = 0, recordlen = 0, total = 0;
+	ssize_t done_bytes = 0;
+	int count = 0, idx = 0;
+
+	while (offset < len) {
+		/* the log file gets the output without the frames */
+		for (count = 0; (count < LD_IOV_MAX) && (offset < len);
+		     offset += recordlen) {
+			if (!(recordlen = lst_decode(buffer + offset, len - offset,
+						     &entry))) {
+				offset = len;
+				break;
+			}
+			iov[count].iov_base = (void *) entry.data;
+			iov[count++].iov_len = entry.len;
+		}
+
+		for (idx = 0; idx < count;) {
+			if ((done_bytes = writev(ldr->logfilefd, iov + idx,
+						 count - idx)) < 0) {
+				if (EINTR == errno)
+					continue;
+				syslog(LOG_ERR, "Failed to write log %s: %m",
+				       ldr->logname);
+				offset = len;
+				break;
+			}
+			total += done_bytes;
+
+			/* a short write resumes within the vector */
+			for (; (idx < count) && ((size_t) done_bytes >= iov[idx].iov_len);
+			     idx++)
+				done_bytes -= iov[idx].iov_len;
+			if (idx < count) {
+				iov[idx].iov_base = (char *) iov[idx].iov_base + done_bytes;
+				iov[idx].iov_len -= done_bytes;
+			}
+		}
+	}
+
+	if (ldr->store && lst_append(ldr->store, buffer, len))
+		syslog(LOG_ERR, "Failed to store log %s: %m", ldr->logname);
+
+	return total;
+}
+
+/*
+ * keep the newest records in the backlog of a redirector, dropping the
+ * oldest ones beyond LD_BACKLOG_MAX bytes; called with submtx held
+ */
+void
+ldr_keepbacklog(struct log_director_redirector *ldr, const char *records,
+		size_t len)
+{
+	struct log_director_buffer *ldb = &ldr->backlog;
+	struct log_store_entry entry = {0};
+	size_t offset = 0, drop = 0, recordlen = 0;
+
+	/* only whole records are kept */
+	while (len - offset > LD_BACKLOG_MAX) {
+		if (!(recordlen = lst_decode(records + offset, len - offset, &entry)))
+			return;
+		offset += recordlen;
+	}
+
+	while (ldb->len - drop + len - offset > LD_BACKLOG_MAX) {
+		if (!(recordlen = lst_decode(ldb->data + drop, ldb->len - drop,
+					     &entry))) {
+			drop = ldb->len;
+			break;
+		}
+		drop += recordlen;
+	}
+	if (drop) {
+		memmove(ldb->data, ldb->data + drop, ldb->len - drop);
+		ldb->len -= drop;
+	}
+
+	if (ldb_reserve(ldb, len - offset) < len - offset)
+		return;
+	memcpy(ldb->data + ldb->len, records + offset, len - offset);
+	ldb->len += len - offset;
+}
+
+/*
+ * hand records just written to the backlog and to every subscriber;
+ * called by the write thread only
+ */
+void
+ldr_publish(struct log_director_redirector *ldr, const char *records,
+	    size_t len)
+{
+	struct log_director_subscriber *ldrs = NULL;
+
+	if (!len || pthread_mutex_lock(&ldr->submtx))
+		return;
+
+	ldr_keepbacklog(ldr, records, len);
+
+	LIST_FOREACH(ldrs, &ldr->subscribers, entries) {
+		if (pthread_mutex_lock(&ldrs->mtx))
+			continue;
+
+		if (!ldrs->dropped &&
+		    (ldb_reserve_max(&ldrs->queue, len, LD_SUBSCRIBER_MAX) < len))
+			ldrs->dropped = true;
+		if (!ldrs->dropped) {
+			memcpy(ldrs->queue.data + ldrs->queue.len, records, len);
+			ldrs->queue.len += len;
+		}
+
+		pthread_cond_signal(&ldrs->ready);
+		pthread_mutex_unlock(&ldrs->mtx);
+	}
+
+	pthread_mutex_unlock(&ldr->submtx);
+}
+
+/*
+ * write out the data buffered for a redirector, rotating the log file
+ * and the store once they exceed maxsize bytes; called by the write
+ * thread only
+ */
+void
+ldr_flush(struct log_director_redirector *ldr, uint32_t maxsize)
+{
+	struct log_director_redirector_client *ldrd = NULL;
+	struct log_director_buffer *ldb = NULL;
+	struct kevent event = {0};
+
+	if (pthread_mutex_lock(&ldr->mtx))
+		return;
+
+	/* hand the event thread the empty buffer */
+	ldb = &ldr->buffers[ldr->fill];
+	ldr->fill ^= 1;
+	ldr->queued = false;
+
+	if (ldr->paused) {
+		LIST_FOREACH(ldrd, &ldr->clients, entries) {
+			if (!ldrd->paused)
+				continue;
+			EV_SET(&event, ldrd->pipefd[0], EVFILT_READ, EV_ENABLE, 0, 0, ldrd);
+			if (kevent(ldr->shard->kqueuefd, &event, 1, NULL, 0, NULL) < 0)
+				continue;
+			ldrd->paused = false;
+			ldr->paused--;
+		}
+	}
+
+	pthread_mutex_unlock(&ldr->mtx);
+
+	/* everything collected since the last flush goes out at once */
+	ldr->logsize += ldr_writerecords(ldr, ldb->data, ldb->len);
+	ldr_publish(ldr, ldb->data, ldb->len);
+	ldb->len = 0;
+
+	if (maxsize && (ldr->logsize >= maxsize))
+		ldr_rotate(ldr);
+	if (maxsize && ldr->store && (lst_get_size(ldr->store) >= maxsize) &&
+	    lst_rotate(ldr->store))
+		syslog(LOG_ERR, "Failed to rotate log store %s: %m", ldr->logname);
+
+	if (!pthread_mutex_lock(&ldr->mtx)) {
+		ldr->writes++;
+		pthread_mutex_unlock(&ldr->mtx);
+	}
+}
+
+/*
+ * queue a redirector with buffered data for the write thread
+ */
+void
+ldsh_queuewrite(struct log_director_shard *ldsh,
+		struct log_director_redirector *ldr)
+{
+	if (pthread_mutex_lock(&ldsh->mtx))
+		return;
+
+	TAILQ_INSERT_TAIL(&ldsh->writequeue, ldr, writeq);
+	pthread_cond_signal(&ldsh->write_ready);
+
+	pthread_mutex_unlock(&ldsh->mtx);
+}
+
+/*
+ * thread writing buffered pipe data to the log files, so disk i/o
+ * never holds up reading from the pipes
+ */
+void *
+ld_write_thread(void *ctx)
+{
+	struct log_director_shard *ldsh = ctx;
+	struct log_director_redirector *ldr = NULL;
+
+	if (pthread_mutex_lock(&ldsh->mtx))
+		return NULL;
+
+	while (1) {
+		while (TAILQ_EMPTY(&ldsh->writequeue) && !ldsh->write_stop)
+			pthread_cond_wait(&ldsh->write_ready, &ldsh->mtx);
+
+		/* the queue is drained before stopping */
+		if (!(ldr = TAILQ_FIRST(&ldsh->writequeue)))
+			break;
+		TAILQ_REMOVE(&ldsh->writequeue, ldr, writeq);
+
+		pthread_mutex_unlock(&ldsh->mtx);
+		ldr_flush(ldr, atomic_load_explicit(&ldsh->ld->rotate_maxsize,
+						    memory_order_relaxed));
+		if (pthread_mutex_lock(&ldsh->mtx))
+			return NULL;
+	}
+
+	pthread_mutex_unlock(&ldsh->mtx);
+
+	return NULL;
+}
+
+/*
+ * queue the segment file <logfile>.0 for the compress thread
+ */
+void
+ld_queuesegment(struct log_director *ld, const char *logfile)
+{
+	struct log_director_segment *lds = NULL;
+
+	if (!(lds = malloc(sizeof(struct log_director_segment))))
+		return;
+	if (!(lds->logfile = strdup(logfile))) {
+		free(lds);
+		return;
+	}
+
+	if (pthread_mutex_lock(&ld->mtx)) {
+		free(lds->logfile);
+		free(lds);
+		return;
+	}
+
+	lds->keep = ld->rotate_keep;
+	lds->compress = ld->rotate_compress;
+	TAILQ_INSERT_TAIL(&ld->compressqueue, lds, entries);
+	pthread_cond_signal(&ld->compress_ready);
+
+	pthread_mutex_unlock(&ld->mtx);
+}
+
+/*
+ * release a segment
+ */
+void
+lds_free(struct log_director_segment *lds)
+{
+	free(lds->logfile);
+	free(lds);
+}
+
+/*
+ * compress file from into file to
+ *
+ * returns 0 on success, -1 on error.
+ */
+int
+lds_compress(const char *from, const char *to)
+{
+	char tmpname[PATH_MAX] = {0};
+	char *chunk = NULL;
+	gzFile gzf = NULL;
+	ssize_t done_bytes = 0;
+	int fromfd = -1, tofd = -1;
+	int result = 0;
+
+	snprintf(tmpname, PATH_MAX, "%s.tmp", to);
+
+	if (!(chunk = malloc(LD_COMPRESS_CHUNK)))
+		return -1;
+
+	if ((fromfd = open(from, O_RDONLY | O_CLOEXEC)) < 0) {
+		free(chunk);
+		return -1;
+	}
+
+	if (((tofd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			  S_IRUSR | S_IWUSR)) < 0) ||
+	    !(gzf = gzdopen(tofd, "wb"))) {
+		if (tofd >= 0) {
+			close(tofd);
+			unlink(tmpname);
+		}
+		close(fromfd);
+		free(chunk);
+		return -1;
+	}
+
+	while ((done_bytes = read(fromfd, chunk, LD_COMPRESS_CHUNK)) != 0) {
+		if (done_bytes < 0) {
+			if (EINTR == errno)
+				continue;
+			result = -1;
+			break;
+		}
+		if (gzwrite(gzf, chunk, done_bytes) != done_bytes) {
+			result = -1;
+			break;
+		}
+	}
+
+	/* gzclose also closes tofd */
+	if (gzclose(gzf) != Z_OK)
+		result = -1;
+	close(fromfd);
+	free(chunk);
+
+	if (!result && (rename(tmpname, to) < 0))
+		result = -1;
+	if (result)
+		unlink(tmpname);
+
+	return result;
+}
+
+/*
+ * move a rotated segment into place as <logfile>.1, shifting older
+ * segments up and dropping those beyond keep
+ */
+void
+lds_process(struct log_director_segment *lds)
+{
+	const char *suffixes[] = { "", ".gz" };
+	char segment[PATH_MAX] = {0};
+	char from[PATH_MAX] = {0};
+	char to[PATH_MAX] = {0};
+	uint32_t idx = 0;
+	size_t sfx = 0;
+
+	snprintf(segment, PATH_MAX, "%s.0", lds->logfile);
+
+	if (!lds->keep) {
+		unlink(segment);
+		return;
+	}
+
+	for (sfx = 0; sfx < sizeof(suffixes) / sizeof(char *); sfx++) {
+		snprintf(to, PATH_MAX, "%s.%u%s", lds->logfile, lds->keep,
+			 suffixes[sfx]);
+		unlink(to);
+
+		for (idx = lds->keep; idx > 1; idx--) {
+			snprintf(from, PATH_MAX, "%s.%u%s", lds->logfile, idx - 1,
+				 suffixes[sfx]);
+			snprintf(to, PATH_MAX, "%s.%u%s", lds->logfile, idx,
+				 suffixes[sfx]);
+			if ((rename(from, to) < 0) && (ENOENT != errno))
+				syslog(LOG_WARNING, "Failed to move %s: %m", from);
+		}
+	}
+
+	if (lds->compress) {
+		snprintf(to, PATH_MAX, "%s.1.gz", lds->logfile);
+		if (!lds_compress(segment, to)) {
+			unlink(segment);
+			return;
+		}
+		syslog(LOG_WARNING, "Failed to compress %s, keeping it as is",
+		       segment);
+	}
+
+	snprintf(to, PATH_MAX, "%s.1", lds->logfile);
+	if (rename(segment, to) < 0)
+		syslog(LOG_ERR, "Failed to move %s: %m", segment);
+}
+
+/*
+ * thread moving and compressing rotated log segments; runs at idle
+ * priority so it only uses cpu time nobody else wants
+ */
+void *
+ld_compress_thread(void *ctx)
+{
+	struct log_director *ld = ctx;
+	struct log_director_segment *lds = NULL;
+	struct rtprio rtp = {
+		.type = RTP_PRIO_IDLE,
+		.prio = RTP_PRIO_MAX
+	};
+
+	if (rtprio_thread(RTP_SET, 0, &rtp) < 0)
+		syslog(LOG_WARNING, "Failed to lower log compression priority");
+
+	if (pthread_mutex_lock(&ld->mtx))
+		return NULL;
+
+	while (1) {
+		while (TAILQ_EMPTY(&ld->compressqueue) && !ld->compress_stop)
+			pthread_cond_wait(&ld->compress_ready, &ld->mtx);
+
+		/* segments left over are picked up on the next start */
+		if (ld->compress_stop)
+			break;
+
+		lds = TAILQ_FIRST(&ld->compressqueue);
+		TAILQ_REMOVE(&ld->compressqueue, lds, entries);
+
+		pthread_mutex_unlock(&ld->mtx);
+		lds_process(lds);
+		lds_free(lds);
+		if (pthread_mutex_lock(&ld->mtx))
+			return NULL;
+	}
+
+	while ((lds = TAILQ_FIRST(&ld->compressqueue))) {
+		TAILQ_REMOVE(&ld->compressqueue, lds, entries);
+		lds_free(lds);
 	}
 
-	return ldrd->pipefd[1];
+	pthread_mutex_unlock(&ld->mtx);
+
+	return NULL;
 }
 
 /*
- * called when data is ready to be raed from pipe and posted to log
+ * handle a pipe event; frees the client once its pipe was closed and
+ * drained
  */
-int
-ldr_recv_ondata(struct log_director_redirector_client *ldrd, int64_t bytes_ready)
+void
+ldrd_onevent(struct log_director_redirector_client *ldrd, struct kevent *event)
 {
-	/* TODO implement */
-	char *buffer = 0;
-	long done_bytes = 0, total = bytes_ready, offset = 0;
+	struct log_director_redirector *ldr = ldrd->ldr;
+	ssize_t done_bytes = 0;
 
-	if (pthread_mutex_lock(&ldrd->ldr->mtx))
-		return -1;
-	
-	syslog(LOG_INFO, "ldr_recv_ondata bytes_ready = %ld", bytes_ready);
-	
-	if (!(buffer = malloc(bytes_ready))) {
-		/* TODO log error */
-		pthread_mutex_unlock(&ldrd->ldr->mtx);
-		return -1;
+	if (event->data > 0) {
+		if ((done_bytes = ldr_recv_ondata(ldrd, event->data)) < 0)
+			syslog(LOG_ERR, "Failed to process inbound pipe data");
 	}
 
-	/* read into buffer */
-	while (total && ((done_bytes = read(ldrd->pipefd[0], buffer + offset, total)) >= 0)) {
-		total -= done_bytes;
-		offset += done_bytes;
-	}
-
-	total = bytes_ready;
-	offset = 0;
-	while (total && ((done_bytes = write(ldrd->ldr->logfilefd, buffer + offset, total)) >= 0)) {
-		total -= done_bytes;
-		offset += done_bytes;
+	/* data left in a closed pipe is picked up by the next event */
+	if ((event->flags & EV_EOF) && (done_bytes >= event->data) &&
+	    !ldrd->paused) {
+		if (pthread_mutex_lock(&ldr->mtx))
+			return;
+		ldrd_freeclient(ldrd);
+		pthread_mutex_unlock(&ldr->mtx);
 	}
-
-	pthread_mutex_unlock(&ldrd->ldr->mtx);
-	
-	free(buffer);
-
-	return 0;
 }
 
 /*
- * kqueue thread handling kevent events
+ * kqueue thread handling kevent events of a shard
  */
 void *
 ld_kqueue_thread(void *ctx)
 {
-	struct log_director *ld = ctx;
-	struct log_director_redirector_client *ldrd = 0;
+	struct log_director_shard *ldsh = ctx;
+	struct log_director *ld = NULL;
 	bool shutdown = false;
-	struct kevent event = {0};
+	struct kevent events[LD_EVENTS_MAX];
+	struct timespec nowait = {0};
+	int count = 0, idx = 0, drain = 0;
 	
-	if (!ld)
+	if (!ldsh)
 		return NULL;
+	ld = ldsh->ld;
 
 	if (pthread_mutex_lock(&ld->mtx)) {
 		return NULL;
@@ -173,41 +1051,37 @@ ld_kqueue_thread(void *ctx)
 
 	pthread_mutex_unlock(&ld->mtx);
 
-	syslog(LOG_INFO, "ld_kqueue_thread started");
-	
-	while (!shutdown) {
-		if (kevent(ld->kqueuefd, NULL, 0, &event, 1, NULL) < 0)
+	while (1) {
+		/* take all pending events at once; once shutting down, only
+		 * those already there */
+		if ((count = kevent(ldsh->kqueuefd, NULL, 0, events, LD_EVENTS_MAX,
+				    shutdown ? &nowait : NULL)) < 0) {
+			if (EINTR == errno)
+				continue;
 			break;
+		}
 
-		syslog(LOG_INFO, "ld_kqueue thread woke up");
-
-		switch(event.filter) {
-		case EVFILT_READ:
-			/* handle data to read from a pipe */
-			ldrd = event.udata;
-			syslog(LOG_INFO, "ld_kqueue thread woke up with EVFILT_READ");
-			
-			if (EV_EOF == event.flags) {
-				/* pipe was closed on the other end */
-				syslog(LOG_INFO, "Process closed pipe end");
-				ldrd_freeclient(ldrd);
-			} else {
-				/* data to receive */
-				if (ldr_recv_ondata(ldrd, event.data)) {
-					/* TODO log error */
-					syslog(LOG_ERR, "Failed to process inbound pipe data");
-				}
-			}
-			break;
-		case EVFILT_USER:
-			syslog(LOG_INFO, "shutdown event");
-			shutdown = true;
-			break;
-		default:
-			syslog(LOG_INFO, "kevent no match");
+		atomic_fetch_add_explicit(&ldsh->wakeups, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&ldsh->events, count, memory_order_relaxed);
+
+		/* output still in the pipes was read; processes that keep
+		 * writing do not hold up the shutdown */
+		if (shutdown && (!count || (drain++ >= LD_DRAIN_ROUNDS)))
 			break;
-		}
 
+		for (idx = 0; idx < count; idx++) {
+			switch(events[idx].filter) {
+			case EVFILT_READ:
+				/* handle data to read from a pipe */
+				ldrd_onevent(events[idx].udata, &events[idx]);
+				break;
+			case EVFILT_USER:
+				shutdown = true;
+				break;
+			default:
+				break;
+			}
+		}
 	}	
 	
 	return NULL;
@@ -260,6 +1134,41 @@ ldrd_redirect_stderr(struct log_director_redirector_client *ldr)
 	return dup2(ldr->pipefd[1], 2);
 }
 
+/*
+ * add file actions redirecting stdout and stderr of a spawned process
+ * to the pipe end; the child keeps no other descriptor of the pipe
+ */
+int
+ldrd_redirect_spawn(struct log_director_redirector_client *ldr,
+		    posix_spawn_file_actions_t *actions)
+{
+	if (!ldr || !actions || ldr->this_accepted) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((errno = posix_spawn_file_actions_adddup2(actions, ldr->pipefd[1], 1)))
+		return -1;
+	if ((errno = posix_spawn_file_actions_adddup2(actions, ldr->pipefd[1], 2)))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * get the pipe end a process launched elsewhere writes its output to
+ */
+int
+ldrd_get_senderfd(const struct log_director_redirector_client *ldr)
+{
+	if (!ldr || ldr->this_accepted) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return ldr->pipefd[1];
+}
+
 /*
  * readies the receiving end for pipe input
  */
@@ -303,42 +1212,100 @@ ldrd_freeclient(struct log_director_redirector_client *ldrd)
  */
 struct log_director_redirector_client *
 ldr_newclient(struct log_director_redirector *ldr)
+{
+	return ldr_newclient_source(ldr, NULL);
+}
+
+/*
+ * prepare for a new client whose output is recorded as coming from
+ * source; source names longer than LST_SOURCE_MAX are cut
+ */
+struct log_director_redirector_client *
+ldr_newclient_source(struct log_director_redirector *ldr, const char *source)
 {
 	struct log_director_redirector_client *ldrd = 0;
 
+	if (!ldr) {
+		errno = EINVAL;
+		return NULL;
+	}
+
 	if (!(ldrd = malloc(sizeof(struct log_director_redirector_client))))
 		return NULL;
 
+	if (!source || !*source)
+		source = LD_SOURCE_DEFAULT;
+	ldrd->sourcelen = strnlen(source, LST_SOURCE_MAX);
+	memcpy(ldrd->source, source, ldrd->sourcelen);
+
 	ldrd->other_end_closed = false;
 	ldrd->this_accepted = false;
 	ldrd->closed = false;
-	if (pipe(ldrd->pipefd) < 0) {
+	ldrd->paused = false;
+	/* close-on-exec keeps processes launched in parallel from
+	 * holding on to each other's pipes */
+	if (pipe2(ldrd->pipefd, O_CLOEXEC) < 0) {
 		free(ldrd);
 		return NULL;
 	}
 
-	/* register for kqueue events */
-	if (ld_register_pipe(ldr->ld, ldr, ldrd)) {
+	/* the event thread may see the pipe as soon as it is registered */
+	ldrd->ldr = ldr;
+
+	if (pthread_mutex_lock(&ldr->mtx)) {
 		close(ldrd->pipefd[1]);
 		close(ldrd->pipefd[0]);
 		free(ldrd);
 		return NULL;
 	}
+		
+	LIST_INSERT_HEAD(&ldr->clients, ldrd, entries);
 
-	ldrd->ldr = ldr;
-
-	if (pthread_mutex_lock(&ldr->mtx)) {
+	/* register for kqueue events */
+	if (ld_register_pipe(ldr->ld, ldr, ldrd)) {
 		ldrd_freeclient(ldrd);
+		pthread_mutex_unlock(&ldr->mtx);
 		return NULL;
 	}
-		
-	LIST_INSERT_HEAD(&ldr->clients, ldrd, entries);
 
 	pthread_mutex_unlock(&ldr->mtx);
 
 	return ldrd;
 }
 
+/*
+ * pick the shard serving a log name; the same vm always lands on the
+ * same shard
+ */
+struct log_director_shard *
+ld_shardfor(struct log_director *ld, const char *logname)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+
+	for (; *logname; logname++) {
+		hash ^= (unsigned char) *logname;
+		hash *= 16777619u;
+	}
+
+	return &ld->shards[hash % ld->shardcount];
+}
+
+/*
+ * set the token bucket of a redirector; a burst of 0 allows one
+ * second worth of output. Called with ldr->mtx held or before the
+ * redirector is in use.
+ */
+void
+ldr_setratelimit(struct log_director_redirector *ldr, uint32_t rate,
+		 uint32_t burst)
+{
+	ldr->rate = rate;
+	ldr->burst = burst ? burst : rate;
+	ldr->tokens = ldr->burst;
+	clock_gettime(CLOCK_MONOTONIC, &ldr->refilled);
+}
+
 /*
  * construct a new redirector structure
  */
@@ -347,107 +1314,381 @@ ldr_new(struct log_director *ld, const char *log_directory, const char *logname)
 {
 	if (!logname) {
 		errno = EINVAL;
-		return NULL;
+		return NULL;
+	}
+
+	struct log_director_redirector *ldr = 0;
+	char logfile_name[PATH_MAX] = {0};
+	struct stat file_info = {0};
+
+	if (!(ldr = malloc(sizeof(struct log_director_redirector))))
+		return NULL;
+
+	bzero(ldr, sizeof(struct log_director_redirector));
+
+	if (pthread_mutex_init(&ldr->mtx, NULL)) {
+		free(ldr);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&ldr->submtx, NULL)) {
+		pthread_mutex_destroy(&ldr->mtx);
+		free(ldr);
+		return NULL;
+	}
+
+	if (!(ldr->logname = strdup(logname))) {
+		free(ldr);
+		return NULL;
+	}
+
+	ldr->ld = ld;
+	ldr->shard = ld_shardfor(ld, logname);
+
+	/* start with a full bucket */
+	if (!pthread_mutex_lock(&ld->mtx)) {
+		ldr_setratelimit(ldr, ld->limit_rate, ld->limit_burst);
+		pthread_mutex_unlock(&ld->mtx);
+	}
+
+	LIST_INIT(&ldr->clients);
+	LIST_INIT(&ldr->subscribers);
+
+	snprintf(logfile_name, PATH_MAX, "%s/%s.log", log_directory, logname);
+	if (!(ldr->logfile = strdup(logfile_name))) {
+		free(ldr->logname);
+		free(ldr);
+		return NULL;
+	}
+
+	/* output of earlier runs is kept; rotation bounds the file */
+	if ((ldr->logfilefd = open(logfile_name, O_WRONLY | O_CREAT | O_APPEND |
+				   O_CLOEXEC, S_IRUSR | S_IWUSR)) < 0) {
+		free(ldr->logfile);
+		free(ldr->logname);
+		free(ldr);
+		return NULL;
+	}
+
+	/* fix permissions */
+	if ((fchmod(ldr->logfilefd, S_IRUSR | S_IWUSR) < 0) ||
+	    (fstat(ldr->logfilefd, &file_info) < 0)) {
+		close(ldr->logfilefd);
+		free(ldr->logfile);
+		free(ldr->logname);
+		free(ldr);
+		return NULL;
+	}
+	ldr->logsize = file_info.st_size;
+
+	/* a segment rotated before the last shutdown */
+	snprintf(logfile_name, PATH_MAX, "%s.0", ldr->logfile);
+	if (!access(logfile_name, F_OK))
+		ld_queuesegment(ld, ldr->logfile);
+
+	/* output is still logged if the store is not available */
+	snprintf(logfile_name, PATH_MAX, "%s/%s", log_directory, logname);
+	if (!(ldr->storename = strdup(logfile_name)) ||
+	    !(ldr->store = lst_open(logfile_name)))
+		syslog(LOG_WARNING, "Failed to open log store %s: %m", logname);
+	else
+		ldr->lasttime = lst_get_lasttime(ldr->store);
+
+	return ldr;	
+}
+
+/*
+ * free resources of a log redirector
+ */
+void
+ldr_free(struct log_director_redirector *ldr)
+{
+	if (!ldr)
+		return;
+
+	struct log_director_redirector_client *ldrd = 0;
+	struct log_director_subscriber *ldrs = NULL;
+	char marker[LD_MARKER_MAX] = {0};
+	size_t markerlen = 0;
+
+	pthread_mutex_lock(&ldr->mtx);
+	
+	while (!LIST_EMPTY(&ldr->clients)) {
+		ldrd = LIST_FIRST(&ldr->clients);
+		LIST_REMOVE(ldrd, entries);
+		ldrd_freeclient(ldrd);
+	}
+
+	/* the write thread is gone, note what was dropped last */
+	if (ldr->suppressed &&
+	    (markerlen = ldr_suppressmarker(ldr, marker, sizeof(marker))))
+		ldr_writerecords(ldr, marker, markerlen);
+	pthread_mutex_unlock(&ldr->mtx);
+	
+	/* readers still following are told the output ended */
+	pthread_mutex_lock(&ldr->submtx);
+	while ((ldrs = LIST_FIRST(&ldr->subscribers))) {
+		LIST_REMOVE(ldrs, entries);
+		pthread_mutex_lock(&ldrs->mtx);
+		ldrs->closed = true;
+		ldrs->ldr = NULL;
+		pthread_cond_signal(&ldrs->ready);
+		pthread_mutex_unlock(&ldrs->mtx);
+	}
+	pthread_mutex_unlock(&ldr->submtx);
+
+	lst_close(ldr->store);
+	free(ldr->storename);
+	free(ldr->backlog.data);
+	free(ldr->logname);
+	free(ldr->logfile);
+	free(ldr->buffers[0].data);
+	free(ldr->buffers[1].data);
+	close(ldr->logfilefd);
+	pthread_mutex_destroy(&ldr->mtx);
+	pthread_mutex_destroy(&ldr->submtx);
+	
+	free(ldr);
+}
+
+/*
+ * set up a shard with its own kqueue
+ */
+int
+ldsh_init(struct log_director_shard *ldsh, struct log_director *ld,
+	  uint32_t index)
+{
+	struct kevent event = {0};
+
+	bzero(ldsh, sizeof(struct log_director_shard));
+	ldsh->ld = ld;
+	ldsh->index = index;
+	TAILQ_INIT(&ldsh->writequeue);
+
+	if ((ldsh->kqueuefd = kqueue()) < 0)
+		return -1;
+
+	/* the user event ldsh_stop triggers */
+	EV_SET(&event, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+	if (kevent(ldsh->kqueuefd, &event, 1, NULL, 0, NULL) < 0) {
+		close(ldsh->kqueuefd);
+		return -1;
+	}
+
+	if (pthread_mutex_init(&ldsh->mtx, NULL)) {
+		close(ldsh->kqueuefd);
+		return -1;
+	}
+
+	if (pthread_cond_init(&ldsh->write_ready, NULL)) {
+		pthread_mutex_destroy(&ldsh->mtx);
+		close(ldsh->kqueuefd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * release resources of a shard whose threads were stopped
+ */
+void
+ldsh_destroy(struct log_director_shard *ldsh)
+{
+	pthread_cond_destroy(&ldsh->write_ready);
+	pthread_mutex_destroy(&ldsh->mtx);
+	close(ldsh->kqueuefd);
+}
+
+/*
+ * stop the write thread of a shard once it wrote out all buffered
+ * data
+ */
+int
+ldsh_write_stop(struct log_director_shard *ldsh)
+{
+	if (pthread_mutex_lock(&ldsh->mtx))
+		return -1;
+
+	ldsh->write_stop = true;
+	pthread_cond_signal(&ldsh->write_ready);
+
+	pthread_mutex_unlock(&ldsh->mtx);
+
+	pthread_join(ldsh->write_thread, NULL);
+
+	return 0;
+}
+
+/*
+ * start the event and write threads of a shard
+ */
+int
+ldsh_start(struct log_director_shard *ldsh)
+{
+	char threadname[32] = {0};
+	int result = 0;
+
+	if ((result = pthread_create(&ldsh->write_thread, NULL, ld_write_thread, ldsh)))
+		return result;
+	snprintf(threadname, sizeof(threadname), "ld writer %u", ldsh->index);
+	pthread_setname_np(ldsh->write_thread, threadname);
+
+	if (!(result = pthread_create(&ldsh->event_thread, NULL, ld_kqueue_thread, ldsh))) {
+		snprintf(threadname, sizeof(threadname), "ld thread %u", ldsh->index);
+		pthread_setname_np(ldsh->event_thread, threadname);
+	} else {
+		ldsh_write_stop(ldsh);
+	}
+
+	return result;
+}
+
+/*
+ * stop the threads of a shard, writing out what was read
+ */
+int
+ldsh_stop(struct log_director_shard *ldsh)
+{
+	struct kevent event = {0};
+
+	EV_SET(&event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+
+	if (kevent(ldsh->kqueuefd, &event, 1, NULL, 0, NULL) < 0) {
+		return -1;
+	}
+
+	/* wait for thread to complete */
+	pthread_join(ldsh->event_thread, NULL);
+
+	/* no more data comes in; write out what is left */
+	return ldsh_write_stop(ldsh);
+}
+
+/*
+ * start kevent threads
+ */
+int
+ld_thread_start(struct log_director *ld)
+{
+	uint32_t idx = 0;
+	int result = 0;
+
+	if (!ld) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	struct log_director_redirector *ldr = 0;
-	char logfile_name[PATH_MAX] = {0};
-
-	if (!(ldr = malloc(sizeof(struct log_director_redirector))))
-		return NULL;
-
-	if (pthread_mutex_init(&ldr->mtx, NULL))
-		return NULL;
+	if ((result = pthread_create(&ld->compress_thread, NULL, ld_compress_thread, ld)))
+		return result;
+	pthread_setname_np(ld->compress_thread, "ld compress");
 
-	if (!(ldr->logname = strdup(logname))) {
-		free(ldr);
-		return NULL;
+	for (idx = 0; idx < ld->shardcount; idx++) {
+		if ((result = ldsh_start(&ld->shards[idx]))) {
+			while (idx--)
+				ldsh_stop(&ld->shards[idx]);
+			ld_compress_stop(ld);
+			return result;
+		}
 	}
 
-	ldr->ld = ld;
+	return result;
+}
 
-	LIST_INIT(&ldr->clients);
+/*
+ * stop kevent threads
+ */
+int
+ld_thread_stop(struct log_director *ld)
+{
+	uint32_t idx = 0;
+	int result = 0;
 
-	snprintf(logfile_name, PATH_MAX, "%s/%s.log", log_directory, logname);
-	if ((ldr->logfilefd = open(logfile_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC)) < 0) {
-		free(ldr->logname);
-		free(ldr);
-		return NULL;
+	for (idx = 0; idx < ld->shardcount; idx++) {
+		if (ldsh_stop(&ld->shards[idx]))
+			result = -1;
 	}
 
-	/* fix permissions */
-	if (fchmod(ldr->logfilefd, S_IRUSR | S_IWUSR) < 0) {
-		close(ldr->logfilefd);
-		free(ldr->logname);
-		free(ldr);
-		return NULL;
-	}
+	if (ld_compress_stop(ld))
+		result = -1;
 
-	return ldr;	
+	return result;
 }
 
 /*
- * free resources of a log redirector
+ * stop the compress thread after the segment it is working on
  */
-void
-ldr_free(struct log_director_redirector *ldr)
+int
+ld_compress_stop(struct log_director *ld)
 {
-	if (!ldr)
-		return;
+	if (pthread_mutex_lock(&ld->mtx))
+		return -1;
 
-	struct log_director_redirector_client *ldrd = 0;
+	ld->compress_stop = true;
+	pthread_cond_signal(&ld->compress_ready);
 
-	pthread_mutex_lock(&ldr->mtx);
-	
-	while (!LIST_EMPTY(&ldr->clients)) {
-		ldrd = LIST_FIRST(&ldr->clients);
-		LIST_REMOVE(ldrd, entries);
-		ldrd_freeclient(ldrd);
-	}
-	pthread_mutex_unlock(&ldr->mtx);
-	
-	free(ldr->logname);
-	pthread_mutex_destroy(&ldr->mtx);
-	
-	free(ldr);
+	pthread_mutex_unlock(&ld->mtx);
+
+	pthread_join(ld->compress_thread, NULL);
+
+	return 0;
 }
 
 /*
- * start kevent thread
+ * limit the output each redirector logs to rate bytes per second,
+ * allowing bursts of up to burst bytes; a rate of 0 disables the
+ * limit
  */
 int
-ld_thread_start(struct log_director *ld)
+ld_set_ratelimit(struct log_director *ld, uint32_t rate, uint32_t burst)
 {
-	int result = 0;
+	struct log_director_redirector *ldr = NULL;
 
 	if (!ld) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	if (!(result = pthread_create(&ld->event_thread, NULL, ld_kqueue_thread, ld))) {
-		pthread_setname_np(ld->event_thread, "ld thread");
+	if (pthread_mutex_lock(&ld->mtx))
+		return -1;
+
+	ld->limit_rate = rate;
+	ld->limit_burst = burst;
+
+	LIST_FOREACH(ldr, &ld->redirects, entries) {
+		if (pthread_mutex_lock(&ldr->mtx))
+			continue;
+		ldr_setratelimit(ldr, rate, burst);
+		pthread_mutex_unlock(&ldr->mtx);
 	}
 
-	return result;
+	pthread_mutex_unlock(&ld->mtx);
+
+	return 0;
 }
 
 /*
- * stop kevent thread
+ * set up log rotation; log files growing beyond maxsize bytes are
+ * moved aside, keeping up to keep older segments (gzip compressed if
+ * compress is set). A maxsize of 0 disables rotation.
  */
 int
-ld_thread_stop(struct log_director *ld)
+ld_set_rotation(struct log_director *ld, uint32_t maxsize, uint32_t keep,
+		bool compress)
 {
-	struct kevent event = {0};
-
-	EV_SET(&event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, &ld);
-
-	if (kevent(ld->kqueuefd, &event, 1, NULL, 0, NULL) < 0) {
+	if (!ld) {
+		errno = EINVAL;
 		return -1;
 	}
 
-	/* wait for thread to complete */
-	pthread_join(ld->event_thread, NULL);
+	if (pthread_mutex_lock(&ld->mtx))
+		return -1;
+
+	ld->rotate_maxsize = maxsize;
+	ld->rotate_keep = keep;
+	ld->rotate_compress = compress;
+
+	pthread_mutex_unlock(&ld->mtx);
 
 	return 0;
 }
@@ -461,10 +1702,9 @@ ld_register_pipe(struct log_director *ld, struct log_director_redirector *ldr,
 {
 	struct kevent event = {0};
 
-	/* register pipefd[0] with kevent queue */
-	syslog(LOG_INFO, "Registering kevent for pipefd = %d", ldrd->pipefd[0]);
+	/* register pipefd[0] with the kevent queue of its shard */
 	EV_SET(&event, ldrd->pipefd[0], EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, ldrd);
-	if (kevent(ld->kqueuefd, &event, 1, NULL, 0, NULL) < 0) {
+	if (kevent(ldr->shard->kqueuefd, &event, 1, NULL, 0, NULL) < 0) {
 		return -1;
 	}
 
@@ -498,6 +1738,8 @@ ld_register_redirect(struct log_director *ld, const char *logname)
 
 	/* add into list */
 	LIST_INSERT_HEAD(&ld->redirects, ldr, entries);
+	atomic_fetch_add_explicit(&ldr->shard->redirectors, 1,
+				  memory_order_relaxed);
 
 	pthread_mutex_unlock(&ld->mtx);
 
@@ -505,10 +1747,20 @@ ld_register_redirect(struct log_director *ld, const char *logname)
 }
 
 /*
- * creates a new log director
+ * creates a new log director with one ingest shard per cpu
  */
 struct log_director *
 ld_new(int verbosity, char *log_directory)
+{
+	return ld_new_shards(verbosity, log_directory, 0);
+}
+
+/*
+ * creates a new log director spreading redirectors across shards
+ * ingest threads; 0 picks one per cpu
+ */
+struct log_director *
+ld_new_shards(int verbosity, char *log_directory, uint32_t shards)
 {
 	if (!log_directory) {
 		errno = EINVAL;
@@ -516,36 +1768,53 @@ ld_new(int verbosity, char *log_directory)
 	}
 
 	struct log_director *ld = malloc(sizeof(struct log_director));
+	long cpus = 0;
+	uint32_t idx = 0;
 
 	if (!ld)
 		return NULL;
 
-	ld->log_level = LOG_ERR;
-	if (verbosity >= 1)
-		ld->log_level = LOG_WARNING;
-	if (verbosity >= 2)
-		ld->log_level = LOG_NOTICE;
-	if (verbosity >= 3)
-		ld->log_level = LOG_INFO;
-	if (verbosity >= 4)
-		ld->log_level = LOG_DEBUG;
+	/* the verbosity applies to all diagnostic messages of the daemon */
+	ld->log_level = dlog_verbositylevel(verbosity);
+	dlog_setlevel(ld->log_level);
 
 	ld->thread_started = false;
 
+	if (!shards) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		shards = (cpus > 0) ? cpus : 1;
+	}
+	if (shards > LD_SHARDS_MAX)
+		shards = LD_SHARDS_MAX;
+
 	ld->log_directory = strdup(log_directory);
 	if (!ld->log_directory) {
 		free(ld);
 		return NULL;
 	}
 
-	if ((ld->kqueuefd = kqueue()) < 0) {
+	if (!(ld->shards = calloc(shards, sizeof(struct log_director_shard)))) {
 		free(ld->log_directory);
 		free(ld);
 		return NULL;
 	}
 
+	for (idx = 0; idx < shards; idx++) {
+		if (ldsh_init(&ld->shards[idx], ld, idx)) {
+			while (idx--)
+				ldsh_destroy(&ld->shards[idx]);
+			free(ld->shards);
+			free(ld->log_directory);
+			free(ld);
+			return NULL;
+		}
+	}
+	ld->shardcount = shards;
+
 	if (pthread_mutex_init(&ld->mtx, NULL)) {
-		close(ld->kqueuefd);
+		for (idx = 0; idx < ld->shardcount; idx++)
+			ldsh_destroy(&ld->shards[idx]);
+		free(ld->shards);
 		free(ld->log_directory);
 		free(ld);
 		return NULL;
@@ -553,7 +1822,20 @@ ld_new(int verbosity, char *log_directory)
 
 	if (pthread_cond_init(&ld->event_ready, NULL)) {
 		pthread_mutex_destroy(&ld->mtx);
-		close(ld->kqueuefd);
+		for (idx = 0; idx < ld->shardcount; idx++)
+			ldsh_destroy(&ld->shards[idx]);
+		free(ld->shards);
+		free(ld->log_directory);
+		free(ld);
+		return NULL;
+	}
+
+	if (pthread_cond_init(&ld->compress_ready, NULL)) {
+		pthread_cond_destroy(&ld->event_ready);
+		pthread_mutex_destroy(&ld->mtx);
+		for (idx = 0; idx < ld->shardcount; idx++)
+			ldsh_destroy(&ld->shards[idx]);
+		free(ld->shards);
 		free(ld->log_directory);
 		free(ld);
 		return NULL;
@@ -561,8 +1843,24 @@ ld_new(int verbosity, char *log_directory)
 
 	LIST_INIT(&ld->redirects);
 
+	/* no rate limit or rotation unless configured */
+	ld->limit_rate = 0;
+	ld->limit_burst = 0;
+	ld->rotate_maxsize = 0;
+	ld->rotate_keep = 0;
+	ld->rotate_compress = false;
+	ld->compress_stop = false;
+	TAILQ_INIT(&ld->compressqueue);
+
 	if (ld_thread_start(ld)) {
-		ld_free(ld);
+		pthread_cond_destroy(&ld->compress_ready);
+		pthread_cond_destroy(&ld->event_ready);
+		pthread_mutex_destroy(&ld->mtx);
+		for (idx = 0; idx < ld->shardcount; idx++)
+			ldsh_destroy(&ld->shards[idx]);
+		free(ld->shards);
+		free(ld->log_directory);
+		free(ld);
 		return NULL;
 	}		
 	
@@ -579,6 +1877,7 @@ ld_free(struct log_director *ld)
 		return;
 
 	struct log_director_redirector *ldr = 0;
+	uint32_t idx = 0;
 
 	ld_thread_stop(ld);
 	
@@ -592,10 +1891,308 @@ ld_free(struct log_director *ld)
 	
 	pthread_mutex_unlock(&ld->mtx);
 
+	pthread_cond_destroy(&ld->compress_ready);
 	pthread_cond_destroy(&ld->event_ready);
 	pthread_mutex_destroy(&ld->mtx);
+
+	for (idx = 0; idx < ld->shardcount; idx++)
+		ldsh_destroy(&ld->shards[idx]);
+	free(ld->shards);
 	
-	close(ld->kqueuefd);
 	free(ld->log_directory);
 	free(ld);
 }
+
+/*
+ * get the number of ingest shards
+ */
+uint32_t
+ld_get_shardcount(struct log_director *ld)
+{
+	if (!ld) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return ld->shardcount;
+}
+
+/*
+ * get the ingest counters of a shard
+ */
+int
+ld_get_shardstats(struct log_director *ld, uint32_t shard,
+		  struct log_director_shardstats *stats)
+{
+	struct log_director_shard *ldsh = NULL;
+
+	if (!ld || !stats || (shard >= ld->shardcount)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ldsh = &ld->shards[shard];
+	stats->redirectors = atomic_load_explicit(&ldsh->redirectors,
+						  memory_order_relaxed);
+	stats->wakeups = atomic_load_explicit(&ldsh->wakeups, memory_order_relaxed);
+	stats->events = atomic_load_explicit(&ldsh->events, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&ldsh->bytes, memory_order_relaxed);
+
+	return 0;
+}
+
+/*
+ * get the number of reads from the pipes of a redirector
+ */
+uint64_t
+ldr_get_reads(struct log_director_redirector *ldr)
+{
+	uint64_t reads = 0;
+
+	if (!ldr || pthread_mutex_lock(&ldr->mtx)) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	reads = ldr->reads;
+	pthread_mutex_unlock(&ldr->mtx);
+
+	return reads;
+}
+
+/*
+ * get the number of writes to the log file of a redirector
+ */
+uint64_t
+ldr_get_writes(struct log_director_redirector *ldr)
+{
+	uint64_t writes = 0;
+
+	if (!ldr || pthread_mutex_lock(&ldr->mtx)) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	writes = ldr->writes;
+	pthread_mutex_unlock(&ldr->mtx);
+
+	return writes;
+}
+
+/*
+ * get the ingest and drop counters of a redirector
+ */
+int
+ldr_get_stats(struct log_director_redirector *ldr,
+	      struct log_director_redirector_stats *stats)
+{
+	if (!ldr || !stats) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pthread_mutex_lock(&ldr->mtx))
+		return -1;
+
+	stats->bytes = ldr->bytes;
+	stats->dropped = ldr->dropped;
+	stats->dropbursts = ldr->dropbursts;
+	stats->reads = ldr->reads;
+	stats->writes = ldr->writes;
+
+	pthread_mutex_unlock(&ldr->mtx);
+
+	return 0;
+}
+
+/*
+ * call cb for each record of the output of a redirector matching query
+ *
+ * the store is read from its files, output not written out yet is not
+ * included.
+ */
+int
+ldr_query(struct log_director_redirector *ldr,
+	  const struct log_store_query *query, lst_entry_cb cb, void *ctx)
+{
+	if (!ldr || !query || !cb) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!ldr->storename) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return lst_query(ldr->storename, query, cb, ctx);
+}
+
+/*
+ * release resources of a subscriber
+ */
+void
+ldrs_free(struct log_director_subscriber *ldrs)
+{
+	pthread_cond_destroy(&ldrs->ready);
+	pthread_mutex_destroy(&ldrs->mtx);
+	free(ldrs->queue.data);
+	free(ldrs->reading.data);
+	free(ldrs);
+}
+
+/*
+ * follow the records written for a redirector, starting with the
+ * records kept in its backlog if backlog is set
+ */
+struct log_director_subscriber *
+ldr_subscribe(struct log_director_redirector *ldr, bool backlog)
+{
+	struct log_director_subscriber *ldrs = NULL;
+
+	if (!ldr) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(ldrs = malloc(sizeof(struct log_director_subscriber))))
+		return NULL;
+	bzero(ldrs, sizeof(struct log_director_subscriber));
+
+	if (pthread_mutex_init(&ldrs->mtx, NULL)) {
+		free(ldrs);
+		return NULL;
+	}
+	if (pthread_cond_init(&ldrs->ready, NULL)) {
+		pthread_mutex_destroy(&ldrs->mtx);
+		free(ldrs);
+		return NULL;
+	}
+
+	ldrs->ldr = ldr;
+
+	if (pthread_mutex_lock(&ldr->submtx)) {
+		ldrs_free(ldrs);
+		return NULL;
+	}
+
+	if (backlog && ldr->backlog.len) {
+		if (ldb_reserve_max(&ldrs->queue, ldr->backlog.len,
+				    LD_SUBSCRIBER_MAX) < ldr->backlog.len) {
+			pthread_mutex_unlock(&ldr->submtx);
+			ldrs_free(ldrs);
+			errno = ENOMEM;
+			return NULL;
+		}
+		memcpy(ldrs->queue.data, ldr->backlog.data, ldr->backlog.len);
+		ldrs->queue.len = ldr->backlog.len;
+	}
+
+	LIST_INSERT_HEAD(&ldr->subscribers, ldrs, entries);
+
+	pthread_mutex_unlock(&ldr->submtx);
+
+	return ldrs;
+}
+
+/*
+ * stop following a redirector and release the subscriber
+ *
+ * subscribers are expected to be gone before the log director is
+ * freed; ld_free only marks those left as closed.
+ */
+void
+ldrs_unsubscribe(struct log_director_subscriber *ldrs)
+{
+	struct log_director_redirector *ldr = NULL;
+
+	if (!ldrs)
+		return;
+
+	if (pthread_mutex_lock(&ldrs->mtx))
+		return;
+
+	/* submtx goes first elsewhere; back off while the writer holds it */
+	while ((ldr = ldrs->ldr) && pthread_mutex_trylock(&ldr->submtx)) {
+		pthread_mutex_unlock(&ldrs->mtx);
+		sched_yield();
+		pthread_mutex_lock(&ldrs->mtx);
+	}
+
+	if (ldr) {
+		LIST_REMOVE(ldrs, entries);
+		ldrs->ldr = NULL;
+		pthread_mutex_unlock(&ldr->submtx);
+	}
+
+	pthread_mutex_unlock(&ldrs->mtx);
+
+	ldrs_free(ldrs);
+}
+
+/*
+ * wait up to timeout milliseconds for records and call cb for each
+ *
+ * returns the number of records handed to cb, 0 on timeout and -1 if
+ * the subscriber was dropped for falling behind (ENOBUFS) or the
+ * redirector went away (ECANCELED).
+ */
+int
+ldrs_read(struct log_director_subscriber *ldrs, lst_entry_cb cb, void *ctx,
+	  uint32_t timeout)
+{
+	struct log_director_buffer swap = {0};
+	struct log_store_entry entry = {0};
+	struct timespec deadline = {0};
+	size_t offset = 0, recordlen = 0;
+	int count = 0;
+
+	if (!ldrs || !cb) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	if (pthread_mutex_lock(&ldrs->mtx))
+		return -1;
+
+	while (!ldrs->queue.len && !ldrs->dropped && !ldrs->closed) {
+		if (pthread_cond_timedwait(&ldrs->ready, &ldrs->mtx, &deadline))
+			break;
+	}
+
+	/* records queued before dropping are still handed out */
+	if (!ldrs->queue.len) {
+		count = (ldrs->dropped || ldrs->closed) ? -1 : 0;
+		errno = ldrs->dropped ? ENOBUFS : ECANCELED;
+		pthread_mutex_unlock(&ldrs->mtx);
+		return count;
+	}
+
+	/* cb runs without holding up the write thread */
+	swap = ldrs->reading;
+	ldrs->reading = ldrs->queue;
+	ldrs->queue = swap;
+	ldrs->queue.len = 0;
+
+	pthread_mutex_unlock(&ldrs->mtx);
+
+	for (offset = 0; offset < ldrs->reading.len; offset += recordlen) {
+		if (!(recordlen = lst_decode(ldrs->reading.data + offset,
+					     ldrs->reading.len - offset, &entry)))
+			break;
+		count++;
+		if (cb(ctx, &entry))
+			break;
+	}
+	ldrs->reading.len = 0;
+
+	return count;
+}
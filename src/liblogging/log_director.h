@@ -28,19 +28,71 @@
 #ifndef __LOG_DIRECTOR_H__
 #define __LOG_DIRECTOR_H__
 
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "log_store.h"
+
 struct log_director_redirector_client;
 struct log_director_redirector;
+struct log_director_subscriber;
 struct log_director;
 
+/*
+ * ingest and drop counters of a redirector
+ */
+struct log_director_redirector_stats {
+	uint64_t bytes;
+	uint64_t dropped;
+	uint64_t dropbursts;
+	uint64_t reads;
+	uint64_t writes;
+};
+
+/*
+ * ingest counters of a log director shard
+ */
+struct log_director_shardstats {
+	uint32_t redirectors;
+	uint64_t wakeups;
+	uint64_t events;
+	uint64_t bytes;
+};
+
 int ldr_get_senderpipe(struct log_director_redirector *ldr);
 
 struct log_director_redirector *ld_register_redirect(struct log_director *ld, const char *logname);
 struct log_director *ld_new(int verbosity, char *log_directory);
+struct log_director *ld_new_shards(int verbosity, char *log_directory,
+				   uint32_t shards);
 void ld_free(struct log_director *ld);
+int ld_set_ratelimit(struct log_director *ld, uint32_t rate, uint32_t burst);
+int ld_set_rotation(struct log_director *ld, uint32_t maxsize, uint32_t keep,
+		    bool compress);
 int ldrd_redirect_stdout(struct log_director_redirector_client *ldr);
 int ldrd_redirect_stderr(struct log_director_redirector_client *ldr);
+int ldrd_redirect_spawn(struct log_director_redirector_client *ldr,
+			posix_spawn_file_actions_t *actions);
+int ldrd_get_senderfd(const struct log_director_redirector_client *ldr);
 int ldrd_accept_redirect(struct log_director_redirector_client *ldr);
 struct log_director_redirector_client *ldr_newclient(struct log_director_redirector *ldr);
+struct log_director_redirector_client *ldr_newclient_source(struct log_director_redirector *ldr,
+							    const char *source);
 void ldrd_freeclient(struct log_director_redirector_client *ldrd);
+uint64_t ldr_get_reads(struct log_director_redirector *ldr);
+uint64_t ldr_get_writes(struct log_director_redirector *ldr);
+int ldr_get_stats(struct log_director_redirector *ldr,
+		  struct log_director_redirector_stats *stats);
+uint32_t ld_get_shardcount(struct log_director *ld);
+int ld_get_shardstats(struct log_director *ld, uint32_t shard,
+		      struct log_director_shardstats *stats);
+int ldr_query(struct log_director_redirector *ldr,
+	      const struct log_store_query *query, lst_entry_cb cb, void *ctx);
+struct log_director_subscriber *ldr_subscribe(struct log_director_redirector *ldr,
+					      bool backlog);
+void ldrs_unsubscribe(struct log_director_subscriber *ldrs);
+int ldrs_read(struct log_director_subscriber *ldrs, lst_entry_cb cb, void *ctx,
+	      uint32_t timeout);
 
 #endif /* __LOG_DIRECTOR_H__ */
@@ -0,0 +1,560 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "log_store.h"
+
+/* index entries written in one go */
+#define LST_INDEX_BATCH 64
+
+/*
+ * the writing end of a store; records go to <basename>.rec, the
+ * sparse index to <basename>.idx
+ */
+struct log_store {
+	char *basename;
+	int recfd;
+	int idxfd;
+
+	/* bytes in the record segment */
+	off_t size;
+	/* offset of the last record indexed, -1 if none */
+	off_t indexed;
+	/* timestamp of the last record */
+	int64_t lasttime;
+};
+
+/*
+ * get the size of the frame preceding the output of a record
+ */
+size_t
+lst_framesize(size_t sourcelen)
+{
+	return sizeof(struct log_store_record) + sourcelen;
+}
+
+/*
+ * write the frame of a record carrying length bytes of output into
+ * buffer, which must hold lst_framesize(sourcelen) bytes
+ *
+ * returns the size of the frame.
+ */
+size_t
+lst_frame(char *buffer, int64_t timestamp, const char *source,
+	  size_t sourcelen, size_t length)
+{
+	struct log_store_record record = {
+		.magic = LST_MAGIC,
+		.length = length,
+		.timestamp = timestamp,
+		.sourcelen = sourcelen
+	};
+
+	memcpy(buffer, &record, sizeof(struct log_store_record));
+	memcpy(buffer + sizeof(struct log_store_record), source, sourcelen);
+
+	return lst_framesize(sourcelen);
+}
+
+/*
+ * decode the record at the start of buffer
+ *
+ * returns the size of the record, 0 if buffer does not start with a
+ * complete record.
+ */
+size_t
+lst_decode(const char *buffer, size_t len, struct log_store_entry *entry)
+{
+	struct log_store_record record = {0};
+	size_t framesize = 0;
+
+	if (len < sizeof(struct log_store_record))
+		return 0;
+
+	/* records are not aligned */
+	memcpy(&record, buffer, sizeof(struct log_store_record));
+	if ((LST_MAGIC != record.magic) || (record.sourcelen > LST_SOURCE_MAX))
+		return 0;
+
+	framesize = lst_framesize(record.sourcelen);
+	if ((len < framesize) || (len - framesize < record.length))
+		return 0;
+
+	entry->timestamp = record.timestamp;
+	entry->source = buffer + sizeof(struct log_store_record);
+	entry->sourcelen = record.sourcelen;
+	entry->data = buffer + framesize;
+	entry->len = record.length;
+
+	return framesize + record.length;
+}
+
+/*
+ * cut off a record torn by a crash and index entries pointing past the
+ * end of the segment, then find the timestamp of the last record
+ *
+ * only the records after the last index entry are read.
+ */
+int
+lst_recover(struct log_store *lst)
+{
+	struct log_store_index entry = {0};
+	struct log_store_record record = {0};
+	struct stat sb = {0};
+	off_t idxsize = 0, offset = 0;
+
+	if (fstat(lst->idxfd, &sb) < 0)
+		return -1;
+	idxsize = sb.st_size - (sb.st_size % sizeof(struct log_store_index));
+
+	while (idxsize > 0) {
+		if (pread(lst->idxfd, &entry, sizeof(entry),
+			  idxsize - sizeof(entry)) != sizeof(entry))
+			return -1;
+		if ((off_t) entry.offset < lst->size)
+			break;
+		idxsize -= sizeof(entry);
+	}
+	if ((idxsize != sb.st_size) && (ftruncate(lst->idxfd, idxsize) < 0))
+		return -1;
+
+	if (idxsize > 0) {
+		offset = entry.offset;
+		lst->indexed = offset;
+		lst->lasttime = entry.timestamp;
+	}
+
+	while (offset + (off_t) sizeof(record) <= lst->size) {
+		if (pread(lst->recfd, &record, sizeof(record), offset) != sizeof(record))
+			return -1;
+		if ((LST_MAGIC != record.magic) ||
+		    (record.sourcelen > LST_SOURCE_MAX) ||
+		    (offset + (off_t) (lst_framesize(record.sourcelen) + record.length) >
+		     lst->size))
+			break;
+		lst->lasttime = record.timestamp;
+		offset += lst_framesize(record.sourcelen) + record.length;
+	}
+
+	if (offset < lst->size) {
+		syslog(LOG_WARNING, "Dropping %jd torn bytes from %s.rec",
+		       (intmax_t) (lst->size - offset), lst->basename);
+		if (ftruncate(lst->recfd, offset) < 0)
+			return -1;
+		lst->size = offset;
+	}
+
+	return 0;
+}
+
+/*
+ * open the segment files of a store
+ */
+int
+lst_opensegment(struct log_store *lst)
+{
+	char filename[PATH_MAX] = {0};
+	struct stat sb = {0};
+
+	lst->size = 0;
+	lst->indexed = -1;
+
+	snprintf(filename, PATH_MAX, "%s.rec", lst->basename);
+	if ((lst->recfd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+			       S_IRUSR | S_IWUSR)) < 0)
+		return -1;
+
+	snprintf(filename, PATH_MAX, "%s.idx", lst->basename);
+	if ((lst->idxfd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+			       S_IRUSR | S_IWUSR)) < 0) {
+		close(lst->recfd);
+		lst->recfd = -1;
+		return -1;
+	}
+
+	if (fstat(lst->recfd, &sb) < 0)
+		return -1;
+	lst->size = sb.st_size;
+
+	return lst_recover(lst);
+}
+
+/*
+ * close the segment files of a store
+ */
+void
+lst_closesegment(struct log_store *lst)
+{
+	if (lst->recfd >= 0)
+		close(lst->recfd);
+	if (lst->idxfd >= 0)
+		close(lst->idxfd);
+	lst->recfd = -1;
+	lst->idxfd = -1;
+}
+
+/*
+ * open a store for appending
+ */
+struct log_store *
+lst_open(const char *basename)
+{
+	struct log_store *lst = NULL;
+
+	if (!basename) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(lst = malloc(sizeof(struct log_store))))
+		return NULL;
+	bzero(lst, sizeof(struct log_store));
+	lst->recfd = -1;
+	lst->idxfd = -1;
+
+	if (!(lst->basename = strdup(basename))) {
+		free(lst);
+		return NULL;
+	}
+
+	if (lst_opensegment(lst)) {
+		lst_close(lst);
+		return NULL;
+	}
+
+	return lst;
+}
+
+/*
+ * close a store
+ */
+void
+lst_close(struct log_store *lst)
+{
+	if (!lst)
+		return;
+
+	lst_closesegment(lst);
+	free(lst->basename);
+	free(lst);
+}
+
+/*
+ * write all of buffer to fd
+ *
+ * returns 0 on success, -1 on error.
+ */
+int
+lst_writeall(int fd, const void *buffer, size_t len)
+{
+	ssize_t done_bytes = 0;
+	size_t offset = 0;
+
+	while (offset < len) {
+		if ((done_bytes = write(fd, (const char *) buffer + offset,
+					len - offset)) < 0) {
+			if (EINTR == errno)
+				continue;
+			return -1;
+		}
+		offset += done_bytes;
+	}
+
+	return 0;
+}
+
+/*
+ * append complete records to a store, indexing one record every
+ * LST_INDEX_INTERVAL bytes
+ *
+ * a failed write is cut off again, so the segment never ends in a
+ * torn record.
+ */
+int
+lst_append(struct log_store *lst, const char *records, size_t len)
+{
+	struct log_store_index index[LST_INDEX_BATCH];
+	struct log_store_entry entry = {0};
+	size_t offset = 0, recordlen = 0, count = 0;
+	int result = 0;
+
+	if (!lst || !records) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((lst->recfd < 0) || (lst->idxfd < 0)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	/* the index must never point past the records */
+	if (lst_writeall(lst->recfd, records, len)) {
+		ftruncate(lst->recfd, lst->size);
+		return -1;
+	}
+
+	for (offset = 0; offset < len; offset += recordlen) {
+		if (!(recordlen = lst_decode(records + offset, len - offset, &entry)))
+			break;
+		lst->lasttime = entry.timestamp;
+
+		if ((lst->indexed >= 0) &&
+		    (lst->size + (off_t) offset - lst->indexed < LST_INDEX_INTERVAL))
+			continue;
+
+		lst->indexed = lst->size + offset;
+		index[count].timestamp = entry.timestamp;
+		index[count].offset = lst->indexed;
+
+		/* a lost index entry only makes queries read more */
+		if (++count == LST_INDEX_BATCH) {
+			if (lst_writeall(lst->idxfd, index, sizeof(index)))
+				result = -1;
+			count = 0;
+		}
+	}
+	lst->size += len;
+
+	if (count && lst_writeall(lst->idxfd, index,
+				  count * sizeof(struct log_store_index)))
+		result = -1;
+
+	return result;
+}
+
+/*
+ * start a new segment, keeping the current one as <basename>.rec.1
+ * and <basename>.idx.1 in place of the previous one
+ */
+int
+lst_rotate(struct log_store *lst)
+{
+	const char *suffixes[] = { "rec", "idx" };
+	char from[PATH_MAX] = {0};
+	char to[PATH_MAX] = {0};
+	size_t sfx = 0;
+
+	if (!lst) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (sfx = 0; sfx < sizeof(suffixes) / sizeof(char *); sfx++) {
+		snprintf(from, PATH_MAX, "%s.%s", lst->basename, suffixes[sfx]);
+		snprintf(to, PATH_MAX, "%s.%s.1", lst->basename, suffixes[sfx]);
+		if (rename(from, to) < 0)
+			return -1;
+	}
+
+	lst_closesegment(lst);
+
+	return lst_opensegment(lst);
+}
+
+/*
+ * get the number of bytes in the current segment
+ */
+off_t
+lst_get_size(struct log_store *lst)
+{
+	if (!lst) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return lst->size;
+}
+
+/*
+ * get the timestamp of the record appended last
+ */
+int64_t
+lst_get_lasttime(struct log_store *lst)
+{
+	if (!lst) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return lst->lasttime;
+}
+
+/*
+ * map a file read-only
+ *
+ * returns MAP_FAILED on error; an empty file maps to NULL.
+ */
+void *
+lst_mapfile(const char *filename, size_t *len)
+{
+	struct stat sb = {0};
+	void *map = MAP_FAILED;
+	int fd = -1;
+
+	*len = 0;
+
+	if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+		return (ENOENT == errno) ? NULL : MAP_FAILED;
+
+	if (fstat(fd, &sb) < 0) {
+		close(fd);
+		return MAP_FAILED;
+	}
+
+	if (!sb.st_size) {
+		close(fd);
+		return NULL;
+	}
+
+	if ((map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) !=
+	    MAP_FAILED)
+		*len = sb.st_size;
+	close(fd);
+
+	return map;
+}
+
+/*
+ * find where to start reading records at or after since: the last
+ * index entry older than since
+ */
+size_t
+lst_seek(const struct log_store_index *index, size_t count, int64_t since,
+	 size_t reclen)
+{
+	struct log_store_index entry = {0};
+	size_t low = 0, high = count, mid = 0;
+
+	/* entries are copied out, a mapping need not be aligned */
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		memcpy(&entry, &index[mid], sizeof(entry));
+		if (entry.timestamp < since)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (!low)
+		return 0;
+
+	memcpy(&entry, &index[low - 1], sizeof(entry));
+
+	return (entry.offset < reclen) ? entry.offset : 0;
+}
+
+/*
+ * run a query against one segment
+ */
+int
+lst_querysegment(const char *recname, const char *idxname,
+		 const struct log_store_query *query, lst_entry_cb cb, void *ctx)
+{
+	struct log_store_entry entry = {0};
+	const char *records = NULL;
+	void *index = NULL;
+	size_t reclen = 0, idxlen = 0, offset = 0, recordlen = 0;
+	size_t sourcelen = query->source ? strlen(query->source) : 0;
+	int result = 0;
+
+	if ((records = lst_mapfile(recname, &reclen)) == MAP_FAILED)
+		return -1;
+	if (!records)
+		return 0;
+
+	/* without an index the segment is read from the start */
+	if (query->since &&
+	    ((index = lst_mapfile(idxname, &idxlen)) != MAP_FAILED) && index)
+		offset = lst_seek(index, idxlen / sizeof(struct log_store_index),
+				  query->since, reclen);
+
+	for (; offset < reclen; offset += recordlen) {
+		if (!(recordlen = lst_decode(records + offset, reclen - offset,
+					     &entry)))
+			break;
+		if (query->until && (entry.timestamp > query->until))
+			break;
+		if (query->since && (entry.timestamp < query->since))
+			continue;
+		if (query->source && ((sourcelen != entry.sourcelen) ||
+				      memcmp(query->source, entry.source, sourcelen)))
+			continue;
+		if ((result = cb(ctx, &entry)))
+			break;
+	}
+
+	if (index && (index != MAP_FAILED))
+		munmap(index, idxlen);
+	munmap((void *) records, reclen);
+
+	return result;
+}
+
+/*
+ * call cb for each record of a store matching query, oldest first;
+ * the segments are mapped, so only the records in range are read
+ *
+ * a non-zero return value of cb ends the query and is passed on.
+ *
+ * returns 0 on success, -1 on error.
+ */
+int
+lst_query(const char *basename, const struct log_store_query *query,
+	  lst_entry_cb cb, void *ctx)
+{
+	const char *generations[] = { ".1", "" };
+	char recname[PATH_MAX] = {0};
+	char idxname[PATH_MAX] = {0};
+	size_t gen = 0;
+	int result = 0;
+
+	if (!basename || !query || !cb) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (gen = 0; gen < sizeof(generations) / sizeof(char *); gen++) {
+		snprintf(recname, PATH_MAX, "%s.rec%s", basename, generations[gen]);
+		snprintf(idxname, PATH_MAX, "%s.idx%s", basename, generations[gen]);
+		if ((result = lst_querysegment(recname, idxname, query, cb, ctx)))
+			return result;
+	}
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LOG_STORE_H__
+#define __LOG_STORE_H__
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* marks the start of a record */
+#define LST_MAGIC 0x524c4d56
+/* upper limit of a source name */
+#define LST_SOURCE_MAX 64
+/* bytes between two index entries */
+#define LST_INDEX_INTERVAL (64 * 1024)
+
+/*
+ * header of a record in a store segment; followed by sourcelen bytes
+ * naming the source and length bytes of output
+ */
+struct log_store_record {
+	uint32_t magic;
+	uint32_t length;
+	/* nanoseconds since the epoch */
+	int64_t timestamp;
+	uint16_t sourcelen;
+	uint16_t flags;
+	uint32_t reserved;
+};
+
+/*
+ * entry of the sparse index of a store segment
+ */
+struct log_store_index {
+	int64_t timestamp;
+	uint64_t offset;
+};
+
+/*
+ * a record as seen by readers
+ */
+struct log_store_entry {
+	int64_t timestamp;
+	const char *source;
+	size_t sourcelen;
+	const char *data;
+	size_t len;
+};
+
+/*
+ * records to look for; times are nanoseconds since the epoch, 0 leaves
+ * the range open; a NULL source matches all
+ */
+struct log_store_query {
+	int64_t since;
+	int64_t until;
+	const char *source;
+};
+
+typedef int (*lst_entry_cb)(void *ctx, const struct log_store_entry *entry);
+
+struct log_store;
+
+size_t lst_framesize(size_t sourcelen);
+size_t lst_frame(char *buffer, int64_t timestamp, const char *source,
+		 size_t sourcelen, size_t length);
+size_t lst_decode(const char *buffer, size_t len, struct log_store_entry *entry);
+struct log_store *lst_open(const char *basename);
+void lst_close(struct log_store *lst);
+int lst_append(struct log_store *lst, const char *records, size_t len);
+int lst_rotate(struct log_store *lst);
+off_t lst_get_size(struct log_store *lst);
+int64_t lst_get_lasttime(struct log_store *lst);
+int lst_query(const char *basename, const struct log_store_query *query,
+	      lst_entry_cb cb, void *ctx);
+
+#endif /* __LOG_STORE_H__ */
@@ -0,0 +1,219 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../log_store.h"
+
+/* one second in nanoseconds */
+#define TEST_SECOND 1000000000LL
+
+/*
+ * collects the output of records matched by a query
+ */
+struct test_collector {
+	size_t count;
+	int64_t first;
+	int64_t last;
+	char data[4096];
+	size_t len;
+};
+
+int
+test_collect(void *ctx, const struct log_store_entry *entry)
+{
+	struct test_collector *tc = ctx;
+
+	if (!tc->count++)
+		tc->first = entry->timestamp;
+	tc->last = entry->timestamp;
+
+	if (tc->len + entry->len < sizeof(tc->data)) {
+		memcpy(tc->data + tc->len, entry->data, entry->len);
+		tc->len += entry->len;
+	}
+
+	return 0;
+}
+
+/*
+ * append one record to a store
+ */
+void
+test_append(struct log_store *lst, int64_t timestamp, const char *source,
+	    const char *data)
+{
+	char buffer[1024] = {0};
+	size_t framelen = lst_frame(buffer, timestamp, source, strlen(source),
+				    strlen(data));
+
+	memcpy(buffer + framelen, data, strlen(data));
+	ATF_REQUIRE_EQ(0, lst_append(lst, buffer, framelen + strlen(data)));
+}
+
+void
+test_removestore(const char *basename)
+{
+	const char *suffixes[] = { "rec", "idx", "rec.1", "idx.1" };
+	char filename[PATH_MAX] = {0};
+	size_t idx = 0;
+
+	for (idx = 0; idx < sizeof(suffixes) / sizeof(char *); idx++) {
+		snprintf(filename, PATH_MAX, "%s.%s", basename, suffixes[idx]);
+		unlink(filename);
+	}
+}
+
+ATF_TC_WITH_CLEANUP(tc_lst_timerange);
+ATF_TC_HEAD(tc_lst_timerange, tc)
+{
+}
+ATF_TC_BODY(tc_lst_timerange, tc)
+{
+	const char *basename = "/tmp/test_lst_timerange";
+	struct log_store *lst = NULL;
+	struct log_store_query query = {0};
+	struct test_collector collected = {0};
+	struct stat sb = {0};
+	char line[512] = {0};
+	int64_t second = 0;
+
+	test_removestore(basename);
+	ATF_REQUIRE(0 != (lst = lst_open(basename)));
+
+	/* an hour of output, filling many index intervals */
+	for (second = 0; second < 3600; second++) {
+		snprintf(line, sizeof(line), "%-255jd\n", (intmax_t) second);
+		test_append(lst, (1000 + second) * TEST_SECOND,
+			    (second % 60) ? "bhyve" : "start_storage", line);
+	}
+	ATF_REQUIRE_EQ(3600 * (lst_framesize(5) + 256) + 60 * 8,
+		       (size_t) lst_get_size(lst));
+	lst_close(lst);
+
+	/* the index is sparse */
+	ATF_REQUIRE_EQ(0, stat("/tmp/test_lst_timerange.idx", &sb));
+	ATF_REQUIRE(sb.st_size > 0);
+	ATF_REQUIRE(sb.st_size < 100 * (off_t) sizeof(struct log_store_index));
+
+	query.since = 2000 * TEST_SECOND;
+	query.until = 2009 * TEST_SECOND;
+	ATF_REQUIRE_EQ(0, lst_query(basename, &query, test_collect, &collected));
+	ATF_REQUIRE_EQ(10, collected.count);
+	ATF_REQUIRE_EQ(2000 * TEST_SECOND, collected.first);
+	ATF_REQUIRE_EQ(2009 * TEST_SECOND, collected.last);
+	ATF_REQUIRE(!strncmp(collected.data, "1000 ", 5));
+
+	bzero(&collected, sizeof(collected));
+	query.since = 0;
+	query.until = 0;
+	query.source = "start_storage";
+	ATF_REQUIRE_EQ(0, lst_query(basename, &query, test_collect, &collected));
+	ATF_REQUIRE_EQ(60, collected.count);
+	ATF_REQUIRE_EQ(1000 * TEST_SECOND, collected.first);
+	ATF_REQUIRE_EQ(4540 * TEST_SECOND, collected.last);
+
+	/* nothing in range */
+	bzero(&collected, sizeof(collected));
+	query.since = 5000 * TEST_SECOND;
+	query.source = NULL;
+	ATF_REQUIRE_EQ(0, lst_query(basename, &query, test_collect, &collected));
+	ATF_REQUIRE_EQ(0, collected.count);
+}
+ATF_TC_CLEANUP(tc_lst_timerange, tc)
+{
+	test_removestore("/tmp/test_lst_timerange");
+}
+
+ATF_TC_WITH_CLEANUP(tc_lst_recover);
+ATF_TC_HEAD(tc_lst_recover, tc)
+{
+}
+ATF_TC_BODY(tc_lst_recover, tc)
+{
+	const char *basename = "/tmp/test_lst_recover";
+	struct log_store *lst = NULL;
+	struct log_store_query query = {0};
+	struct test_collector collected = {0};
+	off_t size = 0;
+	int fd = -1;
+
+	test_removestore(basename);
+	ATF_REQUIRE(0 != (lst = lst_open(basename)));
+	test_append(lst, 10 * TEST_SECOND, "bhyve", "first\n");
+	test_append(lst, 11 * TEST_SECOND, "bhyve", "second\n");
+	size = lst_get_size(lst);
+	lst_close(lst);
+
+	/* a record torn by a crash */
+	ATF_REQUIRE((fd = open("/tmp/test_lst_recover.rec", O_WRONLY | O_APPEND)) >= 0);
+	ATF_REQUIRE_EQ(10, write(fd, "\x56\x4d\x4c\x52torn!", 10));
+	close(fd);
+
+	ATF_REQUIRE(0 != (lst = lst_open(basename)));
+	ATF_REQUIRE_EQ(size, lst_get_size(lst));
+	ATF_REQUIRE_EQ(11 * TEST_SECOND, lst_get_lasttime(lst));
+	test_append(lst, 12 * TEST_SECOND, "bhyve", "third\n");
+
+	/* the previous segment is still searched */
+	ATF_REQUIRE_EQ(0, lst_rotate(lst));
+	ATF_REQUIRE_EQ(0, lst_get_size(lst));
+	test_append(lst, 13 * TEST_SECOND, "bhyve", "fourth\n");
+	lst_close(lst);
+
+	ATF_REQUIRE_EQ(0, lst_query(basename, &query, test_collect, &collected));
+	ATF_REQUIRE_EQ(4, collected.count);
+	collected.data[collected.len] = 0;
+	ATF_REQUIRE_STREQ("first\nsecond\nthird\nfourth\n", collected.data);
+
+	bzero(&collected, sizeof(collected));
+	query.since = 12 * TEST_SECOND;
+	ATF_REQUIRE_EQ(0, lst_query(basename, &query, test_collect, &collected));
+	ATF_REQUIRE_EQ(2, collected.count);
+}
+ATF_TC_CLEANUP(tc_lst_recover, tc)
+{
+	test_removestore("/tmp/test_lst_recover");
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_lst_timerange);
+	ATF_TP_ADD_TC(testplan, tc_lst_recover);
+
+	return atf_no_error();
+}
@@ -25,20 +25,28 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #include <atf-c.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #include "../log_director.h"
 #include "../../libprocwatch/state_change.h"
 
+uint64_t ldr_ratelimit_at(struct log_director_redirector *ldr, uint64_t bytes,
+			  const struct timespec *now);
+
 ATF_TC(tc_ld_initfree);
 ATF_TC_HEAD(tc_ld_initfree, tc)
 {
@@ -178,11 +186,749 @@ ATF_TC_BODY(tc_ld_procwatchrun, tc)
 }
 
 
+ATF_TC(tc_ld_batchedwrite);
+ATF_TC_HEAD(tc_ld_batchedwrite, tc)
+{
+}
+ATF_TC_BODY(tc_ld_batchedwrite, tc)
+{
+	struct log_director *ld = ld_new(1, "/tmp");
+	struct log_director_redirector *ldr = 0;
+	struct log_director_redirector_client *ldrd = 0;
+	struct stat file_info = {0};
+	char *argv[4] = {0};
+	char *expected = 0, *content = 0;
+	size_t expected_len = 0, offset = 0;
+	size_t counter = 0, waited = 0;
+	pid_t pid = 0;
+	int status = 0;
+	int filefd = 0;
+
+	/* a chatty process writing many short lines */
+	argv[0] = "/bin/sh";
+	argv[1] = "-c";
+	argv[2] = "i=0; while [ $i -lt 20000 ]; do echo line $i; i=$((i+1)); done";
+
+	ATF_REQUIRE(0 != (expected = malloc(20000 * 16)));
+	for (counter = 0; counter < 20000; counter++)
+		expected_len += sprintf(expected + expected_len, "line %zu\n", counter);
+
+	unlink("/tmp/testbatch.log");
+	ATF_REQUIRE(0 != ld);
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testbatch")));
+	ATF_REQUIRE(0 != (ldrd = ldr_newclient(ldr)));
+
+	if (0 == (pid = fork())) {
+		ldrd_redirect_stdout(ldrd);
+		exit(execve(argv[0], argv, environ));
+	}
+
+	ldrd_accept_redirect(ldrd);
+	waitpid(pid, &status, 0);
+	ATF_REQUIRE(WIFEXITED(status));
+	ATF_REQUIRE_EQ(0, WEXITSTATUS(status));
+
+	/* the write thread catches up on its own */
+	while ((waited++ < 500) &&
+	       (!stat("/tmp/testbatch.log", &file_info)) &&
+	       ((size_t) file_info.st_size < expected_len))
+		usleep(10000);
+
+	printf("%ju reads, %ju writes\n", (uintmax_t) ldr_get_reads(ldr),
+	       (uintmax_t) ldr_get_writes(ldr));
+	ATF_REQUIRE(ldr_get_reads(ldr) > 0);
+	ATF_REQUIRE(ldr_get_writes(ldr) <= ldr_get_reads(ldr));
+
+	ld_free(ld);
+
+	/* nothing was lost or reordered */
+	ATF_REQUIRE_EQ(0, stat("/tmp/testbatch.log", &file_info));
+	ATF_REQUIRE_EQ(expected_len, (size_t) file_info.st_size);
+	/* a fresh log is only readable by its owner */
+	ATF_REQUIRE_EQ(S_IRUSR | S_IWUSR, file_info.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+	ATF_REQUIRE(0 != (content = malloc(expected_len)));
+	ATF_REQUIRE((filefd = open("/tmp/testbatch.log", O_RDONLY)) >= 0);
+	while (offset < expected_len) {
+		ssize_t done = read(filefd, content + offset, expected_len - offset);
+		ATF_REQUIRE(done > 0);
+		offset += done;
+	}
+	close(filefd);
+	ATF_REQUIRE_EQ(0, memcmp(expected, content, expected_len));
+
+	free(content);
+	free(expected);
+	unlink("/tmp/testbatch.log");
+}
+
+/*
+ * append the uncompressed content of a gzip file to buffer
+ */
+size_t
+test_gunzip(const char *filename, char *buffer, size_t size)
+{
+	gzFile gzf = NULL;
+	int done = 0;
+	size_t offset = 0;
+
+	ATF_REQUIRE(0 != (gzf = gzopen(filename, "rb")));
+	while ((done = gzread(gzf, buffer + offset, size - offset)) > 0)
+		offset += done;
+	ATF_REQUIRE(done == 0);
+	gzclose(gzf);
+
+	return offset;
+}
+
+/*
+ * append the content of a plain file to buffer
+ */
+size_t
+test_readfile(const char *filename, char *buffer, size_t size)
+{
+	ssize_t done = 0;
+	size_t offset = 0;
+	int filefd = 0;
+
+	ATF_REQUIRE((filefd = open(filename, O_RDONLY)) >= 0);
+	while ((done = read(filefd, buffer + offset, size - offset)) > 0)
+		offset += done;
+	ATF_REQUIRE(done == 0);
+	close(filefd);
+
+	return offset;
+}
+
+ATF_TC_WITH_CLEANUP(tc_ld_rotation);
+ATF_TC_HEAD(tc_ld_rotation, tc)
+{
+}
+ATF_TC_BODY(tc_ld_rotation, tc)
+{
+	struct log_director *ld = ld_new(1, "/tmp");
+	struct log_director_redirector *ldr = 0;
+	struct log_director_redirector_client *ldrd = 0;
+	char *argv[4] = {0};
+	char *expected = 0, *content = 0;
+	size_t expected_len = 0, content_len = 0;
+	size_t counter = 0, waited = 0;
+	pid_t pid = 0;
+	int status = 0;
+
+	argv[0] = "/bin/sh";
+	argv[1] = "-c";
+	argv[2] = "i=0; while [ $i -lt 5000 ]; do echo line $i; i=$((i+1)); done";
+
+	ATF_REQUIRE(0 != (expected = malloc(5000 * 16)));
+	ATF_REQUIRE(0 != (content = malloc(5000 * 16)));
+	for (counter = 0; counter < 5000; counter++)
+		expected_len += sprintf(expected + expected_len, "line %zu\n", counter);
+
+	ATF_REQUIRE(0 != ld);
+	ATF_REQUIRE_EQ(0, ld_set_rotation(ld, 4096, 2, true));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testrotate")));
+	ATF_REQUIRE(0 != (ldrd = ldr_newclient(ldr)));
+
+	if (0 == (pid = fork())) {
+		ldrd_redirect_stdout(ldrd);
+		exit(execve(argv[0], argv, environ));
+	}
+
+	ldrd_accept_redirect(ldrd);
+	waitpid(pid, &status, 0);
+	ATF_REQUIRE(WIFEXITED(status));
+
+	/* writes out all output, a segment may be left unprocessed */
+	ld_free(ld);
+
+	/* a restart picks up the left over segment and appends */
+	ATF_REQUIRE(0 != (ld = ld_new(1, "/tmp")));
+	ATF_REQUIRE_EQ(0, ld_set_rotation(ld, 4096, 2, true));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testrotate")));
+
+	while ((waited++ < 500) &&
+	       atf_utils_file_exists("/tmp/testrotate.log.0"))
+		usleep(10000);
+
+	ld_free(ld);
+
+	/* only the newest two segments are kept, compressed */
+	ATF_REQUIRE(atf_utils_file_exists("/tmp/testrotate.log.1.gz"));
+	ATF_REQUIRE(atf_utils_file_exists("/tmp/testrotate.log.2.gz"));
+	ATF_REQUIRE(!atf_utils_file_exists("/tmp/testrotate.log.3.gz"));
+	ATF_REQUIRE(!atf_utils_file_exists("/tmp/testrotate.log.0"));
+
+	/* the segments add up to the end of the output */
+	content_len = test_gunzip("/tmp/testrotate.log.2.gz", content, 5000 * 16);
+	content_len += test_gunzip("/tmp/testrotate.log.1.gz",
+				   content + content_len, 5000 * 16 - content_len);
+	content_len += test_readfile("/tmp/testrotate.log",
+				     content + content_len, 5000 * 16 - content_len);
+
+	ATF_REQUIRE(content_len > 2 * 4096);
+	ATF_REQUIRE(content_len < expected_len);
+	ATF_REQUIRE_EQ(0, memcmp(expected + expected_len - content_len, content,
+				 content_len));
+
+	free(content);
+	free(expected);
+}
+ATF_TC_CLEANUP(tc_ld_rotation, tc)
+{
+	unlink("/tmp/testrotate.log");
+	unlink("/tmp/testrotate.log.0");
+	unlink("/tmp/testrotate.log.1.gz");
+	unlink("/tmp/testrotate.log.2.gz");
+}
+
+/*
+ * synthetic vm writing output into its log pipe
+ */
+struct test_shardwriter {
+	struct log_director_redirector_client *ldrd;
+	size_t bytes;
+	pthread_t thread;
+};
+
+void *
+test_shardwriter_thread(void *ctx)
+{
+	struct test_shardwriter *tsw = ctx;
+	char chunk[4096];
+	size_t written = 0;
+	ssize_t done = 0;
+	int fd = ldrd_get_senderfd(tsw->ldrd);
+
+	memset(chunk, 'x', sizeof(chunk));
+	chunk[sizeof(chunk) - 1] = '\n';
+
+	while (written < tsw->bytes) {
+		if ((done = write(fd, chunk, sizeof(chunk))) < 0)
+			break;
+		written += done;
+	}
+
+	/* closing the sending end ends the client */
+	ldrd_accept_redirect(tsw->ldrd);
+
+	return NULL;
+}
+
+ATF_TC(tc_ld_shardscaling);
+ATF_TC_HEAD(tc_ld_shardscaling, tc)
+{
+}
+ATF_TC_BODY(tc_ld_shardscaling, tc)
+{
+	const uint32_t shardcounts[] = { 1, 2, 4 };
+	const size_t writers = 8, perwriter = 4 * 1024 * 1024;
+	struct test_shardwriter tsw[8];
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	struct log_director_shardstats stats = {0};
+	struct timespec start = {0}, end = {0};
+	char logname[PATH_MAX] = {0};
+	uint64_t bytes = 0;
+	uint32_t redirectors = 0;
+	size_t round = 0, idx = 0, waited = 0;
+	uint32_t shard = 0;
+	double seconds = 0;
+
+	for (round = 0; round < sizeof(shardcounts) / sizeof(uint32_t); round++) {
+		ATF_REQUIRE(0 != (ld = ld_new_shards(1, "/tmp", shardcounts[round])));
+		ATF_REQUIRE_EQ(shardcounts[round], ld_get_shardcount(ld));
+
+		for (idx = 0; idx < writers; idx++) {
+			snprintf(logname, PATH_MAX, "testshard_%zu", idx);
+			ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, logname)));
+			ATF_REQUIRE(0 != (tsw[idx].ldrd = ldr_newclient(ldr)));
+			tsw[idx].bytes = perwriter;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (idx = 0; idx < writers; idx++)
+			ATF_REQUIRE_EQ(0, pthread_create(&tsw[idx].thread, NULL,
+							 test_shardwriter_thread,
+							 &tsw[idx]));
+		for (idx = 0; idx < writers; idx++)
+			pthread_join(tsw[idx].thread, NULL);
+
+		/* wait for the shards to read everything */
+		waited = 0;
+		do {
+			bytes = 0;
+			redirectors = 0;
+			for (shard = 0; shard < ld_get_shardcount(ld); shard++) {
+				ATF_REQUIRE_EQ(0, ld_get_shardstats(ld, shard, &stats));
+				bytes += stats.bytes;
+				redirectors += stats.redirectors;
+			}
+		} while ((bytes < writers * perwriter) && (waited++ < 3000) &&
+			 !usleep(1000));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ATF_REQUIRE_EQ(writers * perwriter, bytes);
+		ATF_REQUIRE_EQ(writers, redirectors);
+
+		seconds = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%u shards: %.1f MiB/s\n", shardcounts[round],
+		       bytes / seconds / (1024 * 1024));
+		for (shard = 0; shard < ld_get_shardcount(ld); shard++) {
+			ATF_REQUIRE_EQ(0, ld_get_shardstats(ld, shard, &stats));
+			printf("  shard %u: %u vms, %ju wakeups, %ju events, "
+			       "%ju bytes\n", shard, stats.redirectors,
+			       (uintmax_t) stats.wakeups, (uintmax_t) stats.events,
+			       (uintmax_t) stats.bytes);
+		}
+
+		ld_free(ld);
+
+		for (idx = 0; idx < writers; idx++) {
+			snprintf(logname, PATH_MAX, "/tmp/testshard_%zu.log", idx);
+			unlink(logname);
+		}
+	}
+}
+
+ATF_TC_WITH_CLEANUP(tc_ld_ratelimit);
+ATF_TC_HEAD(tc_ld_ratelimit, tc)
+{
+}
+ATF_TC_BODY(tc_ld_ratelimit, tc)
+{
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	struct log_director_redirector_stats stats = {0};
+	struct test_shardwriter tsw = {0};
+	char *content = 0, *cursor = 0;
+	size_t content_len = 0, marker_len = 0, waited = 0;
+	struct timespec start = {0}, end = {0};
+	uintmax_t suppressed = 0, total_suppressed = 0;
+	double seconds = 0;
+	int consumed = 0;
+
+	unlink("/tmp/testratelimit.log");
+
+	/* a vm flooding its console */
+	ATF_REQUIRE(0 != (ld = ld_new_shards(1, "/tmp", 1)));
+	ATF_REQUIRE_EQ(0, ld_set_ratelimit(ld, 4096, 8192));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testratelimit")));
+	ATF_REQUIRE(0 != (tsw.ldrd = ldr_newclient(ldr)));
+	tsw.bytes = 64 * 1024;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ATF_REQUIRE_EQ(0, pthread_create(&tsw.thread, NULL,
+					 test_shardwriter_thread, &tsw));
+	pthread_join(tsw.thread, NULL);
+
+	do {
+		ATF_REQUIRE_EQ(0, ldr_get_stats(ldr, &stats));
+	} while ((stats.bytes < tsw.bytes) && (waited++ < 3000) && !usleep(1000));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* everything was read, most of it dropped */
+	ATF_REQUIRE_EQ(tsw.bytes, stats.bytes);
+	ATF_REQUIRE(stats.dropped > 0);
+	ATF_REQUIRE(stats.dropped < stats.bytes);
+	ATF_REQUIRE(stats.dropbursts >= 1);
+
+	/* never more than the burst plus the rate for the time passed */
+	seconds = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	ATF_REQUIRE(stats.bytes - stats.dropped <= 8192 + 4096 * seconds + 1);
+
+	ld_free(ld);
+
+	/* the markers account for every byte dropped */
+	ATF_REQUIRE(0 != (content = malloc(tsw.bytes + 1)));
+	content_len = test_readfile("/tmp/testratelimit.log", content, tsw.bytes);
+	content[content_len] = 0;
+
+	for (cursor = content; (cursor = strstr(cursor, "\n[vmstated: ")); ) {
+		ATF_REQUIRE_EQ(1, sscanf(cursor, "\n[vmstated: %ju bytes suppressed]\n%n",
+					 &suppressed, &consumed));
+		ATF_REQUIRE(consumed > 0);
+		total_suppressed += suppressed;
+		marker_len += consumed;
+		cursor += consumed;
+	}
+
+	ATF_REQUIRE_EQ(stats.dropped, total_suppressed);
+	ATF_REQUIRE_EQ(stats.bytes - stats.dropped, content_len - marker_len);
+
+	free(content);
+}
+ATF_TC_CLEANUP(tc_ld_ratelimit, tc)
+{
+	unlink("/tmp/testratelimit.log");
+}
+
+ATF_TC_WITH_CLEANUP(tc_ld_ratelimitlow);
+ATF_TC_HEAD(tc_ld_ratelimitlow, tc)
+{
+}
+ATF_TC_BODY(tc_ld_ratelimitlow, tc)
+{
+	const uint32_t rate = 100;
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	struct timespec now = {0};
+	uint64_t accepted = 0;
+	size_t round = 0;
+
+	unlink("/tmp/testratelimitlow.log");
+
+	ATF_REQUIRE(0 != (ld = ld_new_shards(1, "/tmp", 1)));
+	ATF_REQUIRE_EQ(0, ld_set_ratelimit(ld, rate, rate));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testratelimitlow")));
+
+	/* the initial burst is spent right away */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ATF_REQUIRE_EQ(rate, ldr_ratelimit_at(ldr, 2 * rate, &now));
+
+	/* a vm printing a byte every 5 ms for two seconds */
+	for (round = 0; round < 400; round++) {
+		now.tv_nsec += 5000000;
+		if (now.tv_nsec >= 1000000000) {
+			now.tv_sec++;
+			now.tv_nsec -= 1000000000;
+		}
+		accepted += ldr_ratelimit_at(ldr, 1, &now);
+	}
+
+	/* half a token per read still adds up to rate bytes per second */
+	ATF_REQUIRE_EQ(2 * rate, accepted);
+
+	ld_free(ld);
+}
+ATF_TC_CLEANUP(tc_ld_ratelimitlow, tc)
+{
+	unlink("/tmp/testratelimitlow.log");
+}
+
+/*
+ * run a shell command with its output redirected to a new client
+ */
+void
+test_runsource(struct log_director_redirector *ldr, const char *source,
+	       const char *command)
+{
+	struct log_director_redirector_client *ldrd = 0;
+	char *argv[4] = { "/bin/sh", "-c", (char *) command, NULL };
+	pid_t pid = 0;
+	int status = 0;
+
+	ATF_REQUIRE(0 != (ldrd = ldr_newclient_source(ldr, source)));
+
+	if (0 == (pid = fork())) {
+		ldrd_redirect_stdout(ldrd);
+		ldrd_redirect_stderr(ldrd);
+		exit(execve(argv[0], argv, environ));
+	}
+
+	ldrd_accept_redirect(ldrd);
+	waitpid(pid, &status, 0);
+	ATF_REQUIRE(WIFEXITED(status));
+	ATF_REQUIRE_EQ(0, WEXITSTATUS(status));
+}
+
+/*
+ * collects the output of records by source
+ */
+struct test_records {
+	size_t count;
+	char data[1024];
+	size_t len;
+};
+
+int
+test_recordsource(void *ctx, const struct log_store_entry *entry)
+{
+	struct test_records *tr = ctx;
+
+	tr->count++;
+	if (tr->len + entry->len < sizeof(tr->data)) {
+		memcpy(tr->data + tr->len, entry->data, entry->len);
+		tr->len += entry->len;
+	}
+
+	return 0;
+}
+
+ATF_TC_WITH_CLEANUP(tc_ld_logstore);
+ATF_TC_HEAD(tc_ld_logstore, tc)
+{
+}
+ATF_TC_BODY(tc_ld_logstore, tc)
+{
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	struct log_store_query query = {0};
+	struct test_records records = {0};
+	char content[1024] = {0};
+	size_t content_len = 0;
+
+	unlink("/tmp/teststore.log");
+	unlink("/tmp/teststore.rec");
+	unlink("/tmp/teststore.idx");
+
+	ATF_REQUIRE(0 != (ld = ld_new_shards(1, "/tmp", 1)));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "teststore")));
+
+	test_runsource(ldr, "bhyve", "echo booting");
+	test_runsource(ldr, "start_storage", "echo attaching; echo failed >&2");
+	test_runsource(ldr, NULL, "echo done");
+
+	ld_free(ld);
+
+	/* the log file still carries the plain output */
+	content_len = test_readfile("/tmp/teststore.log", content, sizeof(content) - 1);
+	content[content_len] = 0;
+	ATF_REQUIRE_STREQ("booting\nattaching\nfailed\ndone\n", content);
+
+	query.source = "start_storage";
+	ATF_REQUIRE_EQ(0, lst_query("/tmp/teststore", &query, test_recordsource,
+				    &records));
+	ATF_REQUIRE(records.count > 0);
+	records.data[records.len] = 0;
+	ATF_REQUIRE_STREQ("attaching\nfailed\n", records.data);
+
+	/* everything is recorded, in order */
+	bzero(&records, sizeof(records));
+	query.source = NULL;
+	ATF_REQUIRE_EQ(0, lst_query("/tmp/teststore", &query, test_recordsource,
+				    &records));
+	records.data[records.len] = 0;
+	ATF_REQUIRE_STREQ(content, records.data);
+
+	/* nothing recorded in the future */
+	bzero(&records, sizeof(records));
+	query.since = (int64_t) (time(NULL) + 60) * 1000000000;
+	ATF_REQUIRE_EQ(0, lst_query("/tmp/teststore", &query, test_recordsource,
+				    &records));
+	ATF_REQUIRE_EQ(0, records.count);
+}
+ATF_TC_CLEANUP(tc_ld_logstore, tc)
+{
+	unlink("/tmp/teststore.log");
+	unlink("/tmp/teststore.rec");
+	unlink("/tmp/teststore.idx");
+}
+
+/*
+ * read from a subscriber until data matches expect or reading fails
+ *
+ * returns the result of the last ldrs_read.
+ */
+int
+test_readsubscriber(struct log_director_subscriber *ldrs, struct test_records *tr,
+		    const char *expect)
+{
+	int result = 0;
+
+	do {
+		if ((result = ldrs_read(ldrs, test_recordsource, tr, 2000)) <= 0)
+			return result;
+		tr->data[tr->len] = 0;
+	} while (expect && strcmp(expect, tr->data));
+
+	return result;
+}
+
+ATF_TC_WITH_CLEANUP(tc_ld_follow);
+ATF_TC_HEAD(tc_ld_follow, tc)
+{
+}
+ATF_TC_BODY(tc_ld_follow, tc)
+{
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	struct log_director_subscriber *live = 0, *late = 0, *slow = 0;
+	struct test_records records = {0};
+	int result = 0;
+
+	unlink("/tmp/testfollow.log");
+	unlink("/tmp/testfollow.rec");
+	unlink("/tmp/testfollow.idx");
+
+	ATF_REQUIRE(0 != (ld = ld_new_shards(1, "/tmp", 1)));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testfollow")));
+
+	/* nothing written yet, reading times out */
+	ATF_REQUIRE(0 != (live = ldr_subscribe(ldr, false)));
+	ATF_REQUIRE_EQ(0, ldrs_read(live, test_recordsource, &records, 100));
+
+	test_runsource(ldr, "bhyve", "echo early");
+	ATF_REQUIRE(test_readsubscriber(live, &records, "early\n") > 0);
+	ldrs_unsubscribe(live);
+
+	/* a late subscriber starts with the backlog */
+	bzero(&records, sizeof(records));
+	ATF_REQUIRE(0 != (late = ldr_subscribe(ldr, true)));
+	ATF_REQUIRE(test_readsubscriber(late, &records, "early\n") > 0);
+	ldrs_unsubscribe(late);
+
+	/* a subscriber that does not read is dropped, not waited for */
+	ATF_REQUIRE(0 != (slow = ldr_subscribe(ldr, false)));
+	test_runsource(ldr, "bhyve", "head -c 4000000 /dev/zero | tr '\\0' x");
+	bzero(&records, sizeof(records));
+	while ((result = test_readsubscriber(slow, &records, NULL)) > 0)
+		records.len = 0;
+	ATF_REQUIRE_EQ(-1, result);
+	ATF_REQUIRE_EQ(ENOBUFS, errno);
+	ldrs_unsubscribe(slow);
+
+	/* subscribers left are told the output ended */
+	ATF_REQUIRE(0 != (late = ldr_subscribe(ldr, false)));
+	ld_free(ld);
+	/* output still buffered was handed out first */
+	while ((result = ldrs_read(late, test_recordsource, &records, 2000)) > 0)
+		records.len = 0;
+	ATF_REQUIRE_EQ(-1, result);
+	ATF_REQUIRE_EQ(ECANCELED, errno);
+	ldrs_unsubscribe(late);
+}
+ATF_TC_CLEANUP(tc_ld_follow, tc)
+{
+	unlink("/tmp/testfollow.log");
+	unlink("/tmp/testfollow.rec");
+	unlink("/tmp/testfollow.idx");
+}
+
+/*
+ * counts the bytes of the records read
+ */
+int
+test_recordbytes(void *ctx, const struct log_store_entry *entry)
+{
+	*(size_t *) ctx += entry->len;
+
+	return 0;
+}
+
+ATF_TC_WITH_CLEANUP(tc_ld_followbacklog);
+ATF_TC_HEAD(tc_ld_followbacklog, tc)
+{
+}
+ATF_TC_BODY(tc_ld_followbacklog, tc)
+{
+	const size_t backlog = 200000, burst = 1030000;
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	struct log_director_subscriber *ldrs = 0;
+	struct log_director_redirector_stats stats = {0};
+	char command[128] = {0};
+	size_t bytes = 0, waited = 0;
+	int result = 0;
+
+	unlink("/tmp/testfollowbacklog.log");
+	unlink("/tmp/testfollowbacklog.rec");
+	unlink("/tmp/testfollowbacklog.idx");
+
+	ATF_REQUIRE(0 != (ld = ld_new_shards(1, "/tmp", 1)));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testfollowbacklog")));
+
+	/* fill the backlog with short lines */
+	snprintf(command, sizeof(command), "yes backlog | head -c %zu", backlog);
+	test_runsource(ldr, "bhyve", command);
+	do {
+		ATF_REQUIRE_EQ(0, ldr_get_stats(ldr, &stats));
+	} while ((stats.bytes < backlog) && (waited++ < 3000) && !usleep(1000));
+	usleep(200000);
+
+	/* the backlog and a full buffer behind it are queued, not dropped */
+	ATF_REQUIRE(0 != (ldrs = ldr_subscribe(ldr, true)));
+	snprintf(command, sizeof(command), "head -c %zu /dev/zero | tr '\\0' x",
+		 burst);
+	test_runsource(ldr, "bhyve", command);
+	waited = 0;
+	do {
+		ATF_REQUIRE_EQ(0, ldr_get_stats(ldr, &stats));
+	} while ((stats.bytes < backlog + burst) && (waited++ < 3000) &&
+		 !usleep(1000));
+	usleep(200000);
+
+	while ((result = ldrs_read(ldrs, test_recordbytes, &bytes, 500)) > 0)
+		;
+	ATF_REQUIRE_EQ(0, result);
+	ATF_REQUIRE(bytes > burst);
+
+	ldrs_unsubscribe(ldrs);
+	ld_free(ld);
+}
+ATF_TC_CLEANUP(tc_ld_followbacklog, tc)
+{
+	unlink("/tmp/testfollowbacklog.log");
+	unlink("/tmp/testfollowbacklog.rec");
+	unlink("/tmp/testfollowbacklog.idx");
+}
+
+/*
+ * unsubscribe while the redirector is freed
+ */
+struct test_unsubscriber {
+	struct log_director_subscriber *ldrs;
+	pthread_t thread;
+};
+
+void *
+test_unsubscriber_thread(void *ctx)
+{
+	struct test_unsubscriber *tus = ctx;
+
+	ldrs_unsubscribe(tus->ldrs);
+
+	return NULL;
+}
+
+ATF_TC_WITH_CLEANUP(tc_ld_unsubscriberace);
+ATF_TC_HEAD(tc_ld_unsubscriberace, tc)
+{
+}
+ATF_TC_BODY(tc_ld_unsubscriberace, tc)
+{
+	struct test_unsubscriber tus[16];
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	size_t round = 0, idx = 0;
+
+	for (round = 0; round < 200; round++) {
+		ATF_REQUIRE(0 != (ld = ld_new_shards(1, "/tmp", 1)));
+		ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "testunsubscribe")));
+		for (idx = 0; idx < 16; idx++)
+			ATF_REQUIRE(0 != (tus[idx].ldrs = ldr_subscribe(ldr, false)));
+
+		for (idx = 0; idx < 16; idx++)
+			ATF_REQUIRE_EQ(0, pthread_create(&tus[idx].thread, NULL,
+							 test_unsubscriber_thread,
+							 &tus[idx]));
+		ld_free(ld);
+		for (idx = 0; idx < 16; idx++)
+			pthread_join(tus[idx].thread, NULL);
+	}
+}
+ATF_TC_CLEANUP(tc_ld_unsubscriberace, tc)
+{
+	unlink("/tmp/testunsubscribe.log");
+	unlink("/tmp/testunsubscribe.rec");
+	unlink("/tmp/testunsubscribe.idx");
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_ld_initfree);
 	ATF_TP_ADD_TC(testplan, tc_ld_forktest);
 	ATF_TP_ADD_TC(testplan, tc_ld_procwatchrun);
+	ATF_TP_ADD_TC(testplan, tc_ld_batchedwrite);
+	ATF_TP_ADD_TC(testplan, tc_ld_rotation);
+	ATF_TP_ADD_TC(testplan, tc_ld_shardscaling);
+	ATF_TP_ADD_TC(testplan, tc_ld_ratelimit);
+	ATF_TP_ADD_TC(testplan, tc_ld_ratelimitlow);
+	ATF_TP_ADD_TC(testplan, tc_ld_logstore);
+	ATF_TP_ADD_TC(testplan, tc_ld_follow);
+	ATF_TP_ADD_TC(testplan, tc_ld_followbacklog);
+	ATF_TP_ADD_TC(testplan, tc_ld_unsubscriberace);
 
 	return atf_no_error();
 }
@@ -30,6 +30,7 @@
 #include <sys/mman.h>
 #include <sys/nv.h>
 #include <sys/queue.h>
+#include <sys/stat.h>
 
 #include <dirent.h>
 #include <err.h>
@@ -37,8 +38,10 @@
 #include <fcntl.h>
 #include <grp.h>
 #include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
@@ -47,12 +50,23 @@
 
 #include "bhyve_config.h"
 #include "bhyve_config_console.h"
+#include "bhyve_config_hooks.h"
 #include "bhyve_uclparser.h"
 #include "bhyve_uclparser_funcs.h"
+#include "config_cache.h"
 
 #include "../libcommand/nvlist_mapping.h"
 #include "../libcommand/bhyve_command.h"
 #include "../libutils/bhyve_utils.h"
+#include "../libutils/daemon_log.h"
+#include "../libutils/memory_arena.h"
+#include "../libutils/string_pool.h"
+
+/* upper limit of threads parsing configuration directories */
+#define BCS_THREADS_MAX 16
+
+/* first arena chunk holds a configuration and the strings of a typical one */
+#define BC_ARENA_SIZE (sizeof(struct bhyve_configuration) + 160)
 
 /*
  * represents a bhyve configuration to be handled by vmstated. This
@@ -61,55 +75,77 @@
  *
  * Handling and working bhyve configuration data is managed by
  * structures in libconfig.
+ *
+ * A configuration lives in its own arena along with its string pool and
+ * consoles, so releasing the arena releases all of them.
  */
 struct bhyve_configuration {
-	char name[PATH_MAX];
-	char configfile[PATH_MAX];
-	char scriptpath[PATH_MAX];
+	/*
+	 * strings are interned in the string pool of the configuration
+	 * once it is constructed; bc_internstrings moves them there.
+	 */
+	char *name;
+	char *configfile;
+	char *scriptpath;
 	char *os;
 	char *osversion;
 	char *owner;
 	char *group;
 	char *description;
-
-	/* number of maximum restarts within maxrestarttime */
-	uint32_t maxrestart;
-	/* number of seconds to allow maxrestarts to occur before failure */
-	time_t maxrestarttime;
+	/* a bootrom file */
+	char *bootrom;
+	/* hostbridge attribute */
+	char *hostbridge;
+	/* stores the filename, which created this instance */
+	char *backing_filepath;
+	/* stores the filename of the generated config */
+	char *generated_config;
+	struct memory_arena *arena;
+	struct string_pool *strings;
 
 	/* console configuration options */
 	struct bhyve_configuration_console_list *consoles;
+	/* order of hook stages, NULL to run them one after another */
+	struct bhyve_configuration_hooks *hooks;
 
-	bool autostart;
-	/* a bootrom file */
-	char *bootrom;
-
+	/* number of seconds to allow maxrestarts to occur before failure */
+	time_t maxrestarttime;
+	/* number of maximum restarts within maxrestarttime */
+	uint32_t maxrestart;
+	/* number of seconds to wait after SIGTERM before killing the vm */
+	uint32_t stoptimeout;
+	/* number of seconds a hook script may run, 0 for no limit */
+	uint32_t scripttimeout;
+	/* number of seconds to wait before restarting a rebooting vm */
+	uint32_t restartdelay;
+	/* start order; higher values start later and stop earlier */
+	uint32_t priority;
 	/* vm memory setting in megabytes */
 	uint32_t memory;
+
+	/* transient cached values */
+	uid_t uid;
+	gid_t gid;
+
 	/* cpu configuration */
 	uint16_t numcpus;
 	uint16_t sockets;
 	uint16_t cores;
 
-	/* transient cached values */
-	uint32_t *uid;
-	uint32_t *gid;
-	/* stores the filename, which created this instance */
-	char *backing_filepath;
-	/* stores the filename of the generated config */
-	char *generated_config;
-
+	bool autostart;
 	/* core config variables */
 	bool generate_acpi_tables;
 	bool wire_memory;
 	bool vmexit_on_halt;
+	/* uid and gid hold looked up ids */
+	bool uid_cached;
+	bool gid_cached;
 
-	/* hostbridge attribute */
-	char *hostbridge;
-	
 	LIST_ENTRY(bhyve_configuration) entries;
 };
 
+LIST_HEAD(bhyve_configuration_list, bhyve_configuration);
+
 /*
  * this maps configuration variable names in our UCL config files into
  * the memory offsets in struct bhyve_configuration
@@ -117,20 +153,20 @@ struct bhyve_configuration {
 struct nvlistitem_mapping bc_nvlist2config[] = {
 	{
 		.offset = offsetof(struct bhyve_configuration, name),
-		.value_type = FIXEDSTRING,
-		.size = PATH_MAX,
+		.value_type = DYNAMICSTRING,
+		.size = sizeof(char *),
 		.varname = "name"
 	},
 	{
 		.offset = offsetof(struct bhyve_configuration, configfile),
-		.value_type = FIXEDSTRING,
-		.size = PATH_MAX,
+		.value_type = DYNAMICSTRING,
+		.size = sizeof(char *),
 		.varname = "configfile"
 	},
 	{
 		.offset = offsetof(struct bhyve_configuration, scriptpath),
-		.value_type = FIXEDSTRING,
-		.size = PATH_MAX,
+		.value_type = DYNAMICSTRING,
+		.size = sizeof(char *),
 		.varname = "scriptpath"
 	},
 	{
@@ -175,6 +211,30 @@ struct nvlistitem_mapping bc_nvlist2config[] = {
 		.size = sizeof(time_t),
 		.varname = "maxrestarttime"
 	},
+	{
+		.offset = offsetof(struct bhyve_configuration, stoptimeout),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "stoptimeout"
+	},
+	{
+		.offset = offsetof(struct bhyve_configuration, scripttimeout),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "scripttimeout"
+	},
+	{
+		.offset = offsetof(struct bhyve_configuration, restartdelay),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "restartdelay"
+	},
+	{
+		.offset = offsetof(struct bhyve_configuration, priority),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "priority"
+	},
 	{
 		.offset = offsetof(struct bhyve_configuration, autostart),
 		.value_type = BOOLEAN,
@@ -207,8 +267,8 @@ struct nvlistitem_mapping bc_nvlist2config[] = {
 	},
 	{
 		.offset = offsetof(struct bhyve_configuration, cores),
-		.value_type = DYNAMICSTRING,
-		.size = sizeof(char *),
+		.value_type = UINT16,
+		.size = sizeof(uint16_t),
 		.varname = "cores"
 	},
 	{
@@ -245,6 +305,11 @@ struct bhyve_uclparser_item bc_ucl2subparser_items[] = {
 		.varname = "consoles",
 		.offset = offsetof(struct bhyve_configuration, consoles),
 		.delegate_func = buf_parse_console_list
+	},
+	{
+		.varname = "hooks",
+		.offset = offsetof(struct bhyve_configuration, hooks),
+		.delegate_func = buf_parse_hooks
 	}
 };
 
@@ -261,7 +326,46 @@ struct bhyve_configuration_iterator {
  */
 struct bhyve_configuration_store {
 	char searchpath[PATH_MAX];
-	LIST_HEAD(,bhyve_configuration) configs;
+	struct bhyve_configuration_list configs;
+	/* threads parsing configuration directories, 0 for one per cpu */
+	uint32_t threads;
+	/* cache of parsed config files, NULL to parse all of them */
+	char *cachefile;
+	/* config files taken from the cache and parsed by the last walk */
+	size_t cached;
+	size_t parsed;
+};
+
+/*
+ * a vm directory found in the search path and the configurations
+ * parsed from it
+ */
+struct bhyve_configuration_dir {
+	char *path;
+	struct bhyve_configuration_list configs;
+	/* set if the directory contained a parsable config file */
+	bool found;
+
+	/* config file details recorded in the cache */
+	struct stat st;
+	uint64_t hash;
+	/* configs came from the cache */
+	bool cached;
+	/* cache entry matched by content only and needs new file details */
+	bool stale;
+};
+
+/*
+ * hands out the vm directories of a search path to parsing threads
+ */
+struct bhyve_configuration_walker {
+	pthread_mutex_t mtx;
+	struct bhyve_configuration_dir *dirs;
+	size_t count;
+	/* index of the next directory to parse */
+	size_t next;
+	/* configurations of the previous walk, may be NULL */
+	struct config_cache *cfc;
 };
 
 /*
@@ -332,6 +436,166 @@ bcs_iterate_configs(struct bhyve_configuration_store *bcs)
 	return bci;	
 }
 
+/* offsets of the string members of struct bhyve_configuration */
+size_t bc_stringoffsets[] = {
+	offsetof(struct bhyve_configuration, name),
+	offsetof(struct bhyve_configuration, configfile),
+	offsetof(struct bhyve_configuration, scriptpath),
+	offsetof(struct bhyve_configuration, os),
+	offsetof(struct bhyve_configuration, osversion),
+	offsetof(struct bhyve_configuration, owner),
+	offsetof(struct bhyve_configuration, group),
+	offsetof(struct bhyve_configuration, description),
+	offsetof(struct bhyve_configuration, bootrom),
+	offsetof(struct bhyve_configuration, hostbridge),
+	offsetof(struct bhyve_configuration, backing_filepath),
+	offsetof(struct bhyve_configuration, generated_config)
+};
+
+#define BC_STRINGCOUNT (sizeof(bc_stringoffsets) / sizeof(size_t))
+
+void bc_free(struct bhyve_configuration *bc);
+
+/*
+ * get a string member of a configuration by its index
+ */
+char **
+bc_stringfield(struct bhyve_configuration *bc, size_t index)
+{
+	return (char **)((char *) bc + bc_stringoffsets[index]);
+}
+
+/*
+ * move strings allocated while parsing or decoding into the string
+ * pool of the configuration
+ *
+ * returns 0 on success; strings that could not be moved stay allocated.
+ */
+int
+bc_internstrings(struct bhyve_configuration *bc)
+{
+	const char *interned = NULL;
+	char **str = NULL;
+	size_t counter = 0, count = 0, length = 0;
+
+	if (!bc->strings && !(bc->strings = spl_new(bc->arena)))
+		return -1;
+
+	for (counter = 0; counter < BC_STRINGCOUNT; counter++) {
+		str = bc_stringfield(bc, counter);
+		if (*str && !spl_owns(bc->strings, *str)) {
+			count++;
+			length += strlen(*str);
+		}
+	}
+
+	if (count && spl_reserve(bc->strings, count, length))
+		return -1;
+
+	for (counter = 0; counter < BC_STRINGCOUNT; counter++) {
+		str = bc_stringfield(bc, counter);
+		if (!*str || spl_owns(bc->strings, *str))
+			continue;
+
+		if (!(interned = spl_intern(bc->strings, *str)))
+			return -1;
+
+		free(*str);
+		*str = (char *) interned;
+	}
+
+	return 0;
+}
+
+/*
+ * drop interned strings before a decoder assigns new values; they stay
+ * in the string pool until the configuration is released
+ */
+void
+bc_detachstrings(struct bhyve_configuration *bc)
+{
+	char **str = NULL;
+	size_t counter = 0;
+
+	for (counter = 0; counter < BC_STRINGCOUNT; counter++) {
+		str = bc_stringfield(bc, counter);
+		if (spl_owns(bc->strings, *str))
+			*str = NULL;
+	}
+}
+
+/*
+ * get number of bytes allocated for a configuration including its
+ * strings and consoles
+ */
+size_t
+bc_get_memusage(const struct bhyve_configuration *bc)
+{
+	struct memory_arena_usage usage = {0};
+
+	if (!bc)
+		return 0;
+
+	ma_get_usage(bc->arena, &usage);
+
+	return usage.bytes;
+}
+
+/*
+ * get the arena a configuration is allocated from
+ */
+struct memory_arena *
+bc_get_arena(const struct bhyve_configuration *bc)
+{
+	if (!bc) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return bc->arena;
+}
+
+/*
+ * set default values for settings that may be omitted in config files
+ */
+void
+bc_setdefaults(struct bhyve_configuration *bc)
+{
+	/* set default values for restart counting */
+	bc->maxrestart = 3;
+	bc->maxrestarttime = 30;
+
+	bc->stoptimeout = 30;
+	bc->scripttimeout = 300;
+	bc->restartdelay = 0;
+	bc->priority = 0;
+}
+
+/*
+ * construct a configuration with default values in a new arena
+ *
+ * returns NULL on error.
+ */
+struct bhyve_configuration *
+bc_alloc()
+{
+	struct bhyve_configuration *bc = NULL;
+	struct memory_arena *ma = NULL;
+
+	if (!(ma = ma_new(BC_ARENA_SIZE)))
+		return NULL;
+
+	if (!(bc = ma_alloc(ma, sizeof(struct bhyve_configuration)))) {
+		ma_free(ma);
+		return NULL;
+	}
+
+	bc->arena = ma;
+	bc_setdefaults(bc);
+
+	return bc;
+}
+
 struct bhyve_configuration *
 bc_new(const char *name,
        const char *configfile,
@@ -345,42 +609,31 @@ bc_new(const char *name,
 		return NULL;
 	}
 
-	struct bhyve_configuration *bc = malloc(sizeof(struct bhyve_configuration));
-	size_t size = 0;
-
-	bzero(bc, sizeof(struct bhyve_configuration));
-
-	/* set default values for restart counting */
-	bc->maxrestart = 3;
-	bc->maxrestarttime = 30;
+	const char *values[] = { name, configfile, os, osversion, owner, group };
+	struct bhyve_configuration *bc = bc_alloc();
+	size_t counter = 0, count = 0, length = 0;
 
 	if (!bc)
 		return NULL;
 
-	strncpy(bc->name, name, PATH_MAX);
-	strncpy(bc->configfile, configfile, PATH_MAX);
-	if (os) {
-		size = strlen(os);
-		bc->os = malloc(size+1);
-		strncpy(bc->os, os, size+1);
-	}
-
-	if (osversion) {
-		size = strlen(osversion);
-		bc->osversion = malloc(size+1);
-		strncpy(bc->osversion, osversion, size+1);
-	}
-
-	if (owner) {
-		size = strlen(owner);
-		bc->owner = malloc(size+1);
-		strncpy(bc->owner, owner, size+1);
+	for (counter = 0; counter < sizeof(values) / sizeof(*values); counter++) {
+		if (values[counter]) {
+			count++;
+			length += strlen(values[counter]);
+		}
 	}
 
-	if (group) {
-		size = strlen(group);
-		bc->group = malloc(size+1);
-		strncpy(bc->group, group, size+1);
+	if (!(bc->strings = spl_new(bc->arena)) ||
+	    spl_reserve(bc->strings, count, length) ||
+	    !(bc->name = (char *) spl_intern(bc->strings, name)) ||
+	    !(bc->configfile = (char *) spl_intern(bc->strings, configfile)) ||
+	    (os && !(bc->os = (char *) spl_intern(bc->strings, os))) ||
+	    (osversion &&
+	     !(bc->osversion = (char *) spl_intern(bc->strings, osversion))) ||
+	    (owner && !(bc->owner = (char *) spl_intern(bc->strings, owner))) ||
+	    (group && !(bc->group = (char *) spl_intern(bc->strings, group)))) {
+		bc_free(bc);
+		return NULL;
 	}
 
 	return bc;
@@ -402,6 +655,10 @@ bc_tonvlist(struct bhyve_configuration *bc, nvlist_t *nvl)
 				 bc, nvl);
 }
 
+/* hashed lookup of bc_nvlist2config entries */
+struct parser_mapping_index bc_nvlist2config_index =
+	PARSER_MAPPING_INDEX(bc_nvlist2config);
+
 /*
  * definition of bc_findmapping via macro
  *
@@ -409,7 +666,7 @@ bc_tonvlist(struct bhyve_configuration *bc, nvlist_t *nvl)
  *
  * returns NULL if nothing matches
  */
-nvlistitem_mapping_lookupfunc(bc_nvlist2config, bc_findmapping);
+nvlistitem_mapping_lookupfunc(bc_nvlist2config_index, bc_findmapping);
 
 /*
  * read configuration from ucl object
@@ -418,8 +675,7 @@ int
 bc_parsefromucl(struct bhyve_configuration *bc, const ucl_object_t *confobj)
 {
 	return bup_parsefromucl(bc, confobj,
-				bc_nvlist2config,
-				sizeof(bc_nvlist2config)/sizeof(struct nvlistitem_mapping),
+				&bc_nvlist2config_index,
 				bc_ucl2subparser_items,
 				sizeof(bc_ucl2subparser_items)/sizeof(struct bhyve_uclparser_item));
 }
@@ -430,15 +686,24 @@ bc_parsefromucl(struct bhyve_configuration *bc, const ucl_object_t *confobj)
 int
 bc_fromnvlist(struct bhyve_configuration *bc, nvlist_t *nvl)
 {
+	int result = 0;
+
 	if (!bc || !nvl) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return bcmd_decodenvlist(bc_nvlist2config,
-				 sizeof(bc_nvlist2config) /
-				 sizeof(struct nvlistitem_mapping),
-				 bc, nvl);
+	/* the decoder replaces strings with allocated copies */
+	bc_detachstrings(bc);
+	result = bcmd_decodenvlist(bc_nvlist2config,
+				   sizeof(bc_nvlist2config) /
+				   sizeof(struct nvlistitem_mapping),
+				   bc, nvl);
+
+	if (bc_internstrings(bc))
+		return -1;
+
+	return result;
 }
 
 /*
@@ -447,26 +712,20 @@ bc_fromnvlist(struct bhyve_configuration *bc, nvlist_t *nvl)
 int
 bc_getuid(struct bhyve_configuration *bc)
 {
-	if (bc->uid)
-		return *bc->uid;
+	if (bc->uid_cached)
+		return bc->uid;
 
 	if (!bc->owner)
 		return -1;
 
-	bc->uid = malloc(sizeof(uint32_t));
-	if (!bc->uid)
-		return -1;
-
 	struct passwd *pwd = getpwnam(bc->owner);
-	if (pwd) {
-		*bc->uid = pwd->pw_uid;
-	} else {
-		free(bc->uid);
-		bc->uid = NULL;
+	if (!pwd)
 		return -1;
-	}
 
-	return *bc->uid;
+	bc->uid = pwd->pw_uid;
+	bc->uid_cached = true;
+
+	return bc->uid;
 }
 
 /*
@@ -475,26 +734,20 @@ bc_getuid(struct bhyve_configuration *bc)
 int
 bc_getgid(struct bhyve_configuration *bc)
 {
-	if (bc->gid)
-		return *bc->gid;
+	if (bc->gid_cached)
+		return bc->gid;
 
 	if (!bc->group)
 		return -1;
 
-	bc->gid = malloc(sizeof(uint32_t));
-	if (!bc->gid)
-		return -1;
-
 	struct group *gr = getgrnam(bc->group);
-	if (gr) {
-		*bc->gid = gr->gr_gid;
-	} else {
-		free(bc->gid);
-		bc->gid = NULL;
+	if (!gr)
 		return -1;
-	}
 
-	return *bc->gid;
+	bc->gid = gr->gr_gid;
+	bc->gid_cached = true;
+
+	return bc->gid;
 }
 
 /*
@@ -503,23 +756,182 @@ bc_getgid(struct bhyve_configuration *bc)
 void
 bc_free(struct bhyve_configuration *bc)
 {
+	char **str = NULL;
+	size_t counter = 0;
+
 	if (!bc)
 		return;
 
-	free(bc->os);
-	free(bc->osversion);
+	/* strings not interned yet were allocated by a decoder */
+	for (counter = 0; counter < BC_STRINGCOUNT; counter++) {
+		str = bc_stringfield(bc, counter);
+		if (!spl_owns(bc->strings, *str))
+			free(*str);
+	}
+	bch_free(bc->hooks);
+
+	/* releases bc itself along with its strings and consoles */
+	ma_free(bc->arena);
+}
 
-	if (bc->consoles)
-		bccl_free(bc->consoles);
+/*
+ * hash names and types of nvlist mappings
+ */
+uint64_t
+bc_hashmapping(uint64_t hash, const struct nvlistitem_mapping *mapping,
+	       size_t mapping_count)
+{
+	size_t counter = 0;
 
-	free(bc->uid);
-	free(bc->gid);
+	for (counter = 0; counter < mapping_count; counter++) {
+		hash = cfc_hash(hash, mapping[counter].varname,
+				strlen(mapping[counter].varname) + 1);
+		hash = cfc_hash(hash, &mapping[counter].value_type,
+				sizeof(mapping[counter].value_type));
+	}
 
-	free(bc->backing_filepath);
-	free(bc->generated_config);
-	free(bc->hostbridge);
-	
-	free(bc);
+	return hash;
+}
+
+/*
+ * fingerprint of the fields written by bc_tocache; caches written with
+ * a different set of fields are discarded
+ */
+uint64_t
+bc_cacheschema()
+{
+	uint64_t schema = CFC_HASH_INIT;
+	const char *stage = NULL;
+	size_t counter = 0;
+
+	schema = bc_hashmapping(schema, bc_nvlist2config,
+				sizeof(bc_nvlist2config) /
+				sizeof(struct nvlistitem_mapping));
+	schema = bc_hashmapping(schema, bcc_get_mapping(),
+				bcc_get_mapping_count());
+
+	for (counter = 0; counter < BCH_STAGECOUNT; counter++) {
+		stage = bch_stagename(counter);
+		schema = cfc_hash(schema, stage, strlen(stage) + 1);
+	}
+
+	return schema;
+}
+
+/*
+ * convert a configuration including consoles and hooks into an nvlist
+ * for the config cache
+ *
+ * returns NULL on error.
+ */
+nvlist_t *
+bc_tocache(struct bhyve_configuration *bc)
+{
+	nvlist_t *nvl = NULL, *hooks = NULL;
+
+	if (!(nvl = nvlist_create(0)))
+		return NULL;
+
+	do {
+		if (bc_tonvlist(bc, nvl))
+			break;
+
+		if (bc->consoles) {
+			if (!bccl_count(bc->consoles))
+				nvlist_add_null(nvl, "consoles");
+			else if (bccl_tonvlist(bc->consoles, nvl, "consoles"))
+				break;
+		}
+
+		if (bc->hooks) {
+			if (!(hooks = nvlist_create(0)) ||
+			    bch_tonvlist(bc->hooks, hooks)) {
+				nvlist_destroy(hooks);
+				break;
+			}
+			nvlist_move_nvlist(nvl, "hooks", hooks);
+		}
+
+		if (nvlist_error(nvl))
+			break;
+
+		return nvl;
+	} while (0);
+
+	nvlist_destroy(nvl);
+
+	return NULL;
+}
+
+/*
+ * hash the settings of a configuration including consoles and hooks;
+ * configurations with equal settings hash equally
+ *
+ * returns 0 on success.
+ */
+int
+bc_hash(const struct bhyve_configuration *bc, uint64_t *hash)
+{
+	nvlist_t *nvl = NULL;
+	void *packed = NULL;
+	size_t size = 0;
+
+	if (!bc || !hash) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!(nvl = bc_tocache((struct bhyve_configuration *) bc)))
+		return -1;
+
+	packed = nvlist_pack(nvl, &size);
+	nvlist_destroy(nvl);
+
+	if (!packed)
+		return -1;
+
+	*hash = cfc_hash(CFC_HASH_INIT, packed, size);
+	free(packed);
+
+	return 0;
+}
+
+/*
+ * construct a configuration from an nvlist made by bc_tocache
+ *
+ * returns NULL on error.
+ */
+struct bhyve_configuration *
+bc_fromcache(const nvlist_t *nvl, const char *configfile)
+{
+	struct bhyve_configuration *bc = NULL;
+
+	if (!(bc = bc_alloc()))
+		return NULL;
+
+	do {
+		/* interned along with the decoded strings */
+		if (!(bc->backing_filepath = strdup(configfile)))
+			break;
+
+		if (bc_fromnvlist(bc, (nvlist_t *)nvl))
+			break;
+
+		if (nvlist_exists(nvl, "consoles") &&
+		    !(bc->consoles = bccl_fromnvlist(bc->arena, nvl,
+							     "consoles")))
+			break;
+
+		if (nvlist_exists_nvlist(nvl, "hooks") &&
+		    !(bc->hooks = bch_fromnvlist(nvlist_get_nvlist(nvl, "hooks"))))
+			break;
+
+		return bc;
+	} while (0);
+
+	bc_free(bc);
+
+	return NULL;
 }
 
 /*
@@ -536,7 +948,7 @@ bcs_getconfig_byname(struct bhyve_configuration_store *bcs, const char *name)
 	struct bhyve_configuration *bc = 0;
 
 	LIST_FOREACH(bc, &bcs->configs, entries) {
-		if (!strcmp(bc->name, name))
+		if (!strcmp(bc_get_name(bc), name))
 			return bc;
 	}
 
@@ -561,50 +973,54 @@ bcs_new(const char *searchpath)
 	strncpy(bcs->searchpath, searchpath, PATH_MAX);
 
 	LIST_INIT(&bcs->configs);
+	bcs->threads = 0;
+	bcs->cachefile = NULL;
+	bcs->cached = 0;
+	bcs->parsed = 0;
 
 	return bcs;
 }
 
 /*
- * parses a config file into the configuration store; since a config file may contain
- * multiple configurations, we are not returning a single object but immediately put
- * results into the bhyve_configuration_store bcs
+ * parses a config file into a list of configurations; since a config file
+ * may contain multiple configurations, results are put into configs
+ * instead of being returned as a single object
  *
  * returns 0 on success.
  */
 int
-bcs_parseucl(struct bhyve_configuration_store *bcs, const char *configfile)
+bcs_parseucl_list(struct bhyve_configuration_list *configs,
+		  const char *configfile)
 {
 	struct ucl_parser *uclp = 0;
 	ucl_object_t *root = 0;
-	const ucl_object_t *obj = NULL;
-	ucl_object_iter_t it = NULL, it_obj = NULL;
-	const ucl_object_t *cur, *tmp;
+	const ucl_object_t *cur;
+	ucl_object_iter_t it = NULL;
 	const char *configname = NULL;
 	struct bhyve_configuration *bc;
-	size_t pathlen = strlen(configfile);
 
-	syslog(LOG_INFO, "Parsing UCL config file \"%s\"", configfile);
+	dlog(LOG_DEBUG, "Parsing UCL config file \"%s\"", configfile);
 
 	uclp = ucl_parser_new(UCL_PARSER_KEY_LOWERCASE);
 	if (!uclp) {
-		syslog(LOG_ERR, "Failed to construct UCL parser");
+		dlog(LOG_ERR, "Failed to construct UCL parser");
 		return -1;
 	}
 
 	if (!ucl_parser_add_file(uclp, configfile)) {
 		if (ucl_parser_get_error(uclp)) {
-			syslog(LOG_ERR, "%s",
-			       ucl_parser_get_error(uclp));
+			dlog(LOG_ERR, "%s", ucl_parser_get_error(uclp));
 		}
-		syslog(LOG_ERR, "Failed to parse \"%s\"", configfile);
+		dlog(LOG_ERR, "Failed to parse \"%s\"", configfile);
+		ucl_parser_free(uclp);
 		return -1;
 	}
 
 	root = ucl_parser_get_object(uclp);
 	do {
 		if (!root) {
-			syslog(LOG_WARNING, "No config node found in \"%s\"", configfile);
+			dlog(LOG_WARNING, "No config node found in \"%s\"",
+			     configfile);
 			break;
 		}
 
@@ -612,36 +1028,37 @@ bcs_parseucl(struct bhyve_configuration_store *bcs, const char *configfile)
 			configname = ucl_object_key(cur);
 						
 			/* handle parsing the contents of the object within bc */
-			bc = malloc(sizeof(struct bhyve_configuration));
-			if (!bc)
+			if (!(bc = bc_alloc()))
 				break;
 			
-			bzero(bc, sizeof(struct bhyve_configuration));
-			
 			/* put configname into name as default */
-			strncpy(bc->name, configname, sizeof(bc->name));
+			if (!(bc->name = strdup(configname))) {
+				bc_free(bc);
+				break;
+			}
 			
 			if (bc_parsefromucl(bc, cur)) {
-				syslog(LOG_WARNING, "Failed to parse \"%s\"", configfile);
+				dlog(LOG_WARNING, "Failed to parse \"%s\"",
+				     configfile);
+				bc_free(bc);
 				break;
 			}
 
 			/* remember file name */
 			bc->backing_filepath = strdup(configfile);
-			if (!bc->backing_filepath) {
+			if (!bc->backing_filepath || bc_internstrings(bc)) {
 				bc_free(bc);
 				break;
 			}
 			
-			LIST_INSERT_HEAD(&bcs->configs, bc, entries);
+			LIST_INSERT_HEAD(configs, bc, entries);
 		}
 	} while (0);
 
-	syslog(LOG_INFO, "Parsing completed for \"%s\"", configfile);
+	dlog(LOG_DEBUG, "Parsing completed for \"%s\"", configfile);
 
 	if (ucl_parser_get_error(uclp)) {
-		syslog(LOG_ERR, "%s",
-		       ucl_parser_get_error(uclp));
+		dlog(LOG_ERR, "%s", ucl_parser_get_error(uclp));
 	}
 
 	ucl_parser_free(uclp);
@@ -651,37 +1068,410 @@ bcs_parseucl(struct bhyve_configuration_store *bcs, const char *configfile)
 }
 
 /*
- * internal method doing the actual walking of the directory
+ * parses a config file into the configuration store
+ *
+ * returns 0 on success.
  */
 int
-bcs_parseconfdir(struct bhyve_configuration_store *bcs, const char *path)
+bcs_parseucl(struct bhyve_configuration_store *bcs, const char *configfile)
+{
+	if (!bcs || !configfile)
+		return -1;
+
+	return bcs_parseucl_list(&bcs->configs, configfile);
+}
+
+/*
+ * take the configurations of a config file from its cache entry
+ *
+ * returns 0 on success.
+ */
+int
+bcs_fromcache(struct bhyve_configuration_list *configs, const nvlist_t *entry,
+	      const char *configfile)
 {
-	char *configpath = 0;
-	const char *configname = "config";
-	size_t pathlen = 0, configlen = 0;
+	const nvlist_t * const *cached = NULL;
+	struct bhyve_configuration *bc = NULL;
+	size_t count = 0;
+
+	if (!nvlist_exists_nvlist_array(entry, "configs"))
+		return 0;
+
+	cached = nvlist_get_nvlist_array(entry, "configs", &count);
+
+	/* entries are stored in list order, insert them backwards */
+	while (count--) {
+		if (!(bc = bc_fromcache(cached[count], configfile))) {
+			while ((bc = LIST_FIRST(configs))) {
+				LIST_REMOVE(bc, entries);
+				bc_free(bc);
+			}
+			return -1;
+		}
+		LIST_INSERT_HEAD(configs, bc, entries);
+	}
+
+	return 0;
+}
+
+/*
+ * load the config file of a vm directory, from the cache if it did not
+ * change or by parsing it otherwise; configpath is scratch space of
+ * PATH_MAX bytes kept by the calling thread
+ *
+ * returns 0 on success.
+ */
+int
+bcs_parseconfdir(struct bhyve_configuration_walker *bcw,
+		 struct bhyve_configuration_dir *bcd, char *configpath)
+{
+	const nvlist_t *entry = NULL;
+
+	if (!bcw || !bcd || !configpath)
+		return -1;
+
+	if (snprintf(configpath, PATH_MAX, "%s/config", bcd->path) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	dlog(LOG_DEBUG, "Checking for config at \"%s\"", configpath);
+
+	if (bcw->cfc) {
+		if (stat(configpath, &bcd->st) < 0)
+			return -1;
+
+		entry = cfc_lookup(bcw->cfc, configpath, &bcd->st, &bcd->hash,
+				   &bcd->stale);
+		if (entry && !bcs_fromcache(&bcd->configs, entry, configpath)) {
+			bcd->cached = true;
+			return 0;
+		}
+		bcd->stale = false;
+	}
+
+	return bcs_parseucl_list(&bcd->configs, configpath);
+}
+
+/*
+ * sort configuration directories by name
+ */
+int
+bcs_cmpdirs(const void *a, const void *b)
+{
+	const struct bhyve_configuration_dir *da = a;
+	const struct bhyve_configuration_dir *db = b;
+
+	return strcmp(da->path, db->path);
+}
+
+/*
+ * collect the vm directories below the search path, sorted by name
+ *
+ * returns 0 on success.
+ */
+int
+bcs_collectdirs(struct bhyve_configuration_store *bcs,
+		struct bhyve_configuration_walker *bcw)
+{
+	struct bhyve_configuration_dir *dirs = NULL;
+	struct dirent *de = NULL;
+	size_t maxbuf = 0, capacity = 0;
+	DIR *d = NULL;
 	int result = 0;
 
-	if (!bcs || !path)
+	if (!(d = opendir(bcs->searchpath)))
+		return -1;
+
+	while ((de = readdir(d))) {
+		/* if directory or dot file, skip */
+		if ('.' == *de->d_name)
+			continue;
+
+		if (!(DT_DIR & de->d_type))
+			continue;
+
+		if (bcw->count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			dirs = reallocarray(bcw->dirs, capacity,
+					    sizeof(struct bhyve_configuration_dir));
+			if (!dirs) {
+				result = -1;
+				break;
+			}
+			bcw->dirs = dirs;
+		}
+
+		/* construct sub path */
+		maxbuf = strlen(bcs->searchpath) + strlen(de->d_name) + 2;
+		bcw->dirs[bcw->count].path = malloc(maxbuf);
+		if (!bcw->dirs[bcw->count].path) {
+			result = -1;
+			break;
+		}
+		snprintf(bcw->dirs[bcw->count].path, maxbuf, "%s/%s",
+			 bcs->searchpath, de->d_name);
+		LIST_INIT(&bcw->dirs[bcw->count].configs);
+		bcw->dirs[bcw->count].found = false;
+		bcw->dirs[bcw->count].cached = false;
+		bcw->dirs[bcw->count].stale = false;
+		bcw->count++;
+	}
+
+	if (result) {
+		dlog(LOG_ERR, "Memory allocation error");
+		closedir(d);
+		errno = ENOMEM;
 		return -1;
+	}
+
+	if (bcw->count)
+		qsort(bcw->dirs, bcw->count,
+		      sizeof(struct bhyve_configuration_dir), bcs_cmpdirs);
 
-	pathlen = strlen(path);
-	configlen = strlen(configname) + pathlen + 2;
-	configpath = malloc(configlen);
-	if (!configpath)
+	/* closedir sets errno on failure */
+	if (closedir(d))
 		return -1;
 
-	snprintf(configpath, configlen, "%s/%s", path, configname);
-	syslog(LOG_INFO, "Checking for config at \"%s\"", configpath);
+	return 0;
+}
+
+/*
+ * parse configuration directories until none is left; runs on every
+ * thread of the walker, including the one calling bcs_walkdir
+ */
+void *
+bcs_parsethread(void *arg)
+{
+	struct bhyve_configuration_walker *bcw = arg;
+	struct bhyve_configuration_dir *bcd = NULL;
+	/* reused for every directory parsed by this thread */
+	char configpath[PATH_MAX];
 
-	result = bcs_parseucl(bcs, configpath);
+	while (1) {
+		pthread_mutex_lock(&bcw->mtx);
+		bcd = (bcw->next < bcw->count) ? &bcw->dirs[bcw->next++] : NULL;
+		pthread_mutex_unlock(&bcw->mtx);
 
-	free(configpath);	    
-	
-	return result;
+		if (!bcd)
+			break;
+
+		dlog(LOG_DEBUG, "Looking for config in \"%s\"", bcd->path);
+		bcd->found = !bcs_parseconfdir(bcw, bcd, configpath);
+	}
+
+	return NULL;
+}
+
+/*
+ * move parsed configurations into the store; the result matches parsing
+ * the directories one after another in name order, independent of the
+ * thread that parsed them
+ */
+bool
+bcs_mergedirs(struct bhyve_configuration_store *bcs,
+	      struct bhyve_configuration_walker *bcw)
+{
+	struct bhyve_configuration *bc = NULL, *prev = NULL;
+	bool found_one = false;
+	size_t idx = 0;
+
+	for (idx = 0; idx < bcw->count; idx++) {
+		if (!bcw->dirs[idx].found) {
+			dlog(LOG_INFO, "No configuration found in \"%s\" - "
+			     "ignoring", bcw->dirs[idx].path);
+			continue;
+		}
+		found_one = true;
+
+		/* later directories go in front, keeping their own order */
+		prev = NULL;
+		while ((bc = LIST_FIRST(&bcw->dirs[idx].configs))) {
+			LIST_REMOVE(bc, entries);
+			if (prev)
+				LIST_INSERT_AFTER(prev, bc, entries);
+			else
+				LIST_INSERT_HEAD(&bcs->configs, bc, entries);
+			prev = bc;
+		}
+	}
+
+	return found_one;
 }
 
 /*
- * collect configuration files from config directory
+ * rewrite the config cache unless it already matches the config files
+ * of this walk; must be called before the directories are merged
+ *
+ * returns 0 on success.
+ */
+int
+bcs_updatecache(struct bhyve_configuration_store *bcs,
+		struct bhyve_configuration_walker *bcw)
+{
+	struct bhyve_configuration_dir *bcd = NULL;
+	struct bhyve_configuration *bc = NULL;
+	nvlist_t **entries = NULL, **configs = NULL;
+	char configpath[PATH_MAX] = {0};
+	size_t found = 0, count = 0, idx = 0, cfgcount = 0, cfgidx = 0;
+	bool changed = false;
+	int result = 0;
+
+	for (idx = 0; idx < bcw->count; idx++) {
+		bcd = &bcw->dirs[idx];
+		if (!bcd->found)
+			continue;
+
+		found++;
+		if (!bcd->cached || bcd->stale)
+			changed = true;
+	}
+
+	/* every config file was found in the cache and none went away */
+	if (!changed && (found == cfc_get_count(bcw->cfc)))
+		return 0;
+
+	if (found && !(entries = calloc(found, sizeof(nvlist_t *))))
+		return -1;
+
+	for (idx = 0; idx < bcw->count; idx++) {
+		bcd = &bcw->dirs[idx];
+		if (!bcd->found)
+			continue;
+
+		snprintf(configpath, sizeof(configpath), "%s/config", bcd->path);
+		if (!(entries[count] = cfc_newentry(configpath, &bcd->st,
+						    bcd->hash))) {
+			result = -1;
+			break;
+		}
+		count++;
+
+		cfgcount = 0;
+		LIST_FOREACH(bc, &bcd->configs, entries) {
+			cfgcount++;
+		}
+		if (!cfgcount)
+			continue;
+
+		if (!(configs = calloc(cfgcount, sizeof(nvlist_t *)))) {
+			result = -1;
+			break;
+		}
+
+		cfgidx = 0;
+		LIST_FOREACH(bc, &bcd->configs, entries) {
+			if (!(configs[cfgidx] = bc_tocache(bc)))
+				break;
+			cfgidx++;
+		}
+		if (cfgidx < cfgcount) {
+			while (cfgidx--)
+				nvlist_destroy(configs[cfgidx]);
+			free(configs);
+			result = -1;
+			break;
+		}
+
+		nvlist_move_nvlist_array(entries[count - 1], "configs", configs,
+					 cfgcount);
+		if (nvlist_error(entries[count - 1])) {
+			result = -1;
+			break;
+		}
+	}
+
+	if (result) {
+		while (count--)
+			nvlist_destroy(entries[count]);
+		free(entries);
+		return -1;
+	}
+
+	dlog(LOG_DEBUG, "Writing %zu config files to cache \"%s\"", count,
+	     bcs->cachefile);
+
+	return cfc_write(bcs->cachefile, bcs->searchpath, bc_cacheschema(),
+			 entries, count);
+}
+
+/*
+ * keep parsed configurations in cachefile to speed up later walks; NULL
+ * parses all config files on every walk
+ *
+ * returns 0 on success.
+ */
+int
+bcs_set_cachefile(struct bhyve_configuration_store *bcs, const char *cachefile)
+{
+	char *copy = NULL;
+
+	if (!bcs) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (cachefile && !(copy = strdup(cachefile)))
+		return -1;
+
+	free(bcs->cachefile);
+	bcs->cachefile = copy;
+
+	return 0;
+}
+
+/*
+ * get the number of config files the last walk took from the cache and
+ * the number it had to parse
+ */
+void
+bcs_get_loadstats(const struct bhyve_configuration_store *bcs, size_t *cached,
+		  size_t *parsed)
+{
+	if (cached)
+		*cached = bcs ? bcs->cached : 0;
+	if (parsed)
+		*parsed = bcs ? bcs->parsed : 0;
+}
+
+/*
+ * get the number of configurations in the store and the bytes they
+ * allocate
+ */
+void
+bcs_get_memusage(const struct bhyve_configuration_store *bcs, size_t *count,
+		 size_t *bytes)
+{
+	const struct bhyve_configuration *bc = NULL;
+	size_t configs = 0, total = 0;
+
+	if (bcs) {
+		LIST_FOREACH(bc, &bcs->configs, entries) {
+			configs++;
+			total += bc_get_memusage(bc);
+		}
+	}
+
+	if (count)
+		*count = configs;
+	if (bytes)
+		*bytes = total;
+}
+
+/*
+ * set the number of threads parsing configuration directories, 0 to use
+ * one per cpu
+ */
+void
+bcs_set_threads(struct bhyve_configuration_store *bcs, uint32_t threads)
+{
+	if (bcs)
+		bcs->threads = threads;
+}
+
+/*
+ * collect configuration files from config directory; the vm directories
+ * are parsed in parallel, unchanged config files are taken from the
+ * cache if there is one
  *
  * returns 0 on success.
  */
@@ -691,69 +1481,88 @@ bcs_walkdir(struct bhyve_configuration_store *bcs)
 	if (!bcs)
 		return -1;
 
-	DIR *d = NULL;
-	struct dirent *de = NULL;
-	char *subpath = NULL;
-	size_t pathlen = strlen(bcs->searchpath);
-	size_t maxbuf = 0;
+	struct bhyve_configuration_walker bcw = { .dirs = NULL };
+	struct bhyve_configuration *bc = NULL;
+	pthread_t threads[BCS_THREADS_MAX];
+	uint32_t nthreads = bcs->threads, started = 0;
+	size_t idx = 0;
+	long cpus = 0;
 	int result = 0;
-	bool found_one = false;
 
-	syslog(LOG_INFO, "Checking configuration dir \"%s\" for config files",
-	       bcs->searchpath);
+	dlog(LOG_INFO, "Checking configuration dir \"%s\" for config files",
+	     bcs->searchpath);
+
+	if (bcs_collectdirs(bcs, &bcw)) {
+		if (errno != ENOMEM) {
+			/* we failed to access the directory */
+			dlog(LOG_ERR, "Configuration directory \"%s\" could "
+			     "not be accessed", bcs->searchpath);
+		}
+		result = -1;
+	}
 
-	if (NULL != (d = opendir(bcs->searchpath))) {
-		while (1) {
-			/* failed to open directory */
-			de = readdir(d);
-			if (!de)
+	if (!result && bcs->cachefile &&
+	    !(bcw.cfc = cfc_new(bcs->cachefile, bcs->searchpath,
+				bc_cacheschema())))
+		dlog(LOG_WARNING, "Failed to open config cache \"%s\"",
+		     bcs->cachefile);
+
+	if (!result) {
+		if (!nthreads) {
+			cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			nthreads = (cpus > 0) ? cpus : 1;
+		}
+		if (nthreads > BCS_THREADS_MAX)
+			nthreads = BCS_THREADS_MAX;
+		if (nthreads > bcw.count)
+			nthreads = bcw.count ? bcw.count : 1;
+
+		pthread_mutex_init(&bcw.mtx, NULL);
+
+		/* the calling thread does its share of parsing */
+		for (started = 0; started < nthreads - 1; started++)
+			if (pthread_create(&threads[started], NULL,
+					   bcs_parsethread, &bcw))
 				break;
-			
-			/* if directory or dot file, skip */
-			if ('.' == *de->d_name)
-				continue;
-			
-			if (DT_DIR & de->d_type) {
-				/* construct sub path */
-				free(subpath);
-				maxbuf = pathlen + strlen(de->d_name) + 2;
-				subpath = malloc(maxbuf);
-				if (!subpath) {
-					result = -1;
-					syslog(LOG_ERR, "Memory allocation error");
-					break;
-				}
-				snprintf(subpath, maxbuf, "%s/%s", bcs->searchpath, de->d_name);
-				syslog(LOG_INFO, "Looking for config in \"%s\"",
-				       subpath);
-				if (!bcs_parseconfdir(bcs, subpath)) {
-					found_one = true;
-				} else {
-					syslog(LOG_INFO,
-					       "No configuration found in \"%s/%s\" - ignoring",
-					       bcs->searchpath,
-					       de->d_name);
-				}
-			}
+		bcs_parsethread(&bcw);
+		while (started--)
+			pthread_join(threads[started], NULL);
+
+		pthread_mutex_destroy(&bcw.mtx);
+
+		bcs->cached = 0;
+		bcs->parsed = 0;
+		for (idx = 0; idx < bcw.count; idx++) {
+			if (bcw.dirs[idx].cached)
+				bcs->cached++;
+			else if (bcw.dirs[idx].found)
+				bcs->parsed++;
 		}
-	} 
-	free(subpath);
+		dlog(LOG_INFO, "Loaded %zu config files from cache, parsed %zu",
+		     bcs->cached, bcs->parsed);
 
-	if (found_one)
-		result = 0;
-	else {
-		errno = ENOENT;
-		result = -1;
+		if (bcw.cfc && bcs_updatecache(bcs, &bcw))
+			dlog(LOG_WARNING, "Failed to update config cache "
+			     "\"%s\"", bcs->cachefile);
+
+		if (!bcs_mergedirs(bcs, &bcw)) {
+			errno = ENOENT;
+			result = -1;
+		}
 	}
 
-	if (!d) {
-		/* we failed to access the directory */
-		syslog(LOG_ERR, "Configuration directory \"%s\" could not be "
-		       "accessed", bcs->searchpath);
-		result = -1;
+	for (idx = 0; idx < bcw.count; idx++) {
+		/* only set if the directory could not be merged */
+		while ((bc = LIST_FIRST(&bcw.dirs[idx].configs))) {
+			LIST_REMOVE(bc, entries);
+			bc_free(bc);
+		}
+		free(bcw.dirs[idx].path);
 	}
+	free(bcw.dirs);
+	cfc_free(bcw.cfc);
 
-	return (d ? closedir(d) : 0) || result;
+	return result;
 }
 
 /*
@@ -773,13 +1582,38 @@ bcs_free(struct bhyve_configuration_store *bcs)
 		bc_free(bc);
 	}
 
+	free(bcs->cachefile);
 	free(bcs);
 }
 
+/*
+ * get vm name
+ */
+const char *
+bc_get_name(const struct bhyve_configuration *bc)
+{
+	return bc->name ? bc->name : "";
+}
+
+/*
+ * get path to the bhyve config file, empty if none is set
+ */
+const char *
+bc_get_configfile(const struct bhyve_configuration *bc)
+{
+	return bc->configfile ? bc->configfile : "";
+}
+
+/*
+ * get path to the hook scripts, empty if none is set
+ */
+const char *
+bc_get_scriptpath(const struct bhyve_configuration *bc)
+{
+	return bc->scriptpath ? bc->scriptpath : "";
+}
+
 /* generate getter functions */
-CREATE_GETTERFUNC_STR(bhyve_configuration, bc, name);
-CREATE_GETTERFUNC_STR(bhyve_configuration, bc, configfile);
-CREATE_GETTERFUNC_STR(bhyve_configuration, bc, scriptpath);
 CREATE_GETTERFUNC_STR(bhyve_configuration, bc, os);
 CREATE_GETTERFUNC_STR(bhyve_configuration, bc, osversion);
 CREATE_GETTERFUNC_STR(bhyve_configuration, bc, owner);
@@ -788,6 +1622,10 @@ CREATE_GETTERFUNC_STR(bhyve_configuration, bc, description);
 CREATE_GETTERFUNC_STR(bhyve_configuration, bc, bootrom);
 CREATE_GETTERFUNC_STR(bhyve_configuration, bc, generated_config);
 CREATE_GETTERFUNC_STR(bhyve_configuration, bc, hostbridge);
+CREATE_GETTERFUNC_UINT32(bhyve_configuration, bc, stoptimeout);
+CREATE_GETTERFUNC_UINT32(bhyve_configuration, bc, scripttimeout);
+CREATE_GETTERFUNC_UINT32(bhyve_configuration, bc, restartdelay);
+CREATE_GETTERFUNC_UINT32(bhyve_configuration, bc, priority);
 
 /*
  * get number of consoles
@@ -807,6 +1645,15 @@ bc_get_consolelist(const struct bhyve_configuration *bc)
 	return bc->consoles;
 }
 
+/*
+ * get order of hook stages
+ */
+const struct bhyve_configuration_hooks *
+bc_get_hooks(const struct bhyve_configuration *bc)
+{
+	return bc->hooks;
+}
+
 /*
  * get maximum restart count before failure state is assumed
  * when it happens within maxrestarttime seconds
@@ -883,13 +1730,17 @@ bc_set_generated_config(struct bhyve_configuration *bc,
 		return -1;
 	}
 
+	/* the previous path stays in the string pool until bc_free */
 	if (!generated_config) {
-		free(bc->generated_config);
 		bc->generated_config = NULL;
 		return 0;
 	}
 
-	if (!(bc->generated_config = strdup(generated_config)))
+	if (!bc->strings && !(bc->strings = spl_new(bc->arena)))
+		return -1;
+
+	if (!(bc->generated_config =
+	      (char *) spl_intern(bc->strings, generated_config)))
 		return -1;
 	
 	return 0;
@@ -36,6 +36,7 @@
 struct bhyve_configuration;
 struct bhyve_configuration_store;
 struct bhyve_configuration_iterator;
+struct bhyve_configuration_hooks;
 
 int bc_tonvlist(struct bhyve_configuration *bc, nvlist_t *nvl);
 int bc_fromnvlist(struct bhyve_configuration *bc, nvlist_t *nvl);
@@ -58,6 +59,10 @@ int         bc_set_generated_config(struct bhyve_configuration *bc,
 const char *bc_get_generated_config(const struct bhyve_configuration *);
 uint32_t    bc_get_maxrestart(const struct bhyve_configuration *bc);
 time_t      bc_get_maxrestarttime(const struct bhyve_configuration *bc);
+uint32_t    bc_get_stoptimeout(const struct bhyve_configuration *bc);
+uint32_t    bc_get_scripttimeout(const struct bhyve_configuration *bc);
+uint32_t    bc_get_restartdelay(const struct bhyve_configuration *bc);
+uint32_t    bc_get_priority(const struct bhyve_configuration *bc);
 size_t      bc_get_consolecount(const struct bhyve_configuration *bc);
 uint32_t    bc_get_memory(const struct bhyve_configuration *bc);
 int         bc_set_numcpus(const struct bhyve_configuration *bc, uint16_t numcpus);
@@ -69,12 +74,16 @@ uint16_t    bc_get_cores(const struct bhyve_configuration *bc);
 bool        bc_get_autostart(const struct bhyve_configuration *bc);
 const struct bhyve_configuration_console_list *
             bc_get_consolelist(const struct bhyve_configuration *bc);
+const struct bhyve_configuration_hooks *
+            bc_get_hooks(const struct bhyve_configuration *bc);
 bool
 bc_get_vmexithlt(const struct bhyve_configuration *bc);
 bool
 bc_get_wired(const struct bhyve_configuration *bc);
 bool
 bc_get_generateacpi(const struct bhyve_configuration *bc);
+size_t      bc_get_memusage(const struct bhyve_configuration *bc);
+int bc_hash(const struct bhyve_configuration *bc, uint64_t *hash);
 
 struct bhyve_configuration_store *bcs_new(const char *searchpath);
 void bcs_free(struct bhyve_configuration_store *bcs);
@@ -82,6 +91,13 @@ int bcs_parseucl(struct bhyve_configuration_store *bcs, const char *configfile);
 struct bhyve_configuration *bcs_getconfig_byname(struct bhyve_configuration_store *bcs,
 						 const char *name);
 int bcs_walkdir(struct bhyve_configuration_store *bcs);
+void bcs_set_threads(struct bhyve_configuration_store *bcs, uint32_t threads);
+int bcs_set_cachefile(struct bhyve_configuration_store *bcs,
+		      const char *cachefile);
+void bcs_get_loadstats(const struct bhyve_configuration_store *bcs,
+		       size_t *cached, size_t *parsed);
+void bcs_get_memusage(const struct bhyve_configuration_store *bcs,
+		      size_t *count, size_t *bytes);
 
 struct bhyve_configuration_iterator *bcs_iterate_configs(struct bhyve_configuration_store *bcs);
 const struct bhyve_configuration *bci_getconfig(struct bhyve_configuration_iterator *bci);
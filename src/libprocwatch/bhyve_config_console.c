@@ -25,6 +25,7 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/nv.h>
 #include <sys/queue.h>
 
 #include <errno.h>
@@ -36,8 +37,10 @@
 #include <unistd.h>
 
 #include "bhyve_config_console.h"
+#include "../libcommand/bhyve_command.h"
 #include "../libcommand/nvlist_mapping.h"
 #include "../libutils/bhyve_utils.h"
+#include "../libutils/memory_arena.h"
 
 /*
  * represents a console configuration
@@ -51,9 +54,11 @@ struct bhyve_configuration_console {
 };
 
 /*
- * represents a list of consoles
+ * represents a list of consoles; the list, its consoles and their
+ * strings are allocated from the arena of the owning configuration
  */
 struct bhyve_configuration_console_list {
+	struct memory_arena *arena;
 	/* list of console entries */
 	LIST_HEAD(,bhyve_configuration_console) consoles;
 };
@@ -79,6 +84,10 @@ struct nvlistitem_mapping bc_console2config[] = {
 	}
 };
 
+/* hashed lookup of bc_console2config entries */
+struct parser_mapping_index bc_console2config_index =
+	PARSER_MAPPING_INDEX(bc_console2config);
+
 /*
  * get number of mappings
  */
@@ -98,74 +107,93 @@ bcc_get_mapping()
 }
 
 /*
- * construct a new, uninitialized console
+ * get index for looking up mappings by name
  */
-struct bhyve_configuration_console *
-bcc_new_empty()
+struct parser_mapping_index *
+bcc_get_mapping_index()
 {
-	struct bhyve_configuration_console *bcc = 0;
-
-	if (!(bcc = malloc(sizeof(struct bhyve_configuration_console))))
-		return NULL;
-
-	bzero(bcc, sizeof(struct bhyve_configuration_console));
-
-	return bcc;
+	return &bc_console2config_index;
 }
 
 /*
- * construct a new console
+ * construct a new console without a name in the arena of a list; it
+ * is not part of the list until it is added
  */
 struct bhyve_configuration_console *
-bcc_new(const char *name, bool enabled)
+bccl_newconsole(struct bhyve_configuration_console_list *bccl, bool enabled)
 {
 	struct bhyve_configuration_console *bcc = 0;
 
-	if (!name) {
+	if (!bccl) {
 		errno = EINVAL;
 		return NULL;
 	}
-	
-	if (!(bcc = malloc(sizeof(struct bhyve_configuration_console))))
-		return NULL;
 
-	bzero(bcc, sizeof(struct bhyve_configuration_console));
-	
-	if (!(bcc->name = strdup(name))) {
-		free(bcc);
+	if (!(bcc = ma_alloc(bccl->arena,
+			     sizeof(struct bhyve_configuration_console))))
 		return NULL;
-	}
 
 	bcc->enabled = enabled;
+
 	return bcc;
 }
 
 /*
- * release previously allocated console structure
+ * move the strings a decoder allocated for a console into the arena of
+ * a list; a console without a name is called defaultname
+ *
+ * returns 0 on success; the decoder's strings are released either way.
  */
-void
-bcc_free(struct bhyve_configuration_console *bcc)
+int
+bccl_adoptstrings(struct bhyve_configuration_console_list *bccl,
+		  struct bhyve_configuration_console *bcc,
+		  const char *defaultname)
 {
-	if (!bcc) {
+	char *name = NULL, *backend = NULL;
+	int result = 0;
+
+	if (!bccl || !bcc) {
 		errno = EINVAL;
-		return;
+		return -1;
 	}
 
+	if (bcc->name)
+		name = ma_strdup(bccl->arena, bcc->name);
+	else if (defaultname)
+		name = ma_strdup(bccl->arena, defaultname);
+
+	if (bcc->backend)
+		backend = ma_strdup(bccl->arena, bcc->backend);
+
+	if ((!name && (bcc->name || defaultname)) ||
+	    (!backend && bcc->backend))
+		result = -1;
+
 	free(bcc->name);
-	free(bcc);
+	free(bcc->backend);
+	bcc->name = name;
+	bcc->backend = backend;
+
+	return result;
 }
 
 /*
- * constructs a new bhyve console list
+ * constructs a new bhyve console list in an arena
  */
 struct bhyve_configuration_console_list *
-bccl_new()
+bccl_new(struct memory_arena *ma)
 {
 	struct bhyve_configuration_console_list *bccl = 0;
 
-	if (!(bccl = malloc(sizeof(struct bhyve_configuration_console_list))))
+	if (!ma) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(bccl = ma_alloc(ma, sizeof(struct bhyve_configuration_console_list))))
 		return NULL;
-	
+
+	bccl->arena = ma;
 	LIST_INIT(&bccl->consoles);
 
 	return bccl;
@@ -229,25 +257,96 @@ bccl_count(struct bhyve_configuration_console_list *bccl)
 }
 
 /*
- * release resources from a console list
+ * add the consoles of a list to nvl as nvlist array called name; an
+ * empty list adds nothing
+ *
+ * returns 0 on success.
  */
-void
-bccl_free(struct bhyve_configuration_console_list *bccl)
+int
+bccl_tonvlist(const struct bhyve_configuration_console_list *bccl,
+	      nvlist_t *nvl, const char *name)
 {
 	struct bhyve_configuration_console *bcc = 0;
+	nvlist_t **consoles = 0;
+	size_t count = 0, idx = 0;
 
-	if (!bccl) {
+	if (!bccl || !nvl || !name) {
 		errno = EINVAL;
-		return;
+		return -1;
 	}
 
-	while (!LIST_EMPTY(&bccl->consoles)) {
-		bcc = LIST_FIRST(&bccl->consoles);
-		LIST_REMOVE(bcc, entries);
-		bcc_free(bcc);
+	LIST_FOREACH(bcc, &bccl->consoles, entries) {
+		count++;
 	}
 
-	free(bccl);
+	if (!count)
+		return 0;
+
+	if (!(consoles = calloc(count, sizeof(nvlist_t *))))
+		return -1;
+
+	LIST_FOREACH(bcc, &bccl->consoles, entries) {
+		if (!(consoles[idx] = nvlist_create(0)) ||
+		    bcmd_encodenvlist(bc_console2config, bcc_get_mapping_count(),
+				      bcc, consoles[idx])) {
+			do {
+				nvlist_destroy(consoles[idx]);
+			} while (idx--);
+			free(consoles);
+			return -1;
+		}
+		idx++;
+	}
+
+	nvlist_move_nvlist_array(nvl, name, consoles, count);
+
+	return nvlist_error(nvl) ? -1 : 0;
+}
+
+/*
+ * construct a console list in an arena from the nvlist array called
+ * name; a missing array results in an empty list
+ *
+ * returns NULL on error.
+ */
+struct bhyve_configuration_console_list *
+bccl_fromnvlist(struct memory_arena *ma, const nvlist_t *nvl,
+		const char *name)
+{
+	const nvlist_t * const *consoles = 0;
+	struct bhyve_configuration_console_list *bccl = 0;
+	struct bhyve_configuration_console *bcc = 0;
+	size_t count = 0, idx = 0;
+	int result = 0;
+
+	if (!nvl || !name) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(bccl = bccl_new(ma)))
+		return NULL;
+
+	if (!nvlist_exists_nvlist_array(nvl, name))
+		return bccl;
+
+	consoles = nvlist_get_nvlist_array(nvl, name, &count);
+
+	/* bccl_add inserts at the head, so go backwards to keep the order */
+	for (idx = count; idx > 0; idx--) {
+		if (!(bcc = bccl_newconsole(bccl, false)))
+			return NULL;
+
+		result = bcmd_decodenvlist(bc_console2config,
+					   bcc_get_mapping_count(), bcc,
+					   (nvlist_t *)consoles[idx - 1]);
+		if (bccl_adoptstrings(bccl, bcc, NULL) || result)
+			return NULL;
+
+		bccl_add(bccl, bcc);
+	}
+
+	return bccl;
 }
 
 CREATE_GETTERFUNC_STR(bhyve_configuration_console, bcc, name);
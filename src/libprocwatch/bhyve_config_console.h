@@ -28,26 +28,35 @@
 #ifndef __BHYVE_CONFIG_CONSOLE_H__
 #define __BHYVE_CONFIG_CONSOLE_H__
 
+#include <sys/nv.h>
+
 #include "../libcommand/nvlist_mapping.h"
+#include "../libutils/memory_arena.h"
 
 struct bhyve_configuration_console;
 struct bhyve_configuration_console_list;
 
 size_t bcc_get_mapping_count();
 struct nvlistitem_mapping * bcc_get_mapping();
+struct parser_mapping_index *bcc_get_mapping_index();
 
-struct bhyve_configuration_console *bcc_new(const char *name, bool enabled);
-struct bhyve_configuration_console *bcc_new_empty();
-void bcc_free(struct bhyve_configuration_console *bcc);
-
-struct bhyve_configuration_console_list *bccl_new();
-void bccl_free(struct bhyve_configuration_console_list *bccl);
+struct bhyve_configuration_console_list *bccl_new(struct memory_arena *ma);
+struct bhyve_configuration_console *
+bccl_newconsole(struct bhyve_configuration_console_list *bccl, bool enabled);
+int bccl_adoptstrings(struct bhyve_configuration_console_list *bccl,
+		      struct bhyve_configuration_console *bcc,
+		      const char *defaultname);
 size_t bccl_count(struct bhyve_configuration_console_list *bccl);
 int
 bccl_add(struct bhyve_configuration_console_list *bccl,
 	 struct bhyve_configuration_console *bcc);
 const struct bhyve_configuration_console *
 bccl_get_consolebyidx(const struct bhyve_configuration_console_list *bccl, size_t idx);
+int bccl_tonvlist(const struct bhyve_configuration_console_list *bccl,
+		  nvlist_t *nvl, const char *name);
+struct bhyve_configuration_console_list *
+bccl_fromnvlist(struct memory_arena *ma, const nvlist_t *nvl,
+		const char *name);
 
 const char *bcc_get_name(const struct bhyve_configuration_console *);
 const char *bcc_get_backend(const struct bhyve_configuration_console *);
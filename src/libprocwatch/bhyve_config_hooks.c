@@ -0,0 +1,266 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/nv.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "bhyve_config_hooks.h"
+
+#define BCH_BIT(stage) (1U << (stage))
+
+/*
+ * static description of a hook stage
+ */
+struct bhyve_hookstage_def {
+	const char *name;
+	/* stages of one phase run as a group */
+	unsigned int phase;
+	/* stages a stage waits for unless configured otherwise */
+	uint32_t after;
+};
+
+struct bhyve_hookstage_def bch_stages[BCH_STAGECOUNT] = {
+	[BCH_START_NETWORK] = {
+		.name = "start_network",
+		.phase = 0,
+		.after = 0
+	},
+	[BCH_START_STORAGE] = {
+		.name = "start_storage",
+		.phase = 0,
+		.after = BCH_BIT(BCH_START_NETWORK)
+	},
+	[BCH_STOP_STORAGE] = {
+		.name = "stop_storage",
+		.phase = 1,
+		.after = 0
+	},
+	[BCH_STOP_NETWORK] = {
+		.name = "stop_network",
+		.phase = 1,
+		.after = BCH_BIT(BCH_STOP_STORAGE)
+	}
+};
+
+/*
+ * dependencies between hook stages of a vm
+ */
+struct bhyve_configuration_hooks {
+	/* bit mask of stages each stage waits for */
+	uint32_t after[BCH_STAGECOUNT];
+};
+
+/*
+ * construct a new hook configuration; stages run one after another
+ */
+struct bhyve_configuration_hooks *
+bch_new()
+{
+	struct bhyve_configuration_hooks *bch = 0;
+	size_t counter = 0;
+
+	if (!(bch = malloc(sizeof(struct bhyve_configuration_hooks))))
+		return NULL;
+
+	for (counter = 0; counter < BCH_STAGECOUNT; counter++)
+		bch->after[counter] = bch_stages[counter].after;
+
+	return bch;
+}
+
+/*
+ * free a hook configuration
+ */
+void
+bch_free(struct bhyve_configuration_hooks *bch)
+{
+	free(bch);
+}
+
+/*
+ * look up a stage by its name
+ *
+ * returns -1 if there is no such stage.
+ */
+int
+bch_lookupstage(const char *name)
+{
+	int counter = 0;
+
+	if (!name) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (counter = 0; counter < BCH_STAGECOUNT; counter++)
+		if (!strcmp(bch_stages[counter].name, name))
+			return counter;
+
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+ * get the name of a stage
+ */
+const char *
+bch_stagename(bhyve_hookstage_t stage)
+{
+	if (stage >= BCH_STAGECOUNT) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return bch_stages[stage].name;
+}
+
+/*
+ * let a stage run without waiting for other stages
+ */
+int
+bch_clear_after(struct bhyve_configuration_hooks *bch,
+		bhyve_hookstage_t stage)
+{
+	if (!bch || (stage >= BCH_STAGECOUNT)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	bch->after[stage] = 0;
+
+	return 0;
+}
+
+/*
+ * let a stage wait for another stage of the same phase
+ *
+ * fails with EDOM if after belongs to another phase or is not entered
+ * before stage.
+ */
+int
+bch_add_after(struct bhyve_configuration_hooks *bch,
+	      bhyve_hookstage_t stage, const char *after)
+{
+	int prior = 0;
+
+	if (!bch || (stage >= BCH_STAGECOUNT)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((prior = bch_lookupstage(after)) < 0) {
+		syslog(LOG_ERR, "Unknown hook stage \"%s\"", after);
+		return -1;
+	}
+
+	if ((bch_stages[prior].phase != bch_stages[stage].phase) ||
+	    (prior >= stage)) {
+		syslog(LOG_ERR, "Hook stage \"%s\" cannot run after \"%s\"",
+		       bch_stages[stage].name, after);
+		errno = EDOM;
+		return -1;
+	}
+
+	bch->after[stage] |= BCH_BIT(prior);
+
+	return 0;
+}
+
+/*
+ * get the stages a stage waits for as bit mask of stage numbers
+ *
+ * returns the default dependencies if bch is NULL.
+ */
+uint32_t
+bch_get_after(const struct bhyve_configuration_hooks *bch,
+	      bhyve_hookstage_t stage)
+{
+	if (stage >= BCH_STAGECOUNT) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (!bch)
+		return bch_stages[stage].after;
+
+	return bch->after[stage];
+}
+
+/*
+ * add the stage dependencies to nvl, one bit mask per stage name
+ *
+ * returns 0 on success.
+ */
+int
+bch_tonvlist(const struct bhyve_configuration_hooks *bch, nvlist_t *nvl)
+{
+	size_t counter = 0;
+
+	if (!bch || !nvl) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (counter = 0; counter < BCH_STAGECOUNT; counter++)
+		nvlist_add_number(nvl, bch_stages[counter].name,
+				  bch->after[counter]);
+
+	return nvlist_error(nvl) ? -1 : 0;
+}
+
+/*
+ * construct a hook configuration from an nvlist made by bch_tonvlist;
+ * stages missing in nvl keep their defaults
+ *
+ * returns NULL on error.
+ */
+struct bhyve_configuration_hooks *
+bch_fromnvlist(const nvlist_t *nvl)
+{
+	struct bhyve_configuration_hooks *bch = 0;
+	size_t counter = 0;
+
+	if (!nvl) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(bch = bch_new()))
+		return NULL;
+
+	for (counter = 0; counter < BCH_STAGECOUNT; counter++)
+		if (nvlist_exists_number(nvl, bch_stages[counter].name))
+			bch->after[counter] = nvlist_get_number(nvl,
+								bch_stages[counter].name);
+
+	return bch;
+}
@@ -0,0 +1,65 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __BHYVE_CONFIG_HOOKS_H__
+#define __BHYVE_CONFIG_HOOKS_H__
+
+#include <sys/nv.h>
+
+#include <stdint.h>
+
+/*
+ * hook stages preparing and releasing vm resources
+ *
+ * stages of the same phase may run in parallel unless one is declared
+ * to run after the other. Stages are listed in the order their states
+ * are entered, so a stage can only wait for earlier stages.
+ */
+typedef enum {
+	BCH_START_NETWORK = 0,
+	BCH_START_STORAGE,
+	BCH_STOP_STORAGE,
+	BCH_STOP_NETWORK,
+	BCH_STAGECOUNT
+} bhyve_hookstage_t;
+
+struct bhyve_configuration_hooks;
+
+struct bhyve_configuration_hooks *bch_new();
+void bch_free(struct bhyve_configuration_hooks *bch);
+int bch_lookupstage(const char *name);
+const char *bch_stagename(bhyve_hookstage_t stage);
+int bch_clear_after(struct bhyve_configuration_hooks *bch,
+		    bhyve_hookstage_t stage);
+int bch_add_after(struct bhyve_configuration_hooks *bch,
+		  bhyve_hookstage_t stage, const char *after);
+uint32_t bch_get_after(const struct bhyve_configuration_hooks *bch,
+		       bhyve_hookstage_t stage);
+int bch_tonvlist(const struct bhyve_configuration_hooks *bch, nvlist_t *nvl);
+struct bhyve_configuration_hooks *bch_fromnvlist(const nvlist_t *nvl);
+
+#endif /* __BHYVE_CONFIG_HOOKS_H__ */
@@ -27,6 +27,8 @@
 
 #include <sys/event.h>
 #include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -36,6 +38,9 @@
 #include <limits.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
@@ -49,24 +54,68 @@
 #include "bhyve_director.h"
 #include "bhyve_director_errors.h"
 #include "bhyve_messagesub_object.h"
+#include "config_cache.h"
 #include "config_generator_object.h"
+#include "hook_executor.h"
 #include "process_def.h"
 #include "process_state.h"
 #include "process_state_errors.h"
+#include "process_watcher_object.h"
 #include "reboot_manager_object.h"
 
 #include "../libcommand/bhyve_command.h"
 #include "../libcommand/vm_info.h"
 #include "../liblogging/log_director.h"
+#include "../libutils/daemon_log.h"
+#include "../libutils/timer_wheel.h"
+
+/* kqueue user event identifiers */
+#define BD_EVENT_SHUTDOWN	0
+#define BD_EVENT_TIMERWAKE	1
+#define BD_EVENT_HOOKEXIT	2
+
+/* resolution of director timers in milliseconds */
+#define BD_TIMER_TICK_MS	100
+
+/* seconds between re-checks while waiting for vms to stop */
+#define BD_SHUTDOWN_RECHECK	1
+/* seconds to wait for killed vms to be reaped after the shutdown deadline */
+#define BD_SHUTDOWN_KILLWAIT	5
+/* seconds vms not yet asked to stop get once an earlier wave used up the deadline */
+#define BD_SHUTDOWN_GRACE	5
+
+/* longest waitstate reply; leaves room for the result code prefix */
+#define BD_WAITSTATE_REPLYLEN	480
+
+/* most log output sent back for one query */
+#define BD_LOGS_MAX		(16 * 1024 * 1024)
+/* milliseconds between checks that a client following logs is still there */
+#define BD_LOGS_HEARTBEAT_MS	1000
 
 /* private API method */
 int psv_onexit(struct process_state_vm *psv, unsigned short exitcode);
+int psv_onsignal(struct process_state_vm *psv, int signal);
+int psv_onhookexit(struct process_state_vm *psv, pid_t pid, int status);
+void psv_onhookschanged(struct process_state_vm *psv);
 int bd_requestreboot(struct bhyve_director *bd, struct process_state_vm *psv);
+int bd_watchprocess(struct bhyve_director *bd, struct process_state_vm *psv,
+		    pid_t pid);
+int bd_watchfile(struct bhyve_director *bd, struct process_state_vm *psv,
+		 int fd);
+int bd_launchhook(struct bhyve_director *bd, struct process_state_vm *psv,
+		  const char *exepath, const char *from, const char *to,
+		  pid_t *pid);
 
 struct reboot_manager_funcs bhyve_director_rmo_funcs = {
 	.request_reboot = (void*) bd_requestreboot
 };
 
+struct process_watcher_funcs bhyve_director_pwo_funcs = {
+	.watch = (void*) bd_watchprocess,
+	.watchfile = (void*) bd_watchfile,
+	.launchhook = (void*) bd_launchhook
+};
+
 /*
  * registers startup attempt timestamps
  */
@@ -83,12 +132,71 @@ struct bhyve_watched_vm {
 	struct process_state_vm *state;
 	const struct bhyve_configuration *config;
 	struct log_director_redirector *ldr;
+
+	/* owning director */
+	struct bhyve_director *bd;
+	/* delays a requested restart */
+	struct timer_wheel_timer restart_timer;
+
+	/* fingerprint of the inputs of the generated config */
+	uint64_t generated_hash;
+	/* generated config as it was written */
+	struct stat generated_st;
+	/* generated_hash and generated_st are valid */
+	bool generated;
+	/* hash of the config template as it was when stat'ed */
+	uint64_t template_hash;
+	struct stat template_st;
+	bool template_hashed;
+	/* fingerprint of the inputs of the arguments set on the vm */
+	uint64_t args_hash;
+	/* args_hash is valid */
+	bool args;
 	
 	SLIST_ENTRY(bhyve_watched_vm) entries;
 	STAILQ_ENTRY(bhyve_watched_vm) reboot_entries;
 	STAILQ_HEAD(,bhyve_start_timestamp) startups;
 };
 
+/*
+ * progress of a fleet shutdown, protected by the director mutex
+ */
+struct bhyve_director_shutdown {
+	bool active;
+	size_t total;
+	size_t stopped;
+	size_t killed;
+	time_t deadline;
+};
+
+/*
+ * tracks a single vm during fleet shutdown
+ */
+struct bhyve_shutdown_entry {
+	struct bhyve_watched_vm *bwv;
+	bool signalled;
+	bool done;
+};
+
+/*
+ * a hook script launched by the hook executor
+ *
+ * its exit is kept until the vm that launched it watches it and
+ * the exit was delivered to the vm.
+ */
+struct bhyve_hook_exit {
+	pid_t pid;
+	int status;
+	/* exit notification received */
+	bool exited;
+	/* vm registered the script through bd_watchprocess */
+	bool watched;
+	/* exit reported to the vm */
+	bool delivered;
+
+	LIST_ENTRY(bhyve_hook_exit) entries;
+};
+
 /*
  * The bhyve_director provides a listening method that parses
  * incoming nvlist command data and converts it into actions.
@@ -103,20 +211,44 @@ struct bhyve_director {
 	pthread_mutex_t mtx;
 	pthread_cond_t cond_ready;
 	pthread_cond_t reboot_wakeup;
+	/* broadcast by the kqueue thread whenever a vm process exited */
+	pthread_cond_t cond_vmexit;
+	uint64_t vmexits;
 	pthread_t kqueue_thread;
 	pthread_t reboot_thread;
 	int reboot_state;
 
 	struct bhyve_configuration_store_obj *store_obj;
 	struct reboot_manager_object rmo;
+	struct process_watcher_object pwo;
 	struct log_director *ld;
 	struct config_generator_object *cgo;
+	/* pass generated configs as arguments, optionally writing the file */
+	bool config_args;
+	bool config_keepfile;
+	/* generated configs written and skipped as unchanged */
+	atomic_uint_least64_t configs_generated;
+	atomic_uint_least64_t configs_skipped;
+
+	/* timers serviced by the kqueue thread */
+	struct timer_wheel *tw;
+
+	/* launches hook scripts if set */
+	struct hook_executor *hke;
+	/* the hook executor terminated, scripts are launched directly */
+	atomic_bool hke_failed;
+	/* scripts launched by the hook executor */
+	LIST_HEAD(, bhyve_hook_exit) hookexits;
+
+	struct bhyve_director_shutdown shutdown;
 
 	SLIST_HEAD(, bhyve_watched_vm) statelist;
 	STAILQ_HEAD(, bhyve_watched_vm) rebootlist;
 };
 
 void bwv_free(struct bhyve_watched_vm *bwv);
+struct bhyve_watched_vm *
+bd_getvmbystate(struct bhyve_director *bd, struct process_state_vm *psv);
 
 /*
  * allocate a new watched structure
@@ -247,7 +379,103 @@ bwv_countrestarts_since(struct bhyve_watched_vm *bwv, time_t deadline)
 }
 
 /*
- * Generate a merged configuration, by using a generator if it is available.
+ * check whether two stats describe the same, unmodified file
+ */
+bool
+bwv_samefile(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+		a->st_size == b->st_size &&
+		a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+		a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+ * hash everything a generated config is made of: the vm configuration it
+ * is translated from and the config template; the template is only read
+ * again after it changed on disk
+ *
+ * returns 0 on success.
+ */
+int
+bwv_confighash(struct bhyve_watched_vm *bwv, uint64_t *hash)
+{
+	const char *template = bc_get_configfile(bwv->config);
+	struct stat st;
+
+	if (bc_hash(bwv->config, hash) || stat(template, &st) < 0)
+		return -1;
+
+	if (!bwv->template_hashed || !bwv_samefile(&st, &bwv->template_st)) {
+		bwv->template_hashed = false;
+		if (cfc_hashfile(template, &bwv->template_hash))
+			return -1;
+		bwv->template_st = st;
+		bwv->template_hashed = true;
+	}
+
+	*hash = cfc_hash(*hash, &bwv->template_hash,
+			 sizeof(bwv->template_hash));
+
+	return 0;
+}
+
+/*
+ * Generate a merged configuration into bhyve arguments kept by the vm's
+ * process definition, so starting it reads no generated file. The file
+ * is only written on request, for debugging. Generating is skipped
+ * while the vm configuration and the config template are unchanged.
+ */
+int
+bwv_generate_args(struct bhyve_watched_vm *bwv,
+		  struct config_generator_object *cgo)
+{
+	char generated_name[PATH_MAX] = {0};
+	char **args = NULL;
+	uint64_t hash = 0;
+	bool hashed = false;
+	int result = -1;
+
+	hashed = !bwv_confighash(bwv, &hash);
+
+	if (hashed && bwv->args && hash == bwv->args_hash) {
+		dlog(LOG_DEBUG, "Arguments for vm \"%s\" are unchanged",
+		     bc_get_name(bwv->config));
+		atomic_fetch_add(&bwv->bd->configs_skipped, 1);
+		return 0;
+	}
+
+	bwv->args = false;
+	dlog(LOG_DEBUG, "Generating arguments for vm \"%s\"",
+	     bc_get_name(bwv->config));
+
+	if (!(args = cgo->generate_config_args(bwv->config)))
+		return -1;
+
+	if (!(result = psv_set_args(bwv->state, (const char **) args))) {
+		atomic_fetch_add(&bwv->bd->configs_generated, 1);
+		bwv->args_hash = hash;
+		bwv->args = hashed;
+	}
+
+	free(args);
+
+	if (!result && bwv->bd->config_keepfile &&
+	    cgo->generate_config_file) {
+		snprintf(generated_name, PATH_MAX, "%s.generated",
+			 bc_get_configfile(bwv->config));
+		if (cgo->generate_config_file(bwv->config, generated_name))
+			dlog(LOG_WARNING, "Failed to write \"%s\"",
+			     generated_name);
+	}
+
+	return result;
+}
+
+/*
+ * Generate a merged configuration, by using a generator if it is
+ * available. Generating is skipped while the vm configuration, the
+ * config template and the generated file are unchanged.
  */
 int
 bwv_generate_config(struct bhyve_watched_vm *bwv,
@@ -261,16 +489,45 @@ bwv_generate_config(struct bhyve_watched_vm *bwv,
 	}
 
 	char generated_name[PATH_MAX] = {0};
+	struct stat st;
+	uint64_t hash = 0;
+	bool hashed = false;
+
+	if (bwv->bd && bwv->bd->config_args && cgo->generate_config_args)
+		return bwv_generate_args(bwv, cgo);
 
 	/* TODO use generated name from bhyve_config if set */
 
 	snprintf(generated_name, PATH_MAX, "%s.generated",
 		 bc_get_configfile(bwv->config));
-	syslog(LOG_INFO, "Generating configuration for vm \"%s\" in file " \
-	       "\"%s\"", bc_get_name(bwv->config), generated_name);
+
+	hashed = !bwv_confighash(bwv, &hash);
+
+	if (hashed && bwv->generated && hash == bwv->generated_hash &&
+	    !stat(generated_name, &st) &&
+	    bwv_samefile(&st, &bwv->generated_st)) {
+		dlog(LOG_DEBUG, "Configuration for vm \"%s\" is unchanged",
+		     bc_get_name(bwv->config));
+		if (bwv->bd)
+			atomic_fetch_add(&bwv->bd->configs_skipped, 1);
+		return psv_set_configfile(bwv->state, generated_name);
+	}
+
+	bwv->generated = false;
+	dlog(LOG_DEBUG, "Generating configuration for vm \"%s\" in file " \
+	     "\"%s\"", bc_get_name(bwv->config), generated_name);
 	
 	if (cgo->generate_config_file)
 		if (!cgo->generate_config_file(bwv->config, generated_name)) {
+			if (bwv->bd)
+				atomic_fetch_add(&bwv->bd->configs_generated, 1);
+
+			/* remember what the file was generated from */
+			if (hashed && !stat(generated_name, &bwv->generated_st)) {
+				bwv->generated_hash = hash;
+				bwv->generated = true;
+			}
+
 			return psv_set_configfile(bwv->state, generated_name);
 		}
 	
@@ -294,14 +551,14 @@ bwv_linkconsoles(struct bhyve_watched_vm *bwv, bool link)
 
 	bccl = bc_get_consolelist(bwv->config);
 
-	syslog(LOG_INFO, "%sinking %zu consoles", link ? "L" : "Unl", console_count);
+	dlog(LOG_DEBUG, "%sinking %zu consoles", link ? "L" : "Unl", console_count);
 
 	for (counter = 0; counter < console_count; counter++) {
 		bcc = bccl_get_consolebyidx(bccl, counter);
 		if (!bcc)
 			continue;
 
-		syslog(LOG_INFO, "%sinking console %zu", link? "L" : "Unl", counter);
+		dlog(LOG_DEBUG, "%sinking console %zu", link? "L" : "Unl", counter);
 		
 		if (link) {
 			strncpy(backend_name, bcc_get_backend(bcc), PATH_MAX);
@@ -315,7 +572,7 @@ bwv_linkconsoles(struct bhyve_watched_vm *bwv, bool link)
 				break;
 			}
 
-			syslog(LOG_INFO, "Backend path is %s", backend_name);
+			dlog(LOG_DEBUG, "Backend path is %s", backend_name);
 		}
 		
 		strncpy(link_path, bc_get_backingfile(bwv->config), PATH_MAX);
@@ -331,17 +588,17 @@ bwv_linkconsoles(struct bhyve_watched_vm *bwv, bool link)
 			/* first unlink before symlinking, in case an old
 			   link still is around */
 			unlink(link_path);
-			syslog(LOG_INFO, "Linking %s -> %s", link_path, backend_name);
+			dlog(LOG_DEBUG, "Linking %s -> %s", link_path, backend_name);
 			retcode = symlink(backend_name, link_path);
 		} else {
-			syslog(LOG_INFO, "Unlinking %s", link_path);
+			dlog(LOG_DEBUG, "Unlinking %s", link_path);
 			retcode = unlink(link_path);
 		}
 		if (retcode)
 			break;
 	}
 
-	syslog(LOG_INFO, "Console links %s", link ? "created" : "unlinked");
+	dlog(LOG_DEBUG, "Console links %s", link ? "created" : "unlinked");
 	
 	return retcode;
 }
@@ -388,42 +645,27 @@ bwv_free(struct bhyve_watched_vm *bwv)
 		STAILQ_REMOVE_HEAD(&bwv->startups, entries);
 		free(bst);
 	}
+
+	if (bwv->bd)
+		tw_cancel(bwv->bd->tw, &bwv->restart_timer);
 	
 	psv_free(bwv->state);
 	free(bwv);
 }
 
 /*
- * request a reboot for a vm from its process_state_vm structure
+ * hand a vm to the reboot thread
  */
 int
-bd_requestreboot(struct bhyve_director *bd, struct process_state_vm *psv)
+bd_queuereboot(struct bhyve_director *bd, struct bhyve_watched_vm *bwv)
 {
-	if (!bd || !psv) {
-		errno = EINVAL;
-		return -1;
-	}
-
-	struct bhyve_watched_vm *bwv = 0;
 	int result = 0;
 
-	/* look up bwv object matching psv */
 	if (pthread_mutex_lock(&bd->mtx)) {
 		errno = EDEADLK;
 		return -1;
 	}
 
-	SLIST_FOREACH(bwv, &bd->statelist, entries) {
-		if (bwv->state == psv)
-			break;
-	}
-
-	if (bwv->state != psv) {
-		errno = ENOENT;
-		pthread_mutex_unlock(&bd->mtx);
-		return -1;
-	}
-
 	/* add to reboot list */
 	STAILQ_INSERT_TAIL(&bd->rebootlist, bwv, reboot_entries);
 
@@ -444,18 +686,79 @@ bd_requestreboot(struct bhyve_director *bd, struct process_state_vm *psv)
 }
 
 /*
- * look up a vm by its name
- *
- * returns NULL if nothing matches.
+ * check whether the director is stopping its vms for good
  */
-struct bhyve_watched_vm *
-bd_getvmbyname(struct bhyve_director *bd, const char *name)
+bool
+bd_is_shuttingdown(struct bhyve_director *bd)
 {
-	if (!bd || !name) {
+	bool active = false;
+
+	if (pthread_mutex_lock(&bd->mtx))
+		return false;
+
+	active = bd->shutdown.active;
+
+	pthread_mutex_unlock(&bd->mtx);
+
+	return active;
+}
+
+/*
+ * called when the restart delay of a vm expired
+ */
+void
+bwv_restart_expired(void *ctx)
+{
+	struct bhyve_watched_vm *bwv = ctx;
+
+	if (bd_queuereboot(bwv->bd, bwv))
+		syslog(LOG_ERR, "Failed to queue restart of vm \"%s\"",
+		       bc_get_name(bwv->config));
+}
+
+/*
+ * request a reboot for a vm from its process_state_vm structure
+ */
+int
+bd_requestreboot(struct bhyve_director *bd, struct process_state_vm *psv)
+{
+	if (!bd || !psv) {
 		errno = EINVAL;
-		return NULL;
+		return -1;
+	}
+
+	uint32_t delay = 0;
+
+	/* look up bwv object matching psv */
+	struct bhyve_watched_vm *bwv = bd_getvmbystate(bd, psv);
+
+	if (!bwv)
+		return -1;
+
+	/* do not bring a vm back up while everything is shutting down */
+	if (bd_is_shuttingdown(bd)) {
+		syslog(LOG_INFO, "Not restarting vm \"%s\" during shutdown",
+		       bc_get_name(bwv->config));
+		return RMO_REBOOT_DECLINED;
+	}
+
+	if (0 != (delay = bc_get_restartdelay(bwv->config))) {
+		syslog(LOG_INFO, "Restarting vm \"%s\" in %u seconds",
+		       bc_get_name(bwv->config), delay);
+		return tw_arm(bd->tw, &bwv->restart_timer, (uint64_t) delay * 1000, 0);
 	}
 
+	return bd_queuereboot(bd, bwv);
+}
+
+/*
+ * look up a vm by its process state
+ *
+ * returns NULL if nothing matches.
+ */
+struct bhyve_watched_vm *
+bd_getvmbystate(struct bhyve_director *bd, struct process_state_vm *psv)
+{
 	struct bhyve_watched_vm *bwv = 0;
 
 	if (pthread_mutex_lock(&bd->mtx)) {
@@ -464,146 +767,532 @@ bd_getvmbyname(struct bhyve_director *bd, const char *name)
 	}
 
 	SLIST_FOREACH(bwv, &bd->statelist, entries) {
-		if (!strcmp(name, bc_get_name(bwv->config))) {
-			if (pthread_mutex_unlock(&bd->mtx)) {
-				err(EDEADLK, "failed to unlock mutex");
-			}
-			
-			return bwv;
-		}
+		if (bwv->state == psv)
+			break;
 	}
 
-	pthread_mutex_unlock(&bd->mtx);
-	
-	return NULL;
+	if (pthread_mutex_unlock(&bd->mtx)) {
+		errno = EDEADLK;
+		return NULL;
+	}
+
+	if (!bwv)
+		errno = ENOENT;
+
+	return bwv;
 }
 
 /*
- * initiates a startup for all virtual machines that have autostart set
+ * register a child process of a vm with the kqueue
+ *
+ * the exit is reported to the vm as a hook exit if pid is its running
+ * hook script, otherwise as an exit of the vm process.
  */
 int
-bd_runautostart(struct bhyve_director *bd)
+bd_watchprocess(struct bhyve_director *bd, struct process_state_vm *psv,
+		pid_t pid)
 {
-	if (!bd) {
+	if (!bd || !psv) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	struct bhyve_watched_vm *bwv = 0, *bwv_temp = 0;
+	struct bhyve_watched_vm *bwv = bd_getvmbystate(bd, psv);
+	struct bhyve_hook_exit *bhe = 0;
+	struct kevent event = {0};
+
+	if (!bwv)
+		return -1;
 
+	/* scripts of the hook executor are reported by the executor */
 	if (pthread_mutex_lock(&bd->mtx)) {
+		errno = EDEADLK;
 		return -1;
 	}
 
-	SLIST_FOREACH_SAFE(bwv, &bd->statelist, entries, bwv_temp) {
-		if (!bc_get_autostart(bwv->config))
-			continue;
-		
-		if (pthread_mutex_unlock(&bd->mtx))
-			return -1;
+	LIST_FOREACH(bhe, &bd->hookexits, entries) {
+		if (bhe->pid == pid)
+			break;
+	}
 
-		if (bd_startvm(bd, bc_get_name(bwv->config))) {
-			syslog(LOG_ERR, "failed to autostart virtual machine \"%s\"",
-			       bc_get_name(bwv->config));
+	if (bhe) {
+		bhe->watched = true;
+		if (bhe->delivered) {
+			LIST_REMOVE(bhe, entries);
+			free(bhe);
+		} else if (bhe->exited) {
+			/* exit arrived before the vm knew the script */
+			EV_SET(&event, BD_EVENT_HOOKEXIT, EVFILT_USER, 0,
+			       NOTE_TRIGGER, 0, 0);
+			if (kevent(bd->kqueuefd, &event, 1, NULL, 0, NULL) < 0)
+				syslog(LOG_ERR, "Failed to wake up director kqueue thread");
 		}
-
-		if (pthread_mutex_lock(&bd->mtx))
-			return -1;
 	}
 
 	pthread_mutex_unlock(&bd->mtx);
 
-	return 0;
+	if (bhe)
+		return 0;
+
+	dlog(LOG_DEBUG, "Registering for kqueue events for pid %d", pid);
+	EV_SET(&event, pid, EVFILT_PROC, EV_ADD | EV_ENABLE, NOTE_EXIT, 0, bwv);
+
+	/* fails with ESRCH if the process is gone already */
+	return kevent(bd->kqueuefd, &event, 1, NULL, 0, NULL) < 0 ? -1 : 0;
 }
 
 /*
- * attempt stopping a vm
+ * register a hook script file or directory of a vm with the kqueue
  */
 int
-bd_stopvm(struct bhyve_director *bd, const char *name)
+bd_watchfile(struct bhyve_director *bd, struct process_state_vm *psv,
+	     int fd)
 {
-	if (!bd || !name) {
+	if (!bd || !psv) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	struct bhyve_watched_vm *bwv = bd_getvmbyname(bd, name);
+	struct bhyve_watched_vm *bwv = bd_getvmbystate(bd, psv);
+	struct kevent event = {0};
 
-	if (!bwv) {
-		errno = ENOENT;
+	if (!bwv)
 		return -1;
-	}
 
-	return psv_stopvm(bwv->state, NULL);
+	/* closing fd removes the event again */
+	EV_SET(&event, fd, EVFILT_VNODE, EV_ADD | EV_ENABLE | EV_CLEAR,
+	       NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB |
+	       NOTE_RENAME | NOTE_REVOKE, 0, bwv);
+
+	return kevent(bd->kqueuefd, &event, 1, NULL, 0, NULL) < 0 ? -1 : 0;
 }
 
 /*
- * attempt failure reset for a vm
+ * launch a hook script of a vm through the hook executor
+ *
+ * fails with ENOTSUP if there is no working hook executor.
  */
 int
-bd_resetfailvm(struct bhyve_director *bd, const char *name)
+bd_launchhook(struct bhyve_director *bd, struct process_state_vm *psv,
+	      const char *exepath, const char *from, const char *to,
+	      pid_t *pid)
 {
-	if (!bd || !name) {
+	if (!bd || !psv || !exepath || !pid) {
 		errno = EINVAL;
 		return -1;
 	}
-	
-	struct bhyve_watched_vm *bwv = bd_getvmbyname(bd, name);
 
-	if (!bwv) {
-		errno = ENOENT;
+	struct bhyve_watched_vm *bwv = 0;
+	struct bhyve_hook_exit *bhe = 0, *bhe_new = 0;
+	struct log_director_redirector_client *ldrd = 0;
+	const char *hookname = NULL;
+	int result = 0;
+
+	if (!bd->hke || atomic_load(&bd->hke_failed)) {
+		errno = ENOTSUP;
 		return -1;
 	}
-	
-	if (!psv_is_failurestate(bwv->state))
-		return BD_ERR_VMSTATENOFAIL;
-
-	return psv_resetfailure(bwv->state);		
-}
 
-/*
- * attempt starting a vm
- */
-int
-bd_startvm(struct bhyve_director *bd, const char *name)
-{
-	if (!bd || !name) {
-		errno = EINVAL;
+	if (!(bwv = bd_getvmbystate(bd, psv)))
 		return -1;
-	}
 
-	struct bhyve_watched_vm *bwv = bd_getvmbyname(bd, name);
-	struct kevent event = {0};
-	pid_t pid = 0;
-	int result = 0;
-	int pidstat = 0;
+	if (!(bhe_new = malloc(sizeof(struct bhyve_hook_exit))))
+		return -1;
+	bzero(bhe_new, sizeof(struct bhyve_hook_exit));
 
-	if (!bwv) {
-		errno = ENOENT;
-		return BD_ERR_UNKNOWNVMNAME;
+	/* output of the hook is recorded under the script name */
+	hookname = (hookname = strrchr(exepath, '/')) ? hookname + 1 : exepath;
+	if (bwv->ldr && !(ldrd = ldr_newclient_source(bwv->ldr, hookname))) {
+		free(bhe_new);
+		return -1;
 	}
 
-	/* if we exceed restart count in max restart time */
-	if (bwv_is_countfail(bwv)) {
-		/* put vm in failed state */
-		psv_failurestate(bwv->state);
-		return BD_ERR_VMSTATEISFAIL;
-	}
+	result = hke_launch(bd->hke, exepath, bc_get_name(bwv->config), from, to,
+			    ldrd ? ldrd_get_senderfd(ldrd) : -1, pid);
 
-	/* if the state is already fail, bail */
-	if (psv_is_failurestate(bwv->state))
-		return BD_ERR_VMSTATEISFAIL;
+	/* the executor holds its own copy of the pipe end */
+	if (ldrd)
+		ldrd_accept_redirect(ldrd);
 
-	bwv_timestamp(bwv);
+	if (result) {
+		free(bhe_new);
+		if (EPIPE != errno)
+			return -1;
 
-	/* attempt re-generating bhyve config, if we have a generator */
-	if (bwv_generate_config(bwv, bd->cgo)) {
-		/* generation failed */
-		psv_failurestate(bwv->state);
-		return BD_ERR_VMCONFGENFAIL;
+		syslog(LOG_ERR, "Hook executor terminated, launching hook "
+		       "scripts directly");
+		atomic_store(&bd->hke_failed, true);
+		errno = ENOTSUP;
+		return -1;
 	}
 
-	/* attempt linking consoles */
+	if (pthread_mutex_lock(&bd->mtx)) {
+		free(bhe_new);
+		errno = EDEADLK;
+		return -1;
+	}
+
+	/* the exit may have been received already */
+	LIST_FOREACH(bhe, &bd->hookexits, entries) {
+		if (bhe->pid == *pid)
+			break;
+	}
+
+	if (bhe) {
+		free(bhe_new);
+	} else {
+		bhe_new->pid = *pid;
+		LIST_INSERT_HEAD(&bd->hookexits, bhe_new, entries);
+	}
+
+	pthread_mutex_unlock(&bd->mtx);
+
+	return 0;
+}
+
+/*
+ * look up the vm a running hook script belongs to
+ *
+ * returns NULL if no vm claims the script (yet).
+ */
+struct bhyve_watched_vm *
+bd_getvmbyhookpid(struct bhyve_director *bd, pid_t pid)
+{
+	struct bhyve_watched_vm *bwv = 0;
+
+	if (pthread_mutex_lock(&bd->mtx)) {
+		errno = EDEADLK;
+		return NULL;
+	}
+
+	SLIST_FOREACH(bwv, &bd->statelist, entries) {
+		if (psv_is_hookpid(bwv->state, pid))
+			break;
+	}
+
+	pthread_mutex_unlock(&bd->mtx);
+
+	if (!bwv)
+		errno = ENOENT;
+
+	return bwv;
+}
+
+/*
+ * report exits of hook executor scripts to the vms running them
+ *
+ * exits of scripts that no vm claims yet are kept for the next call.
+ */
+void
+bd_deliverhookexits(struct bhyve_director *bd)
+{
+	struct bhyve_hook_exit *bhe = 0, *bhe_temp = 0;
+	struct bhyve_hook_exit *pending = 0;
+	struct bhyve_watched_vm *bwv = 0;
+	size_t count = 0, counter = 0;
+
+	if (pthread_mutex_lock(&bd->mtx))
+		return;
+
+	LIST_FOREACH(bhe, &bd->hookexits, entries) {
+		if (bhe->exited && !bhe->delivered)
+			count++;
+	}
+
+	if (count && (pending = malloc(sizeof(struct bhyve_hook_exit) * count))) {
+		LIST_FOREACH(bhe, &bd->hookexits, entries) {
+			if (bhe->exited && !bhe->delivered)
+				pending[counter++] = *bhe;
+		}
+	}
+
+	pthread_mutex_unlock(&bd->mtx);
+
+	if (!pending)
+		return;
+
+	/* vms are called without holding the director lock */
+	for (counter = 0; counter < count; counter++) {
+		if (!(bwv = bd_getvmbyhookpid(bd, pending[counter].pid)))
+			continue;
+
+		psv_onhookexit(bwv->state, pending[counter].pid,
+			       pending[counter].status);
+
+		if (pthread_mutex_lock(&bd->mtx))
+			break;
+
+		LIST_FOREACH_SAFE(bhe, &bd->hookexits, entries, bhe_temp) {
+			if (bhe->pid != pending[counter].pid)
+				continue;
+
+			bhe->delivered = true;
+			if (bhe->watched) {
+				LIST_REMOVE(bhe, entries);
+				free(bhe);
+			}
+			break;
+		}
+
+		bd->vmexits++;
+		pthread_cond_broadcast(&bd->cond_vmexit);
+		pthread_mutex_unlock(&bd->mtx);
+	}
+
+	free(pending);
+}
+
+/*
+ * receive exit notifications from the hook executor
+ */
+void
+bd_readhookexits(struct bhyve_director *bd)
+{
+	struct bhyve_hook_exit *bhe = 0;
+	struct kevent event = {0};
+	pid_t pid = 0;
+	int status = 0;
+	bool failed = false;
+
+	while (!hke_readexit(bd->hke, &pid, &status)) {
+		if (pthread_mutex_lock(&bd->mtx))
+			return;
+
+		LIST_FOREACH(bhe, &bd->hookexits, entries) {
+			if (bhe->pid == pid)
+				break;
+		}
+
+		/* the launching thread did not record the script yet */
+		if (!bhe && (bhe = malloc(sizeof(struct bhyve_hook_exit)))) {
+			bzero(bhe, sizeof(struct bhyve_hook_exit));
+			bhe->pid = pid;
+			LIST_INSERT_HEAD(&bd->hookexits, bhe, entries);
+		}
+
+		if (bhe) {
+			bhe->exited = true;
+			bhe->status = status;
+		}
+
+		pthread_mutex_unlock(&bd->mtx);
+	}
+
+	if (EAGAIN != errno)
+		failed = true;
+
+	if (failed) {
+		syslog(LOG_ERR, "Hook executor terminated, failing its running "
+		       "hook scripts");
+
+		EV_SET(&event, hke_get_eventfd(bd->hke), EVFILT_READ, EV_DELETE,
+		       0, 0, 0);
+		kevent(bd->kqueuefd, &event, 1, NULL, 0, NULL);
+
+		if (pthread_mutex_lock(&bd->mtx))
+			return;
+
+		atomic_store(&bd->hke_failed, true);
+		LIST_FOREACH(bhe, &bd->hookexits, entries) {
+			if (!bhe->exited) {
+				bhe->exited = true;
+				bhe->status = W_EXITCODE(127, 0);
+			}
+		}
+
+		pthread_mutex_unlock(&bd->mtx);
+	}
+
+	bd_deliverhookexits(bd);
+}
+
+/*
+ * look up a vm by its name
+ *
+ * returns NULL if nothing matches.
+ */
+struct bhyve_watched_vm *
+bd_getvmbyname(struct bhyve_director *bd, const char *name)
+{
+	if (!bd || !name) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct bhyve_watched_vm *bwv = 0;
+
+	if (pthread_mutex_lock(&bd->mtx)) {
+		errno = EDEADLK;
+		return NULL;
+	}
+
+	SLIST_FOREACH(bwv, &bd->statelist, entries) {
+		if (!strcmp(name, bc_get_name(bwv->config))) {
+			if (pthread_mutex_unlock(&bd->mtx)) {
+				err(EDEADLK, "failed to unlock mutex");
+			}
+			
+			return bwv;
+		}
+	}
+
+	pthread_mutex_unlock(&bd->mtx);
+	
+	return NULL;
+}
+
+/*
+ * initiates a startup for all virtual machines that have autostart set
+ */
+int
+bd_runautostart(struct bhyve_director *bd)
+{
+	if (!bd) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct bhyve_watched_vm *bwv = 0, *bwv_temp = 0;
+	uint32_t priority = 0, next = 0;
+	bool pending = true;
+
+	/* start vms in ascending priority, lowest first */
+	while (pending) {
+		pending = false;
+
+		if (pthread_mutex_lock(&bd->mtx)) {
+			return -1;
+		}
+
+		SLIST_FOREACH_SAFE(bwv, &bd->statelist, entries, bwv_temp) {
+			if (!bc_get_autostart(bwv->config))
+				continue;
+
+			/* remember the next priority to start */
+			if (bc_get_priority(bwv->config) > priority) {
+				if (!pending || (bc_get_priority(bwv->config) < next))
+					next = bc_get_priority(bwv->config);
+				pending = true;
+				continue;
+			}
+
+			if (bc_get_priority(bwv->config) != priority)
+				continue;
+		
+			if (pthread_mutex_unlock(&bd->mtx))
+				return -1;
+
+			if (bd_startvm(bd, bc_get_name(bwv->config))) {
+				syslog(LOG_ERR, "failed to autostart virtual machine \"%s\"",
+				       bc_get_name(bwv->config));
+			}
+
+			if (pthread_mutex_lock(&bd->mtx))
+				return -1;
+		}
+
+		pthread_mutex_unlock(&bd->mtx);
+
+		priority = next;
+	}
+
+	return 0;
+}
+
+/*
+ * attempt stopping a vm
+ */
+int
+bd_stopvm(struct bhyve_director *bd, const char *name)
+{
+	if (!bd || !name) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct bhyve_watched_vm *bwv = bd_getvmbyname(bd, name);
+
+	if (!bwv) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return psv_stopvm(bwv->state, NULL);
+}
+
+/*
+ * attempt failure reset for a vm
+ */
+int
+bd_resetfailvm(struct bhyve_director *bd, const char *name)
+{
+	if (!bd || !name) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	struct bhyve_watched_vm *bwv = bd_getvmbyname(bd, name);
+
+	if (!bwv) {
+		errno = ENOENT;
+		return -1;
+	}
+	
+	if (!psv_is_failurestate(bwv->state))
+		return BD_ERR_VMSTATENOFAIL;
+
+	return psv_resetfailure(bwv->state);		
+}
+
+/*
+ * attempt starting a vm
+ */
+int
+bd_startvm(struct bhyve_director *bd, const char *name)
+{
+	if (!bd || !name) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct bhyve_watched_vm *bwv = bd_getvmbyname(bd, name);
+	pid_t pid = 0;
+	int result = 0;
+
+	if (!bwv) {
+		errno = ENOENT;
+		return BD_ERR_UNKNOWNVMNAME;
+	}
+
+	/* no vm is started once the director shuts down */
+	if (bd_is_shuttingdown(bd)) {
+		/* a queued restart ends up stopped instead */
+		if (RESTART_STOPPED == psv_getstate(bwv->state))
+			psv_abortreboot(bwv->state);
+		return BD_ERR_SHUTTINGDOWN;
+	}
+
+	/* if we exceed restart count in max restart time */
+	if (bwv_is_countfail(bwv)) {
+		/* put vm in failed state */
+		psv_failurestate(bwv->state);
+		return BD_ERR_VMSTATEISFAIL;
+	}
+
+	/* if the state is already fail, bail */
+	if (psv_is_failurestate(bwv->state))
+		return BD_ERR_VMSTATEISFAIL;
+
+	bwv_timestamp(bwv);
+
+	/* attempt re-generating bhyve config, if we have a generator */
+	if (bwv_generate_config(bwv, bd->cgo)) {
+		/* generation failed */
+		psv_failurestate(bwv->state);
+		return BD_ERR_VMCONFGENFAIL;
+	}
+
+	/* attempt linking consoles */
 	if (bwv_linkconsoles(bwv, true)) {
 		/* linking failed, only warn */
 		syslog(LOG_WARNING, "Failed to link consoles");
@@ -623,44 +1312,16 @@ bd_startvm(struct bhyve_director *bd, const char *name)
 		return BD_ERR_VMSTARTFAILED;
 	}
 
-	errno = 0;
-	if (kill(pid, 0) < 0) {
-		/* process already terminated, assume error because pid vanished */
-		psv_onexit(bwv->state, 4);
-	} else {
-		syslog(LOG_INFO, "pid %d confirmed as valid", pid);
-		/* check if child pid isn't already dead */
-		if (waitpid(pid, &pidstat, WNOHANG | WEXITED | WSTOPPED) == pid) {
-			syslog(LOG_INFO, "waitpid pidstat = %d", pidstat);
-			/* tell it's already terminated */
-			if (WIFEXITED(pidstat)) {
-				syslog(LOG_ERR,
-				       "psv_startvm called but immediate exit, exit = %d",
-				       WEXITSTATUS(pidstat));
-			} else if (WIFSIGNALED(pidstat)) {
-				syslog(LOG_ERR,
-				       "psv_startvm called but immedate sig, signal = %d",
-				       WSTOPSIG(pidstat));
-			}
-			if (WIFEXITED(pidstat) || WIFSIGNALED(pidstat)) {
-				if (psv_onexit(bwv->state, WEXITSTATUS(pidstat))) {
-					/* TODO improve error logging */
-					syslog(LOG_ERR, "psv_onexit failed");
-					psv_failurestate(bwv->state);
-				}
-				syslog(LOG_ERR, "pid %d immediately died after start", pid);
-				return BD_ERR_VMSTARTDIEDIM;
-			}
-		} else {
-			syslog(LOG_INFO, "Registering for kqueue events for pid %d", pid);
-			/* otherwise, we register the pid */
-			EV_SET(&event, pid, EVFILT_PROC, EV_ADD | EV_ENABLE, NOTE_EXIT, 0, bwv);
-			if (kevent(bd->kqueuefd, &event, 1, NULL, 0, NULL) < 0)
-				return BD_ERR_KEVENTREGFAIL;
-		}
-	}
+	/* the process was registered with the kqueue during launch, an
+	   immediate exit is reported through it */
+	if (pid)
+		dlog(LOG_INFO, "vm \"%s\" started with pid %d",
+		     bc_get_name(bwv->config), pid);
+	else
+		dlog(LOG_INFO, "vm \"%s\" is starting, waiting for hook "
+		     "scripts", bc_get_name(bwv->config));
 
-	syslog(LOG_INFO, "bd_startvm return 0");
+	dlog(LOG_DEBUG, "bd_startvm return 0");
 	
 	return 0;
 }
@@ -723,6 +1384,21 @@ bd_restart_thread(struct bhyve_director *bd)
 	return NULL;
 }
 
+/*
+ * wake up the kqueue thread because a timer expires earlier than
+ * its current sleep timeout
+ */
+void
+bd_timer_wakeup(void *ctx)
+{
+	struct bhyve_director *bd = ctx;
+	struct kevent event = {0};
+
+	EV_SET(&event, BD_EVENT_TIMERWAKE, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+	if (kevent(bd->kqueuefd, &event, 1, NULL, 0, 0) < 0)
+		syslog(LOG_ERR, "Failed to wake up director kqueue thread");
+}
+
 /*
  * kernel queue listener thread
  */
@@ -730,6 +1406,8 @@ void *
 bd_kqueue_thread(struct bhyve_director *bd)
 {
 	struct kevent event = {0};
+	struct timespec timeout = {0};
+	int64_t timeout_ms = 0;
 	int result = 0;
 	struct bhyve_watched_vm *bwv = 0;
 	unsigned short exitcode = 0;
@@ -740,7 +1418,19 @@ bd_kqueue_thread(struct bhyve_director *bd)
 	}
 
 	/* register for shutdown events */
-	EV_SET(&event, 0, EVFILT_USER, 0, 0, 0, 0);
+	EV_SET(&event, BD_EVENT_SHUTDOWN, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+	if (kevent(bd->kqueuefd, &event, 1, NULL, 0, 0) < 0) {
+		result = -1;
+	}
+
+	/* register for timer wake up events */
+	EV_SET(&event, BD_EVENT_TIMERWAKE, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+	if (kevent(bd->kqueuefd, &event, 1, NULL, 0, 0) < 0) {
+		result = -1;
+	}
+
+	/* register for hook exits received ahead of their vm */
+	EV_SET(&event, BD_EVENT_HOOKEXIT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
 	if (kevent(bd->kqueuefd, &event, 1, NULL, 0, 0) < 0) {
 		result = -1;
 	}
@@ -755,42 +1445,89 @@ bd_kqueue_thread(struct bhyve_director *bd)
 	pthread_mutex_unlock(&bd->mtx);
 
 	do {
-		result = kevent(bd->kqueuefd, NULL, 0, &event, 1, 0);
+		/* sleep until the next timer is due */
+		timeout_ms = tw_next_timeout(bd->tw);
+		timeout.tv_sec = timeout_ms / 1000;
+		timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+		result = kevent(bd->kqueuefd, NULL, 0, &event, 1,
+				(timeout_ms < 0) ? NULL : &timeout);
 		if (result < 0)
 			break;
 
+		if (!result) {
+			/* timeout */
+			tw_advance(bd->tw);
+			continue;
+		}
+
 		switch(event.filter) {
 		case EVFILT_USER:
-			/* shutdown signal */
-			result = -1;
+			if (BD_EVENT_SHUTDOWN == event.ident) {
+				/* shutdown signal */
+				result = -1;
+			} else if (BD_EVENT_HOOKEXIT == event.ident) {
+				bd_deliverhookexits(bd);
+			}
+			break;
+		case EVFILT_READ:
+			/* exit notifications of the hook executor */
+			bd_readhookexits(bd);
 			break;
 		case EVFILT_PROC:
 			bwv = (void *) event.udata;
 
-			/* attempt imlinking consoles */
-			if (bwv_linkconsoles(bwv, false)) {
-				/* linking failed, only warn */
-				syslog(LOG_WARNING, "Failed to unlink consoles");
-			}
-			
-			if (WIFEXITED(event.data)) {
-				exitcode = WEXITSTATUS(event.data);
-				psv_onexit(bwv->state, exitcode);
+			/* reap the child, its status is part of the event */
+			waitpid(event.ident, NULL, WNOHANG);
+
+			if (psv_is_hookpid(bwv->state, event.ident)) {
+				/* continues the state change waiting for it */
+				psv_onhookexit(bwv->state, event.ident, event.data);
 			} else {
-				if (WIFSIGNALED(event.data)) {
+				/* attempt imlinking consoles */
+				if (bwv_linkconsoles(bwv, false)) {
+					/* linking failed, only warn */
+					syslog(LOG_WARNING, "Failed to unlink consoles");
+				}
+				
+				if (WIFEXITED(event.data)) {
+					exitcode = WEXITSTATUS(event.data);
+					psv_onexit(bwv->state, exitcode);
+				} else if (WIFSIGNALED(event.data)) {
 					syslog(LOG_ERR, "process %d received signal %ld",
 					       psv_getpid(bwv->state),
 					       WTERMSIG(event.data));
+					/* a signal is expected if a stop request was
+					   escalated, anything else is a failure */
+					psv_onsignal(bwv->state, WTERMSIG(event.data));
+				} else {
+					syslog(LOG_ERR, "vm \"%s\" shut down unexpectedly",
+					       bc_get_name(bwv->config));
+					/* process core dumped or other exit state */
+					/* TODO move to error state */
+					psv_failurestate(bwv->state);
 				}
-				syslog(LOG_ERR, "vm \"%s\" shut down unexpectedly",
-				       bc_get_name(bwv->config));
-				/* process core dumped or other exit state */
-				/* TODO move to error state */
-				psv_failurestate(bwv->state);
 			}
+
+			/* wake up anyone waiting for vms to stop or hooks to
+			   finish */
+			if (pthread_mutex_lock(&bd->mtx))
+				break;
+			bd->vmexits++;
+			pthread_cond_broadcast(&bd->cond_vmexit);
+			pthread_mutex_unlock(&bd->mtx);
 			
+			break;
+		case EVFILT_VNODE:
+			bwv = (void *) event.udata;
+
+			/* hook scripts are looked up again on next use */
+			psv_onhookschanged(bwv->state);
 			break;
 		}
+
+		/* run timers that expired while handling the event */
+		tw_advance(bd->tw);
 	} while (result >= 0);
 	
 	return NULL;
@@ -825,7 +1562,7 @@ bd_thread_stop(struct bhyve_director *bd)
 {
 	struct kevent event = {0};
 
-	EV_SET(&event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+	EV_SET(&event, BD_EVENT_SHUTDOWN, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
 	if (kevent(bd->kqueuefd, &event, 1, NULL, 0, 0) < 0)
 		return -1;
 
@@ -858,8 +1595,13 @@ bd_new(struct bhyve_configuration_store_obj *bcso,
 		return NULL;
 
 	bzero(bd, sizeof(struct bhyve_director));
+	atomic_init(&bd->configs_generated, 0);
+	atomic_init(&bd->configs_skipped, 0);
+	atomic_init(&bd->hke_failed, false);
 	bd->rmo.ctx = bd;
 	bd->rmo.funcs = &bhyve_director_rmo_funcs;
+	bd->pwo.ctx = bd;
+	bd->pwo.funcs = &bhyve_director_pwo_funcs;
 		
 	if ((bd->kqueuefd = kqueue()) < 0) {
 		free(bd);
@@ -884,7 +1626,28 @@ bd_new(struct bhyve_configuration_store_obj *bcso,
 		return NULL;
 	}
 
+	if (pthread_cond_init(&bd->cond_vmexit, NULL)) {
+		pthread_cond_destroy(&bd->reboot_wakeup);
+		pthread_cond_destroy(&bd->cond_ready);
+		pthread_mutex_destroy(&bd->mtx);
+		free(bd);
+		return NULL;
+	}
+
+	if (!(bd->tw = tw_new(BD_TIMER_TICK_MS, NULL)) ||
+	    tw_set_wakeup(bd->tw, bd_timer_wakeup, bd)) {
+		tw_free(bd->tw);
+		pthread_cond_destroy(&bd->cond_vmexit);
+		pthread_cond_destroy(&bd->reboot_wakeup);
+		pthread_cond_destroy(&bd->cond_ready);
+		pthread_mutex_destroy(&bd->mtx);
+		free(bd);
+		return NULL;
+	}
+
 	if (bd_thread_start(bd)) {
+		tw_free(bd->tw);
+		pthread_cond_destroy(&bd->cond_vmexit);
 		pthread_cond_destroy(&bd->reboot_wakeup);
 		pthread_cond_destroy(&bd->cond_ready);
 		pthread_mutex_destroy(&bd->mtx);
@@ -895,6 +1658,8 @@ bd_new(struct bhyve_configuration_store_obj *bcso,
 	if (pthread_create(&bd->reboot_thread, NULL, (void*) bd_restart_thread, bd)) {
 		/* failed to start thread */
 		bd_thread_stop(bd);
+		tw_free(bd->tw);
+		pthread_cond_destroy(&bd->cond_vmexit);
 		pthread_cond_destroy(&bd->reboot_wakeup);
 		pthread_cond_destroy(&bd->cond_ready);
 		pthread_mutex_destroy(&bd->mtx);
@@ -910,6 +1675,7 @@ bd_new(struct bhyve_configuration_store_obj *bcso,
 
 	SLIST_INIT(&bd->statelist);
 	STAILQ_INIT(&bd->rebootlist);
+	LIST_INIT(&bd->hookexits);
 
 	/* construct state list from store configurations */
 	bci = bcso->funcs->getiterator(bcso->ctx);
@@ -926,68 +1692,532 @@ bd_new(struct bhyve_configuration_store_obj *bcso,
 			bd_free(bd);
 			return NULL;
 		}
-
-		/* insert into listing */
-		SLIST_INSERT_HEAD(&bd->statelist, bwv, entries);
+
+		bwv->bd = bd;
+		tw_timer_init(&bwv->restart_timer, bwv_restart_expired, bwv);
+		psv_withtimerwheel(bwv->state, bd->tw);
+		psv_withwatcher(bwv->state, &bd->pwo);
+
+		/* insert into listing */
+		SLIST_INSERT_HEAD(&bd->statelist, bwv, entries);
+	}
+
+	return bd;
+}
+
+/*
+ * get message count
+ *
+ * returns zero and errno set on error.
+ */
+uint64_t
+bd_getmsgcount(struct bhyve_director *bd)
+{
+	if (!bd) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	uint64_t count = 0;
+
+	if (pthread_mutex_lock(&bd->mtx)) {
+		return 0;
+	}
+
+	count = bd->msgcount;
+	
+	if (pthread_mutex_unlock(&bd->mtx))
+		return 0;
+	
+	return count;
+}
+
+/*
+ * get the number of generated configs written and the number skipped
+ * because their inputs were unchanged
+ */
+void
+bd_get_configstats(struct bhyve_director *bd, uint64_t *generated,
+		   uint64_t *skipped)
+{
+	if (generated)
+		*generated = bd ? atomic_load(&bd->configs_generated) : 0;
+	if (skipped)
+		*skipped = bd ? atomic_load(&bd->configs_skipped) : 0;
+}
+
+/*
+ * send bhyve director info back to client
+ */
+int
+bd_reply_info(struct bhyve_director *bd, struct bhyve_messagesub_replymgr *bmr)
+{
+	struct bhyve_vm_manager_info *bvmmi = bd_getinfo(bd);
+	void *buffer = 0;
+	size_t bufferlen = 0;
+	int result = 0;
+	
+	if (!bvmmi)
+		return -1;
+
+	do {
+		if (bvmmi_encodebinary(bvmmi, &buffer, &bufferlen)) {
+			result = -1;
+			break;
+		}
+
+		/* send binary blob */
+		result = bmr->reply(bmr->ctx, buffer, bufferlen);
+
+		free(buffer);
+	} while(0);
+
+	bvmmi_free(bvmmi);
+
+	return result;
+}
+
+/*
+ * send fleet shutdown progress back to client
+ */
+int
+bd_reply_shutdownstatus(struct bhyve_director *bd,
+			struct bhyve_messagesub_replymgr *bmr)
+{
+	struct bhyve_director_shutdown progress = {0};
+	char message[128] = {0};
+	time_t now = time(NULL);
+
+	if (pthread_mutex_lock(&bd->mtx))
+		return -1;
+
+	progress = bd->shutdown;
+
+	if (pthread_mutex_unlock(&bd->mtx))
+		return -1;
+
+	if (!progress.active)
+		return bmr->short_reply(bmr->ctx, "no shutdown in progress");
+
+	snprintf(message, sizeof(message),
+		 "shutting down: %zu of %zu vms stopped, %zu killed, %lld seconds left",
+		 progress.stopped, progress.total, progress.killed,
+		 (long long) ((progress.deadline > now) ? progress.deadline - now : 0));
+
+	return bmr->short_reply(bmr->ctx, message);
+}
+
+/*
+ * send the log counters of one or all vms back to client
+ */
+int
+bd_reply_logstats(struct bhyve_director *bd, const char *vmname,
+		  struct bhyve_messagesub_replymgr *bmr)
+{
+	struct bhyve_watched_vm *bwv = NULL;
+	struct log_director_redirector_stats stats = {0};
+	FILE *stream = NULL;
+	char *buffer = NULL;
+	size_t bufferlen = 0;
+	int result = 0;
+
+	if (vmname && !bd_getvmbyname(bd, vmname)) {
+		errno = ENOENT;
+		return BD_ERR_UNKNOWNVMNAME;
+	}
+
+	if (!(stream = open_memstream(&buffer, &bufferlen)))
+		return -1;
+
+	fprintf(stream, "%-16s %14s %14s %8s\n", "Name", "Bytes", "Suppressed",
+		"Bursts");
+
+	if (pthread_mutex_lock(&bd->mtx)) {
+		fclose(stream);
+		free(buffer);
+		return BD_ERR_MUTEXLOCKFAIL;
+	}
+
+	SLIST_FOREACH(bwv, &bd->statelist, entries) {
+		if (vmname && strcmp(vmname, bc_get_name(bwv->config)))
+			continue;
+		if (!bwv->ldr || ldr_get_stats(bwv->ldr, &stats))
+			continue;
+		fprintf(stream, "%-16s %14ju %14ju %8ju\n",
+			bc_get_name(bwv->config), (uintmax_t) stats.bytes,
+			(uintmax_t) stats.dropped, (uintmax_t) stats.dropbursts);
+	}
+
+	pthread_mutex_unlock(&bd->mtx);
+
+	if (fclose(stream)) {
+		free(buffer);
+		return -1;
+	}
+
+	result = bmr->reply(bmr->ctx, buffer, bufferlen);
+	free(buffer);
+
+	return result;
+}
+
+/*
+ * formats log records for a client
+ */
+struct bhyve_director_logs {
+	FILE *stream;
+	size_t written;
+	/* source of the current line, if one was started */
+	bool midline;
+	char source[LST_SOURCE_MAX];
+	size_t sourcelen;
+	/* only records of this source are shown, NULL for all */
+	const char *filter;
+};
+
+/*
+ * append a log record to the reply, starting each line with the time
+ * and the source of the record it started in
+ */
+int
+bd_logs_onentry(void *ctx, const struct log_store_entry *entry)
+{
+	struct bhyve_director_logs *bdl = ctx;
+	const char *data = entry->data, *end = entry->data + entry->len;
+	const char *eol = NULL;
+	char stamp[32] = {0};
+	struct tm tm = {0};
+	time_t seconds = entry->timestamp / 1000000000;
+
+	if (bdl->filter && ((strlen(bdl->filter) != entry->sourcelen) ||
+			    memcmp(bdl->filter, entry->source, entry->sourcelen)))
+		return 0;
+
+	if (bdl->written >= BD_LOGS_MAX) {
+		fprintf(bdl->stream, "%s[output truncated]\n", bdl->midline ? "\n" : "");
+		bdl->midline = false;
+		return 1;
+	}
+
+	/* output of different sources never shares a line */
+	if (bdl->midline && ((bdl->sourcelen != entry->sourcelen) ||
+			     memcmp(bdl->source, entry->source, entry->sourcelen))) {
+		fputc('\n', bdl->stream);
+		bdl->midline = false;
+	}
+
+	localtime_r(&seconds, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+	while (data < end) {
+		if (!bdl->midline) {
+			fprintf(bdl->stream, "%s %.*s: ", stamp, (int) entry->sourcelen,
+				entry->source);
+			memcpy(bdl->source, entry->source, entry->sourcelen);
+			bdl->sourcelen = entry->sourcelen;
+			bdl->midline = true;
+		}
+
+		eol = memchr(data, '\n', end - data);
+		eol = eol ? eol + 1 : end;
+		fwrite(data, 1, eol - data, bdl->stream);
+		bdl->written += eol - data;
+		if (eol[-1] == '\n')
+			bdl->midline = false;
+		data = eol;
+	}
+
+	return 0;
+}
+
+/*
+ * keep sending log output of a vm to client as it is written, until
+ * the client goes away or vmstated shuts down
+ *
+ * a client reading too slowly is dropped rather than holding up the
+ * log director.
+ */
+int
+bd_follow_logs(struct bhyve_director *bd, struct bhyve_watched_vm *bwv,
+	       const struct bhyve_usercommand *bcmd,
+	       struct bhyve_messagesub_replymgr *bmr)
+{
+	struct log_director_subscriber *ldrs = NULL;
+	struct bhyve_director_logs bdl = {
+		.filter = bcmd->source
+	};
+	char *buffer = NULL;
+	size_t bufferlen = 0;
+	int result = 0;
+
+	if (!bmr->stream)
+		return bmr->short_reply(bmr->ctx, "following logs not supported");
+
+	if (!(ldrs = ldr_subscribe(bwv->ldr, bcmd->backlog)))
+		return bmr->short_reply(bmr->ctx, "failed to follow log output");
+
+	while (!bd_is_shuttingdown(bd)) {
+		if (!(bdl.stream = open_memstream(&buffer, &bufferlen))) {
+			result = -1;
+			break;
+		}
+		bdl.written = 0;
+
+		result = ldrs_read(ldrs, bd_logs_onentry, &bdl, BD_LOGS_HEARTBEAT_MS);
+		if (fclose(bdl.stream)) {
+			free(buffer);
+			result = -1;
+			break;
+		}
+
+		if (result < 0) {
+			free(buffer);
+			break;
+		}
+
+		/* an empty frame tells whether the client is still there */
+		if (bmr->stream(bmr->ctx, buffer, bufferlen)) {
+			free(buffer);
+			ldrs_unsubscribe(ldrs);
+			return -1;
+		}
+		free(buffer);
+		buffer = NULL;
+	}
+
+	ldrs_unsubscribe(ldrs);
+
+	if (result >= 0)
+		return bmr->short_reply(bmr->ctx, "shutting down");
+	if (errno == ENOBUFS)
+		return bmr->short_reply(bmr->ctx, "dropped, reading too slowly");
+	if (errno == ECANCELED)
+		return bmr->short_reply(bmr->ctx, "log closed");
+
+	return -1;
+}
+
+/*
+ * send the log output of a vm matching the time range and source of
+ * bcmd back to client
+ */
+int
+bd_reply_logs(struct bhyve_director *bd, const struct bhyve_usercommand *bcmd,
+	      struct bhyve_messagesub_replymgr *bmr)
+{
+	struct bhyve_watched_vm *bwv = NULL;
+	struct bhyve_director_logs bdl = {0};
+	struct log_store_query query = {
+		.since = bcmd->since * 1000000000,
+		/* until names the last second included */
+		.until = bcmd->until ? (bcmd->until + 1) * 1000000000 - 1 : 0,
+		.source = bcmd->source
+	};
+	char *buffer = NULL;
+	size_t bufferlen = 0;
+	int result = 0;
+
+	if (!bcmd->vmname || !(bwv = bd_getvmbyname(bd, bcmd->vmname))) {
+		errno = ENOENT;
+		return BD_ERR_UNKNOWNVMNAME;
+	}
+
+	if (!bwv->ldr)
+		return bmr->short_reply(bmr->ctx, "no log output recorded");
+
+	if (bcmd->follow)
+		return bd_follow_logs(bd, bwv, bcmd, bmr);
+
+	if (!(bdl.stream = open_memstream(&buffer, &bufferlen)))
+		return -1;
+
+	if ((result = ldr_query(bwv->ldr, &query, bd_logs_onentry, &bdl)) < 0) {
+		fclose(bdl.stream);
+		free(buffer);
+		return bmr->short_reply(bmr->ctx, "failed to read log store");
+	}
+	if (bdl.midline)
+		fputc('\n', bdl.stream);
+
+	if (fclose(bdl.stream)) {
+		free(buffer);
+		return -1;
+	}
+
+	result = bufferlen ? bmr->reply(bmr->ctx, buffer, bufferlen) :
+		bmr->short_reply(bmr->ctx, "no matching log output");
+	free(buffer);
+
+	return result;
+}
+
+/*
+ * wait until every vm in vmnames entered one of the states in set
+ *
+ * vmnames is a comma separated list of vm names, NULL waits for all
+ * vms. timeout is given in seconds, 0 waits forever. The states
+ * reached are written to reply; on a timeout, reply names the vm that
+ * did not make it.
+ *
+ * returns BD_ERR_WAITTIMEDOUT on timeout, BD_ERR_UNKNOWNVMNAME with
+ * errno set to ENOENT for unknown vms and BD_ERR_SHUTTINGDOWN if the
+ * director shut down meanwhile.
+ */
+int
+bd_waitstate(struct bhyve_director *bd, const char *vmnames, uint32_t set,
+	     uint32_t timeout, char *reply, size_t replylen)
+{
+	if (!bd || !set || !reply || !replylen) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct bhyve_watched_vm **vms = NULL, *bwv = NULL;
+	struct timespec deadline = {0}, now = {0};
+	char *names = NULL, *cursor = NULL, *name = NULL;
+	size_t count = 0, idx = 0, used = 0;
+	int64_t reached = 0;
+	long remaining = -1;
+	int result = 0;
+
+	*reply = 0;
+
+	if (pthread_mutex_lock(&bd->mtx))
+		return BD_ERR_MUTEXLOCKFAIL;
+	SLIST_FOREACH(bwv, &bd->statelist, entries) {
+		count++;
+	}
+	pthread_mutex_unlock(&bd->mtx);
+
+	/* every vm is named at most once, or all of them are waited for */
+	if (vmnames) {
+		for (cursor = (char *) vmnames; *cursor; cursor++) {
+			if (',' == *cursor)
+				count++;
+		}
+		count++;
+	}
+
+	vms = calloc(count ? count : 1, sizeof(struct bhyve_watched_vm *));
+	if (!vms)
+		return -1;
+
+	if (vmnames) {
+		if (!(names = strdup(vmnames))) {
+			free(vms);
+			return -1;
+		}
+
+		count = 0;
+		cursor = names;
+		while ((name = strsep(&cursor, ","))) {
+			if (!*name)
+				continue;
+			if (!(vms[count] = bd_getvmbyname(bd, name))) {
+				free(names);
+				free(vms);
+				errno = ENOENT;
+				return BD_ERR_UNKNOWNVMNAME;
+			}
+			count++;
+		}
+		free(names);
+	} else {
+		if (pthread_mutex_lock(&bd->mtx)) {
+			free(vms);
+			return BD_ERR_MUTEXLOCKFAIL;
+		}
+		idx = 0;
+		SLIST_FOREACH(bwv, &bd->statelist, entries) {
+			if (idx < count)
+				vms[idx++] = bwv;
+		}
+		count = idx;
+		pthread_mutex_unlock(&bd->mtx);
 	}
 
-	return bd;
-}
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout;
 
-/*
- * get message count
- *
- * returns zero and errno set on error.
- */
-uint64_t
-bd_getmsgcount(struct bhyve_director *bd)
-{
-	if (!bd) {
-		errno = EINVAL;
-		return 0;
-	}
+	/* vms are waited for one after the other within the same deadline */
+	for (idx = 0; idx < count; idx++) {
+		if (timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining = (deadline.tv_sec - now.tv_sec) * 1000 +
+				(deadline.tv_nsec - now.tv_nsec) / 1000000;
+			if (remaining < 0)
+				remaining = 0;
+			if (remaining > INT_MAX)
+				remaining = INT_MAX;
+		}
 
-	uint64_t count = 0;
+		reached = psv_waitstate(vms[idx]->state, set, remaining);
+		if (reached < 0) {
+			result = (ECANCELED == errno) ? BD_ERR_SHUTTINGDOWN :
+				(ETIMEDOUT == errno) ? BD_ERR_WAITTIMEDOUT : -1;
+			snprintf(reply, replylen, "%s %s",
+				 bc_get_name(vms[idx]->config),
+				 (ETIMEDOUT == errno) ? "timed out" : "not reached");
+			break;
+		}
 
-	if (pthread_mutex_lock(&bd->mtx)) {
-		return 0;
+		if (used < replylen) {
+			used += snprintf(reply + used, replylen - used, "%s%s %s",
+					 idx ? ", " : "",
+					 bc_get_name(vms[idx]->config),
+					 psv_state2string(reached));
+		}
 	}
 
-	count = bd->msgcount;
-	
-	if (pthread_mutex_unlock(&bd->mtx))
-		return 0;
-	
-	return count;
+	free(vms);
+
+	return result;
 }
 
 /*
- * send bhyve director info back to client
+ * wait for the states requested by a waitstate command and send the
+ * outcome back to the client
  */
 int
-bd_reply_info(struct bhyve_director *bd, struct bhyve_messagesub_replymgr *bmr)
+bd_reply_waitstate(struct bhyve_director *bd, struct bhyve_usercommand *bcmd,
+		   struct bhyve_messagesub_replymgr *bmr)
 {
-	struct bhyve_vm_manager_info *bvmmi = bd_getinfo(bd);
-	void *buffer = 0;
-	size_t bufferlen = 0;
+	char reply[BD_WAITSTATE_REPLYLEN] = {0};
+	char *states = NULL, *cursor = NULL, *name = NULL;
+	bhyve_vmstate_t state = 0;
+	uint32_t set = 0;
 	int result = 0;
-	
-	if (!bvmmi)
+
+	if (!bcmd->states) {
+		bmr->short_reply(bmr->ctx, "no states given");
+		return -1;
+	}
+	if (!(states = strdup(bcmd->states)))
 		return -1;
 
-	do {
-		if (bvmmi_encodebinary(bvmmi, &buffer, &bufferlen)) {
-			result = -1;
-			break;
+	cursor = states;
+	while ((name = strsep(&cursor, ","))) {
+		if (!*name)
+			continue;
+		if (psv_string2state(name, &state)) {
+			snprintf(reply, sizeof(reply), "unknown state %s", name);
+			free(states);
+			bmr->short_reply(bmr->ctx, reply);
+			return -1;
 		}
+		set |= psv_stateset(state);
+	}
+	free(states);
 
-		/* send binary blob */
-		result = bmr->reply(bmr->ctx, buffer, bufferlen);
-
-		free(buffer);
-	} while(0);
+	if (!set) {
+		bmr->short_reply(bmr->ctx, "no states given");
+		return -1;
+	}
 
-	bvmmi_free(bvmmi);
+	result = bd_waitstate(bd, bcmd->vmname, set, bcmd->timeout,
+			      reply, sizeof(reply));
+	if (*reply)
+		bmr->short_reply(bmr->ctx, reply);
 
 	return result;
 }
@@ -1006,15 +2236,15 @@ bd_recv_ondata(void *ctx, uid_t uid, pid_t pid, const char *cmd,
 	if (!bd)
 		return -1;
 
-	syslog(LOG_INFO, "bd_recv_ondata start");
+	dlog(LOG_DEBUG, "bd_recv_ondata start");
 	
 	if (pthread_mutex_lock(&bd->mtx)) {
-		syslog(LOG_ERR, "Failed to lock mutex");
+		dlog(LOG_ERR, "Failed to lock mutex");
 		return -1;
 	}
 	bd->msgcount++;
 	if (pthread_mutex_unlock(&bd->mtx)) {
-		syslog(LOG_ERR, "Failed to unlock mutex");
+		dlog(LOG_ERR, "Failed to unlock mutex");
 		return -1;
 	}
 
@@ -1022,7 +2252,7 @@ bd_recv_ondata(void *ctx, uid_t uid, pid_t pid, const char *cmd,
 
 	if (strcmp("BHYV", cmd)) {
 		/* not a bhyve command - skip */
-		syslog(LOG_ERR, "not a BHYV command");
+		dlog(LOG_DEBUG, "not a BHYV command");
 		return 0;
 	}
 
@@ -1030,7 +2260,7 @@ bd_recv_ondata(void *ctx, uid_t uid, pid_t pid, const char *cmd,
 	bzero(&bcmd, sizeof(struct bhyve_usercommand));
 
 	if (bcmd_parse_nvlistcmd(data, datalen, &bcmd)) {
-		syslog(LOG_ERR, "bcmd_parse_nvlistcmd failed");
+		dlog(LOG_ERR, "bcmd_parse_nvlistcmd failed");
 		result = -1;
 	}
 
@@ -1042,14 +2272,14 @@ bd_recv_ondata(void *ctx, uid_t uid, pid_t pid, const char *cmd,
 	 */
 	if (!result) {
 		if (!strcmp(bcmd.cmd, "startvm")) {
-			syslog(LOG_INFO, "calling bd_startvm");
+			dlog(LOG_DEBUG, "calling bd_startvm");
 			result = bd_startvm(bd, bcmd.vmname);
-			syslog(LOG_INFO, "bd_startm result = %d", result);
+			dlog(LOG_DEBUG, "bd_startm result = %d", result);
 		}
 		if (!strcmp(bcmd.cmd, "stopvm")) {
-			syslog(LOG_INFO, "calling bd_stopvm");
+			dlog(LOG_DEBUG, "calling bd_stopvm");
 			result = bd_stopvm(bd, bcmd.vmname);
-			syslog(LOG_INFO, "bd_stopvm result = %d", result);
+			dlog(LOG_DEBUG, "bd_stopvm result = %d", result);
 		}
 		if (!strcmp(bcmd.cmd, "status") && bmr) {
 			/* bmr reply manager is given to info func for
@@ -1058,20 +2288,36 @@ bd_recv_ondata(void *ctx, uid_t uid, pid_t pid, const char *cmd,
 			result = bd_reply_info(bd, bmr);
 		}
 		if (!strcmp(bcmd.cmd, "resetfail")) {
-			syslog(LOG_INFO, "calling bd_resetfailvm");
+			dlog(LOG_DEBUG, "calling bd_resetfailvm");
 			result = bd_resetfailvm(bd, bcmd.vmname);
-			syslog(LOG_INFO, "bd_resetfailvm result = %d", result);
+			dlog(LOG_DEBUG, "bd_resetfailvm result = %d", result);
+		}
+		if (!strcmp(bcmd.cmd, "shutdownstatus") && bmr) {
+			result = bd_reply_shutdownstatus(bd, bmr);
+		}
+		if (!strcmp(bcmd.cmd, "logstats") && bmr) {
+			result = bd_reply_logstats(bd, bcmd.vmname, bmr);
+		}
+		if (!strcmp(bcmd.cmd, "logs") && bmr) {
+			result = bd_reply_logs(bd, &bcmd, bmr);
+		}
+		if (!strcmp(bcmd.cmd, "waitstate") && bmr) {
+			/* blocks this connection only */
+			result = bd_reply_waitstate(bd, &bcmd, bmr);
 		}
 	}
 
 	if ((BD_ERR_UNKNOWNVMNAME == result) && (ENOENT == errno)) {
 		bmr->short_reply(bmr->ctx, "unknown vm");
 	}	
+	if (BD_ERR_SHUTTINGDOWN == result) {
+		bmr->short_reply(bmr->ctx, "shutting down");
+	}
 	
 	/* free memory again */
 	bcmd_freestatic(&bcmd);
 
-	syslog(LOG_INFO, "bd_recv_ondata stop");
+	dlog(LOG_DEBUG, "bd_recv_ondata stop");
 	
 	return result;
 }
@@ -1176,6 +2422,344 @@ bd_getinfo(struct bhyve_director *bd)
 	return bvmmi;
 }
 
+/*
+ * check whether a vm has no process and no pending hooks
+ */
+bool
+bwv_is_down(struct bhyve_watched_vm *bwv)
+{
+	/* still running hooks */
+	if (psv_is_busy(bwv->state))
+		return false;
+
+	switch (psv_getstate(bwv->state)) {
+	case INIT:
+	case STOPPED:
+	case RESTART_STOPPED:
+	case FAILED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * account for a vm that finished stopping during fleet shutdown
+ */
+void
+bd_shutdown_progress(struct bhyve_director *bd, struct bhyve_watched_vm *bwv)
+{
+	size_t stopped = 0, total = 0;
+
+	if (pthread_mutex_lock(&bd->mtx))
+		return;
+
+	stopped = ++bd->shutdown.stopped;
+	total = bd->shutdown.total;
+
+	pthread_mutex_unlock(&bd->mtx);
+
+	syslog(LOG_NOTICE, "vm \"%s\" is down (%zu of %zu)",
+	       bc_get_name(bwv->config), stopped, total);
+}
+
+/*
+ * wait until a vm process exits or the recheck interval passes
+ *
+ * returns ETIMEDOUT once the deadline has passed.
+ */
+int
+bd_shutdown_waitexit(struct bhyve_director *bd, uint64_t vmexits,
+		     const struct timespec *deadline)
+{
+	struct timespec wakeup = {0};
+	int result = 0;
+
+	clock_gettime(CLOCK_REALTIME, &wakeup);
+	if (timespeccmp(&wakeup, deadline, >=))
+		return ETIMEDOUT;
+
+	wakeup.tv_sec += BD_SHUTDOWN_RECHECK;
+	if (timespeccmp(&wakeup, deadline, >))
+		wakeup = *deadline;
+
+	if (pthread_mutex_lock(&bd->mtx))
+		return EDEADLK;
+
+	while (!result && (vmexits == bd->vmexits))
+		result = pthread_cond_timedwait(&bd->cond_vmexit, &bd->mtx, &wakeup);
+
+	if (pthread_mutex_unlock(&bd->mtx))
+		return EDEADLK;
+
+	return 0;
+}
+
+/*
+ * stop vms in parallel and wait for all of them to be down
+ *
+ * only vms matching priority are handled; NULL matches all vms.
+ * vms that are still starting up are stopped once they are running.
+ *
+ * returns 0 once all vms are down, ETIMEDOUT if the deadline passed
+ * first.
+ */
+int
+bd_shutdown_wait(struct bhyve_director *bd,
+		 struct bhyve_shutdown_entry *entries, size_t count,
+		 const uint32_t *priority, const struct timespec *deadline)
+{
+	struct bhyve_shutdown_entry *entry = 0;
+	uint64_t vmexits = 0;
+	size_t idx = 0, pending = 0;
+	int result = 0;
+
+	do {
+		/* read exit counter before checking states to not miss an exit */
+		if (pthread_mutex_lock(&bd->mtx))
+			return EDEADLK;
+		vmexits = bd->vmexits;
+		if (pthread_mutex_unlock(&bd->mtx))
+			return EDEADLK;
+
+		pending = 0;
+
+		for (idx = 0; idx < count; idx++) {
+			entry = &entries[idx];
+
+			if (entry->done)
+				continue;
+			if (priority && (*priority != bc_get_priority(entry->bwv->config)))
+				continue;
+
+			if (bwv_is_down(entry->bwv)) {
+				entry->done = true;
+				bd_shutdown_progress(bd, entry->bwv);
+				continue;
+			}
+
+			pending++;
+
+			if (entry->signalled ||
+			    (RUNNING != psv_getstate(entry->bwv->state)))
+				continue;
+
+			/* sends TERM, escalated to KILL after stoptimeout */
+			if (psv_stopvm(entry->bwv->state, NULL)) {
+				/* a busy vm is retried on the next round */
+				if (EBUSY != errno)
+					syslog(LOG_ERR, "Failed to stop vm \"%s\"",
+					       bc_get_name(entry->bwv->config));
+			} else {
+				entry->signalled = true;
+			}
+		}
+
+		if (!pending)
+			return 0;
+		
+		result = bd_shutdown_waitexit(bd, vmexits, deadline);
+	} while (!result);
+
+	return result;
+}
+
+/*
+ * kill all vms that did not stop before the shutdown deadline
+ */
+void
+bd_shutdown_kill(struct bhyve_director *bd,
+		 struct bhyve_shutdown_entry *entries, size_t count)
+{
+	struct bhyve_shutdown_entry *entry = 0;
+	bhyve_vmstate_t state = INIT;
+	pid_t pid = 0;
+	size_t idx = 0, killed = 0;
+
+	for (idx = 0; idx < count; idx++) {
+		entry = &entries[idx];
+
+		if (entry->done || bwv_is_down(entry->bwv))
+			continue;
+
+		state = psv_getstate(entry->bwv->state);
+		pid = psv_getpid(entry->bwv->state);
+
+		switch (state) {
+		case RUNNING:
+		case RESTARTED:
+		case STOPPING:
+		case PRESTOP_BEFORE_RESTART:
+			break;
+		default:
+			/* hook scripts are still running, nothing to kill */
+			syslog(LOG_WARNING, "vm \"%s\" still in state %s at shutdown deadline",
+			       bc_get_name(entry->bwv->config),
+			       psv_state2string(state));
+			continue;
+		}
+
+		if (!pid)
+			continue;
+
+		if (kill(pid, SIGKILL) < 0) {
+			syslog(LOG_ERR, "Failed to kill vm \"%s\" (pid %d)",
+			       bc_get_name(entry->bwv->config), pid);
+			continue;
+		}
+
+		syslog(LOG_WARNING, "Killed vm \"%s\" (pid %d) at shutdown deadline",
+		       bc_get_name(entry->bwv->config), pid);
+		entry->signalled = true;
+		killed++;
+	}
+
+	if (pthread_mutex_lock(&bd->mtx))
+		return;
+
+	bd->shutdown.killed += killed;
+
+	pthread_mutex_unlock(&bd->mtx);
+}
+
+/*
+ * stop all vms before the daemon terminates
+ *
+ * vms are stopped in descending priority; all vms sharing a priority
+ * are stopped in parallel. Each vm gets its stoptimeout before it is
+ * killed. Once timeout seconds have passed, vms of later waves that
+ * were not asked to stop yet get BD_SHUTDOWN_GRACE seconds to do so,
+ * then whatever is still running is killed. No vm is started or
+ * restarted after this was called.
+ *
+ * returns 0 if all vms stopped in time, -1 with errno set otherwise.
+ */
+int
+bd_shutdown(struct bhyve_director *bd, uint32_t timeout)
+{
+	if (!bd) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct bhyve_shutdown_entry *entries = 0;
+	struct bhyve_watched_vm *bwv = 0;
+	struct timespec deadline = {0};
+	size_t count = 0, idx = 0;
+	uint32_t priority = 0;
+	bool found = false, graced = false;
+	int result = 0;
+
+	errno = 0;
+	if (!(count = bd_countvms(bd)) && errno)
+		return -1;
+
+	if (count && !(entries = calloc(count, sizeof(struct bhyve_shutdown_entry))))
+		return -1;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout;
+
+	if (pthread_mutex_lock(&bd->mtx)) {
+		free(entries);
+		errno = EDEADLK;
+		return -1;
+	}
+
+	bd->shutdown.active = true;
+	bd->shutdown.deadline = deadline.tv_sec;
+
+	SLIST_FOREACH(bwv, &bd->statelist, entries) {
+		if (idx >= count)
+			break;
+
+		entries[idx].bwv = bwv;
+		entries[idx].done = bwv_is_down(bwv);
+		if (!entries[idx].done)
+			bd->shutdown.total++;
+		idx++;
+	}
+	count = idx;
+
+	syslog(LOG_NOTICE, "Stopping %zu vms within %u seconds",
+	       bd->shutdown.total, timeout);
+
+	if (pthread_mutex_unlock(&bd->mtx)) {
+		free(entries);
+		errno = EDEADLK;
+		return -1;
+	}
+
+	/* vms waiting for a delayed restart stay down */
+	for (idx = 0; idx < count; idx++) {
+		if (1 == tw_cancel(bd->tw, &entries[idx].bwv->restart_timer))
+			psv_abortreboot(entries[idx].bwv->state);
+	}
+
+	/* stop one priority after the other, highest first */
+	while (!result) {
+		found = false;
+
+		for (idx = 0; idx < count; idx++) {
+			if (entries[idx].done)
+				continue;
+			if (!found || (bc_get_priority(entries[idx].bwv->config) > priority))
+				priority = bc_get_priority(entries[idx].bwv->config);
+			found = true;
+		}
+
+		if (!found)
+			break;
+
+		syslog(LOG_INFO, "Stopping vms with priority %u", priority);
+		result = bd_shutdown_wait(bd, entries, count, &priority, &deadline);
+	}
+
+	/* vms of later waves were never asked to stop, do so before killing */
+	for (idx = 0; (ETIMEDOUT == result) && (idx < count); idx++) {
+		if (!entries[idx].done && !entries[idx].signalled)
+			break;
+	}
+
+	if ((ETIMEDOUT == result) && (idx < count)) {
+		syslog(LOG_WARNING, "Shutdown deadline passed, stopping remaining vms");
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += BD_SHUTDOWN_GRACE;
+		graced = !bd_shutdown_wait(bd, entries, count, NULL, &deadline);
+	}
+
+	if ((ETIMEDOUT == result) && !graced) {
+		syslog(LOG_WARNING, "Shutdown deadline passed, killing remaining vms");
+		bd_shutdown_kill(bd, entries, count);
+
+		/* give the kqueue thread time to reap them */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += BD_SHUTDOWN_KILLWAIT;
+		if (bd_shutdown_wait(bd, entries, count, NULL, &deadline))
+			syslog(LOG_ERR, "Not all vms are down after shutdown");
+	}
+
+	if (!pthread_mutex_lock(&bd->mtx)) {
+		syslog(LOG_NOTICE, "Shutdown complete, %zu of %zu vms stopped, %zu killed",
+		       bd->shutdown.stopped, bd->shutdown.total,
+		       bd->shutdown.killed);
+		pthread_mutex_unlock(&bd->mtx);
+	}
+
+	/* vms will not change state anymore, release waiting clients */
+	for (idx = 0; idx < count; idx++)
+		psv_closewaits(entries[idx].bwv->state);
+
+	free(entries);
+
+	if (result) {
+		errno = result;
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  * set config generator object
  */
@@ -1193,6 +2777,49 @@ bd_set_cgo(struct bhyve_director *bd,
 	return 0;
 }
 
+/*
+ * choose whether generated configs are passed to bhyve as arguments
+ * instead of a file; keepfile writes the file anyway for debugging
+ */
+int
+bd_set_configargs(struct bhyve_director *bd, bool args, bool keepfile)
+{
+	if (!bd) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	bd->config_args = args;
+	bd->config_keepfile = keepfile;
+
+	return 0;
+}
+
+/*
+ * let a hook executor launch hook scripts of all vms
+ *
+ * the executor must stay valid until the director was released.
+ */
+int
+bd_set_hookexecutor(struct bhyve_director *bd, struct hook_executor *hke)
+{
+	struct kevent event = {0};
+
+	if (!bd || !hke) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	EV_SET(&event, hke_get_eventfd(hke), EVFILT_READ, EV_ADD | EV_ENABLE,
+	       0, 0, 0);
+	if (kevent(bd->kqueuefd, &event, 1, NULL, 0, NULL) < 0)
+		return -1;
+
+	bd->hke = hke;
+
+	return 0;
+}
+
 /*
  * release a previously allocated director
  */
@@ -1203,12 +2830,17 @@ bd_free(struct bhyve_director *bd)
 		return;
 
 	struct bhyve_watched_vm *vm = 0;
+	struct bhyve_hook_exit *bhe = 0;
 
 	if (bd_thread_stop(bd)) {
 		/* TODO should probably use err instead */
 		return;
 	}
 
+	dlog(LOG_INFO, "Wrote %ju generated vm configurations, skipped %ju unchanged",
+	     (uintmax_t) atomic_load(&bd->configs_generated),
+	     (uintmax_t) atomic_load(&bd->configs_skipped));
+
 	if (pthread_mutex_lock(&bd->mtx)) {
 		errno = EDEADLK;
 		return;
@@ -1237,13 +2869,22 @@ bd_free(struct bhyve_director *bd)
 		bwv_free(vm);
 	}
 
+	while (!LIST_EMPTY(&bd->hookexits)) {
+		bhe = LIST_FIRST(&bd->hookexits);
+		LIST_REMOVE(bhe, entries);
+		free(bhe);
+	}
+
 	pthread_mutex_unlock(&bd->mtx);
 	pthread_cond_destroy(&bd->cond_ready);
 	pthread_cond_destroy(&bd->reboot_wakeup);
+	pthread_cond_destroy(&bd->cond_vmexit);
 	pthread_mutex_destroy(&bd->mtx);
 
 	close(bd->kqueuefd);
 	bd->kqueuefd = 0;
 
+	tw_free(bd->tw);
+
 	free(bd);
 }
@@ -31,6 +31,7 @@
 #include "bhyve_config_object.h"
 #include "bhyve_messagesub_object.h"
 #include "config_generator_object.h"
+#include "hook_executor.h"
 
 #include "../liblogging/log_director.h"
 
@@ -41,6 +42,8 @@ struct bhyve_director *bd_new(struct bhyve_configuration_store_obj *bcso,
 			      struct log_director *ld);
 void bd_free(struct bhyve_director *bd);
 uint64_t bd_getmsgcount(struct bhyve_director *bd);
+void bd_get_configstats(struct bhyve_director *bd, uint64_t *generated,
+			uint64_t *skipped);
 int bd_startvm(struct bhyve_director *bd, const char *name);
 int bd_resetfailvm(struct bhyve_director *bd, const char *name);
 int bd_stopvm(struct bhyve_director *bd, const char *name);
@@ -48,6 +51,11 @@ struct bhyve_vm_manager_info *bd_getinfo(struct bhyve_director *bd);
 int
 bd_set_cgo(struct bhyve_director *bd,
 	   struct config_generator_object *cgo);
+int bd_set_configargs(struct bhyve_director *bd, bool args, bool keepfile);
+int bd_set_hookexecutor(struct bhyve_director *bd, struct hook_executor *hke);
 int bd_runautostart(struct bhyve_director *bd);
+int bd_shutdown(struct bhyve_director *bd, uint32_t timeout);
+int bd_waitstate(struct bhyve_director *bd, const char *vmnames, uint32_t set,
+		 uint32_t timeout, char *reply, size_t replylen);
 
 #endif /* __BHYVE_DIRECTOR_H__ */
@@ -42,5 +42,7 @@
 #define BD_ERR_VMSTATENOFAIL 164 /* vm is not in failed state */
 #define BD_ERR_VMCONFGENFAIL 163 /* failed to generate vm config */
 #define BD_ERR_UNKNOWNVMNAME 162 /* unknown virtual machine name */
+#define BD_ERR_SHUTTINGDOWN  161 /* director is shutting down */
+#define BD_ERR_WAITTIMEDOUT  160 /* vm did not reach the state in time */
 
 #endif /* __BHYVE_DIRECTOR_ERRORS_H__ */
@@ -39,6 +39,8 @@ struct bhyve_messagesub_replymgr {
 
 	int(*short_reply)(void *ctx, const char*msg);
 	int(*reply)(void *ctx, const void *buffer, size_t bufferlen);
+	/* send data to the client before the reply, may be NULL */
+	int(*stream)(void *ctx, const void *buffer, size_t bufferlen);
 };
 
 /*
@@ -58,28 +58,6 @@ bup_find_subparser(struct bhyve_uclparser_item *bup, size_t bup_count, const cha
 	return NULL;
 }
 
-/*
- * look up matching mapping
- */
-struct nvlistitem_mapping *
-bup_findmapping(struct nvlistitem_mapping *mappings, size_t count, const char *varname)
-{
-	if (!mappings || !count || !varname) {
-		errno = EINVAL;
-		return NULL;
-	}
-	
-	while (count && strcmp(mappings->varname, varname)) {
-		mappings++;
-		count--;
-	}
-
-	if (count)
-		return mappings;
-
-	return NULL;
-}
-
 /*
  * read list configuration from ucl object and delegate sub parsing to
  * a custom handler function
@@ -109,7 +87,7 @@ bup_parselistfromucl(void *ctx, const ucl_object_t *confobj,
  */
 int
 bup_generic_parsefromucl(void *ctx, const ucl_object_t *confobj,
-		 struct nvlistitem_mapping *mappings, size_t mappings_count,
+		 struct parser_mapping_index *mappings,
 		 struct bhyve_uclparser_item *subparsers, size_t subparsers_count)
 {
 	ucl_object_iter_t it = NULL, it_obj = NULL;
@@ -131,9 +109,10 @@ bup_generic_parsefromucl(void *ctx, const ucl_object_t *confobj,
 		keyname = ucl_object_key(cur);
 		
 		/* look up key name in config mapping */
-		mapping = bup_findmapping(mappings, mappings_count, keyname);
+		mapping = pmi_lookup(mappings, keyname);
 		if (!mapping) {
 			/* attempt lookup as function parser */
+			bui = 0;
 			if (subparsers)
 				bui = bup_find_subparser(subparsers, subparsers_count, keyname);
 			if (bui && bui->delegate_func) {
@@ -205,10 +184,9 @@ bup_generic_parsefromucl(void *ctx, const ucl_object_t *confobj,
  */
 int
 bup_parsefromucl(struct bhyve_configuration *bc, const ucl_object_t *confobj,
-		 struct nvlistitem_mapping *mappings, size_t mappings_count,
+		 struct parser_mapping_index *mappings,
 		 struct bhyve_uclparser_item *subparsers, size_t subparsers_count)
 {
-	return bup_generic_parsefromucl(bc, confobj, mappings,
-					mappings_count, subparsers,
+	return bup_generic_parsefromucl(bc, confobj, mappings, subparsers,
 					subparsers_count);
 }
@@ -51,14 +51,13 @@ struct bhyve_uclparser_item *bup_find_subparser(struct bhyve_uclparser_item *bup
 
 int
 bup_generic_parsefromucl(void *ctx, const ucl_object_t *confobj,
-			 struct nvlistitem_mapping *mappings,
-			 size_t mappings_count,
+			 struct parser_mapping_index *mappings,
 			 struct bhyve_uclparser_item *subparsers,
 			 size_t subparsers_count);
 
 int
 bup_parsefromucl(struct bhyve_configuration *bc, const ucl_object_t *confobj,
-		 struct nvlistitem_mapping *mappings, size_t mappings_count,
+		 struct parser_mapping_index *mappings,
 		 struct bhyve_uclparser_item *subparsers, size_t subparsers_count);
 
 int
@@ -28,15 +28,21 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syslog.h>
 #include <unistd.h>
 
 #include <private/ucl/ucl.h>
 
 #include "bhyve_config.h"
 #include "bhyve_config_console.h"
+#include "bhyve_config_hooks.h"
 #include "bhyve_uclparser.h"
 
 #include "../libcommand/nvlist_mapping.h"
+#include "../libutils/memory_arena.h"
+
+/* INTERNAL API */
+struct memory_arena *bc_get_arena(const struct bhyve_configuration *bc);
 
 /*
  * parse specific console
@@ -47,25 +53,20 @@ buf_parse_console(void *ctx, const char *consolename,
 {
 	struct bhyve_configuration_console_list *bccl = ctx;
 	struct bhyve_configuration_console *bcc = 0;
-	struct nvlistitem_mapping *mappings = bcc_get_mapping();
+	int result = 0;
 
-	/* set default name and enable by default */
-	if (!(bcc = bcc_new(consolename, true)))
+	/* enable by default */
+	if (!(bcc = bccl_newconsole(bccl, true)))
 		return -1;
 
-	if (bup_generic_parsefromucl(bcc, confobj,
-					 mappings, bcc_get_mapping_count(),
-					 NULL, 0)) {
-		bccl_free(bccl);
-		return -1;
-	}
+	result = bup_generic_parsefromucl(bcc, confobj,
+					  bcc_get_mapping_index(), NULL, 0);
 
-	if (bccl_add(bccl, bcc)) {
-		bcc_free(bcc);
+	/* the name defaults to the key of the console */
+	if (bccl_adoptstrings(bccl, bcc, consolename) || result)
 		return -1;
-	}
-	
-	return 0;
+
+	return bccl_add(bccl, bcc);
 }
 
 /*
@@ -78,17 +79,75 @@ buf_parse_console_list(struct bhyve_configuration *bc,
 {
 	struct bhyve_configuration_console_list *bccl = 0;
 
-	/* allocate a new console list */
-	if (!(bccl = bccl_new()))
+	/* allocate a new console list along with the configuration */
+	if (!(bccl = bccl_new(bc_get_arena(bc))))
 		return -1;
 
-	if (bup_parselistfromucl(bccl, confobj, buf_parse_console)) {
-		bccl_free(bccl);
+	if (bup_parselistfromucl(bccl, confobj, buf_parse_console))
 		return -1;
-	}
 
 	if (ctx)
 		*ctx = bccl;
 	
 	return 0;
 }
+
+/*
+ * parse dependencies of a specific hook stage
+ */
+int
+buf_parse_hookstage(void *ctx, const char *stagename,
+		    const ucl_object_t *confobj)
+{
+	struct bhyve_configuration_hooks *bch = ctx;
+	const ucl_object_t *after = 0, *cur = 0;
+	ucl_object_iter_t it = NULL;
+	int stage = 0;
+
+	if ((stage = bch_lookupstage(stagename)) < 0) {
+		syslog(LOG_ERR, "Unknown hook stage \"%s\"", stagename);
+		return -1;
+	}
+
+	/* keep default order if nothing is declared */
+	if (!(after = ucl_object_lookup(confobj, "after")))
+		return 0;
+
+	bch_clear_after(bch, stage);
+
+	/* accepts a single stage name or a list of them */
+	while ((cur = ucl_iterate_object(after, &it, true))) {
+		if (bch_add_after(bch, stage, ucl_object_tostring(cur)))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * parses hook stage sub elements
+ */
+int
+buf_parse_hooks(struct bhyve_configuration *bc,
+		const ucl_object_t *confobj,
+		void **ctx)
+{
+	struct bhyve_configuration_hooks *bch = 0;
+
+	/* allocate hooks with default order */
+	if (!(bch = bch_new()))
+		return -1;
+
+	if (bup_parselistfromucl(bch, confobj, buf_parse_hookstage)) {
+		/* stages keep running one after another */
+		bch_free(bch);
+		return -1;
+	}
+
+	if (ctx) {
+		bch_free(*ctx);
+		*ctx = bch;
+	}
+
+	return 0;
+}
@@ -38,4 +38,9 @@ buf_parse_console_list(struct bhyve_configuration *bc,
 		       const ucl_object_t *confobj,
 		       void **ctx);
 
+int
+buf_parse_hooks(struct bhyve_configuration *bc,
+		const ucl_object_t *confobj,
+		void **ctx);
+
 #endif /* __BHYVE_UCLPARSER_FUNCS_H__ */
@@ -0,0 +1,474 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/nv.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "config_cache.h"
+#include "../libutils/daemon_log.h"
+
+/* read size used while hashing config files */
+#define CFC_READ_CHUNK 4096
+
+/*
+ * configurations of a previous start, looked up by config file path
+ *
+ * The cache file holds a header and a packed nvlist. Its "files" array
+ * has one entry per config file, sorted by path, carrying the size,
+ * mtime and content hash of the file and the configurations parsed from
+ * it.
+ */
+struct config_cache {
+	nvlist_t *root;
+	/* entries of root, sorted by path */
+	const nvlist_t * const *files;
+	size_t count;
+};
+
+/*
+ * continue an FNV-1a hash over buffer
+ */
+uint64_t
+cfc_hash(uint64_t hash, const void *buffer, size_t len)
+{
+	const unsigned char *pos = buffer;
+
+	while (len--) {
+		hash ^= *pos++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/*
+ * hash the contents of a file
+ *
+ * returns 0 on success.
+ */
+int
+cfc_hashfile(const char *path, uint64_t *hash)
+{
+	unsigned char buffer[CFC_READ_CHUNK];
+	ssize_t len = 0;
+	int fd = -1;
+
+	if (!path || !hash) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+
+	*hash = CFC_HASH_INIT;
+	while ((len = read(fd, buffer, sizeof(buffer))) > 0)
+		*hash = cfc_hash(*hash, buffer, len);
+
+	close(fd);
+
+	return (len < 0) ? -1 : 0;
+}
+
+/*
+ * compare a path with the path of a cache entry
+ */
+int
+cfc_cmppath(const void *key, const void *entry)
+{
+	return strcmp(key, nvlist_get_string(*(const nvlist_t * const *)entry,
+					     "path"));
+}
+
+/*
+ * order cache entries by path
+ */
+int
+cfc_cmpentries(const void *a, const void *b)
+{
+	return strcmp(nvlist_get_string(*(nvlist_t * const *)a, "path"),
+		      nvlist_get_string(*(nvlist_t * const *)b, "path"));
+}
+
+/*
+ * check that every entry is complete and the entries are sorted
+ *
+ * returns 0 if the entries can be used for lookups.
+ */
+int
+cfc_checkentries(const struct config_cache *cfc)
+{
+	const nvlist_t *entry = NULL;
+	size_t idx = 0;
+
+	for (idx = 0; idx < cfc->count; idx++) {
+		entry = cfc->files[idx];
+		if (!nvlist_exists_string(entry, "path") ||
+		    !nvlist_exists_number(entry, "size") ||
+		    !nvlist_exists_number(entry, "mtime_sec") ||
+		    !nvlist_exists_number(entry, "mtime_nsec") ||
+		    !nvlist_exists_number(entry, "hash"))
+			return -1;
+
+		if (idx && (cfc_cmpentries(&cfc->files[idx - 1], &cfc->files[idx]) >= 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * map a cache file and unpack its contents into cfc
+ *
+ * returns 0 if the file is a valid cache for searchpath and schema.
+ */
+int
+cfc_load(struct config_cache *cfc, const char *cachefile,
+	 const char *searchpath, uint64_t schema)
+{
+	struct config_cache_header hdr = {0};
+	struct stat st = {0};
+	const char *payload = NULL;
+	void *map = MAP_FAILED;
+	nvlist_t *root = NULL;
+	int fd = -1, result = -1;
+
+	if ((fd = open(cachefile, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+
+	do {
+		/* only trust a cache nobody else could have written */
+		if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode) ||
+		    (st.st_uid != geteuid()) ||
+		    (st.st_mode & (S_IWGRP | S_IWOTH)))
+			break;
+
+		if ((size_t)st.st_size < sizeof(hdr))
+			break;
+
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED == map)
+			break;
+
+		memcpy(&hdr, map, sizeof(hdr));
+		payload = (const char *)map + sizeof(hdr);
+		if (memcmp(hdr.magic, CFC_MAGIC, sizeof(hdr.magic)) ||
+		    (hdr.version != CFC_VERSION) ||
+		    (hdr.headersize != sizeof(hdr)) ||
+		    (hdr.schema != schema) ||
+		    (hdr.payloadsize != st.st_size - sizeof(hdr)))
+			break;
+
+		if (cfc_hash(CFC_HASH_INIT, payload, hdr.payloadsize) !=
+		    hdr.payloadhash)
+			break;
+
+		/* unpacked straight from the mapping */
+		if (!(root = nvlist_unpack(payload, hdr.payloadsize, 0)))
+			break;
+
+		if (!nvlist_exists_string(root, "searchpath") ||
+		    strcmp(nvlist_get_string(root, "searchpath"), searchpath))
+			break;
+
+		cfc->root = root;
+		root = NULL;
+		if (nvlist_exists_nvlist_array(cfc->root, "files"))
+			cfc->files = nvlist_get_nvlist_array(cfc->root, "files",
+							     &cfc->count);
+
+		if (cfc_checkentries(cfc)) {
+			nvlist_destroy(cfc->root);
+			cfc->root = NULL;
+			cfc->files = NULL;
+			cfc->count = 0;
+			break;
+		}
+
+		result = 0;
+	} while (0);
+
+	nvlist_destroy(root);
+	if (MAP_FAILED != map)
+		munmap(map, st.st_size);
+	close(fd);
+
+	return result;
+}
+
+/*
+ * open the cache of a configuration directory; a missing or invalid
+ * cache file results in an empty cache
+ *
+ * returns NULL on error.
+ */
+struct config_cache *
+cfc_new(const char *cachefile, const char *searchpath, uint64_t schema)
+{
+	struct config_cache *cfc = NULL;
+
+	if (!cachefile || !searchpath) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(cfc = malloc(sizeof(struct config_cache))))
+		return NULL;
+
+	bzero(cfc, sizeof(struct config_cache));
+
+	if (cfc_load(cfc, cachefile, searchpath, schema))
+		dlog(LOG_INFO, "Config cache \"%s\" missing or outdated, "
+		     "parsing all config files", cachefile);
+
+	return cfc;
+}
+
+/*
+ * release a config cache
+ */
+void
+cfc_free(struct config_cache *cfc)
+{
+	if (!cfc)
+		return;
+
+	nvlist_destroy(cfc->root);
+	free(cfc);
+}
+
+/*
+ * get number of config files in the cache
+ */
+size_t
+cfc_get_count(const struct config_cache *cfc)
+{
+	return cfc ? cfc->count : 0;
+}
+
+/*
+ * look up the cache entry of a config file with stat information st
+ *
+ * An entry is used if size and mtime are unchanged or, failing that,
+ * the content hash matches; stale is set in the latter case. hash
+ * receives the content hash of the file. This only reads from the
+ * cache, so it may be called from several threads at once.
+ *
+ * returns NULL if the file has to be parsed.
+ */
+const nvlist_t *
+cfc_lookup(const struct config_cache *cfc, const char *configfile,
+	   const struct stat *st, uint64_t *hash, bool *stale)
+{
+	const nvlist_t * const *found = NULL;
+	const nvlist_t *entry = NULL;
+
+	*hash = 0;
+	*stale = false;
+
+	if (cfc && cfc->count)
+		found = bsearch(configfile, cfc->files, cfc->count,
+				sizeof(*cfc->files), cfc_cmppath);
+	if (found)
+		entry = *found;
+
+	if (entry &&
+	    (nvlist_get_number(entry, "size") == (uint64_t)st->st_size) &&
+	    (nvlist_get_number(entry, "mtime_sec") == (uint64_t)st->st_mtim.tv_sec) &&
+	    (nvlist_get_number(entry, "mtime_nsec") == (uint64_t)st->st_mtim.tv_nsec)) {
+		*hash = nvlist_get_number(entry, "hash");
+		return entry;
+	}
+
+	if (cfc_hashfile(configfile, hash))
+		return NULL;
+
+	if (entry &&
+	    (nvlist_get_number(entry, "size") == (uint64_t)st->st_size) &&
+	    (nvlist_get_number(entry, "hash") == *hash)) {
+		*stale = true;
+		return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * create the cache entry of a config file; the caller adds the parsed
+ * configurations as "configs" nvlist array
+ *
+ * returns NULL on error.
+ */
+nvlist_t *
+cfc_newentry(const char *configfile, const struct stat *st, uint64_t hash)
+{
+	nvlist_t *entry = NULL;
+
+	if (!configfile || !st) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(entry = nvlist_create(0)))
+		return NULL;
+
+	nvlist_add_string(entry, "path", configfile);
+	nvlist_add_number(entry, "size", st->st_size);
+	nvlist_add_number(entry, "mtime_sec", st->st_mtim.tv_sec);
+	nvlist_add_number(entry, "mtime_nsec", st->st_mtim.tv_nsec);
+	nvlist_add_number(entry, "hash", hash);
+
+	if (nvlist_error(entry)) {
+		errno = nvlist_error(entry);
+		nvlist_destroy(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*
+ * write all of buffer to fd
+ *
+ * returns 0 on success.
+ */
+int
+cfc_writeall(int fd, const void *buffer, size_t len)
+{
+	const char *pos = buffer;
+	ssize_t written = 0;
+
+	while (len) {
+		if ((written = write(fd, pos, len)) < 0) {
+			if (EINTR == errno)
+				continue;
+			return -1;
+		}
+		pos += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+/*
+ * replace the cache file with the given entries; entries is an allocated
+ * array, which is released together with the entries in it
+ *
+ * returns 0 on success.
+ */
+int
+cfc_write(const char *cachefile, const char *searchpath, uint64_t schema,
+	  nvlist_t **entries, size_t count)
+{
+	struct config_cache_header hdr = {0};
+	char tmpfile[PATH_MAX] = {0};
+	nvlist_t *root = NULL;
+	void *payload = NULL;
+	size_t payloadsize = 0, idx = 0;
+	int fd = -1, result = -1;
+
+	if (!cachefile || !searchpath || (count && !entries)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!(root = nvlist_create(0))) {
+		for (idx = 0; idx < count; idx++)
+			nvlist_destroy(entries[idx]);
+		free(entries);
+		return -1;
+	}
+
+	nvlist_add_string(root, "searchpath", searchpath);
+	if (count) {
+		/* lookups rely on the entries being sorted */
+		qsort(entries, count, sizeof(nvlist_t *), cfc_cmpentries);
+		nvlist_move_nvlist_array(root, "files", entries, count);
+	} else
+		free(entries);
+
+	do {
+		if (nvlist_error(root)) {
+			errno = nvlist_error(root);
+			break;
+		}
+
+		if (!(payload = nvlist_pack(root, &payloadsize)))
+			break;
+
+		memcpy(hdr.magic, CFC_MAGIC, sizeof(hdr.magic));
+		hdr.version = CFC_VERSION;
+		hdr.headersize = sizeof(hdr);
+		hdr.schema = schema;
+		hdr.payloadsize = payloadsize;
+		hdr.payloadhash = cfc_hash(CFC_HASH_INIT, payload, payloadsize);
+
+		if (snprintf(tmpfile, sizeof(tmpfile), "%s.XXXXXX",
+			     cachefile) >= (int)sizeof(tmpfile)) {
+			errno = ENAMETOOLONG;
+			break;
+		}
+
+		/* readers only ever see a complete cache file */
+		if ((fd = mkstemp(tmpfile)) < 0)
+			break;
+
+		if (cfc_writeall(fd, &hdr, sizeof(hdr)) ||
+		    cfc_writeall(fd, payload, payloadsize)) {
+			unlink(tmpfile);
+			break;
+		}
+
+		if (close(fd) || rename(tmpfile, cachefile)) {
+			fd = -1;
+			unlink(tmpfile);
+			break;
+		}
+		fd = -1;
+
+		result = 0;
+	} while (0);
+
+	if (fd >= 0)
+		close(fd);
+	free(payload);
+	nvlist_destroy(root);
+
+	return result;
+}
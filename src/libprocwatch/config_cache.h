@@ -0,0 +1,75 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __CONFIG_CACHE_H__
+#define __CONFIG_CACHE_H__
+
+#include <sys/types.h>
+#include <sys/nv.h>
+#include <sys/stat.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* identifies a config cache file */
+#define CFC_MAGIC "VMSDCFC"
+/* bump whenever the layout of the cache file changes */
+#define CFC_VERSION 1
+
+/* initial value of cfc_hash */
+#define CFC_HASH_INIT 14695981039346656037ULL
+
+/*
+ * fixed size header in front of the packed nvlist of a cache file
+ */
+struct config_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t headersize;
+	/* fingerprint of the serialized configuration fields */
+	uint64_t schema;
+	uint64_t payloadsize;
+	uint64_t payloadhash;
+};
+
+struct config_cache;
+
+struct config_cache *cfc_new(const char *cachefile, const char *searchpath,
+			     uint64_t schema);
+void cfc_free(struct config_cache *cfc);
+size_t cfc_get_count(const struct config_cache *cfc);
+const nvlist_t *cfc_lookup(const struct config_cache *cfc,
+			   const char *configfile, const struct stat *st,
+			   uint64_t *hash, bool *stale);
+nvlist_t *cfc_newentry(const char *configfile, const struct stat *st,
+		       uint64_t hash);
+int cfc_write(const char *cachefile, const char *searchpath, uint64_t schema,
+	      nvlist_t **entries, size_t count);
+uint64_t cfc_hash(uint64_t hash, const void *buffer, size_t len);
+int cfc_hashfile(const char *path, uint64_t *hash);
+
+#endif /* __CONFIG_CACHE_H__ */
@@ -41,6 +41,15 @@ struct config_generator_object {
 	 * returns 0 on success
 	 */
 	int(*generate_config_file)(const struct bhyve_configuration *bc, const char *filename);
+
+	/*
+	 * Conversion into bhyve arguments following the application path,
+	 * optional
+	 *
+	 * returns a NULL terminated list in a single allocation, released
+	 * with free(), or NULL on failure
+	 */
+	char **(*generate_config_args)(const struct bhyve_configuration *bc);
 };
 
 #endif /* __CONFIG_GENERATOR_H__ */
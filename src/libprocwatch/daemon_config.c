@@ -43,6 +43,23 @@ struct daemon_config {
 	size_t tapid_max;
 	size_t nmdmid_min;
 	size_t nmdmid_max;
+	/* number of seconds to wait for all vms to stop on shutdown */
+	uint32_t shutdown_timeout;
+	/* launch hook scripts from a helper process */
+	bool hook_server;
+	/* rotate vm logs beyond log_maxsize bytes, keeping log_keep segments */
+	uint32_t log_maxsize;
+	uint32_t log_keep;
+	bool log_compress;
+	/* number of log ingest threads, 0 for one per cpu */
+	uint32_t log_threads;
+	/* bytes per second each vm may log, 0 for no limit */
+	uint32_t log_rate;
+	uint32_t log_burst;
+	/* pass generated vm settings as arguments instead of a file */
+	bool config_args;
+	/* still write the generated file when passing arguments */
+	bool config_keepfile;
 };
 
 /*
@@ -72,11 +89,91 @@ struct nvlistitem_mapping dconf_nvlist2config[] = {
 		.value_type = UINT32,
 		.size = sizeof(uint32_t),
 		.varname = "nmdm_max"
+	},
+	{
+		.offset = offsetof(struct daemon_config, shutdown_timeout),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "shutdown_timeout"
+	},
+	{
+		.offset = offsetof(struct daemon_config, hook_server),
+		.value_type = BOOLEAN,
+		.size = sizeof(bool),
+		.varname = "hook_server"
+	},
+	{
+		.offset = offsetof(struct daemon_config, log_maxsize),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "log_maxsize"
+	},
+	{
+		.offset = offsetof(struct daemon_config, log_keep),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "log_keep"
+	},
+	{
+		.offset = offsetof(struct daemon_config, log_compress),
+		.value_type = BOOLEAN,
+		.size = sizeof(bool),
+		.varname = "log_compress"
+	},
+	{
+		.offset = offsetof(struct daemon_config, log_threads),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "log_threads"
+	},
+	{
+		.offset = offsetof(struct daemon_config, log_rate),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "log_rate"
+	},
+	{
+		.offset = offsetof(struct daemon_config, log_burst),
+		.value_type = UINT32,
+		.size = sizeof(uint32_t),
+		.varname = "log_burst"
+	},
+	{
+		.offset = offsetof(struct daemon_config, config_args),
+		.value_type = BOOLEAN,
+		.size = sizeof(bool),
+		.varname = "config_args"
+	},
+	{
+		.offset = offsetof(struct daemon_config, config_keepfile),
+		.value_type = BOOLEAN,
+		.size = sizeof(bool),
+		.varname = "config_keepfile"
 	}
 };
 
+/* hashed lookup of dconf_nvlist2config entries */
+struct parser_mapping_index dconf_nvlist2config_index =
+	PARSER_MAPPING_INDEX(dconf_nvlist2config);
+
 /* define lookup method */
-nvlistitem_mapping_lookupfunc(dconf_nvlist2config, dconf_findmapping);
+nvlistitem_mapping_lookupfunc(dconf_nvlist2config_index, dconf_findmapping);
+
+/*
+ * set default values for settings that may be omitted in config files
+ */
+void
+dconf_setdefaults(struct daemon_config *dc)
+{
+	bzero(dc, sizeof(struct daemon_config));
+
+	dc->shutdown_timeout = 120;
+	dc->log_maxsize = 10 * 1024 * 1024;
+	dc->log_keep = 5;
+	dc->log_compress = true;
+	dc->log_rate = 1024 * 1024;
+	dc->log_burst = 8 * 1024 * 1024;
+}
 
 /*
  * parse daemon_config from UCL config object
@@ -85,8 +182,7 @@ int
 dconf_parsefromucl(struct daemon_config *dc, const ucl_object_t *confobj)
 {
 	return bup_generic_parsefromucl(dc, confobj,
-				dconf_nvlist2config,
-				sizeof(dconf_nvlist2config) / sizeof(struct nvlistitem_mapping),
+				&dconf_nvlist2config_index,
 				NULL, 0);
 }
 
@@ -137,7 +233,7 @@ dconf_parseucl(struct daemon_config *dc, const char *configfile)
 			if (strcmp(configname, "vmstated"))
 				continue;
 			
-			bzero(dc, sizeof(struct daemon_config));
+			dconf_setdefaults(dc);
 
 			retcode = dconf_parsefromucl(dc, cur);
 			if (retcode)
@@ -170,7 +266,7 @@ dconf_new()
 	if (!dc)
 		return NULL;
 
-	bzero(dc, sizeof(struct daemon_config));
+	dconf_setdefaults(dc);
 	return dc;
 }
 
@@ -187,3 +283,65 @@ CREATE_GETTERFUNC_UINT32(daemon_config, dconf, tapid_min);
 CREATE_GETTERFUNC_UINT32(daemon_config, dconf, tapid_max);
 CREATE_GETTERFUNC_UINT32(daemon_config, dconf, nmdmid_min);
 CREATE_GETTERFUNC_UINT32(daemon_config, dconf, nmdmid_max);
+CREATE_GETTERFUNC_UINT32(daemon_config, dconf, shutdown_timeout);
+CREATE_GETTERFUNC_UINT32(daemon_config, dconf, log_maxsize);
+CREATE_GETTERFUNC_UINT32(daemon_config, dconf, log_keep);
+CREATE_GETTERFUNC_UINT32(daemon_config, dconf, log_threads);
+CREATE_GETTERFUNC_UINT32(daemon_config, dconf, log_rate);
+CREATE_GETTERFUNC_UINT32(daemon_config, dconf, log_burst);
+
+/*
+ * get whether hook scripts are launched from a helper process
+ */
+bool
+dconf_get_hook_server(const struct daemon_config *dc)
+{
+	if (!dc) {
+		errno = EINVAL;
+		return false;
+	}
+
+	return dc->hook_server;
+}
+
+/*
+ * get whether rotated vm logs are compressed
+ */
+bool
+dconf_get_log_compress(const struct daemon_config *dc)
+{
+	if (!dc) {
+		errno = EINVAL;
+		return false;
+	}
+
+	return dc->log_compress;
+}
+
+/*
+ * get whether generated vm settings are passed to bhyve as arguments
+ */
+bool
+dconf_get_config_args(const struct daemon_config *dc)
+{
+	if (!dc) {
+		errno = EINVAL;
+		return false;
+	}
+
+	return dc->config_args;
+}
+
+/*
+ * get whether generated config files are written along with arguments
+ */
+bool
+dconf_get_config_keepfile(const struct daemon_config *dc)
+{
+	if (!dc) {
+		errno = EINVAL;
+		return false;
+	}
+
+	return dc->config_keepfile;
+}
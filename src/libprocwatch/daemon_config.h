@@ -28,6 +28,8 @@
 #ifndef __DAEMON_CONFIG_H__
 #define __DAEMON_CONFIG_H__
 
+#include <stdbool.h>
+
 #include "../libcommand/nvlist_mapping.h"
 
 struct daemon_config;
@@ -44,5 +46,15 @@ uint32_t dconf_get_tapid_min(const struct daemon_config *);
 uint32_t dconf_get_tapid_max(const struct daemon_config *);
 uint32_t dconf_get_nmdmid_min(const struct daemon_config *);
 uint32_t dconf_get_nmdmid_max(const struct daemon_config *);
+uint32_t dconf_get_shutdown_timeout(const struct daemon_config *);
+bool dconf_get_hook_server(const struct daemon_config *);
+uint32_t dconf_get_log_maxsize(const struct daemon_config *);
+uint32_t dconf_get_log_keep(const struct daemon_config *);
+bool dconf_get_log_compress(const struct daemon_config *);
+uint32_t dconf_get_log_threads(const struct daemon_config *);
+uint32_t dconf_get_log_rate(const struct daemon_config *);
+uint32_t dconf_get_log_burst(const struct daemon_config *);
+bool dconf_get_config_args(const struct daemon_config *);
+bool dconf_get_config_keepfile(const struct daemon_config *);
 
 #endif /* __DAEMON_CONFIG_H__ */
@@ -0,0 +1,375 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "hook_cache.h"
+#include "process_watcher_object.h"
+
+/*
+ * a hook script the cache knows about
+ */
+struct hook_cache_entry {
+	/* name of the state, owned by the state list */
+	const char *name;
+	/* an executable script exists */
+	bool present;
+	/* open while the script file exists, to notice changes */
+	int fd;
+};
+
+/*
+ * remembers which hook scripts exist in a script directory
+ *
+ * The cache is only trusted while a watcher reports changes to the
+ * directory and the scripts in it. Without a watcher, each lookup
+ * checks the file system.
+ */
+struct hook_cache {
+	pthread_mutex_t mtx;
+
+	char *scriptpath;
+	struct hook_cache_entry *entries;
+	size_t count;
+
+	/* reports changes to watched files */
+	struct process_watcher_object *pwo;
+	struct process_state_vm *psv;
+
+	/* open directory while the cache is valid */
+	int dirfd;
+	bool valid;
+
+	/* number of directory scans */
+	uint64_t scans;
+};
+
+/*
+ * check whether path is an executable hook script
+ */
+bool
+hkc_checkpath(const char *exepath)
+{
+	struct stat file_info = {0};
+
+	if (stat(exepath, &file_info) < 0)
+		return false;
+
+	if (!S_ISREG(file_info.st_mode) || access(exepath, X_OK)) {
+		syslog(LOG_WARNING, "Ignoring hook \"%s\", it is not an "
+		       "executable file", exepath);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * close all files watched for the cache
+ */
+void
+hkc_closefds(struct hook_cache *hkc)
+{
+	size_t counter = 0;
+
+	for (counter = 0; counter < hkc->count; counter++) {
+		if (hkc->entries[counter].fd >= 0)
+			close(hkc->entries[counter].fd);
+		hkc->entries[counter].fd = -1;
+	}
+
+	if (hkc->dirfd >= 0)
+		close(hkc->dirfd);
+	hkc->dirfd = -1;
+}
+
+/*
+ * open and watch a file of the script directory
+ *
+ * returns -1 if the file cannot be watched.
+ */
+int
+hkc_watch(struct hook_cache *hkc, int fd)
+{
+	if (fd < 0)
+		return -1;
+
+	if (hkc->pwo->funcs->watchfile(hkc->pwo->ctx, hkc->psv, fd)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * scan the script directory; must be called with the cache locked
+ *
+ * the directory is watched before it is scanned, so a change during
+ * the scan invalidates the cache again.
+ */
+int
+hkc_refresh(struct hook_cache *hkc)
+{
+	struct hook_cache_entry *entry = 0;
+	struct stat file_info = {0};
+	size_t counter = 0;
+
+	hkc_closefds(hkc);
+	hkc->scans++;
+
+	hkc->dirfd = hkc_watch(hkc, open(hkc->scriptpath,
+					 O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+	if (hkc->dirfd < 0)
+		return -1;
+
+	for (counter = 0; counter < hkc->count; counter++) {
+		entry = &hkc->entries[counter];
+		entry->present = false;
+
+		if (fstatat(hkc->dirfd, entry->name, &file_info, 0) < 0) {
+			if (ENOENT == errno)
+				continue;
+			break;
+		}
+
+		/* changes of mode or content do not touch the directory */
+		entry->fd = hkc_watch(hkc, openat(hkc->dirfd, entry->name,
+						  O_RDONLY | O_CLOEXEC));
+		if (entry->fd < 0)
+			break;
+
+		if (S_ISREG(file_info.st_mode) &&
+		    !faccessat(hkc->dirfd, entry->name, X_OK, AT_EACCESS))
+			entry->present = true;
+		else
+			syslog(LOG_WARNING, "Ignoring hook \"%s/%s\", it is not an "
+			       "executable file", hkc->scriptpath, entry->name);
+	}
+
+	if (counter < hkc->count) {
+		hkc_closefds(hkc);
+		return -1;
+	}
+
+	hkc->valid = true;
+
+	return 0;
+}
+
+/*
+ * look up the hook script of a state
+ *
+ * puts the path of the script into exepath and returns true if an
+ * executable script exists.
+ */
+bool
+hkc_lookup(struct hook_cache *hkc, const char *name, char *exepath,
+	   size_t len)
+{
+	size_t counter = 0;
+	int present = -1;
+
+	if (!hkc || !name || !exepath) {
+		errno = EINVAL;
+		return false;
+	}
+
+	snprintf(exepath, len, "%s/%s", hkc->scriptpath, name);
+
+	if (pthread_mutex_lock(&hkc->mtx))
+		return hkc_checkpath(exepath);
+
+	if (hkc->pwo && (hkc->valid || !hkc_refresh(hkc))) {
+		for (counter = 0; counter < hkc->count; counter++) {
+			if (!strcmp(hkc->entries[counter].name, name)) {
+				present = hkc->entries[counter].present;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&hkc->mtx);
+
+	/* not cached, ask the file system */
+	if (present < 0)
+		return hkc_checkpath(exepath);
+
+	return present;
+}
+
+/*
+ * drop the cached state, the next lookup scans the directory again
+ */
+void
+hkc_invalidate(struct hook_cache *hkc)
+{
+	if (!hkc)
+		return;
+
+	if (pthread_mutex_lock(&hkc->mtx))
+		return;
+
+	hkc->valid = false;
+
+	pthread_mutex_unlock(&hkc->mtx);
+}
+
+/*
+ * get number of bytes allocated for a hook cache
+ */
+size_t
+hkc_get_memusage(const struct hook_cache *hkc)
+{
+	if (!hkc)
+		return 0;
+
+	return sizeof(struct hook_cache) + strlen(hkc->scriptpath) + 1 +
+		hkc->count * sizeof(struct hook_cache_entry);
+}
+
+/*
+ * get the number of directory scans
+ */
+uint64_t
+hkc_get_scans(struct hook_cache *hkc)
+{
+	uint64_t scans = 0;
+
+	if (!hkc) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (pthread_mutex_lock(&hkc->mtx))
+		return 0;
+
+	scans = hkc->scans;
+
+	pthread_mutex_unlock(&hkc->mtx);
+
+	return scans;
+}
+
+/*
+ * set the watcher reporting changes; enables caching
+ */
+struct hook_cache *
+hkc_withwatcher(struct hook_cache *hkc, struct process_watcher_object *pwo,
+		struct process_state_vm *psv)
+{
+	if (!hkc) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (pthread_mutex_lock(&hkc->mtx))
+		return NULL;
+
+	hkc_closefds(hkc);
+	hkc->valid = false;
+	hkc->pwo = (pwo && pwo->funcs->watchfile) ? pwo : NULL;
+	hkc->psv = psv;
+
+	pthread_mutex_unlock(&hkc->mtx);
+
+	return hkc;
+}
+
+/*
+ * create a new cache for the hooks of the given states
+ *
+ * the state names must remain valid for the lifetime of the cache.
+ */
+struct hook_cache *
+hkc_new(const char *scriptpath, const struct state_node *states, size_t count)
+{
+	struct hook_cache *hkc = 0;
+	size_t counter = 0;
+
+	if (!scriptpath || !states) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	hkc = malloc(sizeof(struct hook_cache));
+	if (!hkc)
+		return NULL;
+
+	bzero(hkc, sizeof(struct hook_cache));
+	hkc->dirfd = -1;
+
+	if (pthread_mutex_init(&hkc->mtx, NULL)) {
+		free(hkc);
+		return NULL;
+	}
+
+	hkc->scriptpath = strdup(scriptpath);
+	hkc->entries = malloc(sizeof(struct hook_cache_entry) * count);
+	if (!hkc->scriptpath || !hkc->entries) {
+		hkc->count = 0;
+		hkc_free(hkc);
+		return NULL;
+	}
+
+	hkc->count = count;
+	for (counter = 0; counter < count; counter++) {
+		hkc->entries[counter].name = states[counter].name;
+		hkc->entries[counter].present = false;
+		hkc->entries[counter].fd = -1;
+	}
+
+	return hkc;
+}
+
+/*
+ * free a hook cache
+ */
+void
+hkc_free(struct hook_cache *hkc)
+{
+	if (!hkc)
+		return;
+
+	hkc_closefds(hkc);
+	pthread_mutex_destroy(&hkc->mtx);
+
+	free(hkc->entries);
+	free(hkc->scriptpath);
+	free(hkc);
+}
@@ -0,0 +1,55 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __HOOK_CACHE_H__
+#define __HOOK_CACHE_H__
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../libstate/state_node.h"
+
+struct hook_cache;
+struct process_state_vm;
+struct process_watcher_object;
+
+struct hook_cache *hkc_new(const char *scriptpath, const struct state_node *states,
+			   size_t count);
+void hkc_free(struct hook_cache *hkc);
+struct hook_cache *hkc_withwatcher(struct hook_cache *hkc,
+				   struct process_watcher_object *pwo,
+				   struct process_state_vm *psv);
+bool hkc_lookup(struct hook_cache *hkc, const char *name, char *exepath,
+		size_t len);
+void hkc_invalidate(struct hook_cache *hkc);
+uint64_t hkc_get_scans(struct hook_cache *hkc);
+size_t hkc_get_memusage(const struct hook_cache *hkc);
+bool hkc_checkpath(const char *exepath);
+
+#endif /* __HOOK_CACHE_H__ */
@@ -0,0 +1,592 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "hook_executor.h"
+
+/* external global variable for environment variables */
+extern char **environ;
+
+/* maximum length of vm and state names passed to scripts */
+#define HKE_NAME_MAX	256
+/* growth of the queue of unsent exit notifications */
+#define HKE_PENDING_CHUNK	16
+
+/*
+ * asks the helper to launch a hook script; the log pipe is passed
+ * along as file descriptor
+ */
+struct hook_executor_request {
+	char exepath[PATH_MAX];
+	char vmname[HKE_NAME_MAX];
+	char from[HKE_NAME_MAX];
+	char to[HKE_NAME_MAX];
+};
+
+/*
+ * answer of the helper to a launch request
+ */
+struct hook_executor_reply {
+	int error;
+	pid_t pid;
+};
+
+/*
+ * sent by the helper whenever a launched script terminated
+ */
+struct hook_executor_exit {
+	pid_t pid;
+	int status;
+};
+
+/*
+ * state of the helper process
+ */
+struct hook_executor_server {
+	int kqueuefd;
+	int requestfd;
+	int eventfd;
+
+	/* exit notifications not yet sent */
+	struct hook_executor_exit *pending;
+	size_t pending_count;
+	size_t pending_size;
+};
+
+/*
+ * a long running helper process launching hook scripts on behalf of
+ * the daemon
+ *
+ * the helper is forked while the daemon is still small and single
+ * threaded; scripts are spawned from its address space instead of the
+ * daemon's.
+ */
+struct hook_executor {
+	/* process id of the helper */
+	pid_t pid;
+	/* launch requests and their replies */
+	int requestfd;
+	/* exit notifications, non-blocking */
+	int eventfd;
+
+	/* serializes requests */
+	pthread_mutex_t mtx;
+
+	/* number of scripts launched */
+	uint64_t launches;
+};
+
+/*
+ * start a new hook executor helper process
+ */
+struct hook_executor *
+hke_new()
+{
+	struct hook_executor *hke = 0;
+	int requestpair[2] = {-1, -1};
+	int eventpair[2] = {-1, -1};
+
+	if (!(hke = malloc(sizeof(struct hook_executor))))
+		return NULL;
+
+	bzero(hke, sizeof(struct hook_executor));
+
+	if (pthread_mutex_init(&hke->mtx, NULL)) {
+		free(hke);
+		return NULL;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, requestpair) ||
+	    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, eventpair)) {
+		if (requestpair[0] >= 0) {
+			close(requestpair[0]);
+			close(requestpair[1]);
+		}
+		pthread_mutex_destroy(&hke->mtx);
+		free(hke);
+		return NULL;
+	}
+
+	if (0 == (hke->pid = fork())) {
+		close(requestpair[0]);
+		close(eventpair[0]);
+
+		/* the helper ends when the daemon closes its socket */
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_IGN);
+		signal(SIGPIPE, SIG_IGN);
+		signal(SIGCHLD, SIG_DFL);
+
+		_exit(hke_serve(requestpair[1], eventpair[1]) ? 1 : 0);
+	}
+
+	close(requestpair[1]);
+	close(eventpair[1]);
+	hke->requestfd = requestpair[0];
+	hke->eventfd = eventpair[0];
+
+	if ((hke->pid < 0) ||
+	    (fcntl(hke->eventfd, F_SETFL, O_NONBLOCK) < 0)) {
+		hke_free(hke);
+		return NULL;
+	}
+
+	syslog(LOG_INFO, "Started hook executor with pid %d", hke->pid);
+
+	return hke;
+}
+
+/*
+ * stop the helper and release the executor
+ *
+ * scripts still running are not affected.
+ */
+void
+hke_free(struct hook_executor *hke)
+{
+	if (!hke) {
+		errno = EINVAL;
+		return;
+	}
+
+	close(hke->requestfd);
+	close(hke->eventfd);
+
+	if (hke->pid > 0)
+		waitpid(hke->pid, NULL, 0);
+
+	pthread_mutex_destroy(&hke->mtx);
+	free(hke);
+}
+
+/*
+ * let the helper launch a hook script
+ *
+ * vmname, from and to are passed to the script as VMSTATED_VM,
+ * VMSTATED_FROM and VMSTATED_TO. If logfd is not negative, the
+ * script's output is written to it. The exit of the script is
+ * reported through hke_readexit.
+ */
+int
+hke_launch(struct hook_executor *hke, const char *exepath,
+	   const char *vmname, const char *from, const char *to,
+	   int logfd, pid_t *pid)
+{
+	struct hook_executor_request request = {0};
+	struct hook_executor_reply reply = {0};
+	char control[CMSG_SPACE(sizeof(int))] = {0};
+	struct msghdr msg = {0};
+	struct cmsghdr *cmsg = 0;
+	struct iovec iov = {0};
+	ssize_t received = 0;
+
+	if (!hke || !exepath || !pid) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (strlcpy(request.exepath, exepath, PATH_MAX) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strlcpy(request.vmname, vmname ? vmname : "", HKE_NAME_MAX);
+	strlcpy(request.from, from ? from : "", HKE_NAME_MAX);
+	strlcpy(request.to, to ? to : "", HKE_NAME_MAX);
+
+	iov.iov_base = &request;
+	iov.iov_len = sizeof(request);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (logfd >= 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &logfd, sizeof(int));
+	}
+
+	if (pthread_mutex_lock(&hke->mtx)) {
+		errno = EDEADLK;
+		return -1;
+	}
+
+	if (sendmsg(hke->requestfd, &msg, MSG_NOSIGNAL) < 0) {
+		pthread_mutex_unlock(&hke->mtx);
+		return -1;
+	}
+
+	received = recv(hke->requestfd, &reply, sizeof(reply), 0);
+	if (received == sizeof(reply))
+		hke->launches++;
+
+	pthread_mutex_unlock(&hke->mtx);
+
+	if (received != sizeof(reply)) {
+		/* helper went away */
+		if (received >= 0)
+			errno = EPIPE;
+		return -1;
+	}
+
+	if (reply.error) {
+		errno = reply.error;
+		return -1;
+	}
+
+	*pid = reply.pid;
+
+	return 0;
+}
+
+/*
+ * read the next exit notification of a launched script
+ *
+ * fails with EAGAIN if there is none and with EPIPE if the helper
+ * terminated.
+ */
+int
+hke_readexit(struct hook_executor *hke, pid_t *pid, int *status)
+{
+	struct hook_executor_exit hkexit = {0};
+	ssize_t received = 0;
+
+	if (!hke || !pid || !status) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((received = recv(hke->eventfd, &hkexit, sizeof(hkexit), 0)) < 0)
+		return -1;
+
+	if (received != sizeof(hkexit)) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	*pid = hkexit.pid;
+	*status = hkexit.status;
+
+	return 0;
+}
+
+/*
+ * get the descriptor receiving exit notifications for event loops
+ */
+int
+hke_get_eventfd(const struct hook_executor *hke)
+{
+	if (!hke) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return hke->eventfd;
+}
+
+/*
+ * get the number of scripts the helper launched
+ */
+uint64_t
+hke_get_launches(struct hook_executor *hke)
+{
+	uint64_t launches = 0;
+
+	if (!hke) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (pthread_mutex_lock(&hke->mtx))
+		return 0;
+
+	launches = hke->launches;
+
+	pthread_mutex_unlock(&hke->mtx);
+
+	return launches;
+}
+
+/*
+ * spawn a script with the environment of the daemon extended by the
+ * variables of the request
+ */
+int
+hke_serve_spawn(const struct hook_executor_request *request, int logfd,
+		pid_t *pid)
+{
+	posix_spawn_file_actions_t actions;
+	char vmname[HKE_NAME_MAX + 16] = {0};
+	char from[HKE_NAME_MAX + 16] = {0};
+	char to[HKE_NAME_MAX + 16] = {0};
+	char *argv[2] = {0};
+	char **envp = 0;
+	size_t envcount = 0;
+	int result = 0;
+
+	while (environ[envcount])
+		envcount++;
+
+	if (!(envp = malloc(sizeof(char *) * (envcount + 4))))
+		return errno;
+
+	memcpy(envp, environ, sizeof(char *) * envcount);
+	snprintf(vmname, sizeof(vmname), "VMSTATED_VM=%s", request->vmname);
+	snprintf(from, sizeof(from), "VMSTATED_FROM=%s", request->from);
+	snprintf(to, sizeof(to), "VMSTATED_TO=%s", request->to);
+	envp[envcount] = vmname;
+	envp[envcount + 1] = from;
+	envp[envcount + 2] = to;
+	envp[envcount + 3] = NULL;
+
+	argv[0] = (char *) request->exepath;
+
+	if ((result = posix_spawn_file_actions_init(&actions))) {
+		free(envp);
+		return result;
+	}
+
+	if (logfd >= 0) {
+		if (!(result = posix_spawn_file_actions_adddup2(&actions, logfd, 1)))
+			result = posix_spawn_file_actions_adddup2(&actions, logfd, 2);
+	}
+
+	if (!result)
+		result = posix_spawn(pid, request->exepath, &actions, NULL,
+				     argv, envp);
+
+	posix_spawn_file_actions_destroy(&actions);
+	free(envp);
+
+	return result;
+}
+
+/*
+ * send queued exit notifications to the daemon
+ *
+ * the helper never blocks on the daemon, which may be busy launching
+ * the next script; the rest is sent once the socket is writable.
+ */
+int
+hke_serve_flush(struct hook_executor_server *hks)
+{
+	struct kevent event = {0};
+	size_t sent = 0;
+
+	while (sent < hks->pending_count) {
+		if (send(hks->eventfd, &hks->pending[sent],
+			 sizeof(struct hook_executor_exit), MSG_NOSIGNAL) < 0) {
+			if (EAGAIN != errno)
+				return -1;
+
+			EV_SET(&event, hks->eventfd, EVFILT_WRITE,
+			       EV_ADD | EV_ONESHOT, 0, 0, 0);
+			if (kevent(hks->kqueuefd, &event, 1, NULL, 0, NULL) < 0)
+				return -1;
+			break;
+		}
+		sent++;
+	}
+
+	hks->pending_count -= sent;
+	memmove(hks->pending, &hks->pending[sent],
+		hks->pending_count * sizeof(struct hook_executor_exit));
+
+	return 0;
+}
+
+/*
+ * reap a terminated script and report it to the daemon
+ */
+int
+hke_serve_exit(struct hook_executor_server *hks, pid_t pid)
+{
+	struct hook_executor_exit *pending = 0;
+	int status = 0;
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+
+	if (hks->pending_count == hks->pending_size) {
+		pending = realloc(hks->pending, sizeof(struct hook_executor_exit) *
+				  (hks->pending_size + HKE_PENDING_CHUNK));
+		if (!pending)
+			return -1;
+		hks->pending = pending;
+		hks->pending_size += HKE_PENDING_CHUNK;
+	}
+
+	hks->pending[hks->pending_count].pid = pid;
+	hks->pending[hks->pending_count].status = status;
+	hks->pending_count++;
+
+	return hke_serve_flush(hks);
+}
+
+/*
+ * handle a launch request from the daemon
+ *
+ * returns 1 if the daemon closed its end.
+ */
+int
+hke_serve_request(struct hook_executor_server *hks)
+{
+	struct hook_executor_request request = {0};
+	struct hook_executor_reply reply = {0};
+	char control[CMSG_SPACE(sizeof(int))] = {0};
+	struct msghdr msg = {0};
+	struct cmsghdr *cmsg = 0;
+	struct iovec iov = {0};
+	struct kevent event = {0};
+	ssize_t received = 0;
+	int logfd = -1;
+
+	iov.iov_base = &request;
+	iov.iov_len = sizeof(request);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if ((received = recvmsg(hks->requestfd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+		return received ? -1 : 1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if ((SOL_SOCKET == cmsg->cmsg_level) &&
+		    (SCM_RIGHTS == cmsg->cmsg_type))
+			memcpy(&logfd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	if (received != sizeof(request)) {
+		reply.error = EINVAL;
+	} else {
+		request.exepath[PATH_MAX - 1] = '\0';
+		request.vmname[HKE_NAME_MAX - 1] = '\0';
+		request.from[HKE_NAME_MAX - 1] = '\0';
+		request.to[HKE_NAME_MAX - 1] = '\0';
+
+		reply.error = hke_serve_spawn(&request, logfd, &reply.pid);
+	}
+
+	if (logfd >= 0)
+		close(logfd);
+
+	if (reply.error)
+		syslog(LOG_ERR, "hook executor: failed to launch \"%s\": errno = %d",
+		       request.exepath, reply.error);
+
+	if (send(hks->requestfd, &reply, sizeof(reply), MSG_NOSIGNAL) < 0)
+		return -1;
+
+	if (reply.error)
+		return 0;
+
+	EV_SET(&event, reply.pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, 0);
+	if (kevent(hks->kqueuefd, &event, 1, NULL, 0, NULL) < 0) {
+		/* script terminated already */
+		if (ESRCH != errno)
+			return -1;
+		return hke_serve_exit(hks, reply.pid);
+	}
+
+	return 0;
+}
+
+/*
+ * main loop of the helper process
+ *
+ * launches scripts requested on requestfd and reports their exits on
+ * eventfd until the daemon closes requestfd.
+ */
+int
+hke_serve(int requestfd, int eventfd)
+{
+	struct hook_executor_server hks = {0};
+	struct kevent event = {0};
+	int result = 0;
+
+	hks.requestfd = requestfd;
+	hks.eventfd = eventfd;
+
+	if ((fcntl(eventfd, F_SETFL, O_NONBLOCK) < 0) ||
+	    ((hks.kqueuefd = kqueue()) < 0))
+		return -1;
+
+	EV_SET(&event, requestfd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, 0);
+	if (kevent(hks.kqueuefd, &event, 1, NULL, 0, NULL) < 0) {
+		close(hks.kqueuefd);
+		return -1;
+	}
+
+	while (!result) {
+		if (kevent(hks.kqueuefd, NULL, 0, &event, 1, NULL) < 0) {
+			if (EINTR == errno)
+				continue;
+			result = -1;
+			break;
+		}
+
+		switch (event.filter) {
+		case EVFILT_READ:
+			/* pending requests are served before an EOF */
+			result = hke_serve_request(&hks);
+			break;
+		case EVFILT_WRITE:
+			result = hke_serve_flush(&hks);
+			break;
+		case EVFILT_PROC:
+			result = hke_serve_exit(&hks, event.ident);
+			break;
+		}
+	}
+
+	close(hks.kqueuefd);
+	close(requestfd);
+	close(eventfd);
+	free(hks.pending);
+
+	return result > 0 ? 0 : result;
+}
@@ -29,12 +29,15 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <unistd.h>
 
 #include "../libutils/bhyve_utils.h"
+#include "../libutils/daemon_log.h"
+#include "../libutils/string_pool.h"
 
 #include "bhyve_config.h"
 #include "process_def.h"
@@ -46,12 +49,16 @@ extern char **environ;
  * a definition of a process to start, watch and relaunch if necessary
  */
 struct process_def {
-	char name[PATH_MAX];
-	char *description;
-	char procpath[PATH_MAX];
+	/* strings are kept in the string pool */
+	const char *name;
+	const char *description;
+	const char *procpath;
 	char **procargs; /* null terminated argument list */
 	
 	void *ctx; /* user context */
+	struct string_pool *strings;
+	/* bytes of argument strings allocated along with procargs */
+	size_t argstrings;
 };
 
 void pd_free(struct process_def *pd);
@@ -69,37 +76,37 @@ pd_new(const char *name,
 	}
 
 	struct process_def *pd = 0;
-	size_t counter = 0, arglen = 0;
+	size_t counter = 0, length = 0;
 	const char **ptrdata = procargs;
 
 	pd = malloc(sizeof(struct process_def));
 	if (!pd)
 		return NULL;
 
-	strncpy(pd->name, name, PATH_MAX);
-	
 	bzero(pd, sizeof(struct process_def));
-	if (description) {
-		size_t desclen = strlen(description) + 1;
-		pd->description = malloc(desclen);
-		if (!pd->description) {
-			free(pd);
-			return NULL;
-		}
-		strncpy(pd->description, description, desclen);
+
+	/* size the string pool to hold everything in one chunk */
+	length = strlen(name) + strlen(procpath) +
+		(description ? strlen(description) : 0);
+	while (ptrdata && *ptrdata) {
+		length += strlen(*ptrdata++);
+		counter++;
 	}
 
-	strncpy(pd->procpath, procpath, PATH_MAX);
+	if (!(pd->strings = spl_new(NULL)) ||
+	    spl_reserve(pd->strings, counter + 3, length) ||
+	    !(pd->name = spl_intern(pd->strings, name)) ||
+	    !(pd->procpath = spl_intern(pd->strings, procpath)) ||
+	    (description &&
+	     !(pd->description = spl_intern(pd->strings, description)))) {
+		pd_free(pd);
+		return NULL;
+	}
 
 	if (procargs) {
-		while (*ptrdata) {
-			ptrdata++;
-			counter++;
-		}
 		pd->procargs = malloc((counter+1) * sizeof(char *));
 		if (!pd->procargs) {
-			free(pd->description);
-			free(pd);
+			pd_free(pd);
 			return NULL;
 		}
 		bzero(pd->procargs, sizeof(char *) * (counter+1));
@@ -108,13 +115,12 @@ pd_new(const char *name,
 		counter = 0;
 
 		while (*ptrdata) {
-			arglen = strlen(*ptrdata);
-			pd->procargs[counter] = malloc(arglen+1);
+			pd->procargs[counter] =
+				(char *) spl_intern(pd->strings, *ptrdata);
 			if (!pd->procargs[counter]) {
 				pd_free(pd);
 				return NULL;
 			}
-			strncpy(pd->procargs[counter], *ptrdata, arglen);
 			
 			ptrdata++;
 			counter++;
@@ -128,8 +134,84 @@ pd_new(const char *name,
 	return pd;
 }
 
+/*
+ * get number of bytes allocated for a process definition
+ */
+size_t
+pd_get_memusage(const struct process_def *pd)
+{
+	size_t bytes = 0, counter = 0;
+
+	if (!pd)
+		return 0;
+
+	spl_get_usage(pd->strings, NULL, &bytes);
+	if (pd->procargs) {
+		while (pd->procargs[counter])
+			counter++;
+		bytes += (counter + 1) * sizeof(char *) + pd->argstrings;
+	}
+
+	return sizeof(struct process_def) + bytes;
+}
+
+/*
+ * get the path of the application
+ */
+const char *
+pd_get_procpath(const struct process_def *pd)
+{
+	if (!pd) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return pd->procpath;
+}
+
+/*
+ * replace the application to launch; its arguments stay unchanged
+ */
+int
+pd_set_procpath(struct process_def *pd, const char *procpath)
+{
+	const char *interned = NULL;
+
+	if (!pd || !procpath) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!(interned = spl_intern(pd->strings, procpath)))
+		return -1;
+
+	pd->procpath = interned;
+
+	return 0;
+}
+
+/*
+ * get the file name of the application, without its directory
+ */
+const char *
+pd_get_procname(const struct process_def *pd)
+{
+	const char *name = NULL;
+
+	if (!pd) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return (name = strrchr(pd->procpath, '/')) ? name + 1 : pd->procpath;
+}
+
 /*
  * launch application with redirection
+ *
+ * the process is created with posix_spawn; redirection of its output
+ * is set up by file actions, so nothing runs between creating the
+ * process and executing the application.
  */
 int
 pd_launch_redirected(struct process_def *pd, pid_t *pid,
@@ -141,46 +223,54 @@ pd_launch_redirected(struct process_def *pd, pid_t *pid,
 	/* TODO add wrapper to add environment variable with vm name and command
 	 *      i.e. vmname = test, cmd = start
 	 */
-	
+
 	pid_t procpid = 0;
 	struct log_director_redirector_client *ldrd = 0;
+	posix_spawn_file_actions_t actions;
+	char *defaultargs[2] = {0};
+	int result = 0;
 
 	if (ldr)
-		if (!(ldrd = ldr_newclient(ldr)))
+		if (!(ldrd = ldr_newclient_source(ldr, pd_get_procname(pd))))
 			return -1;
 
-	syslog(LOG_INFO, "forking for \"%s\"...", pd->procpath);
-	if (0 == (procpid = fork())) {
-		syslog(LOG_INFO, "Starting child executable");
-		if (ldrd) {
-			ldrd_redirect_stdout(ldrd);
-			ldrd_redirect_stderr(ldrd);
-		}
-		
-		if (execve(pd->procpath, pd->procargs, environ) < 0) {
-			syslog(LOG_ERR, "pd_launch_redirected: execve failed: errno = %d", errno);
-			syslog(LOG_ERR, "pd_launch_redirected: pd->procpath: \"%s\"",
-			       pd->procpath);
-			syslog(LOG_ERR, "pd_launch_redirected: pd->procargs[0] = \"%s\"",
-			       pd->procargs[0]);
-			exit(1);
-		}
-		
-		exit(0);
+	if ((result = posix_spawn_file_actions_init(&actions))) {
+		if (ldrd)
+			ldrd_accept_redirect(ldrd);
+		errno = result;
+		return -1;
 	}
+
+	if (ldrd && ldrd_redirect_spawn(ldrd, &actions)) {
+		result = errno;
+		posix_spawn_file_actions_destroy(&actions);
+		ldrd_accept_redirect(ldrd);
+		errno = result;
+		return -1;
+	}
+
+	/* processes without arguments still receive their name */
+	defaultargs[0] = (char *) pd->procpath;
+	result = posix_spawn(&procpid, pd->procpath, &actions, NULL,
+			     pd->procargs ? pd->procargs : defaultargs, environ);
+	posix_spawn_file_actions_destroy(&actions);
+
 	if (ldrd)
 		ldrd_accept_redirect(ldrd);
 
-	if (procpid < 0) {
-		syslog(LOG_ERR, "fork failed - procpid = %d, errno = %d", procpid, errno);
-		return procpid;
+	if (result) {
+		syslog(LOG_ERR, "pd_launch_redirected: posix_spawn failed: errno = %d",
+		       result);
+		syslog(LOG_ERR, "pd_launch_redirected: pd->procpath: \"%s\"",
+		       pd->procpath);
+		errno = result;
+		return -1;
 	}
 
-	if (pid)
-		*pid = procpid;
+	*pid = procpid;
+
+	dlog(LOG_DEBUG, "pd_launch returning 0 for \"%s\"", pd->procpath);
 
-	syslog(LOG_INFO, "pd_launch returning 0 for \"%s\"", pd->procpath);
-	
 	return 0;
 }
 
@@ -207,63 +297,18 @@ pd_fromconfig(const struct bhyve_configuration *bc)
 	if (!bc)
 		return NULL;
 
-	struct process_def *pd = malloc(sizeof(struct process_def));
-	size_t desclen = 0;
-	
-	if (!pd)
-		return NULL;
-
-	/* add name and description */
-	strncpy(pd->name, bc_get_name(bc), PATH_MAX);
-	if (bc_get_description(bc)) {
-		desclen = strlen(bc_get_description(bc));
-		pd->description = malloc(desclen+1);
-		if (!pd->description) {
-			free(pd);
-			return NULL;
-		}
-		strncpy(pd->description, bc_get_description(bc), desclen+1);
-	} else {
-		pd->description = NULL;
-	}
+	const char *procargs[] = { BHYVEBIN, "-k", NULL, NULL };
 
-	/* transfer program arguments */
-	strncpy(pd->procpath, BHYVEBIN, PATH_MAX);
-	
-	/* add -k option */
-	pd->procargs = malloc(sizeof(char **)*4);
-	if (!pd->procargs) {
-		free(pd->description);
-		free(pd);
-		return NULL;
-	}
-	pd->procargs[0] = strdup(pd->procpath);
-	pd->procargs[3] = NULL;
-	pd->procargs[1] = malloc(3);
-	if (!pd->procargs[1]) {
-		free(pd->procargs[0]);
-		free(pd->description);
-		free(pd);
-		return NULL;
-	}
-	strncpy(pd->procargs[1], "-k", 3);
-	pd->procargs[2] = malloc(PATH_MAX);
-	if (!pd->procargs[2]) {
-		free(pd->procargs[0]);
-		free(pd->procargs[1]);
-		free(pd->description);
-		free(pd);
-		return NULL;
-	}
 	/*
 	 * if we have a generated config, we use that instead of the original one
 	 */
 	if (bc_get_generated_config(bc)) 
-		strncpy(pd->procargs[2], bc_get_generated_config(bc), PATH_MAX);
+		procargs[2] = bc_get_generated_config(bc);
 	else 
-		strncpy(pd->procargs[2], bc_get_configfile(bc), PATH_MAX);
+		procargs[2] = bc_get_configfile(bc);
 
-	return pd;
+	return pd_new(bc_get_name(bc), bc_get_description(bc), BHYVEBIN,
+		      procargs, NULL);
 }
 
 /*
@@ -277,8 +322,53 @@ pd_set_configfile(struct process_def *pd, const char *configfile)
 		return -1;
 	}
 
-	bzero(pd->procargs[2], PATH_MAX);
-	strncpy(pd->procargs[2], configfile, PATH_MAX);
+	if (!(configfile = spl_intern(pd->strings, configfile)))
+		return -1;
+
+	/* the previous path stays in the string pool until pd_free */
+	pd->procargs[2] = (char *) configfile;
+	return 0;
+}
+
+/*
+ * Replaces the arguments following the application path
+ *
+ * The new list and its strings are kept in a single allocation instead
+ * of the string pool, so replacing them repeatedly does not grow it.
+ */
+int
+pd_set_args(struct process_def *pd, const char **args)
+{
+	char **procargs = NULL;
+	char *strings = NULL;
+	size_t counter = 0, index = 0, length = 0;
+
+	if (!pd || !args) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	length = strlen(pd->procpath) + 1;
+	while (args[counter])
+		length += strlen(args[counter++]) + 1;
+
+	/* application path, arguments and terminating NULL */
+	if (!(procargs = malloc((counter + 2) * sizeof(char *) + length)))
+		return -1;
+
+	strings = (char *) (procargs + counter + 2);
+	procargs[0] = strings;
+	strings = stpcpy(strings, pd->procpath) + 1;
+	for (index = 0; index < counter; index++) {
+		procargs[index + 1] = strings;
+		strings = stpcpy(strings, args[index]) + 1;
+	}
+	procargs[counter + 1] = NULL;
+
+	free(pd->procargs);
+	pd->procargs = procargs;
+	pd->argstrings = length;
+
 	return 0;
 }
 
@@ -288,19 +378,11 @@ pd_set_configfile(struct process_def *pd, const char *configfile)
 void
 pd_free(struct process_def *pd)
 {
-	char **ptrdata = 0;
-
 	if (!pd)
 		return;
 
-	if (pd->procargs) {
-		ptrdata = pd->procargs;
-		while (*ptrdata) {
-			free(*ptrdata);
-			ptrdata++;
-		}
-		free(pd->procargs);
-	}
-	free(pd->description);
+	/* arguments are kept in the string pool or with procargs */
+	free(pd->procargs);
+	spl_free(pd->strings);
 	free(pd);	
 }
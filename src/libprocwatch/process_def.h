@@ -44,5 +44,10 @@ int pd_launch(struct process_def *pd, pid_t *pid);
 int pd_launch_redirected(struct process_def *pd, pid_t *pid,
 			 struct log_director_redirector *ldr);
 int pd_set_configfile(struct process_def *pd, const char *configfile);
+int pd_set_args(struct process_def *pd, const char **args);
+const char *pd_get_procname(const struct process_def *pd);
+const char *pd_get_procpath(const struct process_def *pd);
+int pd_set_procpath(struct process_def *pd, const char *procpath);
+size_t pd_get_memusage(const struct process_def *pd);
 
 #endif /* __PROCESS_DEF_H__ */
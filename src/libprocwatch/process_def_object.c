@@ -37,6 +37,7 @@ struct process_def_funcs pd_funcs = {
 				      pid_t *,
 				      struct log_director_redirector *)) pd_launch_redirected,
 	.set_configfile = (int (*)(void *, const char *)) pd_set_configfile,
+	.set_args = (int (*)(void *, const char **)) pd_set_args,
 	.free = (void*) pd_free
 };
 
@@ -42,6 +42,8 @@ struct process_def_funcs {
 	int (*launch_redirected)(void *ctx, pid_t *pid, struct log_director_redirector *ldr);
 	/* update configuration file to use when executing bhyve */
 	int (*set_configfile)(void *ctx, const char *configfile);
+	/* replace the arguments passed to bhyve */
+	int (*set_args)(void *ctx, const char **args);
 	/* release context */
 	void (*free)(void *ctx);
 };
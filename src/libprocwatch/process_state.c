@@ -26,28 +26,70 @@
  */
 
 #include <sys/types.h>
+#include <sys/queue.h>
 #include <sys/wait.h>
 
 #include <errno.h>
 #include <limits.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <syslog.h>
 #include <unistd.h>
 
 #include "../liblogging/log_director.h"
 #include "../libstate/state_handler.h"
 #include "../libutils/bhyve_utils.h"
+#include "../libutils/daemon_log.h"
+#include "../libutils/timer_wheel.h"
 
 #include "bhyve_config.h"
+#include "bhyve_config_hooks.h"
+#include "hook_cache.h"
 #include "process_def_object.h"
 #include "process_state.h"
 #include "process_state_errors.h"
+#include "process_watcher_object.h"
 #include "reboot_manager_object.h"
 #include "state_change.h"
 
+/*
+ * maximum number of steps of a single state change
+ */
+#define PSV_PLAN_MAX 8
+
+/*
+ * steps of a state change which are not state transitions
+ */
+#define PSV_STEP_LAUNCH    1000
+#define PSV_STEP_TERMINATE 1001
+/* wait for background hooks, fail if one of them failed */
+#define PSV_STEP_JOIN      1002
+/* wait for background hooks, ignoring their result */
+#define PSV_STEP_SETTLE    1003
+
+/*
+ * flag for a state whose hook runs in the background while the
+ * following steps continue
+ */
+#define PSV_STEP_BACKGROUND (1ULL << 32)
+
+/*
+ * maximum number of hook scripts running at the same time
+ */
+#define PSV_HOOKS_MAX 4
+
+/*
+ * what a parked state change waits for
+ */
+#define PSV_WAIT_NONE 0
+#define PSV_WAIT_HOOK 1
+#define PSV_WAIT_ALL  2
+
 /*
  * list of process states and transition functions
  */
@@ -251,6 +293,65 @@ struct state_transition process_transition_list[] = {
 	}
 };
 
+/*
+ * the transition list compiled once; the state handlers of all vms
+ * share it
+ */
+struct state_table *process_state_table;
+pthread_once_t process_state_table_once = PTHREAD_ONCE_INIT;
+
+void
+psv_compiletable(void)
+{
+	process_state_table = stt_new(process_transition_list,
+				      sizeof(process_transition_list)/sizeof(struct state_transition),
+				      PS_STATE(INIT));
+}
+
+/*
+ * states running the hook stages of a vm
+ */
+const bhyve_vmstate_t psv_stagestates[BCH_STAGECOUNT] = {
+	[BCH_START_NETWORK] = START_NETWORK,
+	[BCH_START_STORAGE] = START_STORAGE,
+	[BCH_STOP_STORAGE] = STOP_STORAGE,
+	[BCH_STOP_NETWORK] = STOP_NETWORK
+};
+
+/*
+ * a running hook script
+ */
+struct process_state_hook {
+	struct process_state_vm *psv;
+	pid_t pid;
+	/* allocated while the script runs */
+	char *path;
+	/* kills the script once scripttimeout expired */
+	struct timer_wheel_timer timer;
+	/* the state change does not wait for it */
+	bool background;
+};
+
+/*
+ * a thread waiting in psv_waitstate
+ */
+struct process_state_waiter {
+	/* states waited for, see psv_stateset */
+	uint32_t set;
+	/* state that ended the wait, -1 while waiting */
+	int64_t reached;
+	LIST_ENTRY(process_state_waiter) entries;
+};
+
+/*
+ * the published state word holds the state in the lower bits and
+ * counts state changes in the upper bits
+ */
+#define PSV_STATEWORD_BITS 16
+#define PSV_STATEWORD_STATE(word) \
+	((bhyve_vmstate_t) ((word) & ((1ULL << PSV_STATEWORD_BITS) - 1)))
+#define PSV_STATEWORD_VERSION(word) ((word) >> PSV_STATEWORD_BITS)
+
 /*
  * combines bhyve configuration and actual process state
  */
@@ -272,15 +373,220 @@ struct process_state_vm {
 
 	/* contains process id if it was started */
 	pid_t processid;
+
+	/* timer wheel for stop deadlines and script timeouts */
+	struct timer_wheel *tw;
+	/* escalates a pending stop request to SIGKILL */
+	struct timer_wheel_timer stop_timer;
+	/* seconds to wait for termination after SIGTERM, 0 to wait forever */
+	uint32_t stoptimeout;
+	/* seconds a hook script may run, 0 for no limit */
+	uint32_t scripttimeout;
+
+	/* reports process exits; hooks run asynchronously if set */
+	struct process_watcher_object *pwo;
+	/* log redirector passed to the pending start */
+	struct log_director_redirector *launch_ldr;
+
+	/* steps of the state change in progress */
+	uint64_t plan[PSV_PLAN_MAX];
+	size_t plan_len;
+	size_t plan_pos;
+	/* plan leads into FAILED */
+	bool plan_failing;
+	/* a step of the plan failed */
+	bool plan_error;
+	/* hand the vm to the reboot manager once the plan completed */
+	bool plan_reboot;
+	/* a state change is in progress */
+	bool busy;
+
+	/* exit of the vm process received during a state change */
+	bool exit_deferred;
+	bool exit_signalled;
+	int exit_code;
+
+	/* running hook scripts */
+	struct process_state_hook hooks[PSV_HOOKS_MAX];
+	size_t hooks_running;
+	/* wait status of the last hook the state change waited for */
+	int hookstatus;
+	/* path of that hook, taken over from its slot */
+	char *hookpath;
+	/* what the parked plan waits for */
+	int hook_wait;
+	/* the parked plan ignores failed background hooks */
+	bool hook_settle;
+	/* hook exited before the plan was parked */
+	bool hook_finished;
+	/* a background hook failed since the last join */
+	bool hook_failed;
+	/* the hook of the state being entered runs in the background */
+	bool hook_background;
+
+	/* stages each hook stage waits for, see bhyve_config_hooks.h */
+	uint32_t stage_after[BCH_STAGECOUNT];
+
+	/* hook scripts found in scriptpath */
+	struct hook_cache *hkc;
+
+	/* current state and version, readable without taking a lock */
+	atomic_uint_least64_t stateword;
+	/* guards the waiters and wakes them on state changes */
+	pthread_mutex_t wait_mtx;
+	pthread_cond_t wait_cond;
+	LIST_HEAD(, process_state_waiter) waiters;
+	/* no more waits, see psv_closewaits */
+	bool wait_closed;
 };
 
+int psv_handleexit(struct process_state_vm *psv, unsigned short exitcode);
+int psv_handlesignal(struct process_state_vm *psv, int signal);
+void psv_publishstate(struct process_state_vm *psv);
+
 /*
  * get current vm state
  */
 bhyve_vmstate_t
 psv_getstate(const struct process_state_vm *psv)
 {
-	return sth_getcurrentid(psv->sth);
+	return PSV_STATEWORD_STATE(atomic_load(&psv->stateword));
+}
+
+/*
+ * get the number of state changes so far
+ */
+uint64_t
+psv_getstateversion(const struct process_state_vm *psv)
+{
+	return PSV_STATEWORD_VERSION(atomic_load(&psv->stateword));
+}
+
+/*
+ * get the bit representing state in a set of states; returns 0 for
+ * unknown states
+ */
+uint32_t
+psv_stateset(bhyve_vmstate_t state)
+{
+	int idx = sth_lookupstate(process_state_list,
+				  sizeof(process_state_list)/sizeof(struct state_node),
+				  state);
+
+	return (idx < 0) ? 0 : (1U << idx);
+}
+
+/*
+ * publish the state the state handler is in and wake up the waiters
+ * that wait for it
+ */
+void
+psv_publishstate(struct process_state_vm *psv)
+{
+	struct process_state_waiter *waiter = NULL;
+	uint64_t word = atomic_load(&psv->stateword);
+	bhyve_vmstate_t state = sth_getcurrentid(psv->sth);
+	uint32_t bit = psv_stateset(state);
+
+	if (PSV_STATEWORD_STATE(word) == state)
+		return;
+
+	pthread_mutex_lock(&psv->wait_mtx);
+
+	word = ((PSV_STATEWORD_VERSION(word) + 1) << PSV_STATEWORD_BITS) | state;
+	atomic_store(&psv->stateword, word);
+
+	/* transient states are caught here, not by the woken thread */
+	LIST_FOREACH(waiter, &psv->waiters, entries) {
+		if ((waiter->reached < 0) && (waiter->set & bit))
+			waiter->reached = state;
+	}
+
+	pthread_cond_broadcast(&psv->wait_cond);
+	pthread_mutex_unlock(&psv->wait_mtx);
+}
+
+/*
+ * wait until the vm enters one of the states in set
+ *
+ * set is a combination of psv_stateset bits. timeout is given in
+ * milliseconds; a negative timeout waits forever.
+ *
+ * returns the state entered; returns -1 and sets errno to ETIMEDOUT
+ * if the timeout expired, or to ECANCELED if waits were closed.
+ */
+int64_t
+psv_waitstate(struct process_state_vm *psv, uint32_t set, int timeout)
+{
+	struct process_state_waiter waiter = {
+		.set = set,
+		.reached = -1
+	};
+	struct timespec deadline = {0};
+	bhyve_vmstate_t state = 0;
+	int result = 0;
+
+	if (!psv || !set) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (timeout >= 0) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	if (pthread_mutex_lock(&psv->wait_mtx)) {
+		errno = EDEADLK;
+		return -1;
+	}
+
+	/* states only change while holding wait_mtx */
+	state = psv_getstate(psv);
+	if (psv_stateset(state) & set) {
+		pthread_mutex_unlock(&psv->wait_mtx);
+		return state;
+	}
+
+	LIST_INSERT_HEAD(&psv->waiters, &waiter, entries);
+
+	while ((waiter.reached < 0) && !psv->wait_closed && !result) {
+		if (timeout < 0)
+			result = pthread_cond_wait(&psv->wait_cond, &psv->wait_mtx);
+		else
+			result = pthread_cond_timedwait(&psv->wait_cond,
+							&psv->wait_mtx,
+							&deadline);
+	}
+
+	LIST_REMOVE(&waiter, entries);
+	pthread_mutex_unlock(&psv->wait_mtx);
+
+	if (waiter.reached >= 0)
+		return waiter.reached;
+
+	errno = result ? result : ECANCELED;
+	return -1;
+}
+
+/*
+ * fail all current and future waits with ECANCELED
+ */
+void
+psv_closewaits(struct process_state_vm *psv)
+{
+	if (!psv)
+		return;
+
+	pthread_mutex_lock(&psv->wait_mtx);
+	psv->wait_closed = true;
+	pthread_cond_broadcast(&psv->wait_cond);
+	pthread_mutex_unlock(&psv->wait_mtx);
 }
 
 /*
@@ -304,330 +610,1086 @@ psv_getpid(const struct process_state_vm *psv)
 }
 
 /*
- * handler method, called whenever child process exits
+ * called when a vm did not terminate within its stop timeout
  */
-int
-psv_onexit(struct process_state_vm *psv, unsigned short exitcode)
+void
+psv_stop_expired(void *ctx)
 {
-	uint64_t state = psv_getstate(psv);
+	struct process_state_vm *psv = ctx;
+	bhyve_vmstate_t state = psv_getstate(psv);
+	pid_t pid = psv_getpid(psv);
 
-	syslog(LOG_INFO, "psv_onexit started for process %d with exit code %d",
-	       psv->processid, exitcode);
+	if (!pid || ((STOPPING != state) && (PRESTOP_BEFORE_RESTART != state)))
+		return;
 
-	switch (state) {
-	case STOPPED:
-		/* we are already stopped and don't do anything */
-		break;
-	case PRESTOP_BEFORE_RESTART:
-		switch (exitcode) {
-		case 0:
-			/* reboot */
-			if (sth_transitionto(psv->sth, RESTARTING))
-				return -1;
-			if (sth_transitionto(psv->sth, RESTART_STOPPED))
-				return -1;
-			if (psv->rmo)
-				/* delegate reboot to reboot manager */
-				if (psv->rmo->funcs->request_reboot(psv->rmo->ctx,
-								    psv)) {
-					psv_failurestate(psv);
-					return -1;
-				}
-			break;
-		case 1:
-		case 2:
-			/* should never happen */
-			break;
-		default:
-			/* TODO log error */
-			break;
-		}
-		break;
-	case RUNNING:
-		/* we have come here because the VM did something */
-		switch (exitcode) {
-		case 0:
-			/* reboot */
-			/* TODO queue for restart by bhyve_director via psv_startvm */
-			if (sth_transitionto(psv->sth, PRESTOP_BEFORE_RESTART))
-				return -1;
-			if (sth_transitionto(psv->sth, RESTARTING))
-				return -1;
-			if (sth_transitionto(psv->sth, RESTART_STOPPED))
-				return -1;
-			if (psv->rmo)
-				/* delegate reboot to reboot manager */
-				if (psv->rmo->funcs->request_reboot(psv->rmo->ctx,
-								    psv)) {
-					psv_failurestate(psv);
-					return -1;
-				}
-			break;
-		case 1:
-		case 2:
-			/* shutdown and halt */
-			if (sth_transitionto(psv->sth, STOP_STORAGE))
-				return -1;
-			if (sth_transitionto(psv->sth, STOP_NETWORK))
-				return -1;
-			if (sth_transitionto(psv->sth, STOPPED))
-				return -1;
-			
-			break;
-		}
-		break;
-	case STOPPING:
-		/* we have come here after signaling TERM */
-		if ((1 == exitcode) || (2 == exitcode)) {
-		} else if (0 == exitcode) {
-			/* unexpected reboot return code */
-			/* TODO think about handling this differently */
-			syslog(LOG_ERR, "Unexpected return code 0");
-		}
-		/* we shut down successfully */
-		if (sth_transitionto(psv->sth, STOP_STORAGE))
-			return -1;
-		if (sth_transitionto(psv->sth, STOP_NETWORK))
-			return -1;
-		if (sth_transitionto(psv->sth, STOPPED))
-			return -1;
-		break;
-	}
-	
-	if (exitcode >= 3) {
-		/* TODO lock overall and build a unlocked-failurestate func instead */
-		/* this would combine the locking */
+	syslog(LOG_WARNING, "process %d did not terminate within %u seconds, "
+	       "sending SIGKILL", pid, psv->stoptimeout);
 
-		/* still progress through shut down */
-		/* we have a failure state! */
-		psv_failurestate(psv);
-		
-		if (pthread_mutex_lock(&psv->mtx)) {
-			return PSV_ERR_MUTEXLOCKFAILED;
-		}
-		
-		/* reset the pid */
-		psv->processid = 0;
-		
-		if (pthread_mutex_unlock(&psv->mtx)) {
-			return PSV_ERR_MUTEXUNLOCKFAIL;
-		}
-	}
-	
-	return 0;
+	if (kill(pid, SIGKILL) < 0)
+		syslog(LOG_ERR, "Failed to send SIGKILL to process %d", pid);
 }
 
 /*
- * put into failure state, i.e. if too many attempted but
- * failed restarts within maxrestarttime
+ * called when a hook script exceeded its timeout
+ */
+void
+psv_hook_expired(void *ctx)
+{
+	struct process_state_hook *psh = ctx;
+	struct process_state_vm *psv = psh->psv;
+	pid_t pid = 0;
+
+	if (pthread_mutex_lock(&psv->mtx))
+		return;
+
+	/* the path is released with the slot once the script exits */
+	if ((pid = psh->pid))
+		syslog(LOG_ERR, "script \"%s\" did not complete within %u "
+		       "seconds, sending SIGKILL", psh->path, psv->scripttimeout);
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	if (!pid)
+		return;
+
+	if (kill(pid, SIGKILL) < 0)
+		syslog(LOG_ERR, "Failed to send SIGKILL to process %d", pid);
+}
+
+/*
+ * claim the vm for a state change
+ *
+ * returns -1 with errno set to EBUSY if another state change is in
+ * progress.
  */
 int
-psv_failurestate(struct process_state_vm *psv)
+psv_claim(struct process_state_vm *psv)
 {
-	if (!psv)
-		return -1;
+	int result = 0;
 
-	if (sth_transitionto(psv->sth, STOP_STORAGE))
-		return -1;
-	if (sth_transitionto(psv->sth, STOP_NETWORK))
-		return -1;
-	if (sth_transitionto(psv->sth, STOPPED))
-		return -1;
-	if (sth_transitionto(psv->sth, FAILED))
+	if (pthread_mutex_lock(&psv->mtx)) {
+		errno = EDEADLK;
 		return -1;
+	}
 
-	return 0;
+	if (psv->busy) {
+		errno = EBUSY;
+		result = -1;
+	} else {
+		psv->busy = true;
+	}
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	return result;
 }
 
 /*
- * check if the vm is in failure state
+ * check whether a state change is in progress
  */
 bool
-psv_is_failurestate(struct process_state_vm *psv)
+psv_is_busy(struct process_state_vm *psv)
 {
+	bool busy = false;
+
 	if (!psv)
-		return true;
-	
-	return (FAILED == psv_getstate(psv));
+		return false;
+
+	if (pthread_mutex_lock(&psv->mtx))
+		return false;
+
+	busy = psv->busy;
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	return busy;
 }
 
 /*
- * reset a failed state back to init
+ * keep an exit of the vm process for later if a state change is in
+ * progress, otherwise claim the vm for handling it
+ *
+ * returns true if the exit was deferred.
  */
-int
-psv_resetfailure(struct process_state_vm *psv)
+bool
+psv_deferexit(struct process_state_vm *psv, bool signalled, int code)
 {
-	if (!psv)
-		return -1;
+	bool deferred = false;
+
+	if (pthread_mutex_lock(&psv->mtx))
+		return false;
+
+	if (psv->busy) {
+		psv->exit_deferred = true;
+		psv->exit_signalled = signalled;
+		psv->exit_code = code;
+		deferred = true;
+	} else {
+		psv->busy = true;
+	}
 
-	if (!psv_is_failurestate(psv))
-		return -1;
+	pthread_mutex_unlock(&psv->mtx);
 
-	return sth_transitionto(psv->sth, INIT);
+	return deferred;
 }
 
 /*
- * start the vm
+ * set the steps of a state change
  *
- * returns 0 on success; puts resulting pid into pid
+ * failing marks steps that lead into FAILED, so a failing step does
+ * not start another way into FAILED.
  */
-int
-psv_startvm(struct process_state_vm *psv, pid_t *pid,
-	    struct log_director_redirector *ldr)
+void
+psv_setplan(struct process_state_vm *psv, const uint64_t *steps, size_t count,
+	    bool failing)
 {
-	if (!psv) {
-		errno = EINVAL;
-		return -1;
-	}
-
-	bhyve_vmstate_t current_state = psv_getstate(psv);
-	bool restarting = (RESTART_STOPPED == current_state);
-	uint64_t target_state = 0;
-	bool failure = false;
-	int result = 0;
+	if (count > PSV_PLAN_MAX)
+		count = PSV_PLAN_MAX;
 
-	syslog(LOG_INFO, "current_state = %d", current_state);
-	
-	/* if we're not in stopped or init state, we fail */
-	if ((INIT != current_state) && (STOPPED != current_state) &&
-	    (RESTART_STOPPED != current_state)) {
-		errno = EALREADY;
-		syslog(LOG_ERR, "vm already running");
-		return -1;
-	}
+	if (count)
+		memcpy(psv->plan, steps, sizeof(uint64_t) * count);
 
-	/* we're either INIT | STOPPED | RESTART_STOPPED */
+	psv->plan_len = count;
+	psv->plan_pos = 0;
+	psv->plan_failing = failing;
+	psv->plan_error = false;
+	psv->plan_reboot = false;
+}
 
-	/* START_NETWORK | PRESTART_AFTER_RESTART */
-	target_state = restarting ? PRESTART_AFTER_RESTART : START_NETWORK;
-	if (sth_transitionto(psv->sth, target_state)) {
-		syslog(LOG_ERR, "Failed to transition to PRESTART/START_NETWORK");
-		if (INIT == current_state) {
-			syslog(LOG_ERR, "Failed out of INIT - staying in INIT");
-			/* just stay in INIT */
-			return -1;
-		}
-		
-		/* goto failure */
-		if (restarting) {
-			/* we go to STOP_STORAGE only if we are restarting; because if
-			 * we are not restarting, we have not yet started storage
-			 * therefore we don't want to stop it either
-			 */
-			if (sth_transitionto(psv->sth, STOP_STORAGE)) {
-				syslog(LOG_ERR, "Failed to transition to STOP_STORAGE");
-				return -1;
+/*
+ * put the states of the hook stages first to last into steps
+ *
+ * stages not waiting for a stage of the current group join the group.
+ * Hooks of a group with several stages run in the background and are
+ * joined before the next group starts.
+ *
+ * returns the number of steps added.
+ */
+size_t
+psv_stagesteps(struct process_state_vm *psv, uint64_t *steps,
+	       bhyve_hookstage_t first, bhyve_hookstage_t last)
+{
+	uint32_t group = 0;
+	size_t count = 0, start = 0, counter = 0;
+	int stage = 0;
+
+	for (stage = first; stage <= (int) last + 1; stage++) {
+		/* close the group at the end or on a dependency */
+		if ((stage > (int) last) || (psv->stage_after[stage] & group)) {
+			if (count - start > 1) {
+				for (counter = start; counter < count; counter++)
+					steps[counter] |= PSV_STEP_BACKGROUND;
+				steps[count++] = PSV_STEP_JOIN;
 			}
+			start = count;
+			group = 0;
 		}
-		if (sth_transitionto(psv->sth, STOP_NETWORK)) {
-			syslog(LOG_ERR, "Failed to transition to STOP_NETWORK");
-			return -1;
-		}
-		if (sth_transitionto(psv->sth, STOPPED)) {
-			syslog(LOG_ERR, "Failed to transition to STOPPED");
+
+		if (stage > (int) last)
+			break;
+
+		group |= 1U << stage;
+		steps[count++] = psv_stagestates[stage];
+	}
+
+	return count;
+}
+
+/*
+ * put the steps releasing storage and network into steps, ending in
+ * STOPPED or FAILED
+ *
+ * returns the number of steps added.
+ */
+size_t
+psv_stopsteps(struct process_state_vm *psv, uint64_t *steps, bool failure)
+{
+	size_t count = 0;
+
+	count = psv_stagesteps(psv, steps, BCH_STOP_STORAGE, BCH_STOP_NETWORK);
+	steps[count++] = STOPPED;
+	if (failure)
+		steps[count++] = FAILED;
+
+	return count;
+}
+
+/*
+ * put the states on the shortest way from the current state to target
+ * into steps
+ *
+ * returns the number of steps added, 0 if there is no way to target.
+ */
+size_t
+psv_pathsteps(struct process_state_vm *psv, uint64_t *steps,
+	      bhyve_vmstate_t target)
+{
+	ssize_t count = sth_findpath(psv->sth, target, steps, PSV_PLAN_MAX);
+
+	if (count < 0) {
+		syslog(LOG_ERR, "no way from %s to %s",
+		       psv_state2string(psv_getstate(psv)),
+		       psv_state2string(target));
+		return 0;
+	}
+
+	return count;
+}
+
+/*
+ * replace the remaining steps with the way into FAILED
+ *
+ * hooks still running in the background are waited for first.
+ */
+void
+psv_setfailureplan(struct process_state_vm *psv)
+{
+	uint64_t steps[PSV_PLAN_MAX] = { PSV_STEP_SETTLE };
+	size_t count = 1;
+
+	switch (psv_getstate(psv)) {
+	case INIT:
+		syslog(LOG_ERR, "Failed out of INIT - staying in INIT");
+		/* FALLTHROUGH */
+	case FAILED:
+		break;
+	case START_NETWORK:
+		/* storage was not started yet */
+		count += psv_stagesteps(psv, &steps[count], BCH_STOP_NETWORK,
+					BCH_STOP_NETWORK);
+		steps[count++] = STOPPED;
+		steps[count++] = FAILED;
+		break;
+	case STOPPED:
+		steps[count++] = FAILED;
+		break;
+	default:
+		count += psv_stopsteps(psv, &steps[count], true);
+		break;
+	}
+
+	psv_setplan(psv, steps, count, true);
+}
+
+/*
+ * launch the vm process
+ */
+int
+psv_launch(struct process_state_vm *psv)
+{
+	pid_t pid = 0;
+	int status = 0;
+	int result = 0;
+
+	if (pthread_mutex_lock(&psv->mtx)) {
+		syslog(LOG_ERR, "Failed to lock mutex");
+		errno = EDEADLK;
+		return -1;
+	}
+
+	/* we let the object launch the program and return the
+	 * process id directly into our structure variable
+	 *
+	 * we are always calling redirected method because if ldr is NULL
+	 * it will behave as if ldr was not set and we run without
+	 * redirection
+	 */
+	result = psv->pdo->funcs->launch_redirected(psv->pdo->ctx, &psv->processid,
+						    psv->launch_ldr ? psv->launch_ldr : psv->ldr);
+	pid = psv->processid;
+
+	if (pthread_mutex_unlock(&psv->mtx)) {
+		syslog(LOG_ERR, "Failed to unlock mutex");
+		errno = EDEADLK;
+		return -1;
+	}
+
+	if (result) {
+		syslog(LOG_ERR, "Call to launch failed, result = %d", result);
+		return -1;
+	}
+
+	if (!psv->pwo || !pid)
+		return 0;
+
+	if (!psv->pwo->funcs->watch(psv->pwo->ctx, psv, pid))
+		return 0;
+
+	/* the process may already be gone */
+	if (waitpid(pid, &status, WNOHANG) != pid) {
+		syslog(LOG_ERR, "Failed to watch process %d", pid);
+		return -1;
+	}
+
+	syslog(LOG_ERR, "pid %d immediately died after start", pid);
+
+	/* handle the exit once the start completed */
+	if (pthread_mutex_lock(&psv->mtx))
+		return -1;
+
+	psv->exit_deferred = true;
+	psv->exit_signalled = WIFSIGNALED(status);
+	psv->exit_code = WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status);
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	return 0;
+}
+
+/*
+ * ask the vm process to terminate; escalated to SIGKILL after
+ * stoptimeout seconds
+ */
+int
+psv_terminate(struct process_state_vm *psv)
+{
+	pid_t pid = psv_getpid(psv);
+	bool exited = false;
+
+	if (pthread_mutex_lock(&psv->mtx))
+		return -1;
+
+	exited = psv->exit_deferred;
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	/* nothing left to terminate */
+	if (!pid || exited)
+		return 0;
+
+	if (kill(pid, SIGTERM) < 0) {
+		/* failed to send signal */
+		return -1;
+	}
+
+	if (psv->tw && psv->stoptimeout) {
+		/* kill the process if it does not terminate in time */
+		if (tw_arm(psv->tw, &psv->stop_timer,
+			   (uint64_t) psv->stoptimeout * 1000, 0))
+			syslog(LOG_ERR, "Failed to arm stop timer for process %d",
+			       pid);
+	}
+
+	return 0;
+}
+
+/*
+ * hand the vm to the reboot manager; the vm must not be claimed, so
+ * the restart can begin right away
+ */
+int
+psv_requestreboot(struct process_state_vm *psv)
+{
+	int result = 0;
+
+	if (!psv->rmo)
+		return 0;
+
+	/* delegate reboot to reboot manager */
+	result = psv->rmo->funcs->request_reboot(psv->rmo->ctx, psv);
+
+	if (RMO_REBOOT_DECLINED == result) {
+		/* finish stopping instead */
+		return psv_abortreboot(psv);
+	}
+
+	return result ? -1 : 0;
+}
+
+/*
+ * collect the result of the background hooks; must be called with the
+ * vm locked
+ */
+int
+psv_joinresult(struct process_state_vm *psv, bool settle)
+{
+	bool failed = psv->hook_failed;
+
+	psv->hook_failed = false;
+
+	return (failed && !settle) ? -1 : 0;
+}
+
+/*
+ * record the exit of a hook script; must be called with the vm locked
+ *
+ * returns the index of the hook or -1 if pid is not a running hook.
+ */
+int
+psv_hookdone(struct process_state_vm *psv, pid_t pid, int status)
+{
+	struct process_state_hook *psh = 0;
+	int counter = 0;
+
+	for (counter = 0; counter < PSV_HOOKS_MAX; counter++) {
+		psh = &psv->hooks[counter];
+		if (psh->pid && (psh->pid == pid))
+			break;
+	}
+
+	if (PSV_HOOKS_MAX == counter)
+		return -1;
+
+	psh->pid = 0;
+	psv->hooks_running--;
+
+	if (psh->background) {
+		if (sch_exitstatus(psh->path, status))
+			psv->hook_failed = true;
+		free(psh->path);
+	} else {
+		psv->hookstatus = status;
+		free(psv->hookpath);
+		psv->hookpath = psh->path;
+	}
+	psh->path = NULL;
+
+	return counter;
+}
+
+/*
+ * wait for all background hooks
+ *
+ * returns STH_PENDING if they still run and their exits are reported
+ * by the watcher.
+ */
+int
+psv_join(struct process_state_vm *psv, bool settle)
+{
+	struct process_state_hook *psh = 0;
+	int status = 0, result = 0;
+	pid_t pid = 0;
+	size_t counter = 0;
+
+	if (psv->pwo) {
+		if (pthread_mutex_lock(&psv->mtx))
 			return -1;
+
+		result = psv->hooks_running ? STH_PENDING :
+			psv_joinresult(psv, settle);
+
+		pthread_mutex_unlock(&psv->mtx);
+
+		return result;
+	}
+
+	/* nobody reports exits, wait for each hook here */
+	for (counter = 0; counter < PSV_HOOKS_MAX; counter++) {
+		psh = &psv->hooks[counter];
+		if (!(pid = psh->pid))
+			continue;
+
+		waitpid(pid, &status, 0);
+
+		/* waits for a running expiry to return */
+		if (psv->tw)
+			tw_cancel(psv->tw, &psh->timer);
+
+		if (pthread_mutex_lock(&psv->mtx))
+			return -1;
+		psv_hookdone(psv, pid, status);
+		pthread_mutex_unlock(&psv->mtx);
+	}
+
+	if (pthread_mutex_lock(&psv->mtx))
+		return -1;
+
+	result = psv_joinresult(psv, settle);
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	return result;
+}
+
+/*
+ * run a single step of a state change
+ *
+ * returns STH_PENDING if the step waits for hook scripts.
+ */
+int
+psv_runstep(struct process_state_vm *psv, uint64_t step)
+{
+	int result = 0;
+
+	if (step & PSV_STEP_BACKGROUND) {
+		/* sch_onenter does not wait for the hook */
+		psv->hook_background = true;
+		result = sth_transitionto(psv->sth, step & ~PSV_STEP_BACKGROUND);
+		psv->hook_background = false;
+		psv_publishstate(psv);
+
+		return result;
+	}
+
+	switch (step) {
+	case PSV_STEP_LAUNCH:
+		return psv_launch(psv);
+	case PSV_STEP_TERMINATE:
+		return psv_terminate(psv);
+	case PSV_STEP_JOIN:
+		return psv_join(psv, false);
+	case PSV_STEP_SETTLE:
+		return psv_join(psv, true);
+	default:
+		result = sth_transitionto(psv->sth, step);
+		psv_publishstate(psv);
+		return result;
+	}
+}
+
+/*
+ * finish a state change and handle an exit of the vm process that
+ * arrived meanwhile
+ */
+void
+psv_release(struct process_state_vm *psv)
+{
+	bool deferred = false, signalled = false;
+	int code = 0;
+
+	if (pthread_mutex_lock(&psv->mtx))
+		return;
+
+	deferred = psv->exit_deferred;
+	signalled = psv->exit_signalled;
+	code = psv->exit_code;
+	psv->exit_deferred = false;
+
+	/* stay claimed for handling the deferred exit */
+	if (!deferred)
+		psv->busy = false;
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	if (!deferred)
+		return;
+
+	dlog(LOG_DEBUG, "Handling deferred exit of process %d", psv_getpid(psv));
+
+	if (signalled)
+		psv_handlesignal(psv, code);
+	else
+		psv_handleexit(psv, code);
+}
+
+/*
+ * run the remaining steps of the current state change
+ *
+ * result is the outcome of the previous step. If a step fails, the
+ * remaining steps are replaced with the way into FAILED. The run stops
+ * at steps waiting for hook scripts and is continued by
+ * psv_onhookexit. Once all steps ran, the vm is released and handed to
+ * the reboot manager if the plan asked for it.
+ *
+ * returns -1 if a step failed, 0 if all steps succeeded or are pending.
+ */
+int
+psv_runplan(struct process_state_vm *psv, int result)
+{
+	bool failed = false, reboot = false;
+	uint64_t step = 0;
+
+	while (true) {
+		if (result) {
+			psv->plan_error = true;
+			
+			if (psv->plan_failing) {
+				/* already on the way to FAILED, stay where we are */
+				syslog(LOG_ERR, "Failed to reach FAILED from %s",
+				       psv_state2string(psv_getstate(psv)));
+				break;
+			}
+
+			syslog(LOG_ERR, "State change failed in %s",
+			       psv_state2string(psv_getstate(psv)));
+			psv_setfailureplan(psv);
+			psv->plan_error = true;
+			result = 0;
 		}
-		if (sth_transitionto(psv->sth, FAILED)) {
-			syslog(LOG_ERR, "Failed to transition to FAILED");
+
+		if (psv->plan_pos >= psv->plan_len)
+			break;
+
+		step = psv->plan[psv->plan_pos++];
+		result = psv_runstep(psv, step);
+		if (STH_PENDING != result)
+			continue;
+
+		/* hand over to psv_onhookexit unless the hooks already finished */
+		if (pthread_mutex_lock(&psv->mtx))
 			return -1;
+
+		if ((PSV_STEP_JOIN == step) || (PSV_STEP_SETTLE == step)) {
+			if (psv->hooks_running) {
+				psv->hook_wait = PSV_WAIT_ALL;
+				psv->hook_settle = (PSV_STEP_SETTLE == step);
+				pthread_mutex_unlock(&psv->mtx);
+				return 0;
+			}
+
+			result = psv_joinresult(psv, PSV_STEP_SETTLE == step);
+		} else {
+			if (!psv->hook_finished) {
+				psv->hook_wait = PSV_WAIT_HOOK;
+				pthread_mutex_unlock(&psv->mtx);
+				return 0;
+			}
+
+			psv->hook_finished = false;
+			result = sch_exitstatus(psv->hookpath, psv->hookstatus) ? -1 : 0;
+		}
+
+		pthread_mutex_unlock(&psv->mtx);
+	}
+
+	failed = psv->plan_error;
+	reboot = psv->plan_reboot && !failed;
+
+	psv_release(psv);
+
+	if (reboot && psv_requestreboot(psv))
+		return -1;
+
+	return failed ? -1 : 0;
+}
+
+/*
+ * handle an exit of the vm process; the vm must be claimed
+ */
+int
+psv_handleexit(struct process_state_vm *psv, unsigned short exitcode)
+{
+	uint64_t steps[PSV_PLAN_MAX] = {0};
+
+	psv_setplan(psv, NULL, 0, false);
+
+	if (exitcode >= 3) {
+		/* we have a failure state! still progress through shut down */
+		psv_setplan(psv, steps, psv_stopsteps(psv, steps, true), true);
+
+		if (pthread_mutex_lock(&psv->mtx)) {
+			return PSV_ERR_MUTEXLOCKFAILED;
+		}
+		
+		/* reset the pid */
+		psv->processid = 0;
+		
+		if (pthread_mutex_unlock(&psv->mtx)) {
+			return PSV_ERR_MUTEXUNLOCKFAIL;
+		}
+
+		return psv_runplan(psv, 0);
+	}
+
+	switch (psv_getstate(psv)) {
+	case STOPPED:
+		/* we are already stopped and don't do anything */
+		break;
+	case PRESTOP_BEFORE_RESTART:
+		/* reboot */
+		if (0 == exitcode) {
+			psv_setplan(psv, steps,
+				    psv_pathsteps(psv, steps, RESTART_STOPPED),
+				    false);
+			psv->plan_reboot = true;
+		}
+		break;
+	case RUNNING:
+		/* we have come here because the VM did something */
+		switch (exitcode) {
+		case 0:
+			/* reboot */
+			psv_setplan(psv, steps,
+				    psv_pathsteps(psv, steps, RESTART_STOPPED),
+				    false);
+			psv->plan_reboot = true;
+			break;
+		case 1:
+		case 2:
+			/* shutdown and halt */
+			psv_setplan(psv, steps, psv_stopsteps(psv, steps, false),
+				    false);
+			break;
 		}
+		break;
+	case STOPPING:
+		/* we have come here after signaling TERM */
+		if (0 == exitcode) {
+			/* unexpected reboot return code */
+			/* TODO think about handling this differently */
+			syslog(LOG_ERR, "Unexpected return code 0");
+		}
+		/* we shut down successfully */
+		psv_setplan(psv, steps, psv_stopsteps(psv, steps, false), false);
+		break;
+	default:
+		break;
+	}
+
+	return psv_runplan(psv, 0);
+}
+
+/*
+ * handle termination of the vm process by a signal; the vm must be
+ * claimed
+ */
+int
+psv_handlesignal(struct process_state_vm *psv, int signal)
+{
+	uint64_t steps[PSV_PLAN_MAX] = {0};
+
+	switch (psv_getstate(psv)) {
+	case STOPPING:
+		/* stop request was escalated, continue regular shutdown */
+		return psv_handleexit(psv, 1);
+	case PRESTOP_BEFORE_RESTART:
+		/* reboot request was escalated, continue reboot */
+		return psv_handleexit(psv, 0);
+	default:
+		break;
+	}
+
+	psv_setplan(psv, steps, psv_stopsteps(psv, steps, true), true);
+
+	return psv_runplan(psv, 0);
+}
+
+/*
+ * handler method, called whenever child process exits
+ */
+int
+psv_onexit(struct process_state_vm *psv, unsigned short exitcode)
+{
+	/* the process is gone, no need to escalate a stop request */
+	if (psv->tw)
+		tw_cancel(psv->tw, &psv->stop_timer);
+
+	dlog(LOG_DEBUG, "psv_onexit started for process %d with exit code %d",
+	     psv->processid, exitcode);
+
+	if (psv_deferexit(psv, false, exitcode)) {
+		dlog(LOG_DEBUG, "State change in progress, deferring exit");
+		return 0;
+	}
+
+	return psv_handleexit(psv, exitcode);
+}
+
+/*
+ * handler method, called whenever child process was terminated by a
+ * signal
+ */
+int
+psv_onsignal(struct process_state_vm *psv, int signal)
+{
+	if (!psv) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (psv->tw)
+		tw_cancel(psv->tw, &psv->stop_timer);
+
+	if (psv_deferexit(psv, true, signal)) {
+		dlog(LOG_DEBUG, "State change in progress, deferring signal");
+		return 0;
+	}
+
+	return psv_handlesignal(psv, signal);
+}
+
+/*
+ * handler method, called whenever a watched hook script exits
+ *
+ * continues the state change waiting for the hook.
+ */
+int
+psv_onhookexit(struct process_state_vm *psv, pid_t pid, int status)
+{
+	struct process_state_hook *psh = 0;
+	int wait = PSV_WAIT_NONE;
+	int result = 0;
+	int idx = 0;
+
+	if (!psv) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pthread_mutex_lock(&psv->mtx)) {
+		errno = EDEADLK;
+		return -1;
+	}
+
+	if ((idx = psv_hookdone(psv, pid, status)) < 0) {
+		pthread_mutex_unlock(&psv->mtx);
+		errno = ESRCH;
+		return -1;
+	}
+
+	psh = &psv->hooks[idx];
+
+	if ((PSV_WAIT_HOOK == psv->hook_wait) && !psh->background) {
+		/* the parked state change waited for this hook */
+		wait = psv->hook_wait;
+		result = sch_exitstatus(psv->hookpath, status) ? -1 : 0;
+	} else if ((PSV_WAIT_ALL == psv->hook_wait) && !psv->hooks_running) {
+		/* the last background hook finished */
+		wait = psv->hook_wait;
+		result = psv_joinresult(psv, psv->hook_settle);
+	} else if (!psh->background) {
+		/* the launching thread did not park the state change yet */
+		psv->hook_finished = true;
+	}
+
+	if (PSV_WAIT_NONE != wait)
+		psv->hook_wait = PSV_WAIT_NONE;
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	if (psv->tw)
+		tw_cancel(psv->tw, &psh->timer);
+
+	if (PSV_WAIT_NONE == wait)
+		return 0;
+
+	return psv_runplan(psv, result);
+}
+
+/*
+ * register a running hook script
+ *
+ * hooks are reported to the watcher if there is one. Background hooks
+ * without a watcher are waited for by the next join.
+ *
+ * returns -1 with errno set if the script cannot be registered, ESRCH
+ * if the watcher found it ended already; the caller then needs to
+ * collect it.
+ */
+int
+psv_addhook(struct process_state_vm *psv, const char *exepath, pid_t pid)
+{
+	struct process_state_hook *psh = 0;
+	char *path = NULL;
+	size_t counter = 0;
+	int result = 0;
+
+	if (!psv || !exepath || (!psv->pwo && !psv->hook_background)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!(path = strdup(exepath)))
+		return -1;
+
+	if (pthread_mutex_lock(&psv->mtx)) {
+		free(path);
+		errno = EDEADLK;
+		return -1;
+	}
+
+	for (counter = 0; counter < PSV_HOOKS_MAX; counter++) {
+		if (!psv->hooks[counter].pid)
+			break;
+	}
+
+	if (PSV_HOOKS_MAX == counter) {
+		pthread_mutex_unlock(&psv->mtx);
+		free(path);
+		errno = ENOSPC;
+		return -1;
 	}
 
-	/* START_STORAGE | START_AFTER_RESTART */
-	target_state = restarting ? START_AFTER_RESTART : START_STORAGE;
-	if (sth_transitionto(psv->sth, target_state)) {
-		syslog(LOG_ERR, "Failed to transition to START_AFTER/START_STORAGE");
-		/* goto failure */
-		if (psv_failurestate(psv)) {
-			syslog(LOG_ERR, "Failed to transition to FAILURE");
-			return -1;
-		}
+	psh = &psv->hooks[counter];
+	psh->pid = pid;
+	psh->background = psv->hook_background;
+	psh->path = path;
+	psv->hooks_running++;
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	if (psv->tw && psv->scripttimeout)
+		tw_arm(psv->tw, &psh->timer,
+		       (uint64_t) psv->scripttimeout * 1000, 0);
+
+	if (!psv->pwo || !psv->pwo->funcs->watch(psv->pwo->ctx, psv, pid))
+		return 0;
+	result = errno;
+
+	if (psv->tw)
+		tw_cancel(psv->tw, &psh->timer);
+
+	if (!pthread_mutex_lock(&psv->mtx)) {
+		psh->pid = 0;
+		free(psh->path);
+		psh->path = NULL;
+		psv->hooks_running--;
+		pthread_mutex_unlock(&psv->mtx);
+	}
+
+	/* ESRCH tells the caller the script already ended */
+	errno = result;
+	return -1;
+}
+
+/*
+ * put into failure state, i.e. if too many attempted but
+ * failed restarts within maxrestarttime
+ */
+int
+psv_failurestate(struct process_state_vm *psv)
+{
+	uint64_t steps[PSV_PLAN_MAX] = {0};
+
+	if (!psv)
+		return -1;
+
+	if (psv_claim(psv))
+		return -1;
+
+	psv_setplan(psv, steps, psv_stopsteps(psv, steps, true), true);
+
+	return psv_runplan(psv, 0);
+}
+
+/*
+ * finish stopping a vm whose restart was cancelled
+ *
+ * runs the remaining stop hooks of a vm in RESTART_STOPPED state
+ * and puts it into STOPPED state.
+ */
+int
+psv_abortreboot(struct process_state_vm *psv)
+{
+	uint64_t steps[PSV_PLAN_MAX] = {0};
+
+	if (!psv) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (psv_claim(psv))
+		return -1;
+
+	if (RESTART_STOPPED != psv_getstate(psv)) {
+		psv_release(psv);
+		errno = EALREADY;
+		return -1;
+	}
+
+	psv_setplan(psv, steps, psv_stopsteps(psv, steps, false), false);
+
+	return psv_runplan(psv, 0);
+}
+
+/*
+ * check if the vm is in failure state
+ */
+bool
+psv_is_failurestate(struct process_state_vm *psv)
+{
+	if (!psv)
+		return true;
+	
+	return (FAILED == psv_getstate(psv));
+}
+
+/*
+ * reset a failed state back to init
+ */
+int
+psv_resetfailure(struct process_state_vm *psv)
+{
+	static const uint64_t reset[] = { INIT };
+
+	if (!psv)
+		return -1;
+
+	if (psv_claim(psv))
+		return -1;
+
+	if (!psv_is_failurestate(psv)) {
+		psv_release(psv);
+		return -1;
+	}
+
+	psv_setplan(psv, reset, 1, true);
+
+	return psv_runplan(psv, 0);
+}
+
+/*
+ * start the vm
+ *
+ * returns 0 on success; puts resulting pid into pid. If hook scripts
+ * run asynchronously, the start may still be in progress; pid is 0
+ * until the vm process was launched.
+ */
+int
+psv_startvm(struct process_state_vm *psv, pid_t *pid,
+	    struct log_director_redirector *ldr)
+{
+	static const uint64_t restart[] = {
+		PRESTART_AFTER_RESTART, START_AFTER_RESTART, PSV_STEP_LAUNCH,
+		RESTARTED, RUNNING
+	};
+
+	if (!psv) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	/* execute bhyve command, retrieve pid, sign up for kqueue monitor */
+	uint64_t steps[PSV_PLAN_MAX] = {0};
+	bhyve_vmstate_t current_state = 0;
+	size_t count = 0;
+	int result = 0;
 
-	if (pthread_mutex_lock(&psv->mtx)) {
-		syslog(LOG_ERR, "Failed to lock mutex");
-		
-		if (psv_failurestate(psv)) {
-			syslog(LOG_ERR, "Failed to transition to FAILURE");
-			return -1;
-		}
-		
-		errno = EDEADLK;
+	if (psv_claim(psv)) {
+		syslog(LOG_ERR, "vm is busy");
 		return -1;
 	}
 
-	/* we let the object launch the program and return the
-	 * process id directly into our structure variable
-	 *
-	 * we are always calling redirected method because if ldr is NULL
-	 * it will behave as if ldr was not set and we run without
-	 * redirection
-	 */
-	if ((result = psv->pdo->funcs->launch_redirected(psv->pdo->ctx, &psv->processid,
-							 ldr ? ldr : psv->ldr))) {
-		/* failure */
-		failure = true;
-		syslog(LOG_ERR, "Call to launch failed, result = %d", result);
+	current_state = psv_getstate(psv);
+	dlog(LOG_DEBUG, "current_state = %d", current_state);
+	
+	/* if we're not in stopped or init state, we fail */
+	if ((INIT != current_state) && (STOPPED != current_state) &&
+	    (RESTART_STOPPED != current_state)) {
+		psv_release(psv);
+		errno = EALREADY;
+		syslog(LOG_ERR, "vm already running");
+		return -1;
 	}
 
-	/* transfer pid to caller */
-	if (!failure)
-		*pid = psv->processid;
+	/* we're either INIT | STOPPED | RESTART_STOPPED */
+	psv->launch_ldr = ldr;
+
+	if (RESTART_STOPPED == current_state) {
+		psv_setplan(psv, restart, 5, false);
+	} else {
+		/* network and storage, maybe in parallel */
+		count = psv_stagesteps(psv, steps, BCH_START_NETWORK,
+				       BCH_START_STORAGE);
+		steps[count++] = PSV_STEP_LAUNCH;
+		steps[count++] = RUNNING;
+		psv_setplan(psv, steps, count, false);
+	}
 
 	/* TODO rework the following steps...
-	 * if we fail any of the following steps, the process could
+	 * if we fail any of the steps after launching, the process could
 	 * actually be running but the VM could land in a failure state
 	 * regardless
 	 *
 	 * we need a config variable whether we want to stop the
 	 * vm when a user script fails past the start step
 	 */
+	result = psv_runplan(psv, 0);
 
-	do {
-		if (pthread_mutex_unlock(&psv->mtx) || failure) {
-			syslog(LOG_ERR, "Mutex unlock fail while failure = %d", failure);
-			
-			result |= PSV_ERR_MUTEXUNLOCKFAIL;
-			
-			/* doesn't matter if transition fails, we return -1 anyways */
-			if (psv_failurestate(psv)) {
-				syslog(LOG_ERR, "Failed to transition to FAILURE");
-				result |= PSV_ERR_TRANSITIONSFAIL;
-			}
-			
-			break;
-		}
-
-		/* RUNNING | RESTARTED */
-		target_state = restarting ? RESTARTED : RUNNING;
-		if (sth_transitionto(psv->sth, target_state)) {
-			result |= PSV_ERR_TRANSITIONSFAIL;
-
-			/* goto failure */
-			/* failure doesn't matter because we already
-			   failed a transition */
-			psv_failurestate(psv);
-			break;
-		}
-		
-		/* RUNNING */
-		if (restarting) {
-			target_state = RUNNING;
-			if (sth_transitionto(psv->sth, target_state)) {
-				result |= PSV_ERR_TRANSITIONSFAIL;
-				
-				/* goto failure */
-				/* failure doesn't matter because we already
-				   failed a transition */
-				psv_failurestate(psv);
-				break;
-			}
-		}
-	} while(0);
+	/* transfer pid to caller; it is only set once the launch step ran */
+	if (!result && pid)
+		*pid = psv_getpid(psv);
 
-	syslog(LOG_INFO, "psv_startvm returning result = %d", result);
+	dlog(LOG_DEBUG, "psv_startvm returning result = %d", result);
 	return result;
 }
 
@@ -637,37 +1699,34 @@ psv_startvm(struct process_state_vm *psv, pid_t *pid,
 int
 psv_stop_or_reboot(struct process_state_vm *psv, bool reboot, int *exitcode)
 {
+	static const uint64_t stop[] = { STOPPING, PSV_STEP_TERMINATE };
+	static const uint64_t prestop[] = { PRESTOP_BEFORE_RESTART, PSV_STEP_TERMINATE };
+
 	if (!psv) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	bhyve_vmstate_t current_state = psv_getstate(psv);
 	pid_t pid = 0;
-	uint64_t target_state = 0;
+	int result = 0;
+
+	if (psv_claim(psv))
+		return -1;
 
 	/* if we're not in the RUNNING state, we fail */
-	if (RUNNING != current_state) {
+	if (RUNNING != psv_getstate(psv)) {
+		psv_release(psv);
 		errno = EALREADY;
 		return -1;
 	}
 
-	target_state = reboot ? PRESTOP_BEFORE_RESTART : STOPPING;
-	/* STOPPING or PRESTOP_BEFORE_RESTART */
-	if (sth_transitionto(psv->sth, target_state)) {
-		if (psv_failurestate(psv))
-			return -1;
-	}
-
 	pid = psv_getpid(psv);
 
-	if (pid) {
-		if (kill(pid, SIGTERM) < 0) {
-			/* failed to send signal */
-			if (psv_failurestate(psv))
-				return -1;
-		}
+	/* STOPPING or PRESTOP_BEFORE_RESTART, then send TERM */
+	psv_setplan(psv, reboot ? prestop : stop, 2, false);
+	result = psv_runplan(psv, 0);
 
+	if (pid) {
 		/* regular waitpid happens via kqueue, this is put here
 		   to safeguard against blocks in test cases */
 
@@ -690,10 +1749,9 @@ psv_stop_or_reboot(struct process_state_vm *psv, bool reboot, int *exitcode)
 		pthread_yield();
 	}
 	
-	/* TODO missing property: timeout? */
 	/* TODO reboot not implemented yet */
 
-	return 0;		
+	return result;		
 }
 
 /*
@@ -746,11 +1804,14 @@ struct process_state_vm *
 psv_withconfig(struct process_def_obj *pdo, const char *scriptpath)
 {
 	struct process_state_vm *psv = 0;
+	size_t counter = 0;
 
 	psv = malloc(sizeof(struct process_state_vm));
 	if (!psv)
 		return NULL;
 
+	bzero(psv, sizeof(struct process_state_vm));
+
 	/* no reboot manager by default */
 	psv->rmo = NULL;
 
@@ -759,29 +1820,276 @@ psv_withconfig(struct process_def_obj *pdo, const char *scriptpath)
 
 	psv->processid = 0;
 
+	/* no timers by default */
+	psv->tw = NULL;
+	tw_timer_init(&psv->stop_timer, psv_stop_expired, psv);
+	for (counter = 0; counter < PSV_HOOKS_MAX; counter++) {
+		psv->hooks[counter].psv = psv;
+		tw_timer_init(&psv->hooks[counter].timer, psv_hook_expired,
+			      &psv->hooks[counter]);
+	}
+
+	/* hook stages run one after another by default */
+	psv_withhooks(psv, NULL);
+	psv->stoptimeout = 0;
+	psv->scripttimeout = 0;
+
 	if (pthread_mutex_init(&psv->mtx, NULL)) {
 		free(psv);
 		return NULL;
 	}
 
-	/* new transition handler, starting with INIT state */
-	psv->sth = sth_new(process_transition_list,
-			   sizeof(process_transition_list)/sizeof(struct state_transition),
-			   PS_STATE(INIT), psv);
+	/* new transition handler on the shared table, starting with INIT state */
+	if (!pthread_once(&process_state_table_once, psv_compiletable) &&
+	    process_state_table)
+		psv->sth = sth_fromtable(process_state_table, PS_STATE(INIT), psv);
 	if (!psv->sth) {
+		pthread_mutex_destroy(&psv->mtx);
+		free(psv);
+		return NULL;
+	}
+
+	atomic_init(&psv->stateword, INIT);
+	LIST_INIT(&psv->waiters);
+	if (pthread_mutex_init(&psv->wait_mtx, NULL)) {
+		sth_free(psv->sth);
+		pthread_mutex_destroy(&psv->mtx);
+		free(psv);
+		return NULL;
+	}
+	if (pthread_cond_init(&psv->wait_cond, NULL)) {
+		pthread_mutex_destroy(&psv->wait_mtx);
+		sth_free(psv->sth);
+		pthread_mutex_destroy(&psv->mtx);
 		free(psv);
 		return NULL;
 	}
 	psv->pdo = pdo;
 
-	if (scriptpath)
+	if (scriptpath) {
 		psv->scriptpath = strdup(scriptpath);
-	else
+		psv->hkc = hkc_new(scriptpath, process_state_list,
+				   sizeof(process_state_list)/sizeof(struct state_node));
+	} else {
 		psv->scriptpath = NULL;
+	}
 	
 	return psv;
 }
 
+/*
+ * sets which hook stages may run in parallel; NULL runs them one
+ * after another
+ */
+struct process_state_vm *
+psv_withhooks(struct process_state_vm *psv,
+	      const struct bhyve_configuration_hooks *bch)
+{
+	size_t counter = 0;
+
+	if (!psv) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (counter = 0; counter < BCH_STAGECOUNT; counter++)
+		psv->stage_after[counter] = bch_get_after(bch, counter);
+
+	return psv;
+}
+
+/*
+ * sets the timer wheel used for stop deadlines and script timeouts
+ */
+struct process_state_vm *
+psv_withtimerwheel(struct process_state_vm *psv, struct timer_wheel *tw)
+{
+	if (!psv) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	psv->tw = tw;
+
+	return psv;
+}
+
+/*
+ * get the timer wheel of the process state vm
+ */
+struct timer_wheel *
+psv_get_timerwheel(const struct process_state_vm *psv)
+{
+	if (!psv) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return psv->tw;
+}
+
+/*
+ * sets the watcher reporting exits of the vm process and its hooks
+ *
+ * with a watcher set, hook scripts run asynchronously and state
+ * changes continue once the watcher reported the hook exit.
+ */
+struct process_state_vm *
+psv_withwatcher(struct process_state_vm *psv, struct process_watcher_object *pwo)
+{
+	if (!psv) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	psv->pwo = pwo;
+	hkc_withwatcher(psv->hkc, pwo, psv);
+
+	return psv;
+}
+
+/*
+ * look up the hook script for entering a state
+ *
+ * puts the path of the script into exepath and returns true if an
+ * executable script exists.
+ */
+bool
+psv_findhook(struct process_state_vm *psv, const struct state_node *state,
+	     char *exepath, size_t len)
+{
+	if (!psv || !state || !exepath) {
+		errno = EINVAL;
+		return false;
+	}
+
+	if (psv->hkc)
+		return hkc_lookup(psv->hkc, state->name, exepath, len);
+
+	snprintf(exepath, len, "%s/%s", psv->scriptpath, state->name);
+
+	return hkc_checkpath(exepath);
+}
+
+/*
+ * launch a hook script of the vm for a state change from one state to
+ * another
+ *
+ * scripts are handed to the watcher if it can launch them and the vm
+ * can track another running script; otherwise they are launched
+ * directly.
+ */
+int
+psv_launchhook(struct process_state_vm *psv, const char *exepath,
+	       const struct state_node *from, const struct state_node *to,
+	       pid_t *pid)
+{
+	if (!psv || !exepath || !to || !pid) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (psv->pwo && psv->pwo->funcs->launchhook &&
+	    (psv->hooks_running < PSV_HOOKS_MAX)) {
+		if (!psv->pwo->funcs->launchhook(psv->pwo->ctx, psv, exepath,
+						 from ? from->name : "",
+						 to->name, pid))
+			return 0;
+
+		if (ENOTSUP != errno)
+			return -1;
+	}
+
+	return sch_launchscript(exepath, psv->ldr, pid);
+}
+
+/*
+ * handler method, called whenever the hook scripts of the vm changed
+ */
+void
+psv_onhookschanged(struct process_state_vm *psv)
+{
+	if (psv)
+		hkc_invalidate(psv->hkc);
+}
+
+/*
+ * get the number of hook directory scans
+ */
+uint64_t
+psv_get_hookscans(struct process_state_vm *psv)
+{
+	if (!psv) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return hkc_get_scans(psv->hkc);
+}
+
+/*
+ * check whether hook scripts run asynchronously
+ */
+bool
+psv_is_async(const struct process_state_vm *psv)
+{
+	return psv && psv->pwo;
+}
+
+/*
+ * check whether hook scripts of the state being entered run in the
+ * background
+ */
+bool
+psv_is_background(const struct process_state_vm *psv)
+{
+	return psv && psv->hook_background;
+}
+
+/*
+ * check whether pid is a running hook script of the vm
+ */
+bool
+psv_is_hookpid(const struct process_state_vm *psv, pid_t pid)
+{
+	bool found = false;
+	size_t counter = 0;
+
+	if (!pid || pthread_mutex_lock((pthread_mutex_t *) &psv->mtx))
+		return false;
+
+	for (counter = 0; counter < PSV_HOOKS_MAX; counter++) {
+		if (psv->hooks[counter].pid == pid) {
+			found = true;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock((pthread_mutex_t *) &psv->mtx);
+
+	return found;
+}
+
+/*
+ * get wait status of the last hook script a state change waited for
+ */
+int
+psv_get_hookstatus(const struct process_state_vm *psv)
+{
+	int status = 0;
+
+	if (pthread_mutex_lock((pthread_mutex_t *) &psv->mtx)) {
+		errno = EDEADLK;
+		return 0;
+	}
+
+	status = psv->hookstatus;
+
+	pthread_mutex_unlock((pthread_mutex_t *) &psv->mtx);
+
+	return status;
+}
+
 /*
  * switch out config file to use
  */
@@ -800,6 +2108,23 @@ psv_set_configfile(struct process_state_vm *psv,
 	return -1;
 }
 
+/*
+ * switch out arguments passed to bhyve
+ */
+int
+psv_set_args(struct process_state_vm *psv, const char **args)
+{
+	if (!psv) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (psv->pdo && psv->pdo->funcs->set_args)
+		return psv->pdo->funcs->set_args(psv->pdo->ctx, args);
+
+	return -1;
+}
+
 /*
  * add a log redirector into the process state vm
  */
@@ -849,6 +2174,11 @@ psv_new(const struct bhyve_configuration *bc)
 	}
 	
 	result = psv_withconfig(pdo, scriptpath);
+	if (result) {
+		result->stoptimeout = bc_get_stoptimeout(bc);
+		result->scripttimeout = bc_get_scripttimeout(bc);
+		psv_withhooks(result, bc_get_hooks(bc));
+	}
 
 	free(configpath);
 
@@ -861,17 +2191,31 @@ psv_new(const struct bhyve_configuration *bc)
 void
 psv_free(struct process_state_vm *psv)
 {
+	size_t counter = 0;
+
 	if (!psv)
 		return;
 
+	if (psv->tw) {
+		tw_cancel(psv->tw, &psv->stop_timer);
+		for (counter = 0; counter < PSV_HOOKS_MAX; counter++)
+			tw_cancel(psv->tw, &psv->hooks[counter].timer);
+	}
+
 	if (pthread_mutex_lock(&psv->mtx)) {
 		errno = EDEADLK;
 		return;
 	}
 
+	for (counter = 0; counter < PSV_HOOKS_MAX; counter++)
+		free(psv->hooks[counter].path);
+	free(psv->hookpath);
 	free(psv->scriptpath);
+	hkc_free(psv->hkc);
 	pthread_mutex_unlock(&psv->mtx);
 	pthread_mutex_destroy(&psv->mtx);
+	pthread_cond_destroy(&psv->wait_cond);
+	pthread_mutex_destroy(&psv->wait_mtx);
 
 	sth_free(psv->sth);
 	pdobj_free(psv->pdo);
@@ -893,6 +2237,37 @@ psv_get_logredirector(struct process_state_vm *psv)
 	return psv->ldr;
 }
 
+/*
+ * get number of bytes allocated for a process state vm, not counting
+ * its process definition and the shared transition table
+ */
+size_t
+psv_get_memusage(struct process_state_vm *psv)
+{
+	size_t bytes = 0, counter = 0;
+
+	if (!psv)
+		return 0;
+
+	if (pthread_mutex_lock(&psv->mtx))
+		return 0;
+
+	if (psv->scriptpath)
+		bytes += strlen(psv->scriptpath) + 1;
+	if (psv->hookpath)
+		bytes += strlen(psv->hookpath) + 1;
+	for (counter = 0; counter < PSV_HOOKS_MAX; counter++) {
+		if (psv->hooks[counter].path)
+			bytes += strlen(psv->hooks[counter].path) + 1;
+	}
+	bytes += hkc_get_memusage(psv->hkc);
+	bytes += sth_get_memusage(psv->sth);
+
+	pthread_mutex_unlock(&psv->mtx);
+
+	return sizeof(struct process_state_vm) + bytes;
+}
+
 /*
  * get a string representation for a state code
  */
@@ -935,4 +2310,32 @@ psv_state2string(bhyve_vmstate_t state)
 	return "UNKNOWN";
 }
 
+/*
+ * look up a state by its name, ignoring case
+ *
+ * returns 0 on success, -1 with errno set to ENOENT for unknown names.
+ */
+int
+psv_string2state(const char *name, bhyve_vmstate_t *state)
+{
+	size_t counter = 0;
+	size_t count = sizeof(process_state_list)/sizeof(struct state_node);
+
+	if (!name || !state) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (counter = 0; counter < count; counter++) {
+		if (!strcasecmp(name, psv_state2string(process_state_list[counter].id))) {
+			*state = process_state_list[counter].id;
+			return 0;
+		}
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
 CREATE_GETTERFUNC_STR(process_state_vm, psv, scriptpath);
+CREATE_GETTERFUNC_UINT32(process_state_vm, psv, scripttimeout);
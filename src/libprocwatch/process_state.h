@@ -31,6 +31,7 @@
 #include "../liblogging/log_director.h"
 #include "../libstate/state_handler.h"
 #include "../libstate/state_node.h"
+#include "../libutils/timer_wheel.h"
 
 #include "bhyve_config.h"
 #include "reboot_manager_object.h"
@@ -72,18 +73,25 @@ typedef enum {
 } bhyve_vmstate_t;
 
 struct process_state_vm;
+struct process_watcher_object;
 
 struct process_state_vm *psv_new(const struct bhyve_configuration *bc);
 void psv_free(struct process_state_vm *psv);
 bhyve_vmstate_t psv_getstate(const struct process_state_vm *psv);
+uint64_t psv_getstateversion(const struct process_state_vm *psv);
+uint32_t psv_stateset(bhyve_vmstate_t state);
+int64_t psv_waitstate(struct process_state_vm *psv, uint32_t set, int timeout);
+void psv_closewaits(struct process_state_vm *psv);
 pid_t psv_getpid(const struct process_state_vm *psv);
 
 const char *psv_get_scriptpath(const struct process_state_vm *);
+uint32_t psv_get_scripttimeout(const struct process_state_vm *);
 
 int psv_startvm(struct process_state_vm *psv, pid_t *pid, struct log_director_redirector *ldr);
 int psv_stopvm(struct process_state_vm *psv, int *exitcode);
 int psv_rebootvm(struct process_state_vm *psv, int *exitcode);
 int psv_failurestate(struct process_state_vm *psv);
+int psv_abortreboot(struct process_state_vm *psv);
 bool psv_is_failurestate(struct process_state_vm *psv);
 struct process_state_vm *
 psv_withrebootmgr(struct process_state_vm *psv, struct reboot_manager_object *rmo);
@@ -91,11 +99,34 @@ struct process_state_vm *
 psv_with_logredirector(struct process_state_vm *psv,
 		       struct log_director_redirector *ldr);
 struct log_director_redirector *psv_get_logredirector(struct process_state_vm *psv);
+struct process_state_vm *
+psv_withhooks(struct process_state_vm *psv,
+	      const struct bhyve_configuration_hooks *bch);
+struct process_state_vm *
+psv_withtimerwheel(struct process_state_vm *psv, struct timer_wheel *tw);
+struct timer_wheel *psv_get_timerwheel(const struct process_state_vm *psv);
+struct process_state_vm *
+psv_withwatcher(struct process_state_vm *psv, struct process_watcher_object *pwo);
+bool psv_is_async(const struct process_state_vm *psv);
+bool psv_is_background(const struct process_state_vm *psv);
+int psv_addhook(struct process_state_vm *psv, const char *exepath, pid_t pid);
+bool psv_is_busy(struct process_state_vm *psv);
+bool psv_is_hookpid(const struct process_state_vm *psv, pid_t pid);
+int psv_get_hookstatus(const struct process_state_vm *psv);
+bool psv_findhook(struct process_state_vm *psv, const struct state_node *state,
+		  char *exepath, size_t len);
+int psv_launchhook(struct process_state_vm *psv, const char *exepath,
+		   const struct state_node *from, const struct state_node *to,
+		   pid_t *pid);
+uint64_t psv_get_hookscans(struct process_state_vm *psv);
 int psv_resetfailure(struct process_state_vm *psv);
+size_t psv_get_memusage(struct process_state_vm *psv);
 
 const char *psv_state2string(bhyve_vmstate_t state);
+int psv_string2state(const char *name, bhyve_vmstate_t *state);
 int
 psv_set_configfile(struct process_state_vm *psv,
 		   const char *configfile);
+int psv_set_args(struct process_state_vm *psv, const char **args);
 
 #endif /* __PROCESS_STATE_H__ */
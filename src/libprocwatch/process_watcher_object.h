@@ -0,0 +1,68 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __PROCESS_WATCHER_OBJECT_H__
+#define __PROCESS_WATCHER_OBJECT_H__
+
+#include <sys/types.h>
+
+struct process_state_vm;
+
+/*
+ * process watcher function table
+ *
+ * watch registers a child process of the vm with an event loop, which
+ * reports its termination through psv_onexit/psv_onsignal for the vm
+ * process or psv_onhookexit for hook scripts. Fails with ESRCH if the
+ * process already terminated.
+ *
+ * watchfile registers an open file or directory of the vm's hook
+ * scripts; any change to it is reported through psv_onhookschanged.
+ * The registration ends when fd is closed.
+ *
+ * launchhook, if set, launches a hook script outside of the daemon
+ * process. The script's exit is reported like that of a watched hook
+ * once it was passed to watch. Fails with ENOTSUP if the watcher
+ * cannot launch scripts, the daemon launches them itself then.
+ */
+struct process_watcher_funcs {
+	int(*watch)(void *ctx, struct process_state_vm *psv, pid_t pid);
+	int(*watchfile)(void *ctx, struct process_state_vm *psv, int fd);
+	int(*launchhook)(void *ctx, struct process_state_vm *psv,
+			 const char *exepath, const char *from, const char *to,
+			 pid_t *pid);
+};
+
+/*
+ * process watcher object definition
+ */
+struct process_watcher_object {
+	void *ctx;
+	struct process_watcher_funcs *funcs;
+};
+
+#endif /* __PROCESS_WATCHER_OBJECT_H__ */
@@ -32,6 +32,11 @@
 
 struct process_state_vm;
 
+/*
+ * returned by request_reboot if the vm must stop instead of restarting
+ */
+#define RMO_REBOOT_DECLINED 1
+
 /*
  * reboot manager function table
  */
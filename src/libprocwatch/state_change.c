@@ -25,11 +25,12 @@
  * SUCH DAMAGE.
  */
 
-#include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <errno.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <syslog.h>
@@ -40,34 +41,81 @@
 #include "state_change.h"
 
 #include "../libstate/state_node.h"
+#include "../libutils/daemon_log.h"
+#include "../libutils/timer_wheel.h"
+
+/*
+ * kills a user script that exceeded its run time
+ */
+struct state_change_script_timeout {
+	struct timer_wheel_timer timer;
+	const char *exepath;
+	uint32_t timeout;
+	pid_t pid;
+};
 
 /*
  * called when a new state is being entered
  *
- * should return 0 when it completed successfully.
+ * should return 0 when it completed successfully. If the vm runs its
+ * hooks asynchronously, STH_PENDING is returned while the script runs.
+ * Scripts of states entered in the background are only launched.
  */
 int
 sch_onenter(struct state_node *new_state, void *ctx, struct state_node *from, uint64_t from_state)
 {
 	struct process_state_vm *psv = ctx;
-	struct stat file_info = {0};
 	char exepath[PATH_MAX] = {0};
+	pid_t pid = 0;
 
-	/* run script with name of target state */
-	const char *scriptpath = psv_get_scriptpath(psv);
+	/* run script with name of target state; ignore if there is none */
+	if (!psv_findhook(psv, new_state, exepath, PATH_MAX))
+		return 0;
 
-	snprintf(exepath, PATH_MAX, "%s/%s", scriptpath, new_state->name);
-	
-	if (stat(exepath, &file_info) < 0) {
-		/* ignore if file does not exist */
+	if (psv_is_background(psv) || psv_is_async(psv)) {
+		dlog(LOG_DEBUG, "sch_onenter: psv_launchhook(\"%s\")", exepath);
+		if (psv_launchhook(psv, exepath, from, new_state, &pid))
+			return -1;
+
+		/* the state change resumes once the script was reaped,
+		   background scripts are collected by the next join */
+		if (!psv_addhook(psv, exepath, pid))
+			return psv_is_background(psv) ? 0 : STH_PENDING;
+
+		/* the script timeout fires on the watcher's thread, which
+		   may be this one; only collect scripts that already ended */
+		if (psv_is_async(psv) && (ESRCH != errno)) {
+			dlog(LOG_ERR, "Failed to watch script \"%s\", "
+			     "terminating it", exepath);
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			return -1;
+		}
 
-		/* TODO differentiate errno cases; file not found is ok */
-		
-		return 0;
+		/* script could not be watched, collect it right here */
+		return sch_waitscript(exepath, pid, psv_get_timerwheel(psv),
+				      psv_get_scripttimeout(psv));
 	}
 
-	syslog(LOG_INFO, "sch_onenter: sch_runscript(\"%s\", true)", exepath);
-	return sch_runscript(exepath, true, psv_get_logredirector(psv));
+	dlog(LOG_DEBUG, "sch_onenter: sch_runscript(\"%s\", true)", exepath);
+	return sch_runscript_timed(exepath, true, psv_get_logredirector(psv),
+				   psv_get_timerwheel(psv),
+				   psv_get_scripttimeout(psv));
+}
+
+/*
+ * called when a user script exceeded its timeout
+ */
+void
+sch_script_expired(void *ctx)
+{
+	struct state_change_script_timeout *scst = ctx;
+
+	syslog(LOG_ERR, "script \"%s\" did not complete within %u seconds, "
+	       "sending SIGKILL", scst->exepath, scst->timeout);
+
+	if (kill(scst->pid, SIGKILL) < 0)
+		syslog(LOG_ERR, "Failed to send SIGKILL to process %d", scst->pid);
 }
 
 /*
@@ -75,11 +123,19 @@ sch_onenter(struct state_node *new_state, void *ctx, struct state_node *from, ui
  */
 int
 sch_runscript(const char *exepath, bool waitfinish, struct log_director_redirector *ldr)
+{
+	return sch_runscript_timed(exepath, waitfinish, ldr, NULL, 0);
+}
+
+/*
+ * launches a user script without waiting for it
+ */
+int
+sch_launchscript(const char *exepath, struct log_director_redirector *ldr,
+		 pid_t *pid)
 {
 	struct process_def *pd = 0;
-	pid_t pid = 0;
 	int result = 0;
-	int status = 0;
 	const char *argptr[2] = {0};
 
 	argptr[0] = exepath;
@@ -90,42 +146,91 @@ sch_runscript(const char *exepath, bool waitfinish, struct log_director_redirect
 		    argptr,  /* no additional parameters */
 		    NULL);   /* no user context */
 	if (!pd) {
-		syslog(LOG_ERR, "sch_runscript: failed to instantiate new process_def");
+		syslog(LOG_ERR, "sch_launchscript: failed to instantiate new process_def");
 		return -1;
 	}
 
 	/* just using redirected method, because if ldr is NULL, it will
 	 * behave like there is no redirection */
-	result = pd_launch_redirected(pd, &pid, ldr);
+	result = pd_launch_redirected(pd, pid, ldr);
 
-	pthread_yield();
-	if ((!result) && waitfinish) {
-		waitpid(pid, &status, 0);
-
-		if (WIFEXITED(status)) {
-			result = WEXITSTATUS(status);
-			syslog(LOG_INFO, "pd_launch exit code = %d", result);
-		} else {
-			syslog(LOG_ERR, "WIFEXITED(status) not true");
-
-			syslog(LOG_ERR, "WIFSIGNALED(status) = %d",
-			       WIFSIGNALED(status));
-			if (WIFSIGNALED(status)) {
-				syslog(LOG_ERR, "signal: %d",
-				       WTERMSIG(status));
-				syslog(LOG_ERR, "coredump: %d",
-				       WCOREDUMP(status));
-			}
-			syslog(LOG_ERR, "WIFSTOPPED(status) = %d",
-			       WIFSTOPPED(status));
-			
-			result = -1;
-		}
-	} else {
-		syslog(LOG_INFO, "pd_launch result = %d", result);
+	pd_free(pd);
+
+	return result;
+}
+
+/*
+ * convert the wait status of a finished user script into its
+ * return code; returns -1 if it did not exit regularly
+ */
+int
+sch_exitstatus(const char *exepath, int status)
+{
+	if (WIFEXITED(status)) {
+		dlog(LOG_DEBUG, "script \"%s\" exit code = %d", exepath,
+		     WEXITSTATUS(status));
+		return WEXITSTATUS(status);
 	}
 
-	pd_free(pd);
+	if (WIFSIGNALED(status))
+		dlog(LOG_ERR, "script \"%s\" terminated by signal %d, %s",
+		     exepath, WTERMSIG(status),
+		     WCOREDUMP(status) ? "core dumped" : "no core dump");
+	else
+		dlog(LOG_ERR, "script \"%s\" did not exit regularly, status "
+		     "0x%x", exepath, status);
+
+	return -1;
+}
+
+/*
+ * waits for a launched user script and returns its return code; the
+ * script is killed if it runs longer than timeout seconds and a timer
+ * wheel is given
+ */
+int
+sch_waitscript(const char *exepath, pid_t pid,
+	       struct timer_wheel *tw, uint32_t timeout)
+{
+	struct state_change_script_timeout scst = {0};
+	int status = 0;
+
+	if (tw && timeout) {
+		tw_timer_init(&scst.timer, sch_script_expired, &scst);
+		scst.exepath = exepath;
+		scst.timeout = timeout;
+		scst.pid = pid;
+		tw_arm(tw, &scst.timer, (uint64_t) timeout * 1000, 0);
+	}
+
+	waitpid(pid, &status, 0);
+
+	/* waits for a running expiry to return before scst goes
+	   out of scope */
+	if (tw && timeout)
+		tw_cancel(tw, &scst.timer);
+
+	return sch_exitstatus(exepath, status);
+}
+
+/*
+ * executes a user script and collects return code if waitfinish is
+ * true; the script is killed if it runs longer than timeout seconds
+ * and a timer wheel is given
+ */
+int
+sch_runscript_timed(const char *exepath, bool waitfinish,
+		    struct log_director_redirector *ldr,
+		    struct timer_wheel *tw, uint32_t timeout)
+{
+	pid_t pid = 0;
+	int result = 0;
+
+	result = sch_launchscript(exepath, ldr, &pid);
+
+	pthread_yield();
+	if ((!result) && waitfinish)
+		result = sch_waitscript(exepath, pid, tw, timeout);
 	
 	return result;
 }
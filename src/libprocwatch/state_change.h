@@ -30,8 +30,17 @@
 
 #include "../liblogging/log_director.h"
 #include "../libstate/state_node.h"
+#include "../libutils/timer_wheel.h"
 
 int sch_onenter(struct state_node *new_state, void *ctx, struct state_node *from, uint64_t from_state);
 int sch_runscript(const char *exepath, bool waitfinish, struct log_director_redirector *ldr);
+int sch_runscript_timed(const char *exepath, bool waitfinish,
+			struct log_director_redirector *ldr,
+			struct timer_wheel *tw, uint32_t timeout);
+int sch_launchscript(const char *exepath, struct log_director_redirector *ldr,
+		     pid_t *pid);
+int sch_waitscript(const char *exepath, pid_t pid,
+		   struct timer_wheel *tw, uint32_t timeout);
+int sch_exitstatus(const char *exepath, int status);
 
 #endif /* __STATE_CHANGE_H__ */
@@ -42,25 +42,19 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include "../bhyve_config_hooks.h"
 #include "../process_def.h"
+#include "../process_state.h"
 
 struct bhyve_configuration {
-	char name[PATH_MAX];
-	char configfile[PATH_MAX];
-	char scriptpath[PATH_MAX];
+	char *name;
+	char *configfile;
+	char *scriptpath;
 	char *os;
 	char *osversion;
 	char *owner;
 	char *group;
 	char *description;
-
-	uint32_t maxrestart;
-	time_t maxrestarttime;
-
-	/* console configuration options */
-	struct bhyve_configuration_console_list *consoles;
-
-	bool autostart;
 	/* a bootrom file */
 	char *bootrom;
 };
@@ -286,8 +280,8 @@ ATF_TC_BODY(tc_bc_uclmultiparsing, tc)
 	ATF_REQUIRE(0 != (bc = bcs_getconfig_byname(bcs, "another_one")));
 	printf("bc->owner = %s\n", bc->owner);
 	ATF_REQUIRE_EQ(0, strcmp(bc->owner, "lclchristianm"));
-	ATF_REQUIRE_EQ(3, bc->maxrestart);
-	ATF_REQUIRE_EQ(10, bc->maxrestarttime);
+	ATF_REQUIRE_EQ(3, bc_get_maxrestart(bc));
+	ATF_REQUIRE_EQ(10, bc_get_maxrestarttime(bc));
 
 	bcs_free(bcs);
 }
@@ -454,6 +448,340 @@ ATF_TC_CLEANUP(tc_bc_networkconfig, tc)
 	unlink("/tmp/config_with_network");	
 }
 
+ATF_TC_WITH_CLEANUP(tc_bc_hookstages);
+ATF_TC_HEAD(tc_bc_hookstages, tc)
+{
+}
+ATF_TC_BODY(tc_bc_hookstages, tc)
+{
+	int filefd = 0;
+	const char *teststring = "staged_vm {\n"
+		"configfile = test3.conf;\n" \
+		"owner = lclchristianm;\n" \
+		"\thooks {\n" \
+		"\t\tstart_storage {\n" \
+		"\t\t\tafter = [];\n" \
+		"\t\t}\n" \
+		"\t\tstop_network {\n" \
+		"\t\t\tafter = stop_storage;\n" \
+		"\t\t}\n" \
+		"\t} \n" \
+		"}";
+	struct bhyve_configuration_store *bcs = bcs_new("/tmp");
+	const struct bhyve_configuration *bc = 0;
+	struct bhyve_configuration_iterator *bci = 0;
+
+	errno = 0;
+	filefd = open("/tmp/config_with_hooks", O_RDWR | O_CREAT);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	ATF_REQUIRE_EQ(0, errno);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(write(filefd, teststring, strlen(teststring))>0);
+	close(filefd);
+
+	ATF_REQUIRE_EQ(0, bcs_parseucl(bcs, "/tmp/config_with_hooks"));
+
+	ATF_REQUIRE(0 != (bci = bcs_iterate_configs(bcs)));
+	ATF_REQUIRE(bci_next(bci));
+	ATF_REQUIRE(0 != (bc = bci_getconfig(bci)));
+	ATF_REQUIRE(0 != bc_get_hooks(bc));
+
+	/* storage no longer waits for network */
+	ATF_REQUIRE_EQ(0, bch_get_after(bc_get_hooks(bc), BCH_START_STORAGE));
+	ATF_REQUIRE_EQ(1 << BCH_STOP_STORAGE,
+		       bch_get_after(bc_get_hooks(bc), BCH_STOP_NETWORK));
+
+	/* stages without configuration keep their defaults */
+	ATF_REQUIRE_EQ(0, bch_get_after(bc_get_hooks(bc), BCH_START_NETWORK));
+	ATF_REQUIRE_EQ(1 << BCH_START_NETWORK,
+		       bch_get_after(NULL, BCH_START_STORAGE));
+	bci_free(bci);
+
+	bcs_free(bcs);
+}
+ATF_TC_CLEANUP(tc_bc_hookstages, tc)
+{
+	unlink("/tmp/config_with_hooks");
+}
+
+/*
+ * create count vm directories, each with a config file, below base
+ */
+int
+test_mkvmdirs(const char *base, size_t count)
+{
+	char path[PATH_MAX];
+	FILE *f = NULL;
+	size_t idx = 0;
+
+	if (mkdir(base, S_IRWXU) && errno != EEXIST)
+		return -1;
+
+	for (idx = 0; idx < count; idx++) {
+		snprintf(path, sizeof(path), "%s/vm%05zu", base, idx);
+		if (mkdir(path, S_IRWXU) && errno != EEXIST)
+			return -1;
+		snprintf(path, sizeof(path), "%s/vm%05zu/config", base, idx);
+		if (!(f = fopen(path, "w")))
+			return -1;
+		fprintf(f, "vm%05zu { configfile = vm.conf; owner = root; "
+			"memory = 512; numcpus = 2; }\n", idx);
+		fclose(f);
+	}
+
+	return 0;
+}
+
+/*
+ * remove the vm directories created by test_mkvmdirs
+ */
+void
+test_rmvmdirs(const char *base, size_t count)
+{
+	char path[PATH_MAX];
+	size_t idx = 0;
+
+	for (idx = 0; idx < count; idx++) {
+		snprintf(path, sizeof(path), "%s/vm%05zu/config", base, idx);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/vm%05zu", base, idx);
+		rmdir(path);
+	}
+	rmdir(base);
+}
+
+ATF_TC_WITH_CLEANUP(tc_bcs_walkdirscale);
+ATF_TC_HEAD(tc_bcs_walkdirscale, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "600");
+}
+ATF_TC_BODY(tc_bcs_walkdirscale, tc)
+{
+	const size_t vmcounts[] = { 1000, 10000 };
+	/* the cache is written by the first cached walk, used by the second */
+	const struct {
+		const char *label;
+		uint32_t threads;
+		bool cache;
+	} modes[] = {
+		{ "serial", 1, false },
+		{ "parallel", 0, false },
+		{ "cache cold", 0, true },
+		{ "cache warm", 0, true }
+	};
+	struct bhyve_configuration_store *bcs = NULL;
+	struct bhyve_configuration_iterator *bci = NULL;
+	const struct bhyve_configuration *bc = NULL;
+	struct timespec start = {0}, end = {0};
+	char expected[PATH_MAX];
+	size_t round = 0, idx = 0, found = 0, cached = 0, parsed = 0;
+	double elapsed = 0;
+
+	for (round = 0; round < sizeof(vmcounts) / sizeof(*vmcounts); round++) {
+		ATF_REQUIRE_EQ(0, test_mkvmdirs("/tmp/testscale",
+						vmcounts[round]));
+
+		unlink("/tmp/testscale.cache");
+
+		for (idx = 0; idx < sizeof(modes) / sizeof(*modes); idx++) {
+			ATF_REQUIRE(0 != (bcs = bcs_new("/tmp/testscale")));
+			bcs_set_threads(bcs, modes[idx].threads);
+			if (modes[idx].cache)
+				ATF_REQUIRE_EQ(0, bcs_set_cachefile(bcs,
+								    "/tmp/testscale.cache"));
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			ATF_REQUIRE_EQ(0, bcs_walkdir(bcs));
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			elapsed = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9;
+			bcs_get_loadstats(bcs, &cached, &parsed);
+			printf("%zu vms, %s: %.3f s, %.0f configs/s, "
+			       "%zu cached, %zu parsed\n", vmcounts[round],
+			       modes[idx].label, elapsed,
+			       vmcounts[round] / elapsed, cached, parsed);
+			ATF_REQUIRE_EQ(vmcounts[round], cached + parsed);
+
+			/* the merge must not depend on thread scheduling */
+			found = 0;
+			ATF_REQUIRE(0 != (bci = bcs_iterate_configs(bcs)));
+			while (bci_next(bci)) {
+				ATF_REQUIRE(0 != (bc = bci_getconfig(bci)));
+				snprintf(expected, sizeof(expected), "vm%05zu",
+					 vmcounts[round] - 1 - found);
+				ATF_REQUIRE_STREQ(expected, bc_get_name(bc));
+				found++;
+			}
+			bci_free(bci);
+			ATF_REQUIRE_EQ(vmcounts[round], found);
+
+			bcs_free(bcs);
+		}
+
+		ATF_REQUIRE_EQ(vmcounts[round], cached);
+
+		test_rmvmdirs("/tmp/testscale", vmcounts[round]);
+	}
+}
+ATF_TC_CLEANUP(tc_bcs_walkdirscale, tc)
+{
+	unlink("/tmp/testscale.cache");
+	test_rmvmdirs("/tmp/testscale", 10000);
+}
+
+ATF_TC_WITH_CLEANUP(tc_bcs_memoryscale);
+ATF_TC_HEAD(tc_bcs_memoryscale, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "600");
+}
+ATF_TC_BODY(tc_bcs_memoryscale, tc)
+{
+	const size_t vmcounts[] = { 1000, 10000 };
+	struct bhyve_configuration_store *bcs = NULL;
+	struct bhyve_configuration_iterator *bci = NULL;
+	struct process_def *pd = NULL;
+	struct process_state_vm *psv = NULL;
+	size_t round = 0, count = 0, bytes = 0, pdbytes = 0, psvbytes = 0;
+
+	for (round = 0; round < sizeof(vmcounts) / sizeof(*vmcounts); round++) {
+		ATF_REQUIRE_EQ(0, test_mkvmdirs("/tmp/testmemory",
+						vmcounts[round]));
+		ATF_REQUIRE(0 != (bcs = bcs_new("/tmp/testmemory")));
+		ATF_REQUIRE_EQ(0, bcs_walkdir(bcs));
+
+		bcs_get_memusage(bcs, &count, &bytes);
+		ATF_REQUIRE_EQ(vmcounts[round], count);
+
+		/* a registered vm also keeps the process definition and state */
+		pdbytes = 0;
+		psvbytes = 0;
+		ATF_REQUIRE(0 != (bci = bcs_iterate_configs(bcs)));
+		while (bci_next(bci)) {
+			ATF_REQUIRE(0 != (pd = pd_fromconfig(bci_getconfig(bci))));
+			pdbytes += pd_get_memusage(pd);
+			pd_free(pd);
+			ATF_REQUIRE(0 != (psv = psv_new(bci_getconfig(bci))));
+			psvbytes += psv_get_memusage(psv);
+			psv_free(psv);
+		}
+		bci_free(bci);
+
+		printf("%zu vms: %zu bytes per configuration, %zu bytes per "
+		       "process definition, %zu bytes per process state\n",
+		       vmcounts[round], bytes / count, pdbytes / count,
+		       psvbytes / count);
+
+		/* the former layouts embedded three and five PATH_MAX arrays */
+		ATF_REQUIRE(bytes / count < PATH_MAX / 2);
+		ATF_REQUIRE(pdbytes / count < PATH_MAX / 2);
+		ATF_REQUIRE(psvbytes / count < 2 * PATH_MAX);
+
+		bcs_free(bcs);
+		test_rmvmdirs("/tmp/testmemory", vmcounts[round]);
+	}
+}
+ATF_TC_CLEANUP(tc_bcs_memoryscale, tc)
+{
+	test_rmvmdirs("/tmp/testmemory", 10000);
+}
+
+/*
+ * replace the contents of a config file
+ */
+void
+test_writeconfig(const char *path, const char *content)
+{
+	FILE *f = NULL;
+
+	ATF_REQUIRE(0 != (f = fopen(path, "w")));
+	ATF_REQUIRE(fputs(content, f) >= 0);
+	fclose(f);
+}
+
+ATF_TC_WITH_CLEANUP(tc_bcs_configcache);
+ATF_TC_HEAD(tc_bcs_configcache, tc)
+{
+}
+ATF_TC_BODY(tc_bcs_configcache, tc)
+{
+	const char *vm0 = "vm0 {\n" \
+		"configfile = vm0.conf;\n" \
+		"owner = root;\n" \
+		"memory = 512;\n" \
+		"\tconsoles {\n" \
+		"\t\tconsole0 {\n" \
+		"\t\t\tname = vmconsole0;\n" \
+		"\t\t}\n" \
+		"\t}\n" \
+		"\thooks {\n" \
+		"\t\tstart_storage {\n" \
+		"\t\t\tafter = [];\n" \
+		"\t\t}\n" \
+		"\t}\n" \
+		"}\n";
+	struct bhyve_configuration_store *bcs = NULL;
+	struct bhyve_configuration *bc = NULL;
+	size_t cached = 0, parsed = 0, round = 0;
+
+	mkdir("/tmp/testcache", S_IRWXU);
+	mkdir("/tmp/testcache/vm0", S_IRWXU);
+	mkdir("/tmp/testcache/vm1", S_IRWXU);
+	test_writeconfig("/tmp/testcache/vm0/config", vm0);
+	test_writeconfig("/tmp/testcache/vm1/config",
+			 "vm1 { configfile = vm1.conf; owner = root; }\n");
+	unlink("/tmp/testcache.cache");
+
+	/* the first walk writes the cache, the second one uses it */
+	for (round = 0; round < 2; round++) {
+		ATF_REQUIRE(0 != (bcs = bcs_new("/tmp/testcache")));
+		ATF_REQUIRE_EQ(0, bcs_set_cachefile(bcs, "/tmp/testcache.cache"));
+		ATF_REQUIRE_EQ(0, bcs_walkdir(bcs));
+
+		bcs_get_loadstats(bcs, &cached, &parsed);
+		ATF_REQUIRE_EQ(round ? 2 : 0, cached);
+		ATF_REQUIRE_EQ(round ? 0 : 2, parsed);
+
+		ATF_REQUIRE(0 != (bc = bcs_getconfig_byname(bcs, "vm0")));
+		ATF_REQUIRE_STREQ("vm0.conf", bc_get_configfile(bc));
+		ATF_REQUIRE_STREQ("/tmp/testcache/vm0/config",
+				  bc_get_backingfile(bc));
+		ATF_REQUIRE_EQ(512, bc_get_memory(bc));
+		ATF_REQUIRE_EQ(1, bc_get_consolecount(bc));
+		ATF_REQUIRE(0 != bc_get_hooks(bc));
+		ATF_REQUIRE_EQ(0, bch_get_after(bc_get_hooks(bc),
+						BCH_START_STORAGE));
+
+		bcs_free(bcs);
+	}
+
+	/* only the changed file is parsed again */
+	test_writeconfig("/tmp/testcache/vm1/config",
+			 "vm1 { configfile = vm1.conf; owner = toor; cores = 2; }\n");
+
+	ATF_REQUIRE(0 != (bcs = bcs_new("/tmp/testcache")));
+	ATF_REQUIRE_EQ(0, bcs_set_cachefile(bcs, "/tmp/testcache.cache"));
+	ATF_REQUIRE_EQ(0, bcs_walkdir(bcs));
+
+	bcs_get_loadstats(bcs, &cached, &parsed);
+	ATF_REQUIRE_EQ(1, cached);
+	ATF_REQUIRE_EQ(1, parsed);
+
+	ATF_REQUIRE(0 != (bc = bcs_getconfig_byname(bcs, "vm1")));
+	ATF_REQUIRE_STREQ("toor", bc_get_owner(bc));
+	ATF_REQUIRE_EQ(2, bc_get_cores(bc));
+
+	bcs_free(bcs);
+}
+ATF_TC_CLEANUP(tc_bcs_configcache, tc)
+{
+	unlink("/tmp/testcache.cache");
+	unlink("/tmp/testcache/vm0/config");
+	unlink("/tmp/testcache/vm1/config");
+	rmdir("/tmp/testcache/vm0");
+	rmdir("/tmp/testcache/vm1");
+	rmdir("/tmp/testcache");
+}
 
 ATF_TP_ADD_TCS(testplan)
 {
@@ -466,6 +794,10 @@ ATF_TP_ADD_TCS(testplan)
 	ATF_TP_ADD_TC(testplan, tc_bc_parsedir);
 	ATF_TP_ADD_TC(testplan, tc_bc_iterator);
 	ATF_TP_ADD_TC(testplan, tc_bc_networkconfig);
+	ATF_TP_ADD_TC(testplan, tc_bc_hookstages);
+	ATF_TP_ADD_TC(testplan, tc_bcs_walkdirscale);
+	ATF_TP_ADD_TC(testplan, tc_bcs_memoryscale);
+	ATF_TP_ADD_TC(testplan, tc_bcs_configcache);
 
 	unlink("/tmp/testdir/something/config");
 	unlink("/tmp/testdir/another/config");
@@ -26,6 +26,7 @@
  */
 
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <atf-c.h>
 #include <errno.h>
@@ -39,6 +40,7 @@
 
 #include "../../liblogging/log_director.h"
 #include "../bhyve_director.h"
+#include "../bhyve_director_errors.h"
 #include "../bhyve_messagesub_object.h"
 #include "../process_def_object.h"
 #include "../process_state.h"
@@ -46,12 +48,14 @@
 int tc_bd_initfree_callcounter = 0;
 
 struct process_def {
-	char name[PATH_MAX];
-	char *description;
-	char procpath[PATH_MAX];
+	const char *name;
+	const char *description;
+	const char *procpath;
 	char **procargs; /* null terminated argument list */
 	
 	void *ctx; /* user context */
+	struct string_pool *strings;
+	size_t argstrings;
 };
 
 struct process_state_vm {
@@ -88,6 +92,61 @@ int bwv_timestamp(struct bhyve_watched_vm *bwv);
 unsigned int bwv_countrestarts_since(struct bhyve_watched_vm *bwv, time_t deadline);
 struct bhyve_watched_vm *bd_getvmbyname(struct bhyve_director *bd, const char *name);
 bool bwv_is_countfail(struct bhyve_watched_vm *bwv);
+int bwv_generate_config(struct bhyve_watched_vm *bwv,
+			struct config_generator_object *cgo);
+
+int tc_bd_generateconfig_callcounter = 0;
+
+/*
+ * counts generated configs and writes the vm name into them
+ */
+int
+tc_bd_generateconfig_generate(const struct bhyve_configuration *bc,
+			      const char *filename)
+{
+	FILE *f = NULL;
+
+	tc_bd_generateconfig_callcounter++;
+
+	if (!(f = fopen(filename, "w")))
+		return -1;
+	fprintf(f, "name=%s\n", bc_get_name(bc));
+	fclose(f);
+
+	return 0;
+}
+
+struct config_generator_object tc_bd_generateconfig_cgo = {
+	.generate_config_file = tc_bd_generateconfig_generate
+};
+
+int tc_bd_configargs_callcounter = 0;
+
+/*
+ * counts generated argument lists, which name the vm
+ */
+char **
+tc_bd_configargs_generate(const struct bhyve_configuration *bc)
+{
+	char **args = NULL;
+
+	tc_bd_configargs_callcounter++;
+
+	if (!(args = malloc(5 * sizeof(char *))))
+		return NULL;
+	args[0] = "-k";
+	args[1] = (char *) bc_get_configfile(bc);
+	args[2] = "-o";
+	args[3] = "name=generated";
+	args[4] = NULL;
+
+	return args;
+}
+
+struct config_generator_object tc_bd_configargs_cgo = {
+	.generate_config_file = tc_bd_generateconfig_generate,
+	.generate_config_args = tc_bd_configargs_generate
+};
 
 struct bhyve_messagesub_obj tc_bd_initfree_msgsub = {
 	.obj = NULL,
@@ -216,6 +275,153 @@ ATF_TC_CLEANUP(tc_bd_timestamping, tc)
 	unlink("/tmp/testfile");
 }
 
+ATF_TC_WITH_CLEANUP(tc_bd_generateconfig);
+ATF_TC_HEAD(tc_bd_generateconfig, tc)
+{
+	tc_bd_generateconfig_callcounter = 0;
+}
+ATF_TC_BODY(tc_bd_generateconfig, tc)
+{
+	const char *teststring = "generated { configfile = "
+		"\"/tmp/testgenerate.conf\"; owner = root; }\n";
+	struct bhyve_configuration_store *bcs = bcs_new("/tmp");
+	struct bhyve_configuration_store_obj *bcso = 0;
+	struct bhyve_watched_vm *bwv = 0;
+	struct bhyve_director *bd = 0;
+	uint64_t generated = 0, skipped = 0;
+	FILE *f = NULL;
+
+	ATF_REQUIRE(0 != (f = fopen("/tmp/testgenerate", "w")));
+	fprintf(f, "%s", teststring);
+	fclose(f);
+	ATF_REQUIRE(0 != (f = fopen("/tmp/testgenerate.conf", "w")));
+	fprintf(f, "x86.strictmsr=true\n");
+	fclose(f);
+
+	ATF_REQUIRE_EQ(0, bcs_parseucl(bcs, "/tmp/testgenerate"));
+	ATF_REQUIRE(0 != (bcso = bcsobj_frombcs(bcs)));
+	ATF_REQUIRE(0 != (bd = bd_new(bcso, NULL)));
+	ATF_REQUIRE(0 != (bwv = bd_getvmbyname(bd, "generated")));
+
+	/* the first start generates the config, the next one reuses it */
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_generateconfig_cgo));
+	ATF_REQUIRE_EQ(1, tc_bd_generateconfig_callcounter);
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_generateconfig_cgo));
+	ATF_REQUIRE_EQ(1, tc_bd_generateconfig_callcounter);
+
+	/* a changed template is merged again */
+	ATF_REQUIRE(0 != (f = fopen("/tmp/testgenerate.conf", "a")));
+	fprintf(f, "destroy_on_poweroff=true\n");
+	fclose(f);
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_generateconfig_cgo));
+	ATF_REQUIRE_EQ(2, tc_bd_generateconfig_callcounter);
+
+	/* so is a generated config that went missing */
+	ATF_REQUIRE_EQ(0, unlink("/tmp/testgenerate.conf.generated"));
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_generateconfig_cgo));
+	ATF_REQUIRE_EQ(3, tc_bd_generateconfig_callcounter);
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_generateconfig_cgo));
+	ATF_REQUIRE_EQ(3, tc_bd_generateconfig_callcounter);
+
+	bd_get_configstats(bd, &generated, &skipped);
+	ATF_REQUIRE_EQ(3, generated);
+	ATF_REQUIRE_EQ(2, skipped);
+
+	bd_free(bd);
+	bcsobj_free(bcso);
+
+	bcs_free(bcs);
+}
+ATF_TC_CLEANUP(tc_bd_generateconfig, tc)
+{
+	unlink("/tmp/testgenerate");
+	unlink("/tmp/testgenerate.conf");
+	unlink("/tmp/testgenerate.conf.generated");
+}
+
+ATF_TC_WITH_CLEANUP(tc_bd_configargs);
+ATF_TC_HEAD(tc_bd_configargs, tc)
+{
+	tc_bd_generateconfig_callcounter = 0;
+	tc_bd_configargs_callcounter = 0;
+}
+ATF_TC_BODY(tc_bd_configargs, tc)
+{
+	const char *teststring = "generated { configfile = "
+		"\"/tmp/testargs.conf\"; owner = root; }\n";
+	const char *testscript = "#!/bin/sh\necho \"$@\" > /tmp/testargs.out\n";
+	struct bhyve_configuration_store *bcs = bcs_new("/tmp");
+	struct bhyve_configuration_store_obj *bcso = 0;
+	struct bhyve_watched_vm *bwv = 0;
+	struct bhyve_director *bd = 0;
+	struct process_def *pd = 0;
+	struct stat st;
+	uint64_t generated = 0, skipped = 0;
+	pid_t pid = 0;
+	int status = 0;
+	FILE *f = NULL;
+
+	ATF_REQUIRE(0 != (f = fopen("/tmp/testargs", "w")));
+	fprintf(f, "%s", teststring);
+	fclose(f);
+	ATF_REQUIRE(0 != (f = fopen("/tmp/testargs.conf", "w")));
+	fprintf(f, "x86.strictmsr=true\n");
+	fclose(f);
+	ATF_REQUIRE(0 != (f = fopen("/tmp/testargs.sh", "w")));
+	fprintf(f, "%s", testscript);
+	fclose(f);
+	ATF_REQUIRE_EQ(0, chmod("/tmp/testargs.sh", S_IRWXU));
+
+	ATF_REQUIRE_EQ(0, bcs_parseucl(bcs, "/tmp/testargs"));
+	ATF_REQUIRE(0 != (bcso = bcsobj_frombcs(bcs)));
+	ATF_REQUIRE(0 != (bd = bd_new(bcso, NULL)));
+	ATF_REQUIRE_EQ(0, bd_set_configargs(bd, true, false));
+	ATF_REQUIRE(0 != (bwv = bd_getvmbyname(bd, "generated")));
+
+	/* the stub stands in for bhyve and echoes its arguments */
+	ATF_REQUIRE(0 != (pd = bwv->state->pdo->ctx));
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/tmp/testargs.sh"));
+
+	/* arguments are built once and no config file is written */
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_configargs_cgo));
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_configargs_cgo));
+	ATF_REQUIRE_EQ(1, tc_bd_configargs_callcounter);
+	ATF_REQUIRE_EQ(0, tc_bd_generateconfig_callcounter);
+	ATF_REQUIRE_EQ(-1, stat("/tmp/testargs.conf.generated", &st));
+
+	ATF_REQUIRE_EQ(0, pd_launch(pd, &pid));
+	ATF_REQUIRE_EQ(pid, waitpid(pid, &status, 0));
+	ATF_REQUIRE(atf_utils_compare_file("/tmp/testargs.out",
+		"-k /tmp/testargs.conf -o name=generated\n"));
+
+	/* the file can still be written for debugging */
+	ATF_REQUIRE_EQ(0, bd_set_configargs(bd, true, true));
+	ATF_REQUIRE(0 != (f = fopen("/tmp/testargs.conf", "a")));
+	fprintf(f, "destroy_on_poweroff=true\n");
+	fclose(f);
+	ATF_REQUIRE_EQ(0, bwv_generate_config(bwv, &tc_bd_configargs_cgo));
+	ATF_REQUIRE_EQ(2, tc_bd_configargs_callcounter);
+	ATF_REQUIRE_EQ(1, tc_bd_generateconfig_callcounter);
+	ATF_REQUIRE_EQ(0, stat("/tmp/testargs.conf.generated", &st));
+
+	bd_get_configstats(bd, &generated, &skipped);
+	ATF_REQUIRE_EQ(2, generated);
+	ATF_REQUIRE_EQ(1, skipped);
+
+	bd_free(bd);
+	bcsobj_free(bcso);
+
+	bcs_free(bcs);
+}
+ATF_TC_CLEANUP(tc_bd_configargs, tc)
+{
+	unlink("/tmp/testargs");
+	unlink("/tmp/testargs.conf");
+	unlink("/tmp/testargs.conf.generated");
+	unlink("/tmp/testargs.sh");
+	unlink("/tmp/testargs.out");
+}
+
 ATF_TC_WITH_CLEANUP(tc_bd_vmstartstop);
 ATF_TC_HEAD(tc_bd_vmstartstop, tc)
 {
@@ -274,7 +480,7 @@ ATF_TC_BODY(tc_bd_vmstartstop, tc)
 	
 	/* modify bhyve to testscript */
 	ATF_REQUIRE_EQ(0, strcmp(pd->procpath, "/usr/sbin/bhyve"));
-	strcpy(pd->procpath, "/tmp/testscript");
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/tmp/testscript"));
 
 	/* disable reboot manager on this, otherwise it'll loop */
 	bwv->state->rmo = NULL;
@@ -382,7 +588,7 @@ ATF_TC_BODY(tc_bd_vmstartstoplong, tc)
 	
 	/* modify bhyve to testscript */
 	ATF_REQUIRE_EQ(0, strcmp(pd->procpath, "/usr/sbin/bhyve"));
-	strcpy(pd->procpath, "/tmp/testscript_long");
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/tmp/testscript_long"));
 	
 	/* start and confirm it still runs after a few seconds */
 	ATF_REQUIRE_EQ(0, bd_startvm(bd, "another_one"));
@@ -411,12 +617,156 @@ ATF_TC_CLEANUP(tc_bd_vmstartstoplong, tc)
 	unlink("/tmp/testscript_long");
 }
 
+ATF_TC_WITH_CLEANUP(tc_bd_shutdown);
+ATF_TC_HEAD(tc_bd_shutdown, tc)
+{
+	int filefd = 0;
+	const char *teststring = "stubborn { configfile = test.conf;\nstoptimeout = 60; priority = 1; }\n";
+	const char *stubborn = "#!/bin/sh\n" \
+		"trap '' TERM\n\n" \
+		"while true; do\n" \
+		"    sleep 1\n" \
+		"done\n";
+
+	filefd = open("/tmp/testfile_shutdown", O_RDWR | O_CREAT);
+	fchmod(filefd, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH );
+	write(filefd, teststring, strlen(teststring));
+	close(filefd);
+	
+	filefd = open("/tmp/testscript_shutdown", O_RDWR | O_CREAT);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	write(filefd, stubborn, strlen(stubborn));
+	close(filefd);
+}
+ATF_TC_BODY(tc_bd_shutdown, tc)
+{
+	struct bhyve_configuration_store *bcs = bcs_new("/tmp");
+	struct bhyve_configuration_store_obj *bcso = 0;
+	struct bhyve_watched_vm *bwv = 0;
+	struct bhyve_director *bd = 0;
+	struct process_def *pd = 0;
+
+	ATF_REQUIRE_EQ(0, bcs_parseucl(bcs, "/tmp/testfile_shutdown"));
+	ATF_REQUIRE(0 != (bcso = bcsobj_frombcs(bcs)));
+
+	ATF_REQUIRE(0 != (bd = bd_new(bcso, NULL)));
+	ATF_REQUIRE(0 != (bwv = bd_getvmbyname(bd, "stubborn")));
+
+	pd = bwv->state->pdo->ctx;
+	ATF_REQUIRE(0 != pd);
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/tmp/testscript_shutdown"));
+
+	ATF_REQUIRE_EQ(0, bd_startvm(bd, "stubborn"));
+	sleep(1);
+	ATF_REQUIRE_EQ(RUNNING, psv_getstate(bwv->state));
+
+	/* TERM is ignored, so the vm is killed once the deadline passes */
+	ATF_REQUIRE_EQ(-1, bd_shutdown(bd, 2));
+	ATF_REQUIRE_EQ(ETIMEDOUT, errno);
+	ATF_REQUIRE_EQ(STOPPED, psv_getstate(bwv->state));
+
+	/* nothing is started once the director shuts down */
+	ATF_REQUIRE_EQ(BD_ERR_SHUTTINGDOWN, bd_startvm(bd, "stubborn"));
+
+	bd_free(bd);
+	bcsobj_free(bcso);
+	bcs_free(bcs);
+}
+ATF_TC_CLEANUP(tc_bd_shutdown, tc)
+{
+	unlink("/tmp/testfile_shutdown");
+	unlink("/tmp/testscript_shutdown");
+}
+
+ATF_TC_WITH_CLEANUP(tc_bd_shutdownwaves);
+ATF_TC_HEAD(tc_bd_shutdownwaves, tc)
+{
+	int filefd = 0;
+	const char *teststring = "stubborn { configfile = test.conf;\nstoptimeout = 60; priority = 2; }\n" \
+		"polite { configfile = test.conf;\nstoptimeout = 60; priority = 1; }\n";
+	const char *stubborn = "#!/bin/sh\n" \
+		"trap '' TERM\n\n" \
+		"while true; do\n" \
+		"    sleep 1\n" \
+		"done\n";
+	const char *polite = "#!/bin/sh\n" \
+		"trap 'echo TERM > /tmp/testshutdown_polite; exit 0' TERM\n\n" \
+		"while true; do\n" \
+		"    sleep 1\n" \
+		"done\n";
+
+	filefd = open("/tmp/testfile_shutdownwaves", O_RDWR | O_CREAT);
+	fchmod(filefd, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH );
+	write(filefd, teststring, strlen(teststring));
+	close(filefd);
+	
+	filefd = open("/tmp/testscript_stubborn", O_RDWR | O_CREAT);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	write(filefd, stubborn, strlen(stubborn));
+	close(filefd);
+
+	filefd = open("/tmp/testscript_polite", O_RDWR | O_CREAT);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	write(filefd, polite, strlen(polite));
+	close(filefd);
+}
+ATF_TC_BODY(tc_bd_shutdownwaves, tc)
+{
+	struct bhyve_configuration_store *bcs = bcs_new("/tmp");
+	struct bhyve_configuration_store_obj *bcso = 0;
+	struct bhyve_watched_vm *stubborn = 0, *polite = 0;
+	struct bhyve_director *bd = 0;
+	struct process_def *pd = 0;
+
+	ATF_REQUIRE_EQ(0, bcs_parseucl(bcs, "/tmp/testfile_shutdownwaves"));
+	ATF_REQUIRE(0 != (bcso = bcsobj_frombcs(bcs)));
+
+	ATF_REQUIRE(0 != (bd = bd_new(bcso, NULL)));
+	ATF_REQUIRE(0 != (stubborn = bd_getvmbyname(bd, "stubborn")));
+	ATF_REQUIRE(0 != (polite = bd_getvmbyname(bd, "polite")));
+
+	ATF_REQUIRE(0 != (pd = stubborn->state->pdo->ctx));
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/tmp/testscript_stubborn"));
+	ATF_REQUIRE(0 != (pd = polite->state->pdo->ctx));
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/tmp/testscript_polite"));
+
+	ATF_REQUIRE_EQ(0, bd_startvm(bd, "stubborn"));
+	ATF_REQUIRE_EQ(0, bd_startvm(bd, "polite"));
+	sleep(1);
+	ATF_REQUIRE_EQ(RUNNING, psv_getstate(stubborn->state));
+	ATF_REQUIRE_EQ(RUNNING, psv_getstate(polite->state));
+
+	/* the first wave uses up the whole deadline */
+	ATF_REQUIRE_EQ(-1, bd_shutdown(bd, 2));
+	ATF_REQUIRE_EQ(ETIMEDOUT, errno);
+	ATF_REQUIRE_EQ(STOPPED, psv_getstate(stubborn->state));
+	ATF_REQUIRE_EQ(STOPPED, psv_getstate(polite->state));
+
+	/* the second wave still got TERM instead of being killed right away */
+	ATF_REQUIRE(atf_utils_compare_file("/tmp/testshutdown_polite", "TERM\n"));
+
+	bd_free(bd);
+	bcsobj_free(bcso);
+	bcs_free(bcs);
+}
+ATF_TC_CLEANUP(tc_bd_shutdownwaves, tc)
+{
+	unlink("/tmp/testfile_shutdownwaves");
+	unlink("/tmp/testscript_stubborn");
+	unlink("/tmp/testscript_polite");
+	unlink("/tmp/testshutdown_polite");
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_bd_initfree);
 	ATF_TP_ADD_TC(testplan, tc_bd_timestamping);
+	ATF_TP_ADD_TC(testplan, tc_bd_generateconfig);
+	ATF_TP_ADD_TC(testplan, tc_bd_configargs);
 	ATF_TP_ADD_TC(testplan, tc_bd_vmstartstop);
 	ATF_TP_ADD_TC(testplan, tc_bd_vmstartstoplong);
+	ATF_TP_ADD_TC(testplan, tc_bd_shutdown);
+	ATF_TP_ADD_TC(testplan, tc_bd_shutdownwaves);
 
 	return atf_no_error();
 }
@@ -0,0 +1,272 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/nv.h>
+#include <sys/stat.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../config_cache.h"
+
+#define TC_CFC_SCHEMA 42
+#define TC_CFC_CACHEFILE "/tmp/cfctest.cache"
+#define TC_CFC_SEARCHPATH "/tmp/cfctest"
+
+const char *tc_cfc_files[] = {
+	TC_CFC_SEARCHPATH "/vm1/config",
+	TC_CFC_SEARCHPATH "/vm0/config"
+};
+
+/*
+ * helper method writing a config file
+ */
+void
+tc_cfc_writefile(const char *path, const char *content)
+{
+	FILE *f = NULL;
+
+	ATF_REQUIRE(0 != (f = fopen(path, "w")));
+	ATF_REQUIRE(fputs(content, f) >= 0);
+	fclose(f);
+}
+
+/*
+ * helper method writing config files and a cache holding both of them
+ */
+void
+tc_cfc_setup()
+{
+	nvlist_t **entries = NULL;
+	nvlist_t *config = NULL;
+	struct stat st = {0};
+	uint64_t hash = 0;
+	size_t idx = 0;
+
+	mkdir(TC_CFC_SEARCHPATH, S_IRWXU);
+	mkdir(TC_CFC_SEARCHPATH "/vm0", S_IRWXU);
+	mkdir(TC_CFC_SEARCHPATH "/vm1", S_IRWXU);
+	tc_cfc_writefile(tc_cfc_files[0], "vm1 { owner = root; }\n");
+	tc_cfc_writefile(tc_cfc_files[1], "vm0 { owner = root; }\n");
+
+	ATF_REQUIRE(0 != (entries = calloc(2, sizeof(nvlist_t *))));
+	for (idx = 0; idx < 2; idx++) {
+		ATF_REQUIRE_EQ(0, stat(tc_cfc_files[idx], &st));
+		ATF_REQUIRE_EQ(0, cfc_hashfile(tc_cfc_files[idx], &hash));
+		ATF_REQUIRE(0 != (entries[idx] = cfc_newentry(tc_cfc_files[idx],
+							      &st, hash)));
+		ATF_REQUIRE(0 != (config = nvlist_create(0)));
+		nvlist_add_string(config, "name", idx ? "vm0" : "vm1");
+		nvlist_add_nvlist_array(entries[idx], "configs",
+					(const nvlist_t * const *)&config, 1);
+		nvlist_destroy(config);
+	}
+
+	ATF_REQUIRE_EQ(0, cfc_write(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+				    TC_CFC_SCHEMA, entries, 2));
+}
+
+/*
+ * helper method removing the files of tc_cfc_setup
+ */
+void
+tc_cfc_cleanup()
+{
+	unlink(TC_CFC_CACHEFILE);
+	unlink(tc_cfc_files[0]);
+	unlink(tc_cfc_files[1]);
+	rmdir(TC_CFC_SEARCHPATH "/vm0");
+	rmdir(TC_CFC_SEARCHPATH "/vm1");
+	rmdir(TC_CFC_SEARCHPATH);
+}
+
+ATF_TC_WITH_CLEANUP(tc_cfc_lookup);
+ATF_TC_HEAD(tc_cfc_lookup, tc)
+{
+}
+ATF_TC_BODY(tc_cfc_lookup, tc)
+{
+	struct config_cache *cfc = NULL;
+	const nvlist_t *entry = NULL;
+	const nvlist_t * const *configs = NULL;
+	struct stat st = {0};
+	uint64_t hash = 0, filehash = 0;
+	size_t count = 0;
+	bool stale = true;
+
+	tc_cfc_setup();
+
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+					TC_CFC_SCHEMA)));
+	ATF_REQUIRE_EQ(2, cfc_get_count(cfc));
+
+	/* entries are found regardless of the order they were written in */
+	ATF_REQUIRE_EQ(0, stat(tc_cfc_files[1], &st));
+	ATF_REQUIRE(0 != (entry = cfc_lookup(cfc, tc_cfc_files[1], &st, &hash,
+					     &stale)));
+	ATF_REQUIRE(!stale);
+	ATF_REQUIRE_EQ(0, cfc_hashfile(tc_cfc_files[1], &filehash));
+	ATF_REQUIRE_EQ(filehash, hash);
+	ATF_REQUIRE_STREQ(tc_cfc_files[1], nvlist_get_string(entry, "path"));
+	configs = nvlist_get_nvlist_array(entry, "configs", &count);
+	ATF_REQUIRE_EQ(1, count);
+	ATF_REQUIRE_STREQ("vm0", nvlist_get_string(configs[0], "name"));
+
+	ATF_REQUIRE_EQ(0, stat(tc_cfc_files[0], &st));
+	ATF_REQUIRE(0 != cfc_lookup(cfc, tc_cfc_files[0], &st, &hash, &stale));
+
+	/* unknown files have to be parsed */
+	ATF_REQUIRE_EQ(0, cfc_lookup(cfc, TC_CFC_SEARCHPATH "/vm2/config", &st,
+				     &hash, &stale));
+
+	cfc_free(cfc);
+}
+ATF_TC_CLEANUP(tc_cfc_lookup, tc)
+{
+	tc_cfc_cleanup();
+}
+
+ATF_TC_WITH_CLEANUP(tc_cfc_changes);
+ATF_TC_HEAD(tc_cfc_changes, tc)
+{
+}
+ATF_TC_BODY(tc_cfc_changes, tc)
+{
+	struct timespec times[2] = {
+		{ .tv_sec = 1000000000, .tv_nsec = 0 },
+		{ .tv_sec = 1000000000, .tv_nsec = 0 }
+	};
+	struct config_cache *cfc = NULL;
+	struct stat st = {0};
+	uint64_t hash = 0;
+	bool stale = false;
+
+	tc_cfc_setup();
+
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+					TC_CFC_SCHEMA)));
+
+	/* a new mtime with the same contents keeps the entry */
+	ATF_REQUIRE_EQ(0, utimensat(AT_FDCWD, tc_cfc_files[0], times, 0));
+	ATF_REQUIRE_EQ(0, stat(tc_cfc_files[0], &st));
+	ATF_REQUIRE(0 != cfc_lookup(cfc, tc_cfc_files[0], &st, &hash, &stale));
+	ATF_REQUIRE(stale);
+
+	/* same size, different contents */
+	tc_cfc_writefile(tc_cfc_files[0], "vm1 { owner = toor; }\n");
+	ATF_REQUIRE_EQ(0, stat(tc_cfc_files[0], &st));
+	ATF_REQUIRE_EQ(0, cfc_lookup(cfc, tc_cfc_files[0], &st, &hash, &stale));
+	ATF_REQUIRE(!stale);
+
+	/* different size */
+	tc_cfc_writefile(tc_cfc_files[1], "vm0 { owner = root; memory = 512; }\n");
+	ATF_REQUIRE_EQ(0, stat(tc_cfc_files[1], &st));
+	ATF_REQUIRE_EQ(0, cfc_lookup(cfc, tc_cfc_files[1], &st, &hash, &stale));
+
+	cfc_free(cfc);
+}
+ATF_TC_CLEANUP(tc_cfc_changes, tc)
+{
+	tc_cfc_cleanup();
+}
+
+ATF_TC_WITH_CLEANUP(tc_cfc_invalid);
+ATF_TC_HEAD(tc_cfc_invalid, tc)
+{
+}
+ATF_TC_BODY(tc_cfc_invalid, tc)
+{
+	struct config_cache *cfc = NULL;
+	char byte = 0;
+	int fd = -1;
+
+	tc_cfc_setup();
+
+	/* different fields or search path */
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+					TC_CFC_SCHEMA + 1)));
+	ATF_REQUIRE_EQ(0, cfc_get_count(cfc));
+	cfc_free(cfc);
+
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, "/tmp", TC_CFC_SCHEMA)));
+	ATF_REQUIRE_EQ(0, cfc_get_count(cfc));
+	cfc_free(cfc);
+
+	/* a cache others may write to is not trusted */
+	ATF_REQUIRE_EQ(0, chmod(TC_CFC_CACHEFILE, 0666));
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+					TC_CFC_SCHEMA)));
+	ATF_REQUIRE_EQ(0, cfc_get_count(cfc));
+	cfc_free(cfc);
+	ATF_REQUIRE_EQ(0, chmod(TC_CFC_CACHEFILE, 0600));
+
+	/* damaged payload */
+	ATF_REQUIRE((fd = open(TC_CFC_CACHEFILE, O_RDWR)) >= 0);
+	ATF_REQUIRE_EQ(1, pread(fd, &byte, 1, sizeof(struct config_cache_header) + 4));
+	byte ^= 0x55;
+	ATF_REQUIRE_EQ(1, pwrite(fd, &byte, 1, sizeof(struct config_cache_header) + 4));
+	close(fd);
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+					TC_CFC_SCHEMA)));
+	ATF_REQUIRE_EQ(0, cfc_get_count(cfc));
+	cfc_free(cfc);
+
+	/* truncated file */
+	ATF_REQUIRE_EQ(0, truncate(TC_CFC_CACHEFILE, 10));
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+					TC_CFC_SCHEMA)));
+	ATF_REQUIRE_EQ(0, cfc_get_count(cfc));
+	cfc_free(cfc);
+
+	/* missing file */
+	unlink(TC_CFC_CACHEFILE);
+	ATF_REQUIRE(0 != (cfc = cfc_new(TC_CFC_CACHEFILE, TC_CFC_SEARCHPATH,
+					TC_CFC_SCHEMA)));
+	ATF_REQUIRE_EQ(0, cfc_get_count(cfc));
+	cfc_free(cfc);
+}
+ATF_TC_CLEANUP(tc_cfc_invalid, tc)
+{
+	tc_cfc_cleanup();
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_cfc_lookup);
+	ATF_TP_ADD_TC(testplan, tc_cfc_changes);
+	ATF_TP_ADD_TC(testplan, tc_cfc_invalid);
+
+	return atf_no_error();
+}
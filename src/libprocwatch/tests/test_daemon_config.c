@@ -68,6 +68,8 @@ ATF_TC_BODY(tc_dconf_parsing, tc)
 	ATF_REQUIRE_EQ(1, dconf_get_tapid_min(dc));
 	ATF_REQUIRE_EQ(1000, dconf_get_tapid_max(dc));
 	ATF_REQUIRE_EQ(0, dconf_get_nmdmid_min(dc));
+	/* not set in file, default applies */
+	ATF_REQUIRE_EQ(120, dconf_get_shutdown_timeout(dc));
 
 	dconf_free(dc);
 	
@@ -77,8 +79,116 @@ ATF_TC_CLEANUP(tc_dconf_parsing, tc)
 	unlink("/tmp/dconf_test");
 }
 
+ATF_TC_WITH_CLEANUP(tc_dconf_hookserver);
+ATF_TC_HEAD(tc_dconf_hookserver, tc)
+{
+}
+ATF_TC_BODY(tc_dconf_hookserver, tc)
+{
+	int filefd = 0;
+	const char *teststring = "vmstated { hook_server = true; }\n";
+	struct daemon_config *dc = dconf_new();
+
+	ATF_REQUIRE(0 != dc);
+
+	/* hook scripts are launched directly by default */
+	ATF_REQUIRE_EQ(false, dconf_get_hook_server(dc));
+
+	filefd = open("/tmp/dconf_hookserver", O_RDWR | O_CREAT, S_IRWXU);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(write(filefd, teststring, strlen(teststring))>0);
+	close(filefd);
+
+	ATF_REQUIRE_EQ(0, dconf_parseucl(dc, "/tmp/dconf_hookserver"));
+	ATF_REQUIRE_EQ(true, dconf_get_hook_server(dc));
+
+	dconf_free(dc);
+}
+ATF_TC_CLEANUP(tc_dconf_hookserver, tc)
+{
+	unlink("/tmp/dconf_hookserver");
+}
+
+ATF_TC_WITH_CLEANUP(tc_dconf_logrotation);
+ATF_TC_HEAD(tc_dconf_logrotation, tc)
+{
+}
+ATF_TC_BODY(tc_dconf_logrotation, tc)
+{
+	int filefd = 0;
+	const char *teststring = "vmstated { log_maxsize = 1mb; log_keep = 2; "
+		"log_compress = false; log_threads = 4; log_rate = 0; }\n";
+	struct daemon_config *dc = dconf_new();
+
+	ATF_REQUIRE(0 != dc);
+
+	/* logs are rotated at 10 MiB by default */
+	ATF_REQUIRE_EQ(10 * 1024 * 1024, dconf_get_log_maxsize(dc));
+	ATF_REQUIRE_EQ(5, dconf_get_log_keep(dc));
+	ATF_REQUIRE_EQ(true, dconf_get_log_compress(dc));
+	/* one log thread per cpu */
+	ATF_REQUIRE_EQ(0, dconf_get_log_threads(dc));
+	ATF_REQUIRE_EQ(1024 * 1024, dconf_get_log_rate(dc));
+	ATF_REQUIRE_EQ(8 * 1024 * 1024, dconf_get_log_burst(dc));
+
+	filefd = open("/tmp/dconf_logrotation", O_RDWR | O_CREAT, S_IRWXU);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(write(filefd, teststring, strlen(teststring))>0);
+	close(filefd);
+
+	ATF_REQUIRE_EQ(0, dconf_parseucl(dc, "/tmp/dconf_logrotation"));
+	ATF_REQUIRE_EQ(1024 * 1024, dconf_get_log_maxsize(dc));
+	ATF_REQUIRE_EQ(2, dconf_get_log_keep(dc));
+	ATF_REQUIRE_EQ(false, dconf_get_log_compress(dc));
+	ATF_REQUIRE_EQ(4, dconf_get_log_threads(dc));
+	/* the limit can be turned off */
+	ATF_REQUIRE_EQ(0, dconf_get_log_rate(dc));
+
+	dconf_free(dc);
+}
+ATF_TC_CLEANUP(tc_dconf_logrotation, tc)
+{
+	unlink("/tmp/dconf_logrotation");
+}
+
+ATF_TC_WITH_CLEANUP(tc_dconf_configargs);
+ATF_TC_HEAD(tc_dconf_configargs, tc)
+{
+}
+ATF_TC_BODY(tc_dconf_configargs, tc)
+{
+	int filefd = 0;
+	const char *teststring = "vmstated { config_args = true; "
+		"config_keepfile = true; }\n";
+	struct daemon_config *dc = dconf_new();
+
+	ATF_REQUIRE(0 != dc);
+
+	/* bhyve reads generated config files by default */
+	ATF_REQUIRE_EQ(false, dconf_get_config_args(dc));
+	ATF_REQUIRE_EQ(false, dconf_get_config_keepfile(dc));
+
+	filefd = open("/tmp/dconf_configargs", O_RDWR | O_CREAT, S_IRWXU);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(write(filefd, teststring, strlen(teststring))>0);
+	close(filefd);
+
+	ATF_REQUIRE_EQ(0, dconf_parseucl(dc, "/tmp/dconf_configargs"));
+	ATF_REQUIRE_EQ(true, dconf_get_config_args(dc));
+	ATF_REQUIRE_EQ(true, dconf_get_config_keepfile(dc));
+
+	dconf_free(dc);
+}
+ATF_TC_CLEANUP(tc_dconf_configargs, tc)
+{
+	unlink("/tmp/dconf_configargs");
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_dconf_parsing);
+	ATF_TP_ADD_TC(testplan, tc_dconf_hookserver);
+	ATF_TP_ADD_TC(testplan, tc_dconf_logrotation);
+	ATF_TP_ADD_TC(testplan, tc_dconf_configargs);
 	return atf_no_error();
 }
@@ -0,0 +1,166 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../hook_cache.h"
+#include "../process_watcher_object.h"
+
+struct state_node tc_hkc_states[] = {
+	{ .id = 10, .name = "start_network" },
+	{ .id = 100, .name = "running" }
+};
+
+/*
+ * helper method emulating a watcher; counts watched files
+ */
+int
+tc_hkc_watchfile(void *ctx, struct process_state_vm *psv, int fd)
+{
+	(*((int *) ctx))++;
+	return 0;
+}
+
+struct process_watcher_funcs tc_hkc_watcherfuncs = {
+	.watchfile = tc_hkc_watchfile
+};
+
+/*
+ * helper method creating a hook script
+ */
+void
+tc_hkc_writehook(const char *path, mode_t mode)
+{
+	const char *hook = "#!/bin/sh\nexit 0\n";
+	int filefd = 0;
+
+	filefd = open(path, O_RDWR | O_CREAT | O_TRUNC, mode);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(write(filefd, hook, strlen(hook)) > 0);
+	fchmod(filefd, mode);
+	close(filefd);
+}
+
+ATF_TC(tc_hkc_uncached);
+ATF_TC_HEAD(tc_hkc_uncached, tc)
+{
+}
+ATF_TC_BODY(tc_hkc_uncached, tc)
+{
+	struct hook_cache *hkc = 0;
+	char exepath[PATH_MAX] = {0};
+
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_uncached", S_IRWXU));
+	ATF_REQUIRE(0 != (hkc = hkc_new("/tmp/testhooks_uncached", tc_hkc_states, 2)));
+
+	/* without a watcher, each lookup asks the file system */
+	ATF_REQUIRE(!hkc_lookup(hkc, "running", exepath, PATH_MAX));
+	ATF_REQUIRE_STREQ("/tmp/testhooks_uncached/running", exepath);
+
+	tc_hkc_writehook("/tmp/testhooks_uncached/running", S_IRWXU);
+	ATF_REQUIRE(hkc_lookup(hkc, "running", exepath, PATH_MAX));
+	ATF_REQUIRE_EQ(0, hkc_get_scans(hkc));
+
+	hkc_free(hkc);
+}
+ATF_TC_CLEANUP(tc_hkc_uncached, tc)
+{
+	unlink("/tmp/testhooks_uncached/running");
+	rmdir("/tmp/testhooks_uncached");
+}
+
+ATF_TC(tc_hkc_cached);
+ATF_TC_HEAD(tc_hkc_cached, tc)
+{
+}
+ATF_TC_BODY(tc_hkc_cached, tc)
+{
+	struct process_watcher_object pwo = {0};
+	struct hook_cache *hkc = 0;
+	char exepath[PATH_MAX] = {0};
+	int watched = 0;
+
+	pwo.ctx = &watched;
+	pwo.funcs = &tc_hkc_watcherfuncs;
+
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_cached", S_IRWXU));
+	tc_hkc_writehook("/tmp/testhooks_cached/running", S_IRWXU);
+	tc_hkc_writehook("/tmp/testhooks_cached/start_network", S_IRUSR | S_IWUSR);
+
+	ATF_REQUIRE(0 != (hkc = hkc_new("/tmp/testhooks_cached", tc_hkc_states, 2)));
+	ATF_REQUIRE(0 != hkc_withwatcher(hkc, &pwo, NULL));
+
+	/* first lookup scans the directory and watches it and both files */
+	ATF_REQUIRE(hkc_lookup(hkc, "running", exepath, PATH_MAX));
+	ATF_REQUIRE_STREQ("/tmp/testhooks_cached/running", exepath);
+	ATF_REQUIRE_EQ(1, hkc_get_scans(hkc));
+	ATF_REQUIRE_EQ(3, watched);
+
+	/* scripts that cannot be executed are ignored */
+	ATF_REQUIRE(!hkc_lookup(hkc, "start_network", exepath, PATH_MAX));
+	ATF_REQUIRE_EQ(1, hkc_get_scans(hkc));
+
+	/* the cache keeps its state until the watcher reports a change */
+	ATF_REQUIRE_EQ(0, unlink("/tmp/testhooks_cached/running"));
+	ATF_REQUIRE(hkc_lookup(hkc, "running", exepath, PATH_MAX));
+	ATF_REQUIRE_EQ(1, hkc_get_scans(hkc));
+
+	hkc_invalidate(hkc);
+	ATF_REQUIRE(!hkc_lookup(hkc, "running", exepath, PATH_MAX));
+	ATF_REQUIRE_EQ(2, hkc_get_scans(hkc));
+
+	ATF_REQUIRE_EQ(0, chmod("/tmp/testhooks_cached/start_network", S_IRWXU));
+	hkc_invalidate(hkc);
+	ATF_REQUIRE(hkc_lookup(hkc, "start_network", exepath, PATH_MAX));
+	ATF_REQUIRE_EQ(3, hkc_get_scans(hkc));
+
+	hkc_free(hkc);
+}
+ATF_TC_CLEANUP(tc_hkc_cached, tc)
+{
+	unlink("/tmp/testhooks_cached/running");
+	unlink("/tmp/testhooks_cached/start_network");
+	rmdir("/tmp/testhooks_cached");
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_hkc_uncached);
+	ATF_TP_ADD_TC(testplan, tc_hkc_cached);
+
+	return atf_no_error();
+}
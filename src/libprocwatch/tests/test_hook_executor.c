@@ -0,0 +1,276 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../hook_executor.h"
+#include "../process_def.h"
+#include "../state_change.h"
+
+/*
+ * helper method creating a hook script
+ */
+void
+tc_hke_writehook(const char *path, const char *hook)
+{
+	int filefd = 0;
+
+	filefd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRWXU);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(write(filefd, hook, strlen(hook)) > 0);
+	close(filefd);
+}
+
+/*
+ * helper method waiting for the next exit notification
+ */
+void
+tc_hke_waitexit(struct hook_executor *hke, pid_t *pid, int *status)
+{
+	struct pollfd pfd = {0};
+
+	pfd.fd = hke_get_eventfd(hke);
+	pfd.events = POLLIN;
+
+	while (hke_readexit(hke, pid, status)) {
+		ATF_REQUIRE_EQ(EAGAIN, errno);
+		ATF_REQUIRE_EQ(1, poll(&pfd, 1, 5000));
+	}
+}
+
+ATF_TC_WITH_CLEANUP(tc_hke_launch);
+ATF_TC_HEAD(tc_hke_launch, tc)
+{
+}
+ATF_TC_BODY(tc_hke_launch, tc)
+{
+	const char *hook = "#!/bin/sh\n" \
+		"echo \"$VMSTATED_VM $VMSTATED_FROM $VMSTATED_TO\" > /tmp/hke_env\n" \
+		"exit 3\n";
+	struct hook_executor *hke = 0;
+	char buffer[128] = {0};
+	pid_t pid = 0, exitpid = 0;
+	int status = 0;
+	int filefd = 0;
+
+	tc_hke_writehook("/tmp/hke_hook", hook);
+
+	ATF_REQUIRE(0 != (hke = hke_new()));
+	ATF_REQUIRE(hke_get_eventfd(hke) >= 0);
+
+	ATF_REQUIRE_EQ(0, hke_launch(hke, "/tmp/hke_hook", "bsdvm",
+				     "start_network", "start_storage", -1, &pid));
+	ATF_REQUIRE(pid > 0);
+	ATF_REQUIRE_EQ(1, hke_get_launches(hke));
+
+	/* the helper reaps the script and reports its status */
+	tc_hke_waitexit(hke, &exitpid, &status);
+	ATF_REQUIRE_EQ(pid, exitpid);
+	ATF_REQUIRE(WIFEXITED(status));
+	ATF_REQUIRE_EQ(3, WEXITSTATUS(status));
+	ATF_REQUIRE_EQ(-1, waitpid(pid, NULL, WNOHANG));
+
+	ATF_REQUIRE((filefd = open("/tmp/hke_env", O_RDONLY)) >= 0);
+	ATF_REQUIRE(read(filefd, buffer, sizeof(buffer) - 1) > 0);
+	close(filefd);
+	ATF_REQUIRE_STREQ("bsdvm start_network start_storage\n", buffer);
+
+	/* missing scripts are reported to the caller */
+	ATF_REQUIRE_EQ(-1, hke_launch(hke, "/tmp/hke_missing", "bsdvm",
+				      "running", "stopping", -1, &pid));
+	ATF_REQUIRE_EQ(ENOENT, errno);
+
+	hke_free(hke);
+}
+ATF_TC_CLEANUP(tc_hke_launch, tc)
+{
+	unlink("/tmp/hke_hook");
+	unlink("/tmp/hke_env");
+}
+
+ATF_TC_WITH_CLEANUP(tc_hke_output);
+ATF_TC_HEAD(tc_hke_output, tc)
+{
+}
+ATF_TC_BODY(tc_hke_output, tc)
+{
+	const char *hook = "#!/bin/sh\n" \
+		"echo \"to stdout\"\n" \
+		"echo \"to stderr\" 1>&2\n";
+	struct hook_executor *hke = 0;
+	char buffer[128] = {0};
+	pid_t pid = 0, exitpid = 0;
+	int pipefd[2] = {0};
+	int status = 0;
+	ssize_t total = 0, received = 0;
+
+	tc_hke_writehook("/tmp/hke_hook", hook);
+
+	/* the helper must not inherit the pipe */
+	ATF_REQUIRE(0 != (hke = hke_new()));
+	ATF_REQUIRE_EQ(0, pipe(pipefd));
+	ATF_REQUIRE_EQ(0, hke_launch(hke, "/tmp/hke_hook", "bsdvm",
+				     "init", "start_network", pipefd[1], &pid));
+	close(pipefd[1]);
+
+	/* the pipe ends once the script closed its copy */
+	while ((received = read(pipefd[0], buffer + total,
+				sizeof(buffer) - 1 - total)) > 0)
+		total += received;
+	close(pipefd[0]);
+	ATF_REQUIRE_STREQ("to stdout\nto stderr\n", buffer);
+
+	tc_hke_waitexit(hke, &exitpid, &status);
+	ATF_REQUIRE_EQ(pid, exitpid);
+	ATF_REQUIRE_EQ(0, WEXITSTATUS(status));
+
+	hke_free(hke);
+}
+ATF_TC_CLEANUP(tc_hke_output, tc)
+{
+	unlink("/tmp/hke_hook");
+}
+
+/*
+ * fork the test and execute the script of pd, as the daemon used to
+ */
+static pid_t
+tc_hke_forkhook(struct process_def *pd)
+{
+	const char *procpath = pd_get_procpath(pd);
+	char *const procargs[2] = { (char *)procpath, NULL };
+	pid_t pid = 0;
+
+	if (0 == (pid = fork())) {
+		execv(procpath, procargs);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+/*
+ * measure launching and reaping rounds scripts in microseconds; the
+ * scripts are launched by hke, forked from the test if pd is set or
+ * spawned from the test otherwise
+ */
+long
+tc_hke_measure(struct hook_executor *hke, struct process_def *pd, int rounds)
+{
+	struct timespec begin = {0}, end = {0};
+	pid_t pid = 0;
+	int status = 0;
+	int counter = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (counter = 0; counter < rounds; counter++) {
+		if (hke) {
+			ATF_REQUIRE_EQ(0, hke_launch(hke, "/tmp/hke_hook", "bsdvm",
+						     "running", "restarting", -1, &pid));
+		} else if (pd) {
+			ATF_REQUIRE((pid = tc_hke_forkhook(pd)) > 0);
+		} else {
+			ATF_REQUIRE_EQ(0, sch_launchscript("/tmp/hke_hook", NULL, &pid));
+		}
+	}
+	for (counter = 0; counter < rounds; counter++) {
+		if (hke) {
+			tc_hke_waitexit(hke, &pid, &status);
+		} else {
+			ATF_REQUIRE(waitpid(-1, &status, 0) > 0);
+		}
+		ATF_REQUIRE_EQ(0, WEXITSTATUS(status));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - begin.tv_sec) * 1000000 +
+		(end.tv_nsec - begin.tv_nsec) / 1000;
+}
+
+ATF_TC_WITH_CLEANUP(tc_hke_massreboot);
+ATF_TC_HEAD(tc_hke_massreboot, tc)
+{
+}
+ATF_TC_BODY(tc_hke_massreboot, tc)
+{
+	struct hook_executor *hke = 0;
+	struct process_def *pd = 0;
+	const char *procargs[2] = { "/tmp/hke_hook", NULL };
+	const size_t heapsize = 512 << 20;
+	char *heap = 0;
+	long forked = 0, spawned = 0, helper = 0;
+
+	tc_hke_writehook("/tmp/hke_hook", "#!/bin/sh\nexit 0\n");
+	ATF_REQUIRE(0 != (pd = pd_new("user script", "hook", procargs[0],
+				      procargs, NULL)));
+
+	/* the helper is started while the daemon is small */
+	ATF_REQUIRE(0 != (hke = hke_new()));
+
+	ATF_REQUIRE(0 != (heap = malloc(heapsize)));
+	memset(heap, 1, heapsize);
+
+	/* a reboot of 100 vms runs about 8 hook scripts each */
+	forked = tc_hke_measure(NULL, pd, 800);
+	spawned = tc_hke_measure(NULL, NULL, 800);
+	helper = tc_hke_measure(hke, NULL, 800);
+
+	printf("800 hook scripts: %ld ms forked, %ld ms spawned from daemon, "
+	       "%ld ms from helper\n", forked / 1000, spawned / 1000,
+	       helper / 1000);
+
+	free(heap);
+	pd_free(pd);
+	hke_free(hke);
+}
+ATF_TC_CLEANUP(tc_hke_massreboot, tc)
+{
+	unlink("/tmp/hke_hook");
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_hke_launch);
+	ATF_TP_ADD_TC(testplan, tc_hke_output);
+	ATF_TP_ADD_TC(testplan, tc_hke_massreboot);
+
+	return atf_no_error();
+}
@@ -35,6 +35,9 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -51,15 +54,54 @@ pthread_cond_t tc_pd_complexscript_cond;
 int tc_pd_complexscript_status;
 struct process_def *tc_pd_complexscript_pd;
 
+extern char **environ;
+
 struct process_def {
-	char name[PATH_MAX];
-	char *description;
-	char procpath[PATH_MAX];
+	const char *name;
+	const char *description;
+	const char *procpath;
 	char **procargs; /* null terminated argument list */
 	
 	void *ctx; /* user context */
+	struct string_pool *strings;
+	size_t argstrings;
 };
 
+/*
+ * launch application with redirection by forking the test; this is the
+ * launch path pd_launch_redirected replaced, kept to compare latency
+ */
+static int
+tc_pd_forkredirected(struct process_def *pd, pid_t *pid,
+		     struct log_director_redirector *ldr)
+{
+	struct log_director_redirector_client *ldrd = 0;
+	pid_t procpid = 0;
+
+	if (ldr)
+		if (!(ldrd = ldr_newclient_source(ldr, pd_get_procname(pd))))
+			return -1;
+
+	if (0 == (procpid = fork())) {
+		if (ldrd) {
+			ldrd_redirect_stdout(ldrd);
+			ldrd_redirect_stderr(ldrd);
+		}
+
+		execve(pd->procpath, pd->procargs, environ);
+		_exit(127);
+	}
+	if (ldrd)
+		ldrd_accept_redirect(ldrd);
+
+	if (procpid < 0)
+		return -1;
+
+	*pid = procpid;
+
+	return 0;
+}
+
 ATF_TC_WITH_CLEANUP(tc_pd_fromconfig);
 ATF_TC_HEAD(tc_pd_fromconfig, tc)
 {
@@ -241,11 +283,129 @@ ATF_TC_CLEANUP(tc_pd_complexscript, tc)
 {
 }
 
+ATF_TC_WITH_CLEANUP(tc_pd_spawnfailure);
+ATF_TC_HEAD(tc_pd_spawnfailure, tc)
+{
+}
+ATF_TC_BODY(tc_pd_spawnfailure, tc)
+{
+	struct process_def *pd = pd_new("test", "description",
+					"/nonexistent/bhyve", NULL, NULL);
+	pid_t pid = 0;
+
+	ATF_REQUIRE(0 != pd);
+
+	/* a missing executable is reported to the caller */
+	ATF_REQUIRE_EQ(-1, pd_launch(pd, &pid));
+	ATF_REQUIRE_EQ(ENOENT, errno);
+	ATF_REQUIRE_EQ(0, pid);
+
+	pd_free(pd);
+}
+ATF_TC_CLEANUP(tc_pd_spawnfailure, tc)
+{
+}
+
+/*
+ * measure the average launch latency of a launch function in
+ * microseconds; processes are reaped outside of the measurement
+ */
+long
+tc_pd_measurelaunch(int (*launch)(struct process_def *, pid_t *,
+				  struct log_director_redirector *),
+		    struct process_def *pd,
+		    struct log_director_redirector *ldr,
+		    int rounds)
+{
+	struct timespec begin = {0}, end = {0};
+	long total = 0;
+	pid_t pid = 0;
+	int status = 0;
+	int counter = 0;
+
+	for (counter = 0; counter < rounds; counter++) {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		ATF_REQUIRE_EQ(0, launch(pd, &pid, ldr));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ATF_REQUIRE_EQ(pid, waitpid(pid, &status, 0));
+		ATF_REQUIRE(WIFEXITED(status));
+		ATF_REQUIRE_EQ(0, WEXITSTATUS(status));
+
+		total += (end.tv_sec - begin.tv_sec) * 1000000 +
+			(end.tv_nsec - begin.tv_nsec) / 1000;
+	}
+
+	return total / rounds;
+}
+
+ATF_TC_WITH_CLEANUP(tc_pd_launchlatency);
+ATF_TC_HEAD(tc_pd_launchlatency, tc)
+{
+}
+ATF_TC_BODY(tc_pd_launchlatency, tc)
+{
+	const char *hook_script = "#!/bin/sh\n" \
+		"echo \"hook output\"\n" \
+		"exit 0\n";
+	const char *binargs[2] = { "/usr/bin/true", NULL };
+	const char *hookargs[2] = { "/tmp/pd_latency", NULL };
+	const size_t heapsizes[3] = { 0, 64, 512 };
+	struct process_def *binpd = 0, *hookpd = 0;
+	struct log_director *ld = 0;
+	struct log_director_redirector *ldr = 0;
+	char *heap = 0;
+	int scriptfd = 0;
+	size_t counter = 0;
+
+	ATF_REQUIRE(0 != (ld = ld_new(1, "/tmp")));
+	ATF_REQUIRE(0 != (ldr = ld_register_redirect(ld, "launchlatency")));
+
+	ATF_REQUIRE((scriptfd = open("/tmp/pd_latency", O_RDWR | O_CREAT | O_TRUNC)) >= 0);
+	ATF_REQUIRE_EQ(0, fchmod(scriptfd, S_IRWXU));
+	ATF_REQUIRE(write(scriptfd, hook_script, strlen(hook_script)) > 0);
+	ATF_REQUIRE_EQ(0, close(scriptfd));
+
+	/* /usr/bin/true stands in for bhyve; the launch path is the same */
+	ATF_REQUIRE(0 != (binpd = pd_new("bhyve", "vm", binargs[0], binargs, NULL)));
+	ATF_REQUIRE(0 != (hookpd = pd_new("user script", "hook", hookargs[0],
+					  hookargs, NULL)));
+
+	/* fork gets slower as the daemon's heap grows, spawn should not */
+	for (counter = 0; counter < 3; counter++) {
+		if (heapsizes[counter]) {
+			ATF_REQUIRE(0 != (heap = malloc(heapsizes[counter] << 20)));
+			memset(heap, 1, heapsizes[counter] << 20);
+		}
+
+		printf("heap %4zu MB: bhyve fork %6ld us, spawn %6ld us; "
+		       "hook fork %6ld us, spawn %6ld us\n",
+		       heapsizes[counter],
+		       tc_pd_measurelaunch(tc_pd_forkredirected, binpd, ldr, 100),
+		       tc_pd_measurelaunch(pd_launch_redirected, binpd, ldr, 100),
+		       tc_pd_measurelaunch(tc_pd_forkredirected, hookpd, ldr, 100),
+		       tc_pd_measurelaunch(pd_launch_redirected, hookpd, ldr, 100));
+
+		free(heap);
+		heap = 0;
+	}
+
+	pd_free(binpd);
+	pd_free(hookpd);
+	ld_free(ld);
+}
+ATF_TC_CLEANUP(tc_pd_launchlatency, tc)
+{
+	unlink("/tmp/pd_latency");
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_pd_fromconfig);
 	ATF_TP_ADD_TC(testplan, tc_pd_simpleexec);
 	ATF_TP_ADD_TC(testplan, tc_pd_complexscript);
+	ATF_TP_ADD_TC(testplan, tc_pd_spawnfailure);
+	ATF_TP_ADD_TC(testplan, tc_pd_launchlatency);
 
 	return atf_no_error();
 }
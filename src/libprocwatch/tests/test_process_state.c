@@ -27,11 +27,13 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include <atf-c.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -40,12 +42,16 @@
 #include <time.h>
 
 #include "../../liblogging/log_director.h"
+#include "../bhyve_config_hooks.h"
 #include "../bhyve_director.h"
+#include "../hook_executor.h"
 #include "../process_def_object.h"
 #include "../process_state.h"
+#include "../process_watcher_object.h"
 
 struct process_state_vm *
 psv_withconfig(struct process_def_obj *pdo, const char *scriptpath);
+int psv_onhookexit(struct process_state_vm *psv, pid_t pid, int status);
 struct bhyve_watched_vm *bd_getvmbyname(struct bhyve_director *bd, const char *name);
 struct bhyve_watched_vm {
 	struct process_state_vm *state;
@@ -54,12 +60,14 @@ struct bhyve_watched_vm {
 
 
 struct process_def {
-	char name[PATH_MAX];
-	char *description;
-	char procpath[PATH_MAX];
+	const char *name;
+	const char *description;
+	const char *procpath;
 	char **procargs; /* null terminated argument list */
 	
 	void *ctx; /* user context */
+	struct string_pool *strings;
+	size_t argstrings;
 };
 
 struct process_state_vm {
@@ -112,6 +120,54 @@ struct process_def_funcs tc_psv_nopfuncs = {
 	.free = tc_psv_free
 };
 
+/*
+ * helper method emulating a watcher; remembers the watched pid
+ */
+int
+tc_psv_watch(void *ctx, struct process_state_vm *psv, pid_t pid)
+{
+	*((pid_t *) ctx) = pid;
+	return 0;
+}
+
+struct process_watcher_funcs tc_psv_watcherfuncs = {
+	.watch = tc_psv_watch
+};
+
+/*
+ * helper method emulating a watcher that cannot register processes
+ */
+int
+tc_psv_watchfail(void *ctx, struct process_state_vm *psv, pid_t pid)
+{
+	*((pid_t *) ctx) = pid;
+	errno = EBADF;
+	return -1;
+}
+
+struct process_watcher_funcs tc_psv_failwatcherfuncs = {
+	.watch = tc_psv_watchfail
+};
+
+/* hook executor of tc_psv_executorfuncs */
+struct hook_executor *tc_psv_hke;
+
+/*
+ * helper method emulating a watcher launching hooks through a hook
+ * executor
+ */
+int
+tc_psv_launchhook(void *ctx, struct process_state_vm *psv, const char *exepath,
+		  const char *from, const char *to, pid_t *pid)
+{
+	return hke_launch(tc_psv_hke, exepath, "testvm", from, to, -1, pid);
+}
+
+struct process_watcher_funcs tc_psv_executorfuncs = {
+	.watch = tc_psv_watch,
+	.launchhook = tc_psv_launchhook
+};
+
 ATF_TC(tc_psv_initfree);
 ATF_TC_HEAD(tc_psv_initfree, tc)
 {
@@ -219,7 +275,7 @@ ATF_TC_BODY(tc_psv_startstopexe, tc)
 
 	pd = pdo->ctx;
 	/* fix procpath to /bin/ls */
-	strncpy(pd->procpath, "/bin/ls", PATH_MAX);
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/bin/ls"));
 
 	ATF_REQUIRE_EQ(0, psv_startvm(psv, &pid, NULL));
 	ATF_REQUIRE(0 != pid);
@@ -293,7 +349,7 @@ ATF_TC_BODY(tc_psv_reboot, tc)
 	ATF_REQUIRE(0 != pd);
 	
 	/* modify bhyve to testscript */
-	strcpy(pd->procpath, "/tmp/testscript_reboot");
+	ATF_REQUIRE_EQ(0, pd_set_procpath(pd, "/tmp/testscript_reboot"));
 	
 	/* start and confirm it still runs after a few seconds */
 	/* starting it via director ensures that termination
@@ -350,12 +406,477 @@ ATF_TC_CLEANUP(tc_psv_reboot, tc)
 	unlink("/tmp/testscript_reboot");
 }
 
+ATF_TC_WITH_CLEANUP(tc_psv_asynchook);
+ATF_TC_HEAD(tc_psv_asynchook, tc)
+{
+}
+ATF_TC_BODY(tc_psv_asynchook, tc)
+{
+	struct process_def_obj *pdobj = malloc(sizeof(struct process_def_obj));
+	struct process_watcher_object pwo = {0};
+	const char *hook = "#!/bin/sh\n" \
+		"sleep 1\n" \
+		"exit 0\n";
+	pid_t watched = 0;
+	pid_t pid = 1;
+	int filefd = 0;
+	int status = 0;
+
+	/* a start_network hook that outlives psv_startvm */
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_async", S_IRWXU));
+	filefd = open("/tmp/testhooks_async/start_network", O_RDWR | O_CREAT);
+	ATF_REQUIRE(filefd >= 0);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	ATF_REQUIRE(write(filefd, hook, strlen(hook)) > 0);
+	close(filefd);
+
+	ATF_REQUIRE(0 != pdobj);
+	bzero(pdobj, sizeof(struct process_def_obj));
+	pdobj->funcs = &tc_psv_nopfuncs;
+
+	pwo.ctx = &watched;
+	pwo.funcs = &tc_psv_watcherfuncs;
+
+	struct process_state_vm *psv = psv_withconfig(pdobj, "/tmp/testhooks_async");
+
+	ATF_REQUIRE(0 != psv);
+	ATF_REQUIRE(0 != psv_withwatcher(psv, &pwo));
+	ATF_REQUIRE(psv_is_async(psv));
+
+	/* start returns while the start_network hook still runs, before
+	   the vm was launched */
+	ATF_REQUIRE_EQ(0, psv_startvm(psv, &pid, NULL));
+	ATF_REQUIRE_EQ(0, pid);
+	ATF_REQUIRE_EQ(START_NETWORK, psv_getstate(psv));
+	ATF_REQUIRE(psv_is_busy(psv));
+	ATF_REQUIRE(0 != watched);
+	ATF_REQUIRE(psv_is_hookpid(psv, watched));
+
+	/* no other state change while the hook runs */
+	errno = 0;
+	ATF_REQUIRE_EQ(-1, psv_startvm(psv, &pid, NULL));
+	ATF_REQUIRE_EQ(EBUSY, errno);
+
+	/* report the hook exit like the director does */
+	ATF_REQUIRE_EQ(watched, waitpid(watched, &status, 0));
+	ATF_REQUIRE_EQ(0, psv_onhookexit(psv, watched, status));
+
+	ATF_REQUIRE_EQ(RUNNING, psv_getstate(psv));
+	ATF_REQUIRE(!psv_is_busy(psv));
+	ATF_REQUIRE(!psv_is_hookpid(psv, watched));
+
+	psv_free(psv);
+}
+ATF_TC_CLEANUP(tc_psv_asynchook, tc)
+{
+	unlink("/tmp/testhooks_async/start_network");
+	rmdir("/tmp/testhooks_async");
+}
+
+/*
+ * arguments and outcome of tc_psv_waiter
+ */
+struct tc_psv_wait {
+	struct process_state_vm *psv;
+	uint32_t set;
+	int64_t reached;
+	int error;
+};
+
+/*
+ * thread waiting for a state
+ */
+void *
+tc_psv_waiter(void *ctx)
+{
+	struct tc_psv_wait *wait = ctx;
+
+	wait->reached = psv_waitstate(wait->psv, wait->set, 5000);
+	wait->error = errno;
+
+	return NULL;
+}
+
+ATF_TC_WITH_CLEANUP(tc_psv_waitstate);
+ATF_TC_HEAD(tc_psv_waitstate, tc)
+{
+}
+ATF_TC_BODY(tc_psv_waitstate, tc)
+{
+	struct process_def_obj *pdobj = malloc(sizeof(struct process_def_obj));
+	struct process_watcher_object pwo = {0};
+	struct tc_psv_wait transient = {0}, running = {0}, stopped = {0};
+	pthread_t transient_thread, running_thread, stopped_thread;
+	const char *hook = "#!/bin/sh\n" \
+		"sleep 1\n" \
+		"exit 0\n";
+	uint64_t version = 0;
+	pid_t watched = 0;
+	pid_t pid = 1;
+	int filefd = 0;
+	int status = 0;
+
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_wait", S_IRWXU));
+	filefd = open("/tmp/testhooks_wait/start_network", O_RDWR | O_CREAT);
+	ATF_REQUIRE(filefd >= 0);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	ATF_REQUIRE(write(filefd, hook, strlen(hook)) > 0);
+	close(filefd);
+
+	ATF_REQUIRE(0 != pdobj);
+	bzero(pdobj, sizeof(struct process_def_obj));
+	pdobj->funcs = &tc_psv_nopfuncs;
+
+	pwo.ctx = &watched;
+	pwo.funcs = &tc_psv_watcherfuncs;
+
+	struct process_state_vm *psv = psv_withconfig(pdobj, "/tmp/testhooks_wait");
+	ATF_REQUIRE(0 != psv);
+	ATF_REQUIRE(0 != psv_withwatcher(psv, &pwo));
+
+	/* a state already entered does not block */
+	ATF_REQUIRE_EQ(INIT, psv_waitstate(psv, psv_stateset(INIT), 0));
+	ATF_REQUIRE_EQ(-1, psv_waitstate(psv, psv_stateset(RUNNING), 50));
+	ATF_REQUIRE_EQ(ETIMEDOUT, errno);
+	ATF_REQUIRE_EQ(-1, psv_waitstate(psv, 0, 50));
+	ATF_REQUIRE_EQ(EINVAL, errno);
+	version = psv_getstateversion(psv);
+
+	/* start stays in START_NETWORK while the hook runs */
+	ATF_REQUIRE_EQ(0, psv_startvm(psv, &pid, NULL));
+	ATF_REQUIRE_EQ(START_NETWORK, psv_getstate(psv));
+	ATF_REQUIRE_EQ(version + 1, psv_getstateversion(psv));
+
+	transient.psv = running.psv = stopped.psv = psv;
+	transient.set = psv_stateset(START_STORAGE);
+	running.set = psv_stateset(RUNNING) | psv_stateset(FAILED);
+	stopped.set = psv_stateset(STOPPED);
+	ATF_REQUIRE_EQ(0, pthread_create(&transient_thread, NULL, tc_psv_waiter, &transient));
+	ATF_REQUIRE_EQ(0, pthread_create(&running_thread, NULL, tc_psv_waiter, &running));
+	ATF_REQUIRE_EQ(0, pthread_create(&stopped_thread, NULL, tc_psv_waiter, &stopped));
+
+	/* the plan passes START_STORAGE on its way to RUNNING */
+	ATF_REQUIRE_EQ(watched, waitpid(watched, &status, 0));
+	ATF_REQUIRE_EQ(0, psv_onhookexit(psv, watched, status));
+	ATF_REQUIRE_EQ(RUNNING, psv_getstate(psv));
+	ATF_REQUIRE_EQ(version + 3, psv_getstateversion(psv));
+
+	pthread_join(transient_thread, NULL);
+	pthread_join(running_thread, NULL);
+	ATF_REQUIRE_EQ(START_STORAGE, transient.reached);
+	ATF_REQUIRE_EQ(RUNNING, running.reached);
+
+	/* closing waits releases the remaining waiter */
+	psv_closewaits(psv);
+	pthread_join(stopped_thread, NULL);
+	ATF_REQUIRE_EQ(-1, stopped.reached);
+	ATF_REQUIRE_EQ(ECANCELED, stopped.error);
+
+	psv_free(psv);
+}
+ATF_TC_CLEANUP(tc_psv_waitstate, tc)
+{
+	unlink("/tmp/testhooks_wait/start_network");
+	rmdir("/tmp/testhooks_wait");
+}
+
+ATF_TC_WITH_CLEANUP(tc_psv_unwatchedhook);
+ATF_TC_HEAD(tc_psv_unwatchedhook, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "20");
+}
+ATF_TC_BODY(tc_psv_unwatchedhook, tc)
+{
+	struct process_def_obj *pdobj = malloc(sizeof(struct process_def_obj));
+	struct process_watcher_object pwo = {0};
+	const char *hook = "#!/bin/sh\n" \
+		"sleep 60\n" \
+		"exit 0\n";
+	pid_t watched = 0;
+	pid_t pid = 1;
+	int filefd = 0;
+
+	/* a hung start_network hook the watcher fails to register */
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_unwatched", S_IRWXU));
+	filefd = open("/tmp/testhooks_unwatched/start_network", O_RDWR | O_CREAT);
+	ATF_REQUIRE(filefd >= 0);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	ATF_REQUIRE(write(filefd, hook, strlen(hook)) > 0);
+	close(filefd);
+
+	ATF_REQUIRE(0 != pdobj);
+	bzero(pdobj, sizeof(struct process_def_obj));
+	pdobj->funcs = &tc_psv_nopfuncs;
+
+	pwo.ctx = &watched;
+	pwo.funcs = &tc_psv_failwatcherfuncs;
+
+	struct process_state_vm *psv = psv_withconfig(pdobj, "/tmp/testhooks_unwatched");
+
+	ATF_REQUIRE(0 != psv);
+	ATF_REQUIRE(0 != psv_withwatcher(psv, &pwo));
+
+	/* the start fails instead of waiting for the script */
+	ATF_REQUIRE(0 != psv_startvm(psv, &pid, NULL));
+	ATF_REQUIRE(0 != watched);
+	ATF_REQUIRE(RUNNING != psv_getstate(psv));
+	ATF_REQUIRE(!psv_is_hookpid(psv, watched));
+
+	/* the script was terminated and collected */
+	ATF_REQUIRE_EQ(-1, kill(watched, 0));
+	ATF_REQUIRE_EQ(ESRCH, errno);
+
+	psv_free(psv);
+}
+ATF_TC_CLEANUP(tc_psv_unwatchedhook, tc)
+{
+	unlink("/tmp/testhooks_unwatched/start_network");
+	rmdir("/tmp/testhooks_unwatched");
+}
+
+ATF_TC_WITH_CLEANUP(tc_psv_hookexecutor);
+ATF_TC_HEAD(tc_psv_hookexecutor, tc)
+{
+}
+ATF_TC_BODY(tc_psv_hookexecutor, tc)
+{
+	struct process_def_obj *pdobj = malloc(sizeof(struct process_def_obj));
+	struct process_watcher_object pwo = {0};
+	const char *hook = "#!/bin/sh\n" \
+		"echo \"$VMSTATED_VM $VMSTATED_TO\" > /tmp/testhooks_executor/env\n" \
+		"exit 0\n";
+	struct pollfd pfd = {0};
+	char buffer[64] = {0};
+	pid_t watched = 0, exitpid = 0;
+	pid_t pid = 1;
+	int filefd = 0;
+	int status = 0;
+
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_executor", S_IRWXU));
+	filefd = open("/tmp/testhooks_executor/start_network", O_RDWR | O_CREAT);
+	ATF_REQUIRE(filefd >= 0);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	ATF_REQUIRE(write(filefd, hook, strlen(hook)) > 0);
+	close(filefd);
+
+	ATF_REQUIRE(0 != (tc_psv_hke = hke_new()));
+
+	ATF_REQUIRE(0 != pdobj);
+	bzero(pdobj, sizeof(struct process_def_obj));
+	pdobj->funcs = &tc_psv_nopfuncs;
+
+	pwo.ctx = &watched;
+	pwo.funcs = &tc_psv_executorfuncs;
+
+	struct process_state_vm *psv = psv_withconfig(pdobj, "/tmp/testhooks_executor");
+
+	ATF_REQUIRE(0 != psv);
+	ATF_REQUIRE(0 != psv_withwatcher(psv, &pwo));
+
+	/* the executor launched the hook, the vm waits for its exit */
+	ATF_REQUIRE_EQ(0, psv_startvm(psv, &pid, NULL));
+	ATF_REQUIRE_EQ(START_NETWORK, psv_getstate(psv));
+	ATF_REQUIRE_EQ(1, hke_get_launches(tc_psv_hke));
+	ATF_REQUIRE(psv_is_hookpid(psv, watched));
+
+	/* report the exit like the director does */
+	pfd.fd = hke_get_eventfd(tc_psv_hke);
+	pfd.events = POLLIN;
+	ATF_REQUIRE_EQ(1, poll(&pfd, 1, 5000));
+	ATF_REQUIRE_EQ(0, hke_readexit(tc_psv_hke, &exitpid, &status));
+	ATF_REQUIRE_EQ(watched, exitpid);
+	ATF_REQUIRE_EQ(0, psv_onhookexit(psv, exitpid, status));
+
+	ATF_REQUIRE_EQ(RUNNING, psv_getstate(psv));
+
+	filefd = open("/tmp/testhooks_executor/env", O_RDONLY);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(read(filefd, buffer, sizeof(buffer) - 1) > 0);
+	close(filefd);
+	ATF_REQUIRE_STREQ("testvm start_network\n", buffer);
+
+	psv_free(psv);
+	hke_free(tc_psv_hke);
+}
+ATF_TC_CLEANUP(tc_psv_hookexecutor, tc)
+{
+	unlink("/tmp/testhooks_executor/start_network");
+	unlink("/tmp/testhooks_executor/env");
+	rmdir("/tmp/testhooks_executor");
+}
+
+/*
+ * helper method creating a hook script in /tmp/testhooks_stages
+ */
+void
+tc_psv_writestage(const char *name, const char *body)
+{
+	char path[PATH_MAX] = {0};
+	int filefd = 0;
+
+	snprintf(path, PATH_MAX, "/tmp/testhooks_stages/%s", name);
+	filefd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRWXU);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(write(filefd, body, strlen(body)) > 0);
+	fchmod(filefd, S_IRWXU | S_IRWXG | S_IROTH );
+	close(filefd);
+}
+
+/*
+ * helper method measuring a start of the vm in milliseconds
+ */
+long
+tc_psv_timestart(const struct bhyve_configuration_hooks *bch, int expected)
+{
+	struct process_def_obj *pdobj = malloc(sizeof(struct process_def_obj));
+	struct timespec begin = {0}, end = {0};
+	struct process_state_vm *psv = 0;
+	pid_t pid = 0;
+
+	ATF_REQUIRE(0 != pdobj);
+	bzero(pdobj, sizeof(struct process_def_obj));
+	pdobj->funcs = &tc_psv_nopfuncs;
+
+	ATF_REQUIRE(0 != (psv = psv_withconfig(pdobj, "/tmp/testhooks_stages")));
+	ATF_REQUIRE(0 != psv_withhooks(psv, bch));
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	ATF_REQUIRE_EQ(expected, psv_startvm(psv, &pid, NULL));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ATF_REQUIRE_EQ(expected ? FAILED : RUNNING, psv_getstate(psv));
+	psv_free(psv);
+
+	return (end.tv_sec - begin.tv_sec) * 1000 +
+		(end.tv_nsec - begin.tv_nsec) / 1000000;
+}
+
+/*
+ * helper method telling if both start hooks began before either ended
+ */
+bool
+tc_psv_stagesoverlap(void)
+{
+	char buffer[256] = {0};
+	char *end = 0, *network = 0, *storage = 0;
+	int filefd = 0;
+
+	filefd = open("/tmp/testhooks_stages/markers", O_RDONLY);
+	ATF_REQUIRE(filefd >= 0);
+	ATF_REQUIRE(read(filefd, buffer, sizeof(buffer) - 1) > 0);
+	close(filefd);
+	printf("%s", buffer);
+
+	network = strstr(buffer, "start_network");
+	storage = strstr(buffer, "start_storage");
+	end = strstr(buffer, "end_");
+
+	ATF_REQUIRE(network && storage && end);
+	ATF_REQUIRE_EQ(0, unlink("/tmp/testhooks_stages/markers"));
+
+	return (network < end) && (storage < end);
+}
+
+ATF_TC_WITH_CLEANUP(tc_psv_parallelstages);
+ATF_TC_HEAD(tc_psv_parallelstages, tc)
+{
+}
+ATF_TC_BODY(tc_psv_parallelstages, tc)
+{
+	struct bhyve_configuration_hooks *bch = 0;
+	/* each hook waits a while for the other one to begin */
+	const char *network = "#!/bin/sh\n" \
+		"cd /tmp/testhooks_stages\n" \
+		"echo start_network >> markers\n" \
+		"n=0\n" \
+		"while ! grep -q start_storage markers && [ $n -lt 30 ]; do\n" \
+		"    sleep 0.1; n=$((n+1))\n" \
+		"done\n" \
+		"echo end_network >> markers\n";
+	const char *storage = "#!/bin/sh\n" \
+		"cd /tmp/testhooks_stages\n" \
+		"echo start_storage >> markers\n" \
+		"n=0\n" \
+		"while ! grep -q start_network markers && [ $n -lt 30 ]; do\n" \
+		"    sleep 0.1; n=$((n+1))\n" \
+		"done\n" \
+		"echo end_storage >> markers\n";
+
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_stages", S_IRWXU));
+	tc_psv_writestage("start_network", network);
+	tc_psv_writestage("start_storage", storage);
+
+	/* by default, storage waits for network */
+	tc_psv_timestart(NULL, 0);
+	ATF_REQUIRE(!tc_psv_stagesoverlap());
+
+	ATF_REQUIRE(0 != (bch = bch_new()));
+	ATF_REQUIRE_EQ(0, bch_clear_after(bch, BCH_START_STORAGE));
+	tc_psv_timestart(bch, 0);
+	ATF_REQUIRE(tc_psv_stagesoverlap());
+
+	bch_free(bch);
+}
+ATF_TC_CLEANUP(tc_psv_parallelstages, tc)
+{
+	unlink("/tmp/testhooks_stages/start_network");
+	unlink("/tmp/testhooks_stages/start_storage");
+	unlink("/tmp/testhooks_stages/markers");
+	rmdir("/tmp/testhooks_stages");
+}
+
+ATF_TC_WITH_CLEANUP(tc_psv_stagerollback);
+ATF_TC_HEAD(tc_psv_stagerollback, tc)
+{
+}
+ATF_TC_BODY(tc_psv_stagerollback, tc)
+{
+	struct bhyve_configuration_hooks *bch = 0;
+	struct stat file_info = {0};
+
+	ATF_REQUIRE_EQ(0, mkdir("/tmp/testhooks_stages", S_IRWXU));
+	tc_psv_writestage("start_network", "#!/bin/sh\nsleep 1\n");
+	tc_psv_writestage("start_storage", "#!/bin/sh\nexit 1\n");
+	tc_psv_writestage("stop_storage",
+			  "#!/bin/sh\ntouch /tmp/testhooks_stages/storage_released\n");
+	tc_psv_writestage("stop_network",
+			  "#!/bin/sh\ntouch /tmp/testhooks_stages/network_released\n");
+
+	ATF_REQUIRE(0 != (bch = bch_new()));
+	ATF_REQUIRE_EQ(0, bch_clear_after(bch, BCH_START_STORAGE));
+	ATF_REQUIRE_EQ(0, bch_clear_after(bch, BCH_STOP_NETWORK));
+
+	/* storage fails while network still starts; both are released */
+	tc_psv_timestart(bch, -1);
+
+	ATF_REQUIRE_EQ(0, stat("/tmp/testhooks_stages/storage_released", &file_info));
+	ATF_REQUIRE_EQ(0, stat("/tmp/testhooks_stages/network_released", &file_info));
+
+	bch_free(bch);
+}
+ATF_TC_CLEANUP(tc_psv_stagerollback, tc)
+{
+	unlink("/tmp/testhooks_stages/start_network");
+	unlink("/tmp/testhooks_stages/start_storage");
+	unlink("/tmp/testhooks_stages/stop_storage");
+	unlink("/tmp/testhooks_stages/stop_network");
+	unlink("/tmp/testhooks_stages/storage_released");
+	unlink("/tmp/testhooks_stages/network_released");
+	rmdir("/tmp/testhooks_stages");
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_psv_initfree);
 	ATF_TP_ADD_TC(testplan, tc_psv_statechanges);
 	ATF_TP_ADD_TC(testplan, tc_psv_startstopexe);
 	ATF_TP_ADD_TC(testplan, tc_psv_reboot);
+	ATF_TP_ADD_TC(testplan, tc_psv_asynchook);
+	ATF_TP_ADD_TC(testplan, tc_psv_unwatchedhook);
+	ATF_TP_ADD_TC(testplan, tc_psv_hookexecutor);
+	ATF_TP_ADD_TC(testplan, tc_psv_parallelstages);
+	ATF_TP_ADD_TC(testplan, tc_psv_stagerollback);
+	ATF_TP_ADD_TC(testplan, tc_psv_waitstate);
 
 	return atf_no_error();
 }
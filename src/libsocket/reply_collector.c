@@ -28,10 +28,13 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/socket.h>
+
 #include "reply_collector.h"
 
 #include "../libutils/transmit_collect.h"
@@ -50,6 +53,9 @@ struct socket_reply_collector {
 	char *short_reply;
 	/* collected buffer to provide to callers */
 	char *collected_buffer;
+
+	/* client connection for replies sent while a command runs */
+	int streamfd;
 };
 
 /*
@@ -68,6 +74,7 @@ src_new()
 
 	src->short_reply = NULL;
 	src->collected_buffer = NULL;
+	src->streamfd = -1;
 	
 	src->stc = stc_new();
 	if (!src->stc) {
@@ -197,4 +204,67 @@ src_reply(struct socket_reply_collector *src, const void *buffer, size_t bufferl
 	return stc_store_transmit(src->stc, buffer, bufferlen);
 }
 
+/*
+ * set the client connection that src_stream writes to
+ */
+void
+src_set_streamfd(struct socket_reply_collector *src, int streamfd)
+{
+	if (src)
+		src->streamfd = streamfd;
+}
+
+/*
+ * write all of buffer to the client connection
+ */
+int
+src_sendall(int fd, const void *buffer, size_t bufferlen)
+{
+	ssize_t sent_bytes = 0;
+	size_t sent_total = 0;
+
+	while (sent_total < bufferlen) {
+		/* a client that went away must not take us down */
+		if ((sent_bytes = send(fd, (const char *) buffer + sent_total,
+				       bufferlen - sent_total, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		sent_total += sent_bytes;
+	}
+
+	return 0;
+}
+
+/*
+ * send a DATA frame to the client right away instead of collecting it
+ * for the reply; a command may stream any number of frames before its
+ * final reply. An empty frame checks whether the client is still there.
+ *
+ * returns 0 on success, -1 and errno if the client cannot be reached.
+ */
+int
+src_stream(struct socket_reply_collector *src, const void *buffer, size_t bufferlen)
+{
+	char datastr[32] = {0};
+
+	if (!src || (!buffer && bufferlen)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (src->streamfd < 0) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	/* include zero byte at the end */
+	snprintf(datastr, sizeof(datastr), "DATA %zu", bufferlen);
+	if (src_sendall(src->streamfd, datastr, strlen(datastr) + 1))
+		return -1;
+
+	return bufferlen ? src_sendall(src->streamfd, buffer, bufferlen) : 0;
+}
+
 CREATE_GETTERFUNC_STR(socket_reply_collector, src, short_reply);
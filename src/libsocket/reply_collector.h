@@ -29,6 +29,7 @@
 #define __SOCKET_REPLY_COLLECTOR_H__
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct socket_reply_collector;
 
@@ -39,6 +40,8 @@ void src_free(struct socket_reply_collector *src);
 
 int src_short_reply(struct socket_reply_collector *src, const char *reply);
 int src_reply(struct socket_reply_collector *src, const void *buffer, size_t bufferlen);
+int src_stream(struct socket_reply_collector *src, const void *buffer, size_t bufferlen);
+void src_set_streamfd(struct socket_reply_collector *src, int streamfd);
 
 bool src_has_reply(struct socket_reply_collector *src);
 bool src_has_short_reply(struct socket_reply_collector *src);
@@ -51,65 +51,31 @@ struct socket_connection {
 };
 
 /*
- * send arbitrary data to remote and receive reply, supporting
- * binary blob data replies in addition to string messages.
+ * receive one reply from remote: either a string message, written to
+ * retbuffer, or a "DATA" header in retbuffer followed by a binary blob
+ * returned in blob_reply. A command streaming its reply sends several
+ * DATA frames before a final string message, each read by another
+ * call.
  */
 int
-sc_sendrecv_dynamic(struct socket_connection *sc,
-		    const char *command,
-		    const void *data,
-		    size_t datalen,
-		    char *retbuffer,
-		    size_t retbuffer_len,
-		    void **blob_reply,
-		    size_t *blob_reply_len)
+sc_recv_frame(struct socket_connection *sc,
+	      char *retbuffer,
+	      size_t retbuffer_len,
+	      void **blob_reply,
+	      size_t *blob_reply_len)
 {
-	if (!sc || !command) {
+	if (!sc || !retbuffer || (retbuffer_len < 6) ||
+	    !blob_reply || !blob_reply_len) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	char sendbuf[SHC_MAXTRANSPORTDATA] = {0};
-	size_t sendlen = strlen(command) + (data ? datalen : 0) + 1;
 	size_t bytes_sent = 0, bytes_total = 0;
 	size_t bytes_read = 0;
-	fd_set sendfds = {0};
 	const char *numstring = 0;
-	struct timeval timeout = {0};
 	char recv_check[5] = {0};
 	uint64_t bloblen = 0;
 
-	if (sendlen > SHC_MAXTRANSPORTDATA) {
-		errno = EMSGSIZE;
-		return -1;
-	}		
-
-	timeout.tv_usec = 100;
-	
-	/* check if we can really send */
-	FD_SET(sc->clientfd, &sendfds);
-	if (select(1, NULL, &sendfds, NULL, &timeout) < 0) {
-		/* failure to select */
-		return -1;
-	}
-
-	/* copy command, zero byte and data into send buffer */
-	snprintf(sendbuf, SHC_MAXTRANSPORTDATA, "%s%c",
-		 command, 0);
-	memcpy(sendbuf + strlen(command) + 1, data, datalen);
-
-	/* send data to remote end */
-	while(((sendlen - bytes_total) > 0) &&
-	      (bytes_sent = write(sc->clientfd, sendbuf + bytes_total, sendlen - bytes_sent)) > 0) {
-		bytes_total += bytes_sent;
-	}
-
-	/* check that we have something to read */
-	if (select(1, &sendfds, NULL, NULL, &timeout) < 0) {
-		/* failure to select for read */
-		return -1;
-	}
-
 	/* first, we read only 4 bytes, to check whether we got "DATA"
 	 * indicating a binary blob as reply */
 	bytes_total = 0;
@@ -152,7 +118,8 @@ sc_sendrecv_dynamic(struct socket_connection *sc,
 		}
 
 		/* attempt to allocate blob memory */
-		if (!(*blob_reply = malloc(bloblen))) {
+		/* an empty frame still yields a blob to free */
+		if (!(*blob_reply = malloc(bloblen ? bloblen : 1))) {
 			/* TODO handle allocation error; should close the socket now, I guess */
 			return -1;
 		}
@@ -171,7 +138,65 @@ sc_sendrecv_dynamic(struct socket_connection *sc,
 	}
 
 	return 0;
+}
+
+/*
+ * send arbitrary data to remote and receive reply, supporting
+ * binary blob data replies in addition to string messages.
+ */
+int
+sc_sendrecv_dynamic(struct socket_connection *sc,
+		    const char *command,
+		    const void *data,
+		    size_t datalen,
+		    char *retbuffer,
+		    size_t retbuffer_len,
+		    void **blob_reply,
+		    size_t *blob_reply_len)
+{
+	if (!sc || !command) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	char sendbuf[SHC_MAXTRANSPORTDATA] = {0};
+	size_t sendlen = strlen(command) + (data ? datalen : 0) + 1;
+	size_t bytes_sent = 0, bytes_total = 0;
+	fd_set sendfds = {0};
+	struct timeval timeout = {0};
+
+	if (sendlen > SHC_MAXTRANSPORTDATA) {
+		errno = EMSGSIZE;
+		return -1;
+	}		
+
+	timeout.tv_usec = 100;
+	
+	/* check if we can really send */
+	FD_SET(sc->clientfd, &sendfds);
+	if (select(1, NULL, &sendfds, NULL, &timeout) < 0) {
+		/* failure to select */
+		return -1;
+	}
+
+	/* copy command, zero byte and data into send buffer */
+	snprintf(sendbuf, SHC_MAXTRANSPORTDATA, "%s%c",
+		 command, 0);
+	memcpy(sendbuf + strlen(command) + 1, data, datalen);
+
+	/* send data to remote end */
+	while(((sendlen - bytes_total) > 0) &&
+	      (bytes_sent = write(sc->clientfd, sendbuf + bytes_total, sendlen - bytes_sent)) > 0) {
+		bytes_total += bytes_sent;
+	}
+
+	/* check that we have something to read */
+	if (select(1, &sendfds, NULL, NULL, &timeout) < 0) {
+		/* failure to select for read */
+		return -1;
+	}
 
+	return sc_recv_frame(sc, retbuffer, retbuffer_len, blob_reply, blob_reply_len);
 }
 
 /*
@@ -58,4 +58,11 @@ sc_sendrecv_dynamic(struct socket_connection *sc,
 		    void **blob_reply,
 		    size_t *blob_reply_len);	
 
+int
+sc_recv_frame(struct socket_connection *sc,
+	      char *retbuffer,
+	      size_t retbuffer_len,
+	      void **blob_reply,
+	      size_t *blob_reply_len);
+
 #endif /* __SOCKET_CONNECT_H__ */
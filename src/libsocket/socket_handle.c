@@ -48,6 +48,8 @@
 #include "socket_handle.h"
 #include "socket_handle_errors.h"
 
+#include "../libutils/daemon_log.h"
+
 #define SH_EVT_CMD_SHUTDOWN 0
 #define SH_MAXCONNECT 4
 #define SH_CMDLEN 4
@@ -254,6 +256,7 @@ shc_new(void *ctx, int clientfd, uid_t uid, pid_t pid)
 	bzero(&shc->buffer, sizeof(shc->buffer));
 
 	shc->src = src_new();
+	src_set_streamfd(shc->src, clientfd);
 
 	return shc;
 }
@@ -598,7 +601,7 @@ sh_disconnect_client(struct socket_handle *sh, struct socket_connection *shc)
 	LIST_REMOVE(shc, entries);
 	pthread_mutex_unlock(&sh->mtx);
 
-	syslog(LOG_INFO, "Disconnecting client");
+	dlog(LOG_DEBUG, "Disconnecting client");
 	
 	/* close handle, that also removes it from kqueue */
 	close(shc->clientfd);
@@ -664,13 +667,13 @@ sh_accept_handler_thread(void *data)
 				if (!shc)
 					break;
 				
-				syslog(LOG_ERR, "Disconnecting client");
+				dlog(LOG_DEBUG, "Client closed its connection");
 				
 				if (sh_disconnect_client(sh, shc)) {
 					/* TODO log error */
 				}
 			} else if (EVFILT_READ & sct->event.filter) {
-				syslog(LOG_ERR, "Received READ kevent");
+				dlog(LOG_DEBUG, "Received READ kevent");
 				
 				/* we want to read from client */
 				/* find matching connection and its buffer */
@@ -678,7 +681,7 @@ sh_accept_handler_thread(void *data)
 				if (!shc) {
 					/* log error */
 
-					syslog(LOG_ERR, "Failed to lookup connection");
+					dlog(LOG_ERR, "Failed to lookup connection");
 					close(sct->event.ident);
 					break;
 				}
@@ -688,11 +691,11 @@ sh_accept_handler_thread(void *data)
 					
 					/* close client connection on failure */
 					if (sh_disconnect_client(sh, shc)) {
-						syslog(LOG_ERR, "Failed to disconnect client");
+						dlog(LOG_ERR, "Failed to disconnect client");
 						/* TODO log error */
 					}
 					
-					syslog(LOG_ERR, "Failed to read from client");
+					dlog(LOG_ERR, "Failed to read from client");
 					break;
 				}
 				
@@ -704,7 +707,7 @@ sh_accept_handler_thread(void *data)
 				
 				/* if we're supposed to read more data, do just that */
 				if (SH_WRN_KEEPREADNMORE == parsedata.errcode) {
-					syslog(LOG_ERR, "Awaiting more input data");
+					dlog(LOG_DEBUG, "Awaiting more input data");
 					break;
 				}
 				
@@ -753,10 +756,6 @@ sh_accept_handler_thread(void *data)
 		}
 	} while (0);
 
-	/* release stack */
-	fflush(NULL);
-	free(sct);
-
 	fflush(NULL);
 	sct->event.flags = EV_ENABLE;
 	if (kevent(sh->keventfd, &sct->event, 1, NULL, 0, 0) < 0) {
@@ -766,13 +765,16 @@ sh_accept_handler_thread(void *data)
 			err(SH_ERR_ADDKEVENTFAIL, "Failed to re-enable kevent");
 	}
 	
-	if (pthread_mutex_lock(&sct->sh->mtx))
+	if (pthread_mutex_lock(&sh->mtx))
 		err(SH_ERR_MUTEXLOCKFAIL, "Failed to lock mutex");
 	
-	sct->sh->thread_counter--;
+	sh->thread_counter--;
 
-	pthread_mutex_unlock(&sct->sh->mtx);
-	pthread_cond_signal(&sct->sh->thread_change);
+	pthread_mutex_unlock(&sh->mtx);
+	pthread_cond_signal(&sh->thread_change);
+
+	/* release stack */
+	free(sct);
 
 	return NULL;
 }
@@ -839,8 +841,11 @@ sh_accept_thread(void *data)
 		if (pthread_create(&threadid, NULL, sh_accept_handler_thread, sct))
 			err(SH_ERR_THREADSTAFAIL, "Failed to launch handler thread");
 
-		if (pthread_join(threadid, NULL))
-		  err(SH_ERR_THREADSTAFAIL, "Failed to synchronize handler thread");
+		/* events of a connection stay disabled until its handler
+		 * finished, so a blocking command only holds up its own
+		 * connection */
+		if (pthread_detach(threadid))
+		  err(SH_ERR_THREADSTAFAIL, "Failed to detach handler thread");
 	}
 
 	if (pthread_mutex_lock(&sh->mtx))
@@ -851,15 +856,15 @@ sh_accept_thread(void *data)
 
 	/* wait for threads to finish */
 	do {
-		if (pthread_mutex_lock(&sct->sh->mtx))
+		if (pthread_mutex_lock(&sh->mtx))
 			err(SH_ERR_MUTEXLOCKFAIL, "Failed to lock mutex");
 
-		thread_count = sct->sh->thread_counter;
+		thread_count = sh->thread_counter;
 		
 		if (thread_count > 0) {
-			pthread_cond_wait(&sct->sh->thread_change, &sct->sh->mtx);
+			pthread_cond_wait(&sh->thread_change, &sh->mtx);
 		}
-		pthread_mutex_unlock(&sct->sh->mtx);
+		pthread_mutex_unlock(&sh->mtx);
 	} while(thread_count > 0);
 
 	return NULL;
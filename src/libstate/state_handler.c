@@ -35,31 +35,293 @@
 #include "state_handler.h"
 #include "state_node.h"
 
+/* TODO we might need a "reset" function */
+
 /*
- * a helper structure that combines state nodes with
- * transitions to simplify lookups
+ * largest id that is mapped to a node index through a direct lookup
+ * array; larger ids are looked up by binary search
  */
-struct state_node_expanded {
-	/* TODO implement */
-	/* we could simplify this by building this a list of
-	   states that directly link the available transitions.
-	   We would then no longer need to walk through the
-	   whole array to find the right transitions */
-};
+#define STH_IDMAP_MAX 4096
 
-/* TODO we might need a "reset" function */
+/*
+ * maps a state id to its node index
+ */
+struct state_index {
+	uint64_t id;
+	size_t index;
+};
 
-struct state_handler {
-	struct state_node *current;
+/*
+ * a transition list compiled for lookups; it is not changed once
+ * compiled, so state handlers of the same definition share it
+ */
+struct state_table {
 	/* array of transition pointers */
 	struct state_transition *vec;
 	size_t vecsize;
+	/* nodes referenced by the transitions, densely indexed */
+	struct state_node **nodes;
+	size_t nodecount;
+	/* nodecount x nodecount table of transitions, from x to */
+	struct state_transition **table;
+	/* direct id to index lookup; -1 marks unknown ids */
+	int *idmap;
+	size_t idmapsize;
+	/* ids sorted for lookups of ids above STH_IDMAP_MAX */
+	struct state_index *ids;
+};
+
+struct state_handler {
+	const struct state_table *stt;
+	/* table compiled by sth_new, NULL if the table is shared */
+	struct state_table *owned;
+	struct state_node *current;
 	void *ctx;
+	/* index of current in nodes */
+	size_t currentidx;
+	/* scratch space for path searches */
+	size_t *prev;
+	size_t *queue;
+	uint64_t *path;
 };
 
+int stt_addnode(struct state_table *stt, struct state_node *node);
+int stt_compile(struct state_table *stt, struct state_node *initial);
+int stt_compareindex(const void *a, const void *b);
+ssize_t stt_nodeindex(const struct state_table *stt, uint64_t id);
+ssize_t stt_nodeptrindex(const struct state_table *stt, struct state_node *node);
+void sth_setcurrent(struct state_handler *sth, struct state_transition *st);
+
+/*
+ * look up the index of the node with id; returns -1 if there is no
+ * such node
+ */
+ssize_t
+stt_nodeindex(const struct state_table *stt, uint64_t id)
+{
+	size_t low = 0, high = stt->nodecount, mid = 0;
+
+	if (stt->idmap) {
+		if (id >= stt->idmapsize)
+			return -1;
+		return stt->idmap[id];
+	}
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (stt->ids[mid].id == id)
+			return stt->ids[mid].index;
+		if (stt->ids[mid].id < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return -1;
+}
+
+/*
+ * look up the index of a node by its address; returns -1 if the node
+ * was not added yet
+ */
+ssize_t
+stt_nodeptrindex(const struct state_table *stt, struct state_node *node)
+{
+	for (size_t i = 0; i < stt->nodecount; i++) {
+		if (stt->nodes[i] == node)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * add a node to the node list unless it is known already
+ */
+int
+stt_addnode(struct state_table *stt, struct state_node *node)
+{
+	if (!node || (stt_nodeptrindex(stt, node) >= 0))
+		return 0;
+
+	stt->nodes[stt->nodecount++] = node;
+	return 0;
+}
+
+/*
+ * order state indices by id
+ */
+int
+stt_compareindex(const void *a, const void *b)
+{
+	const struct state_index *ia = a, *ib = b;
+
+	if (ia->id != ib->id)
+		return (ia->id < ib->id) ? -1 : 1;
+	/* keep equal ids in node order so the first node wins */
+	if (ia->index != ib->index)
+		return (ia->index < ib->index) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * compile the transition list into a dense adjacency table
+ *
+ * the first transition of the list matching a pair of states wins;
+ * a transition without from applies to every state. The initial
+ * state is indexed first.
+ */
+int
+stt_compile(struct state_table *stt, struct state_node *initial)
+{
+	struct state_transition *transition = NULL;
+	size_t counter = 0, n = 0, row = 0;
+	ssize_t to = 0;
+	uint64_t maxid = 0;
+
+	/* each transition adds at most two nodes, plus the initial one */
+	stt->nodes = calloc(stt->vecsize * 2 + 1, sizeof(struct state_node *));
+	if (!stt->nodes)
+		return -1;
+
+	stt_addnode(stt, initial);
+	for (counter = 0; counter < stt->vecsize; counter++) {
+		stt_addnode(stt, stt->vec[counter].from);
+		stt_addnode(stt, stt->vec[counter].to);
+	}
+
+	n = stt->nodecount;
+	stt->table = calloc(n * n, sizeof(struct state_transition *));
+	if (!stt->table)
+		return -1;
+
+	for (counter = 0; counter < n; counter++) {
+		if (stt->nodes[counter]->id > maxid)
+			maxid = stt->nodes[counter]->id;
+	}
+
+	if (maxid < STH_IDMAP_MAX) {
+		stt->idmapsize = maxid + 1;
+		stt->idmap = malloc(sizeof(int) * stt->idmapsize);
+		if (!stt->idmap)
+			return -1;
+		memset(stt->idmap, 0xff, sizeof(int) * stt->idmapsize);
+		/* walk backwards so the first node with an id wins */
+		for (counter = n; counter > 0; counter--)
+			stt->idmap[stt->nodes[counter - 1]->id] = counter - 1;
+	} else {
+		stt->ids = calloc(n, sizeof(struct state_index));
+		if (!stt->ids)
+			return -1;
+		for (counter = 0; counter < n; counter++) {
+			stt->ids[counter].id = stt->nodes[counter]->id;
+			stt->ids[counter].index = counter;
+		}
+		qsort(stt->ids, n, sizeof(struct state_index), stt_compareindex);
+	}
+
+	transition = stt->vec;
+	for (counter = 0; counter < stt->vecsize; counter++, transition++) {
+		if (!transition->to)
+			continue;
+
+		/* a transition only matches on the first node with an id */
+		to = stt_nodeindex(stt, transition->to->id);
+		if (!transition->from) {
+			for (row = 0; row < n; row++) {
+				if (!stt->table[row * n + to])
+					stt->table[row * n + to] = transition;
+			}
+			continue;
+		}
+
+		/* every node sharing the id of from matches */
+		for (row = 0; row < n; row++) {
+			if (stt->nodes[row]->id != transition->from->id)
+				continue;
+			if (!stt->table[row * n + to])
+				stt->table[row * n + to] = transition;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * compile a transition list to be shared by state handlers starting
+ * in initial or in any state of the list
+ *
+ * - vec: the list of transitions
+ * - vecsize: size of the transition list (number of items)
+ * - initial: the state handlers usually start in
+ */
+struct state_table *
+stt_new(struct state_transition *vec, size_t vecsize, struct state_node *initial)
+{
+	struct state_table *stt = NULL;
+
+	if (!vec) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(stt = malloc(sizeof(struct state_table))))
+		return NULL;
+
+	bzero(stt, sizeof(struct state_table));
+	stt->vec = vec;
+	stt->vecsize = vecsize;
+
+	if (stt_compile(stt, initial)) {
+		stt_free(stt);
+		return NULL;
+	}
+
+	return stt;
+}
+
+/*
+ * free a compiled transition list; the state handlers using it must
+ * be gone
+ */
+void
+stt_free(struct state_table *stt)
+{
+	if (!stt)
+		return;
+
+	free(stt->nodes);
+	free(stt->table);
+	free(stt->idmap);
+	free(stt->ids);
+	free(stt);
+}
+
+/*
+ * get number of bytes allocated for a compiled transition list
+ */
+size_t
+stt_get_memusage(const struct state_table *stt)
+{
+	size_t bytes = 0;
+
+	if (!stt)
+		return 0;
+
+	bytes = (stt->vecsize * 2 + 1) * sizeof(struct state_node *) +
+		stt->nodecount * stt->nodecount * sizeof(struct state_transition *);
+	if (stt->idmap)
+		bytes += stt->idmapsize * sizeof(int);
+	if (stt->ids)
+		bytes += stt->nodecount * sizeof(struct state_index);
+
+	return sizeof(struct state_table) + bytes;
+}
+
 /*
  * look up a transition from current state to desired target state
- * this only supports moving to a neighboring state.
+ * this only supports moving to a neighboring state; see sth_driveto
+ * for walking further.
  *
  * returns NULL if no transition exists
  */
@@ -69,23 +331,91 @@ sth_findtransition(struct state_handler *sth, uint64_t target_state)
 	if (!sth)
 		return NULL;
 
-	struct state_transition *transition = sth->vec;
-	size_t counter = 0;
-	
-	for(counter = 0; counter < sth->vecsize; counter++, transition++) {
-		if (transition->from) {
-			/* if transition has a from property, check it */
-			if (transition->from->id != sth->current->id)
+	ssize_t to = stt_nodeindex(sth->stt, target_state);
+	if (to < 0)
+		return NULL;
+
+	return sth->stt->table[sth->currentidx * sth->stt->nodecount + to];
+}
+
+/*
+ * find the shortest way from the current state to target_state
+ *
+ * puts the ids of the states to pass, ending with target_state, into
+ * path; ties are resolved in favour of states listed first in the
+ * transition list.
+ *
+ * returns the number of states put into path, 0 if the handler is in
+ * target_state already, or -1 with errno set to ENOENT if there is no
+ * way to target_state or ENOSPC if it takes more than max steps.
+ */
+ssize_t
+sth_findpath(struct state_handler *sth, uint64_t target_state,
+	     uint64_t *path, size_t max)
+{
+	if (!sth || (!path && max)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const struct state_table *stt = sth->stt;
+	size_t n = stt->nodecount, head = 0, tail = 0, node = 0, to = 0;
+	size_t count = 0;
+	ssize_t target = stt_nodeindex(stt, target_state);
+
+	if (target < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if ((size_t) target == sth->currentidx)
+		return 0;
+
+	/* prev doubles as visited marker; n means not visited yet */
+	for (node = 0; node < n; node++)
+		sth->prev[node] = n;
+
+	sth->prev[sth->currentidx] = sth->currentidx;
+	sth->queue[tail++] = sth->currentidx;
+
+	while ((head < tail) && (sth->prev[target] == n)) {
+		node = sth->queue[head++];
+		for (to = 0; to < n; to++) {
+			if (!stt->table[node * n + to] || (sth->prev[to] != n))
 				continue;
+			sth->prev[to] = node;
+			sth->queue[tail++] = to;
 		}
-		if (transition->to) {
-			/* we match on the target state */
-			if (transition->to->id == target_state)
-				return transition;
-		}			    
 	}
 
-	return NULL;
+	if (sth->prev[target] == n) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	for (node = target; node != sth->currentidx; node = sth->prev[node])
+		count++;
+
+	if (count > max) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	to = count;
+	for (node = target; node != sth->currentidx; node = sth->prev[node])
+		path[--to] = stt->nodes[node]->id;
+
+	return count;
+}
+
+/*
+ * move into the target state of transition st
+ */
+void
+sth_setcurrent(struct state_handler *sth, struct state_transition *st)
+{
+	sth->current = st->to;
+	sth->currentidx = stt_nodeindex(sth->stt, st->to->id);
 }
 
 /*
@@ -97,6 +427,10 @@ sth_findtransition(struct state_handler *sth, uint64_t target_state)
  * new desired target state. If any of the on_exit of on_enter calls
  * fails with <0, the transition will fail with -1.
  *
+ * If on_enter returns STH_PENDING, the state is entered regardless
+ * and STH_PENDING is returned; the caller is responsible for following
+ * up once the pending work completed.
+ *
  * - sth: state handler
  * - target_state: numeric id of target state
  */
@@ -107,6 +441,8 @@ sth_transitionto(struct state_handler *sth, uint64_t target_state)
 		return -1;
 
 	struct state_transition *st = sth_findtransition(sth, target_state);
+	int result = 0;
+
 	if (!st) {
 		syslog(LOG_ERR, "Failed to find transition to target_state = %lu", target_state);
 		return -1;
@@ -121,17 +457,55 @@ sth_transitionto(struct state_handler *sth, uint64_t target_state)
 	}
 
 	if (st->to->on_enter) {
-		if (st->to->on_enter(st->to, sth->ctx, sth->current, sth->current->id) != 0) {
+		result = st->to->on_enter(st->to, sth->ctx, sth->current, sth->current->id);
+		if (STH_PENDING == result) {
+			sth_setcurrent(sth, st);
+			return STH_PENDING;
+		}
+		if (result != 0) {
 			syslog(LOG_ERR, "on_enter returned error");
 			return -1;
 		}
 	}
 
-	sth->current = st->to;
+	sth_setcurrent(sth, st);
 	
 	return 0;
 }
 
+/*
+ * walk from the current state to target_state along the shortest way,
+ * transitioning through every state in between
+ *
+ * on_exit and on_enter are called for every state passed in order.
+ * Stops at the first transition that fails or returns STH_PENDING and
+ * returns its result; call sth_driveto again once the pending work
+ * completed to continue the walk.
+ *
+ * returns 0 once target_state is reached, -1 if there is no way to it.
+ */
+int
+sth_driveto(struct state_handler *sth, uint64_t target_state)
+{
+	ssize_t count = 0, counter = 0;
+	int result = 0;
+
+	count = sth_findpath(sth, target_state, sth ? sth->path : NULL,
+			     sth ? sth->stt->nodecount : 0);
+	if (count < 0) {
+		syslog(LOG_ERR, "No way to target_state = %lu", target_state);
+		return -1;
+	}
+
+	for (counter = 0; counter < count; counter++) {
+		result = sth_transitionto(sth, sth->path[counter]);
+		if (result)
+			return result;
+	}
+
+	return 0;
+}
+
 /*
  * get id of current state; sets errno if an error occurrs.
  */
@@ -164,7 +538,50 @@ sth_lookupstate(struct state_node *vec, size_t vecsize, uint64_t id)
 }
 
 /*
- * instantiate a new state handler
+ * instantiate a state handler on a shared compiled transition list
+ *
+ * - stt: the compiled transition list, which must outlive the handler
+ * - current: the initial state to start from, known to stt
+ */
+struct state_handler *
+sth_fromtable(const struct state_table *stt, struct state_node *current,
+	      void *ctx)
+{
+	struct state_handler *sth = NULL;
+	ssize_t currentidx = 0;
+
+	if (!stt || !current) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((currentidx = stt_nodeindex(stt, current->id)) < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	if (!(sth = malloc(sizeof(struct state_handler))))
+		return NULL;
+
+	bzero(sth, sizeof(struct state_handler));
+	sth->stt = stt;
+	sth->current = current;
+	sth->currentidx = currentidx;
+	sth->ctx = ctx;
+
+	sth->prev = calloc(stt->nodecount, sizeof(size_t));
+	sth->queue = calloc(stt->nodecount, sizeof(size_t));
+	sth->path = calloc(stt->nodecount, sizeof(uint64_t));
+	if (!sth->prev || !sth->queue || !sth->path) {
+		sth_free(sth);
+		return NULL;
+	}
+
+	return sth;
+}
+
+/*
+ * instantiate a new state handler with its own compiled transition list
  *
  * - vec: the list of transitions
  * - vecsize: size of the transition list (number of items)
@@ -173,17 +590,20 @@ sth_lookupstate(struct state_node *vec, size_t vecsize, uint64_t id)
 struct state_handler *
 sth_new(struct state_transition *vec, size_t vecsize, struct state_node *current, void *ctx)
 {
-	if (!vec)
+	struct state_table *stt = NULL;
+	struct state_handler *sth = NULL;
+
+	if (!vec || !current)
 		return NULL;
 
-	struct state_handler *sth = malloc(sizeof(struct state_handler));
-	if (!sth)
+	if (!(stt = stt_new(vec, vecsize, current)))
 		return NULL;
 
-	sth->vec = vec;
-	sth->vecsize = vecsize;
-	sth->current = current;
-	sth->ctx = ctx;
+	if (!(sth = sth_fromtable(stt, current, ctx))) {
+		stt_free(stt);
+		return NULL;
+	}
+	sth->owned = stt;
 
 	return sth;
 }
@@ -194,5 +614,26 @@ sth_new(struct state_transition *vec, size_t vecsize, struct state_node *current
 void
 sth_free(struct state_handler *sth)
 {
+	if (!sth)
+		return;
+
+	stt_free(sth->owned);
+	free(sth->prev);
+	free(sth->queue);
+	free(sth->path);
 	free(sth);
 }
+
+/*
+ * get number of bytes allocated for a state handler, not counting a
+ * shared transition list
+ */
+size_t
+sth_get_memusage(const struct state_handler *sth)
+{
+	if (!sth)
+		return 0;
+
+	return sizeof(struct state_handler) + stt_get_memusage(sth->owned) +
+		sth->stt->nodecount * (2 * sizeof(size_t) + sizeof(uint64_t));
+}
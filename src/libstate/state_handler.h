@@ -28,14 +28,28 @@
 #ifndef __STATE_HANDLER_H__
 #define __STATE_HANDLER_H__
 
+#include <sys/types.h>
+
 #include "state_node.h"
 
 struct state_handler;
+struct state_table;
+
+struct state_table *stt_new(struct state_transition *vec, size_t vecsize,
+			    struct state_node *initial);
+void stt_free(struct state_table *stt);
+size_t stt_get_memusage(const struct state_table *stt);
 
 struct state_handler *sth_new(struct state_transition *vec, size_t vecsize,
 			      struct state_node *current, void *ctx);
+struct state_handler *sth_fromtable(const struct state_table *stt,
+				    struct state_node *current, void *ctx);
 void sth_free(struct state_handler *sth);
+size_t sth_get_memusage(const struct state_handler *sth);
 int sth_transitionto(struct state_handler *sth, uint64_t target_state);
+int sth_driveto(struct state_handler *sth, uint64_t target_state);
+ssize_t sth_findpath(struct state_handler *sth, uint64_t target_state,
+		     uint64_t *path, size_t max);
 uint64_t sth_getcurrentid(struct state_handler *sth);
 int sth_lookupstate(struct state_node *vec, size_t vecsize, uint64_t id);
 
@@ -28,6 +28,12 @@
 #ifndef __STATE_NODE_H__
 #define __STATE_NODE_H__
 
+/*
+ * returned by on_enter if entering the state completes asynchronously;
+ * the state handler moves into the state and returns STH_PENDING
+ */
+#define STH_PENDING 0x10000
+
 /*
  * defines a state node
  */
@@ -32,6 +32,8 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "../state_handler.h"
 #include "../state_node.h"
@@ -146,9 +148,373 @@ ATF_TC_CLEANUP(tc_sth_simplerun, tc)
 {
 }
 
+int
+node_pending_enter(struct state_node *ns, void *ctx, struct state_node *from, uint64_t from_state)
+{
+	(*(int *)ctx)++;
+	return STH_PENDING;
+}
+
+struct state_node pending_nodes[] = {
+	{
+		.id = 0,
+		.name = "Start node",
+		.on_enter = NULL,
+		.on_exit = NULL
+	},
+	{
+		.id = 1,
+		.name = "Pending node",
+		.on_enter = node_pending_enter,
+		.on_exit = NULL
+	}
+};
+
+struct state_transition pending_transitions[] = {
+	{
+		.from = &pending_nodes[0],
+		.to = &pending_nodes[1]
+	}
+};
+
+ATF_TC(tc_sth_pending);
+ATF_TC_HEAD(tc_sth_pending, tc)
+{
+}
+ATF_TC_BODY(tc_sth_pending, tc)
+{
+	int funccalls = 0;
+
+	struct state_handler *sth = sth_new(pending_transitions, 1, &pending_nodes[0], &funccalls);
+	ATF_REQUIRE(0 != sth);
+
+	/* a pending on_enter still moves into the new state */
+	ATF_REQUIRE_EQ(STH_PENDING, sth_transitionto(sth, 1));
+	ATF_REQUIRE_EQ(1, sth_getcurrentid(sth));
+	ATF_REQUIRE_EQ(1, funccalls);
+
+	sth_free(sth);
+}
+ATF_TC_CLEANUP(tc_sth_pending, tc)
+{
+}
+
+/* records on_exit as -id - 1 and on_enter as id */
+int order_log[16] = {0};
+size_t order_count = 0;
+
+int
+node_order_enter(struct state_node *ns, void *ctx, struct state_node *from, uint64_t from_state)
+{
+	order_log[order_count++] = ns->id;
+	if (ctx && (*(uint64_t *)ctx == ns->id))
+		return STH_PENDING;
+	return 0;
+}
+
+int
+node_order_exit(struct state_node *os, void *ctx, struct state_node *to, uint64_t to_state)
+{
+	order_log[order_count++] = -(int) os->id - 1;
+	return 0;
+}
+
+struct state_node order_nodes[] = {
+	{ .id = 0, .name = "a", .on_enter = node_order_enter, .on_exit = node_order_exit },
+	{ .id = 1, .name = "b", .on_enter = node_order_enter, .on_exit = node_order_exit },
+	{ .id = 2, .name = "c", .on_enter = node_order_enter, .on_exit = node_order_exit },
+	{ .id = 3, .name = "d", .on_enter = node_order_enter, .on_exit = node_order_exit },
+	{ .id = 4, .name = "e", .on_enter = node_order_enter, .on_exit = node_order_exit }
+};
+
+/* a -> b -> c -> d, a shortcut b -> d, any -> e and e -> a */
+struct state_transition order_transitions[] = {
+	{ .from = &order_nodes[0], .to = &order_nodes[1] },
+	{ .from = &order_nodes[1], .to = &order_nodes[2] },
+	{ .from = &order_nodes[2], .to = &order_nodes[3] },
+	{ .from = &order_nodes[1], .to = &order_nodes[3] },
+	{ .from = NULL, .to = &order_nodes[4] },
+	{ .from = &order_nodes[4], .to = &order_nodes[0] }
+};
+
+ATF_TC(tc_sth_driveto);
+ATF_TC_HEAD(tc_sth_driveto, tc)
+{
+}
+ATF_TC_BODY(tc_sth_driveto, tc)
+{
+	int expected[] = { -1, 1, -2, 3 };
+	struct state_handler *sth = NULL;
+	uint64_t path[4] = {0};
+
+	order_count = 0;
+	sth = sth_new(order_transitions, 6, &order_nodes[0], NULL);
+	ATF_REQUIRE(0 != sth);
+
+	/* the shortcut makes the way two steps long */
+	ATF_REQUIRE_EQ(2, sth_findpath(sth, 3, path, 4));
+	ATF_REQUIRE_EQ(1, path[0]);
+	ATF_REQUIRE_EQ(3, path[1]);
+	ATF_REQUIRE_EQ(-1, sth_findpath(sth, 3, path, 1));
+	ATF_REQUIRE_EQ(ENOSPC, errno);
+	ATF_REQUIRE_EQ(-1, sth_findpath(sth, 42, path, 4));
+	ATF_REQUIRE_EQ(ENOENT, errno);
+	ATF_REQUIRE_EQ(0, sth_findpath(sth, 0, path, 4));
+
+	/* exits and enters run in order along the way */
+	ATF_REQUIRE_EQ(0, sth_driveto(sth, 3));
+	ATF_REQUIRE_EQ(3, sth_getcurrentid(sth));
+	ATF_REQUIRE_EQ(4, order_count);
+	ATF_REQUIRE_EQ(0, memcmp(expected, order_log, sizeof(expected)));
+
+	/* d has no way out but through the wildcard transition */
+	ATF_REQUIRE_EQ(0, sth_driveto(sth, 1));
+	ATF_REQUIRE_EQ(1, sth_getcurrentid(sth));
+	ATF_REQUIRE_EQ(10, order_count);
+
+	/* nothing to do if we are there already */
+	ATF_REQUIRE_EQ(0, sth_driveto(sth, 1));
+	ATF_REQUIRE_EQ(10, order_count);
+
+	sth_free(sth);
+}
+ATF_TC_CLEANUP(tc_sth_driveto, tc)
+{
+}
+
+ATF_TC(tc_sth_sharedtable);
+ATF_TC_HEAD(tc_sth_sharedtable, tc)
+{
+}
+ATF_TC_BODY(tc_sth_sharedtable, tc)
+{
+	struct state_node stray = { .id = 42, .name = "stray" };
+	struct state_table *stt = NULL;
+	struct state_handler *first = NULL, *second = NULL, *owned = NULL;
+
+	order_count = 0;
+	ATF_REQUIRE(0 != (stt = stt_new(order_transitions, 6, &order_nodes[0])));
+	ATF_REQUIRE(0 != (first = sth_fromtable(stt, &order_nodes[0], NULL)));
+	ATF_REQUIRE(0 != (second = sth_fromtable(stt, &order_nodes[4], NULL)));
+	ATF_REQUIRE_EQ(0, sth_fromtable(stt, &stray, NULL));
+	ATF_REQUIRE_EQ(ENOENT, errno);
+
+	/* handlers on one table keep their own state */
+	ATF_REQUIRE_EQ(0, sth_driveto(first, 3));
+	ATF_REQUIRE_EQ(3, sth_getcurrentid(first));
+	ATF_REQUIRE_EQ(4, sth_getcurrentid(second));
+	ATF_REQUIRE_EQ(0, sth_driveto(second, 1));
+	ATF_REQUIRE_EQ(1, sth_getcurrentid(second));
+	ATF_REQUIRE_EQ(3, sth_getcurrentid(first));
+
+	/* the table is only counted for a handler owning it */
+	ATF_REQUIRE(0 != (owned = sth_new(order_transitions, 6, &order_nodes[0],
+					  NULL)));
+	ATF_REQUIRE_EQ(sth_get_memusage(first) + stt_get_memusage(stt),
+		       sth_get_memusage(owned));
+
+	sth_free(owned);
+	sth_free(first);
+	sth_free(second);
+	stt_free(stt);
+}
+ATF_TC_CLEANUP(tc_sth_sharedtable, tc)
+{
+}
+
+struct state_node sink_nodes[] = {
+	{ .id = 0, .name = "start" },
+	{ .id = 1, .name = "sink" }
+};
+
+struct state_transition sink_transitions[] = {
+	{ .from = &sink_nodes[0], .to = &sink_nodes[1] }
+};
+
+ATF_TC(tc_sth_drivepending);
+ATF_TC_HEAD(tc_sth_drivepending, tc)
+{
+}
+ATF_TC_BODY(tc_sth_drivepending, tc)
+{
+	struct state_handler *sth = NULL;
+	uint64_t pending = 1;
+
+	order_count = 0;
+	sth = sth_new(order_transitions, 6, &order_nodes[0], &pending);
+	ATF_REQUIRE(0 != sth);
+
+	/* the walk stops in a pending state and continues later */
+	ATF_REQUIRE_EQ(STH_PENDING, sth_driveto(sth, 3));
+	ATF_REQUIRE_EQ(1, sth_getcurrentid(sth));
+	ATF_REQUIRE_EQ(2, order_count);
+
+	pending = 0;
+	ATF_REQUIRE_EQ(0, sth_driveto(sth, 3));
+	ATF_REQUIRE_EQ(3, sth_getcurrentid(sth));
+	ATF_REQUIRE_EQ(4, order_count);
+
+	sth_free(sth);
+
+	/* no way back out of a sink */
+	sth = sth_new(sink_transitions, 1, &sink_nodes[1], NULL);
+	ATF_REQUIRE(0 != sth);
+	ATF_REQUIRE_EQ(-1, sth_driveto(sth, 0));
+	ATF_REQUIRE_EQ(1, sth_getcurrentid(sth));
+	sth_free(sth);
+}
+ATF_TC_CLEANUP(tc_sth_drivepending, tc)
+{
+}
+
+struct state_node sparse_nodes[] = {
+	{ .id = 10, .name = "ten" },
+	{ .id = 1ULL << 40, .name = "large" },
+	{ .id = 5000, .name = "above map" }
+};
+
+struct state_transition sparse_transitions[] = {
+	{ .from = &sparse_nodes[0], .to = &sparse_nodes[1] },
+	{ .from = &sparse_nodes[1], .to = &sparse_nodes[2] },
+	{ .from = NULL, .to = &sparse_nodes[0] }
+};
+
+ATF_TC(tc_sth_sparseids);
+ATF_TC_HEAD(tc_sth_sparseids, tc)
+{
+}
+ATF_TC_BODY(tc_sth_sparseids, tc)
+{
+	struct state_handler *sth = NULL;
+
+	sth = sth_new(sparse_transitions, 3, &sparse_nodes[0], NULL);
+	ATF_REQUIRE(0 != sth);
+
+	ATF_REQUIRE_EQ(-1, sth_transitionto(sth, 5000));
+	ATF_REQUIRE_EQ(-1, sth_transitionto(sth, 11));
+	ATF_REQUIRE_EQ(0, sth_transitionto(sth, 1ULL << 40));
+	ATF_REQUIRE_EQ(1ULL << 40, sth_getcurrentid(sth));
+	ATF_REQUIRE_EQ(0, sth_driveto(sth, 5000));
+	ATF_REQUIRE_EQ(5000, sth_getcurrentid(sth));
+	ATF_REQUIRE_EQ(0, sth_transitionto(sth, 10));
+
+	sth_free(sth);
+}
+ATF_TC_CLEANUP(tc_sth_sparseids, tc)
+{
+}
+
+#define TC_STH_RINGSIZE 64
+#define TC_STH_ROUNDS 2000000
+
+struct state_node ring_nodes[TC_STH_RINGSIZE + 1];
+struct state_transition ring_transitions[TC_STH_RINGSIZE + 1];
+
+/*
+ * the lookup as done before transitions were compiled into a table
+ */
+struct state_transition *
+tc_sth_scantransition(struct state_node *current, uint64_t target_state)
+{
+	struct state_transition *transition = ring_transitions;
+
+	for (size_t i = 0; i < TC_STH_RINGSIZE + 1; i++, transition++) {
+		if (transition->from && (transition->from->id != current->id))
+			continue;
+		if (transition->to && (transition->to->id == target_state))
+			return transition;
+	}
+
+	return NULL;
+}
+
+int
+tc_sth_countenter(struct state_node *ns, void *ctx, struct state_node *from, uint64_t from_state)
+{
+	(*(int *)ctx)++;
+	return 0;
+}
+
+double
+tc_sth_elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+ATF_TC(tc_sth_transitionrate);
+ATF_TC_HEAD(tc_sth_transitionrate, tc)
+{
+}
+ATF_TC_BODY(tc_sth_transitionrate, tc)
+{
+	struct state_transition *st = NULL;
+	struct state_node *current = &ring_nodes[0];
+	struct state_handler *sth = NULL;
+	struct timespec start;
+	double scan = 0, table = 0;
+	int funccalls = 0;
+	size_t i = 0;
+
+	/* a ring of states and a failure state reachable from anywhere */
+	for (i = 0; i <= TC_STH_RINGSIZE; i++) {
+		ring_nodes[i].id = i * 10;
+		ring_nodes[i].name = "ring";
+		ring_nodes[i].on_enter = tc_sth_countenter;
+		ring_nodes[i].on_exit = NULL;
+	}
+	for (i = 0; i < TC_STH_RINGSIZE; i++) {
+		ring_transitions[i].from = &ring_nodes[i];
+		ring_transitions[i].to = &ring_nodes[(i + 1) % TC_STH_RINGSIZE];
+	}
+	ring_transitions[TC_STH_RINGSIZE].from = NULL;
+	ring_transitions[TC_STH_RINGSIZE].to = &ring_nodes[TC_STH_RINGSIZE];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < TC_STH_ROUNDS; i++) {
+		st = tc_sth_scantransition(current,
+		    ((i + 1) % TC_STH_RINGSIZE) * 10);
+		ATF_REQUIRE(0 != st);
+		st->to->on_enter(st->to, &funccalls, current, current->id);
+		current = st->to;
+	}
+	scan = tc_sth_elapsed(&start);
+
+	sth = sth_new(ring_transitions, TC_STH_RINGSIZE + 1, &ring_nodes[0],
+		      &funccalls);
+	ATF_REQUIRE(0 != sth);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < TC_STH_ROUNDS; i++) {
+		ATF_REQUIRE_EQ(0, sth_transitionto(sth,
+		    ((i + 1) % TC_STH_RINGSIZE) * 10));
+	}
+	table = tc_sth_elapsed(&start);
+
+	ATF_REQUIRE_EQ(2 * TC_STH_ROUNDS, funccalls);
+	ATF_REQUIRE_EQ(current->id, sth_getcurrentid(sth));
+
+	printf("%d states: scan %.0f transitions/s, table %.0f transitions/s\n",
+	       TC_STH_RINGSIZE + 1, TC_STH_ROUNDS / scan, TC_STH_ROUNDS / table);
+
+	sth_free(sth);
+}
+ATF_TC_CLEANUP(tc_sth_transitionrate, tc)
+{
+}
+
 ATF_TP_ADD_TCS(testplan)
 {
 	ATF_TP_ADD_TC(testplan, tc_sth_simplerun);
+	ATF_TP_ADD_TC(testplan, tc_sth_pending);
+	ATF_TP_ADD_TC(testplan, tc_sth_driveto);
+	ATF_TP_ADD_TC(testplan, tc_sth_sharedtable);
+	ATF_TP_ADD_TC(testplan, tc_sth_drivepending);
+	ATF_TP_ADD_TC(testplan, tc_sth_sparseids);
+	ATF_TP_ADD_TC(testplan, tc_sth_transitionrate);
 
 	return atf_no_error();
 }
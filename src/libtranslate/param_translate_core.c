@@ -35,6 +35,7 @@
 #include "../libconfig/config_core.h"
 #include "../libprocwatch/bhyve_config.h"
 #include "../libprocwatch/bhyve_config_console.h"
+#include "../libutils/daemon_log.h"
 
 #define bc_transfer_nn_variable(structname, varname)	\
 	if (bc_get_##varname(structname->bc)) { \
@@ -78,7 +79,7 @@ ptc_translate(struct param_translate_core *ptc)
 		return -1;
 	}
 
-	syslog(LOG_INFO, "Staring bhyve_config to core translation");
+	dlog(LOG_DEBUG, "Staring bhyve_config to core translation");
 
 	ptc->bpc = bpc_new(bc_get_name(ptc->bc));
 
@@ -100,7 +101,7 @@ ptc_translate(struct param_translate_core *ptc)
 	bc_transfer_nn_variable(ptc, cores);
 
 	if (bc_get_hostbridge(ptc->bc)) {
-		syslog(LOG_INFO, "Translating hostbridge configuration");
+		dlog(LOG_DEBUG, "Translating hostbridge configuration");
 		/* add a hostbridge */
 		if (bpc_addpcislot_at(ptc->bpc,
 				  0, 0, 0,
@@ -110,7 +111,7 @@ ptc_translate(struct param_translate_core *ptc)
 			return -1;
 		}
 	} else {
-		syslog(LOG_INFO, "No hostbridge specified in config");
+		dlog(LOG_DEBUG, "No hostbridge specified in config");
 	}
 	
 	/* add consoles */
@@ -140,7 +141,7 @@ ptc_translate(struct param_translate_core *ptc)
 			return -1;
 	}
 
-	syslog(LOG_INFO, "Translation completed");
+	dlog(LOG_DEBUG, "Translation completed");
 
 	return 0;
 }
@@ -0,0 +1,404 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "daemon_log.h"
+
+/*
+ * a message waiting in a thread buffer
+ */
+struct dlog_record {
+	int level;
+	char msg[DLOG_MSG_MAX];
+};
+
+/*
+ * messages of a single thread
+ *
+ * only the owning thread advances head and only the drain thread
+ * advances tail, so neither side takes a lock.
+ */
+struct dlog_ring {
+	/* next record written by the owning thread */
+	_Atomic uint32_t head;
+	/* next record read by the drain thread */
+	_Atomic uint32_t tail;
+	/* messages lost since the last drain */
+	_Atomic uint64_t dropped;
+	/* the owning thread exited; freed once drained */
+	_Atomic bool orphaned;
+
+	struct dlog_record records[DLOG_RING_SIZE];
+
+	LIST_ENTRY(dlog_ring) entries;
+};
+
+/*
+ * process wide state of the diagnostic log
+ */
+struct dlog_state {
+	/* protects the ring list, the sink and the counters */
+	pthread_mutex_t mtx;
+	/* wakes the drain thread early */
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	/* messages go through the thread buffers */
+	_Atomic bool running;
+	bool stopping;
+
+	pthread_once_t once;
+	pthread_key_t key;
+
+	LIST_HEAD(, dlog_ring) rings;
+
+	void (*sink)(void *ctx, int level, const char *msg);
+	void *ctx;
+
+	uint64_t written;
+	uint64_t dropped;
+};
+
+void dlog_syslog(void *ctx, int level, const char *msg);
+
+_Atomic int dlog_level = LOG_INFO;
+
+struct dlog_state dlog_state = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.once = PTHREAD_ONCE_INIT,
+	.rings = LIST_HEAD_INITIALIZER(dlog_state.rings),
+	.sink = dlog_syslog
+};
+
+/*
+ * default sink passing messages on to syslog
+ */
+void
+dlog_syslog(void *ctx, int level, const char *msg)
+{
+	syslog(level, "%s", msg);
+}
+
+/*
+ * translate the number of -v flags into the least important level
+ * logged; informational messages are logged by default
+ */
+int
+dlog_verbositylevel(int verbosity)
+{
+	if (verbosity <= 0)
+		return LOG_INFO;
+
+	return (LOG_INFO + verbosity > LOG_DEBUG) ? LOG_DEBUG : LOG_INFO + verbosity;
+}
+
+/*
+ * set the least important level logged
+ */
+void
+dlog_setlevel(int level)
+{
+	atomic_store_explicit(&dlog_level, level, memory_order_relaxed);
+}
+
+/*
+ * replace where messages are delivered to; NULL restores syslog
+ */
+void
+dlog_set_sink(void (*sink)(void *ctx, int level, const char *msg), void *ctx)
+{
+	pthread_mutex_lock(&dlog_state.mtx);
+	dlog_state.sink = sink ? sink : dlog_syslog;
+	dlog_state.ctx = sink ? ctx : NULL;
+	pthread_mutex_unlock(&dlog_state.mtx);
+}
+
+/*
+ * mark the buffer of an exiting thread for release
+ */
+void
+dlog_orphan(void *ring)
+{
+	atomic_store_explicit(&((struct dlog_ring *) ring)->orphaned, true,
+			      memory_order_release);
+}
+
+/*
+ * create the key holding the buffer of each thread
+ */
+void
+dlog_initkey(void)
+{
+	pthread_key_create(&dlog_state.key, dlog_orphan);
+}
+
+/*
+ * get the buffer of the calling thread, creating it on first use
+ */
+struct dlog_ring *
+dlog_getring(void)
+{
+	struct dlog_ring *ring = NULL;
+
+	if (pthread_once(&dlog_state.once, dlog_initkey))
+		return NULL;
+
+	if ((ring = pthread_getspecific(dlog_state.key)))
+		return ring;
+
+	if (!(ring = calloc(1, sizeof(struct dlog_ring))))
+		return NULL;
+
+	if (pthread_setspecific(dlog_state.key, ring)) {
+		free(ring);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&dlog_state.mtx);
+	LIST_INSERT_HEAD(&dlog_state.rings, ring, entries);
+	pthread_mutex_unlock(&dlog_state.mtx);
+
+	return ring;
+}
+
+/*
+ * hand all buffered messages to the sink; called with mtx held
+ */
+void
+dlog_drain(void)
+{
+	struct dlog_ring *ring = NULL, *next = NULL;
+	struct dlog_record *rec = NULL;
+	uint32_t head = 0, tail = 0;
+	uint64_t dropped = 0;
+	bool orphaned = false;
+	char msg[DLOG_MSG_MAX] = {0};
+
+	LIST_FOREACH_SAFE(ring, &dlog_state.rings, entries, next) {
+		/* nothing is written after the owner exited */
+		orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+		for (; tail != head; tail++) {
+			rec = &ring->records[tail & (DLOG_RING_SIZE - 1)];
+			dlog_state.sink(dlog_state.ctx, rec->level, rec->msg);
+			dlog_state.written++;
+			atomic_store_explicit(&ring->tail, tail + 1,
+					      memory_order_release);
+		}
+
+		if ((dropped = atomic_exchange_explicit(&ring->dropped, 0,
+							memory_order_relaxed))) {
+			dlog_state.dropped += dropped;
+			snprintf(msg, sizeof(msg),
+				 "Dropped %ju diagnostic messages", (uintmax_t) dropped);
+			dlog_state.sink(dlog_state.ctx, LOG_WARNING, msg);
+		}
+
+		if (orphaned) {
+			LIST_REMOVE(ring, entries);
+			free(ring);
+		}
+	}
+}
+
+/*
+ * drain thread buffers periodically, or early when an error was logged
+ */
+void *
+dlog_thread(void *arg)
+{
+	struct timespec deadline = {0};
+
+	pthread_mutex_lock(&dlog_state.mtx);
+
+	while (!dlog_state.stopping) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += DLOG_DRAIN_MS * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&dlog_state.cond, &dlog_state.mtx, &deadline);
+		dlog_drain();
+	}
+
+	pthread_mutex_unlock(&dlog_state.mtx);
+
+	return NULL;
+}
+
+/*
+ * start buffering messages and draining them from a separate thread;
+ * until then, and after dlog_stop, messages are delivered right away
+ *
+ * returns 0 on success, -1 and errno on error.
+ */
+int
+dlog_start(void)
+{
+	int result = 0;
+
+	pthread_mutex_lock(&dlog_state.mtx);
+
+	if (!atomic_load(&dlog_state.running)) {
+		dlog_state.stopping = false;
+		if ((result = pthread_create(&dlog_state.thread, NULL, dlog_thread,
+					     NULL))) {
+			pthread_mutex_unlock(&dlog_state.mtx);
+			errno = result;
+			return -1;
+		}
+		atomic_store(&dlog_state.running, true);
+	}
+
+	pthread_mutex_unlock(&dlog_state.mtx);
+
+	return 0;
+}
+
+/*
+ * stop the drain thread, delivering all buffered messages
+ *
+ * meant to be called once the other threads are gone; a message
+ * written while stopping may stay buffered until the next dlog_start.
+ */
+void
+dlog_stop(void)
+{
+	pthread_mutex_lock(&dlog_state.mtx);
+
+	if (!atomic_load(&dlog_state.running)) {
+		pthread_mutex_unlock(&dlog_state.mtx);
+		return;
+	}
+
+	atomic_store(&dlog_state.running, false);
+	dlog_state.stopping = true;
+	pthread_cond_signal(&dlog_state.cond);
+
+	pthread_mutex_unlock(&dlog_state.mtx);
+
+	pthread_join(dlog_state.thread, NULL);
+
+	pthread_mutex_lock(&dlog_state.mtx);
+	dlog_drain();
+	pthread_mutex_unlock(&dlog_state.mtx);
+}
+
+/*
+ * get the message counters
+ */
+void
+dlog_getstats(struct dlog_stats *stats)
+{
+	struct dlog_ring *ring = NULL;
+
+	if (!stats)
+		return;
+
+	pthread_mutex_lock(&dlog_state.mtx);
+
+	stats->written = dlog_state.written;
+	stats->dropped = dlog_state.dropped;
+	/* losses not reported yet */
+	LIST_FOREACH(ring, &dlog_state.rings, entries)
+		stats->dropped += atomic_load_explicit(&ring->dropped,
+						       memory_order_relaxed);
+
+	pthread_mutex_unlock(&dlog_state.mtx);
+}
+
+/*
+ * format a message into the buffer of the calling thread
+ *
+ * a full buffer drops the message rather than waiting for the drain
+ * thread.
+ */
+void
+dlog_vwrite(int level, const char *fmt, va_list ap)
+{
+	struct dlog_ring *ring = NULL;
+	struct dlog_record *rec = NULL;
+	uint32_t head = 0;
+	char msg[DLOG_MSG_MAX] = {0};
+
+	if (!atomic_load_explicit(&dlog_state.running, memory_order_acquire) ||
+	    !(ring = dlog_getring())) {
+		/* not buffering, deliver right away */
+		vsnprintf(msg, sizeof(msg), fmt, ap);
+		pthread_mutex_lock(&dlog_state.mtx);
+		dlog_state.sink(dlog_state.ctx, level, msg);
+		dlog_state.written++;
+		pthread_mutex_unlock(&dlog_state.mtx);
+		return;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >=
+	    DLOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	rec = &ring->records[head & (DLOG_RING_SIZE - 1)];
+	rec->level = level;
+	vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	/* errors should not wait for the next drain */
+	if (level <= LOG_ERR)
+		pthread_cond_signal(&dlog_state.cond);
+}
+
+/*
+ * log a message; see the dlog macro for level filtering
+ */
+void
+dlog_write(int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	dlog_vwrite(level, fmt, ap);
+	va_end(ap);
+}
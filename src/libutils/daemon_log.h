@@ -0,0 +1,88 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __DAEMON_LOG_H__
+#define __DAEMON_LOG_H__
+
+#include <sys/cdefs.h>
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <syslog.h>
+
+/*
+ * messages less important than this level are compiled out; builds may
+ * lower it with -DDLOG_COMPILE_LEVEL=LOG_INFO
+ */
+#ifndef DLOG_COMPILE_LEVEL
+#define DLOG_COMPILE_LEVEL	LOG_DEBUG
+#endif
+
+/* longest message kept, including the zero byte */
+#define DLOG_MSG_MAX		240
+/* messages buffered per thread, power of two */
+#define DLOG_RING_SIZE		128
+/* milliseconds between drains of the thread buffers */
+#define DLOG_DRAIN_MS		100
+
+/* least important level currently logged */
+extern _Atomic int dlog_level;
+
+/*
+ * log a diagnostic message at a syslog level
+ *
+ * the level check happens before any arguments are evaluated, so
+ * filtered messages cost a compare. Messages are formatted with
+ * vsnprintf, so %m is not available.
+ */
+#define dlog(level, ...) do { \
+	if (((level) <= DLOG_COMPILE_LEVEL) && \
+	    ((level) <= atomic_load_explicit(&dlog_level, memory_order_relaxed))) \
+		dlog_write((level), __VA_ARGS__); \
+} while (0)
+
+/*
+ * message counters
+ */
+struct dlog_stats {
+	/* messages handed to the sink */
+	uint64_t written;
+	/* messages lost because a thread buffer was full */
+	uint64_t dropped;
+};
+
+int dlog_verbositylevel(int verbosity);
+void dlog_setlevel(int level);
+int dlog_start(void);
+void dlog_stop(void);
+void dlog_set_sink(void (*sink)(void *ctx, int level, const char *msg), void *ctx);
+void dlog_getstats(struct dlog_stats *stats);
+void dlog_write(int level, const char *fmt, ...) __printflike(2, 3);
+void dlog_vwrite(int level, const char *fmt, va_list ap);
+
+#endif /* __DAEMON_LOG_H__ */
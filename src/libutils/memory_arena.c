@@ -0,0 +1,254 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "memory_arena.h"
+
+/* every allocation is aligned for any type */
+#define MA_ALIGN sizeof(max_align_t)
+#define MA_ROUNDUP(size) (((size) + MA_ALIGN - 1) & ~(MA_ALIGN - 1))
+
+/*
+ * a block of memory allocations are carved from
+ */
+struct memory_arena_chunk {
+	struct memory_arena_chunk *next;
+	/* bytes available in data */
+	size_t size;
+	/* bytes handed out from data */
+	size_t used;
+	max_align_t data[];
+};
+
+struct memory_arena {
+	/* chunk currently allocated from first */
+	struct memory_arena_chunk *chunks;
+	/* bytes available in a regular chunk */
+	size_t chunksize;
+	size_t allocations;
+	size_t requested;
+	size_t nchunks;
+	size_t bytes;
+};
+
+/* the first chunk is allocated along with the arena */
+#define MA_FIRSTCHUNK(ma) \
+	((struct memory_arena_chunk *)((char *)(ma) + \
+	    MA_ROUNDUP(sizeof(struct memory_arena))))
+
+/*
+ * construct a new arena handing out memory from chunks with room for
+ * chunksize bytes each; 0 selects MA_CHUNK_SIZE
+ */
+struct memory_arena *
+ma_new(size_t chunksize)
+{
+	struct memory_arena *ma = NULL;
+	size_t bytes = 0;
+
+	chunksize = MA_ROUNDUP(chunksize ? chunksize : MA_CHUNK_SIZE);
+	bytes = MA_ROUNDUP(sizeof(struct memory_arena)) +
+		sizeof(struct memory_arena_chunk) + chunksize;
+
+	if (!(ma = malloc(bytes)))
+		return NULL;
+
+	ma->chunks = MA_FIRSTCHUNK(ma);
+	ma->chunks->next = NULL;
+	ma->chunks->size = chunksize;
+	ma->chunks->used = 0;
+	ma->chunksize = chunksize;
+	ma->allocations = 0;
+	ma->requested = 0;
+	ma->nchunks = 1;
+	ma->bytes = bytes;
+
+	return ma;
+}
+
+/*
+ * release an arena and everything allocated from it
+ */
+void
+ma_free(struct memory_arena *ma)
+{
+	struct memory_arena_chunk *mac = NULL;
+
+	if (!ma)
+		return;
+
+	while ((mac = ma->chunks)) {
+		ma->chunks = mac->next;
+		if (mac != MA_FIRSTCHUNK(ma))
+			free(mac);
+	}
+
+	free(ma);
+}
+
+/*
+ * add a chunk with room for size bytes; a chunk for a single large
+ * allocation goes behind the current one, which keeps serving small
+ * allocations
+ *
+ * returns NULL on error.
+ */
+struct memory_arena_chunk *
+ma_addchunk(struct memory_arena *ma, size_t size)
+{
+	struct memory_arena_chunk *mac = NULL;
+
+	if (!(mac = malloc(sizeof(struct memory_arena_chunk) + size)))
+		return NULL;
+
+	mac->size = size;
+	mac->used = 0;
+
+	if (size > ma->chunksize) {
+		mac->next = ma->chunks->next;
+		ma->chunks->next = mac;
+	} else {
+		mac->next = ma->chunks;
+		ma->chunks = mac;
+	}
+
+	ma->nchunks++;
+	ma->bytes += sizeof(struct memory_arena_chunk) + size;
+
+	return mac;
+}
+
+/*
+ * allocate size bytes of zeroed memory from an arena; it stays valid
+ * until the arena is released
+ *
+ * returns NULL on error.
+ */
+void *
+ma_alloc(struct memory_arena *ma, size_t size)
+{
+	struct memory_arena_chunk *mac = NULL;
+	size_t rounded = 0;
+	void *ptr = NULL;
+
+	if (!ma) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (size > SIZE_MAX - MA_ALIGN - sizeof(struct memory_arena_chunk)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	rounded = MA_ROUNDUP(size ? size : 1);
+	mac = ma->chunks;
+
+	if (mac->size - mac->used < rounded &&
+	    !(mac = ma_addchunk(ma, rounded > ma->chunksize ?
+				rounded : ma->chunksize)))
+		return NULL;
+
+	ptr = (char *) mac->data + mac->used;
+	mac->used += rounded;
+	ma->allocations++;
+	ma->requested += size;
+
+	bzero(ptr, rounded);
+
+	return ptr;
+}
+
+/*
+ * copy a string into an arena
+ *
+ * returns NULL on error.
+ */
+char *
+ma_strdup(struct memory_arena *ma, const char *str)
+{
+	char *copy = NULL;
+	size_t len = 0;
+
+	if (!str) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	len = strlen(str);
+	if (!(copy = ma_alloc(ma, len + 1)))
+		return NULL;
+
+	memcpy(copy, str, len);
+
+	return copy;
+}
+
+/*
+ * check whether ptr was allocated from an arena
+ */
+bool
+ma_owns(const struct memory_arena *ma, const void *ptr)
+{
+	const struct memory_arena_chunk *mac = NULL;
+
+	if (!ma || !ptr)
+		return false;
+
+	for (mac = ma->chunks; mac; mac = mac->next)
+		if ((const char *) ptr >= (const char *) mac->data &&
+		    (const char *) ptr < (const char *) mac->data + mac->used)
+			return true;
+
+	return false;
+}
+
+/*
+ * get allocation statistics of an arena
+ */
+void
+ma_get_usage(const struct memory_arena *ma, struct memory_arena_usage *usage)
+{
+	if (!usage)
+		return;
+
+	bzero(usage, sizeof(struct memory_arena_usage));
+
+	if (!ma)
+		return;
+
+	usage->allocations = ma->allocations;
+	usage->requested = ma->requested;
+	usage->chunks = ma->nchunks;
+	usage->bytes = ma->bytes;
+}
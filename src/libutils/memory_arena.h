@@ -0,0 +1,66 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __MEMORY_ARENA_H__
+#define __MEMORY_ARENA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* chunk size of an arena constructed with a chunk size of 0 */
+#define MA_CHUNK_SIZE 4096
+
+/*
+ * hands out memory for objects sharing one lifetime from a few large
+ * chunks; nothing is released individually, ma_free releases all of it
+ * in one call.
+ */
+struct memory_arena;
+
+/*
+ * allocation statistics of an arena
+ */
+struct memory_arena_usage {
+	/* number of allocations handed out */
+	size_t allocations;
+	/* bytes requested by those allocations */
+	size_t requested;
+	/* number of chunks */
+	size_t chunks;
+	/* bytes allocated by the arena including its chunks */
+	size_t bytes;
+};
+
+struct memory_arena *ma_new(size_t chunksize);
+void ma_free(struct memory_arena *ma);
+void *ma_alloc(struct memory_arena *ma, size_t size);
+char *ma_strdup(struct memory_arena *ma, const char *str);
+bool ma_owns(const struct memory_arena *ma, const void *ptr);
+void ma_get_usage(const struct memory_arena *ma,
+		  struct memory_arena_usage *usage);
+
+#endif /* __MEMORY_ARENA_H__ */
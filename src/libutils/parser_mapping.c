@@ -0,0 +1,165 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "parser_mapping.h"
+
+/* serializes building the indexes of all mapping tables */
+pthread_mutex_t pmi_buildmtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * seeded FNV-1a hash of a variable name
+ */
+uint32_t
+pmi_hash(const char *varname, uint32_t seed)
+{
+	uint32_t hash = 2166136261u ^ seed;
+
+	while (*varname) {
+		hash ^= (unsigned char) *varname++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+ * attempt to place every mapping into its own slot
+ *
+ * returns 0 if seed and mask make a perfect hash.
+ */
+int
+pmi_place(struct parser_mapping_index *pmi, uint32_t seed, uint32_t mask)
+{
+	uint32_t slot = 0;
+	size_t counter = 0;
+
+	memset(pmi->slots, 0, sizeof(pmi->slots));
+
+	for (counter = 0; counter < pmi->count; counter++) {
+		slot = pmi_hash(pmi->mappings[counter].varname, seed) & mask;
+		if (pmi->slots[slot])
+			return -1;
+		pmi->slots[slot] = counter + 1;
+	}
+
+	pmi->seed = seed;
+	pmi->mask = mask;
+
+	return 0;
+}
+
+/*
+ * search seed and table size for a perfect hash over the mappings;
+ * tables too large or with duplicate names are searched linearly
+ */
+void
+pmi_build(struct parser_mapping_index *pmi)
+{
+	uint32_t size = 1, seed = 0;
+
+	pthread_mutex_lock(&pmi_buildmtx);
+
+	if (atomic_load_explicit(&pmi->ready, memory_order_relaxed)) {
+		pthread_mutex_unlock(&pmi_buildmtx);
+		return;
+	}
+
+	pmi->linear = true;
+
+	/* start with a load factor of at most one half */
+	while (size < 2 * pmi->count)
+		size <<= 1;
+
+	for (; pmi->linear && (size <= PMI_SLOTS_MAX); size <<= 1)
+		for (seed = 0; seed < PMI_SEED_TRIES; seed++)
+			if (!pmi_place(pmi, seed, size - 1)) {
+				pmi->linear = false;
+				break;
+			}
+
+	atomic_store_explicit(&pmi->ready, true, memory_order_release);
+
+	pthread_mutex_unlock(&pmi_buildmtx);
+}
+
+/*
+ * look up the mapping of a variable name
+ *
+ * returns NULL if nothing matches.
+ */
+struct parser_mapping *
+pmi_lookup(struct parser_mapping_index *pmi, const char *varname)
+{
+	struct parser_mapping *mapping = NULL;
+	size_t counter = 0;
+	uint8_t slot = 0;
+
+	if (!pmi || !varname) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!atomic_load_explicit(&pmi->ready, memory_order_acquire))
+		pmi_build(pmi);
+
+	if (pmi->linear) {
+		for (counter = 0; counter < pmi->count; counter++)
+			if (!strcmp(pmi->mappings[counter].varname, varname))
+				return &pmi->mappings[counter];
+		return NULL;
+	}
+
+	if (!(slot = pmi->slots[pmi_hash(varname, pmi->seed) & pmi->mask]))
+		return NULL;
+
+	mapping = &pmi->mappings[slot - 1];
+
+	return strcmp(mapping->varname, varname) ? NULL : mapping;
+}
+
+/*
+ * get number of mappings
+ */
+size_t
+pmi_get_count(const struct parser_mapping_index *pmi)
+{
+	return pmi ? pmi->count : 0;
+}
+
+/*
+ * get the mapping array
+ */
+struct parser_mapping *
+pmi_get_mappings(const struct parser_mapping_index *pmi)
+{
+	return pmi ? pmi->mappings : NULL;
+}
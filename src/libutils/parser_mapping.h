@@ -28,6 +28,16 @@
 #ifndef __PARSER_MAPPING_H__
 #define __PARSER_MAPPING_H__
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* most slots of a parser_mapping_index, a power of two */
+#define PMI_SLOTS_MAX 256
+/* seeds tried per table size while building a parser_mapping_index */
+#define PMI_SEED_TRIES 4096
+
 struct parser_mapping {
 	size_t offset;
 	enum {
@@ -42,4 +52,33 @@ struct parser_mapping {
 	const char *varname;
 };
 
+/*
+ * finds the mapping of a variable name with one hash and one string
+ * compare; the perfect hash is built on first use
+ */
+struct parser_mapping_index {
+	struct parser_mapping *mappings;
+	size_t count;
+
+	/* set once seed, mask and slots are valid */
+	_Atomic bool ready;
+	/* no perfect hash found, compare against every mapping */
+	bool linear;
+	uint32_t seed;
+	uint32_t mask;
+	/* index of the mapping plus one, 0 for an empty slot */
+	uint8_t slots[PMI_SLOTS_MAX];
+};
+
+/* static initializer for the index of a mapping array */
+#define PARSER_MAPPING_INDEX(v) { \
+		.mappings = v, \
+		.count = sizeof(v) / sizeof(struct parser_mapping) \
+	}
+
+struct parser_mapping *pmi_lookup(struct parser_mapping_index *pmi,
+				  const char *varname);
+size_t pmi_get_count(const struct parser_mapping_index *pmi);
+struct parser_mapping *pmi_get_mappings(const struct parser_mapping_index *pmi);
+
 #endif /* __PARSER_MAPPING_H__ */
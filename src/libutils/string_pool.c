@@ -0,0 +1,269 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string_pool.h"
+
+/* space taken by a string of len bytes including its length and NUL */
+#define SPL_ENTRY_SIZE(len) \
+	((sizeof(uint32_t) + (len) + 1 + sizeof(uint32_t) - 1) & \
+	 ~(sizeof(uint32_t) - 1))
+
+/*
+ * a block of memory holding strings one after another
+ */
+struct string_pool_chunk {
+	struct string_pool_chunk *next;
+	/* bytes available in data */
+	size_t size;
+	/* bytes taken by strings */
+	size_t used;
+	uint32_t data[];
+};
+
+struct string_pool {
+	/* arena providing the memory, NULL to use malloc */
+	struct memory_arena *arena;
+	/* most recently allocated chunk first */
+	struct string_pool_chunk *chunks;
+	/* number of strings stored */
+	size_t count;
+	/* bytes allocated by the pool including its chunks */
+	size_t bytes;
+};
+
+/*
+ * construct a new, empty string pool; with an arena given the pool and
+ * its chunks are allocated from ma
+ */
+struct string_pool *
+spl_new(struct memory_arena *ma)
+{
+	struct string_pool *spl = NULL;
+
+	if (ma)
+		spl = ma_alloc(ma, sizeof(struct string_pool));
+	else
+		spl = malloc(sizeof(struct string_pool));
+
+	if (!spl)
+		return NULL;
+
+	spl->arena = ma;
+	spl->chunks = NULL;
+	spl->count = 0;
+	spl->bytes = sizeof(struct string_pool);
+
+	return spl;
+}
+
+/*
+ * release a string pool and all strings stored in it; a pool on an
+ * arena is released with the arena
+ */
+void
+spl_free(struct string_pool *spl)
+{
+	struct string_pool_chunk *spc = NULL;
+
+	if (!spl || spl->arena)
+		return;
+
+	while ((spc = spl->chunks)) {
+		spl->chunks = spc->next;
+		free(spc);
+	}
+
+	free(spl);
+}
+
+/*
+ * add a chunk with room for at least size bytes of entries
+ *
+ * returns 0 on success.
+ */
+int
+spl_addchunk(struct string_pool *spl, size_t size)
+{
+	struct string_pool_chunk *spc = NULL;
+
+	if (spl->arena)
+		spc = ma_alloc(spl->arena,
+			       sizeof(struct string_pool_chunk) + size);
+	else
+		spc = malloc(sizeof(struct string_pool_chunk) + size);
+
+	if (!spc)
+		return -1;
+
+	spc->size = size;
+	spc->used = 0;
+	spc->next = spl->chunks;
+	spl->chunks = spc;
+	spl->bytes += sizeof(struct string_pool_chunk) + size;
+
+	return 0;
+}
+
+/*
+ * make room for count strings of length bytes in total, so they are
+ * stored in one chunk without wasting space
+ *
+ * returns 0 on success.
+ */
+int
+spl_reserve(struct string_pool *spl, size_t count, size_t length)
+{
+	size_t size = 0;
+
+	if (!spl) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size = length + count * SPL_ENTRY_SIZE(0);
+	if (spl->chunks && spl->chunks->size - spl->chunks->used >= size)
+		return 0;
+
+	return spl_addchunk(spl, size);
+}
+
+/*
+ * look for a string of len bytes in the pool
+ *
+ * returns NULL if the string is not stored yet.
+ */
+const char *
+spl_find(const struct string_pool *spl, const char *str, uint32_t len)
+{
+	const struct string_pool_chunk *spc = NULL;
+	const char *entry = NULL;
+	size_t offset = 0;
+
+	for (spc = spl->chunks; spc; spc = spc->next) {
+		offset = 0;
+		while (offset < spc->used) {
+			entry = (const char *) spc->data + offset;
+			if (*(const uint32_t *) entry == len &&
+			    !memcmp(entry + sizeof(uint32_t), str, len))
+				return entry + sizeof(uint32_t);
+			offset += SPL_ENTRY_SIZE(*(const uint32_t *) entry);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * store a string in the pool unless an equal one is stored already
+ *
+ * returns the stored copy, valid until the pool is released, or NULL
+ * on error.
+ */
+const char *
+spl_intern(struct string_pool *spl, const char *str)
+{
+	struct string_pool_chunk *spc = NULL;
+	const char *interned = NULL;
+	size_t len = 0, entrysize = 0;
+	char *entry = NULL;
+
+	if (!spl || !str) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((len = strlen(str)) > UINT32_MAX - 2 * sizeof(uint32_t)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	if ((interned = spl_find(spl, str, len)))
+		return interned;
+
+	entrysize = SPL_ENTRY_SIZE(len);
+
+	if (!spl->chunks || spl->chunks->size - spl->chunks->used < entrysize)
+		if (spl_addchunk(spl, entrysize > SPL_CHUNK_SIZE ?
+				 entrysize : SPL_CHUNK_SIZE))
+			return NULL;
+
+	spc = spl->chunks;
+	entry = (char *) spc->data + spc->used;
+	*(uint32_t *) entry = len;
+	memcpy(entry + sizeof(uint32_t), str, len + 1);
+	spc->used += entrysize;
+	spl->count++;
+
+	return entry + sizeof(uint32_t);
+}
+
+/*
+ * check whether a string is stored in the pool
+ */
+bool
+spl_owns(const struct string_pool *spl, const char *str)
+{
+	const struct string_pool_chunk *spc = NULL;
+
+	if (!spl || !str)
+		return false;
+
+	for (spc = spl->chunks; spc; spc = spc->next)
+		if (str >= (const char *) spc->data &&
+		    str < (const char *) spc->data + spc->used)
+			return true;
+
+	return false;
+}
+
+/*
+ * get the length of a string stored in a pool without scanning it
+ */
+size_t
+spl_length(const char *str)
+{
+	if (!str)
+		return 0;
+
+	return *(const uint32_t *)(str - sizeof(uint32_t));
+}
+
+/*
+ * get number of strings and bytes allocated by the pool
+ */
+void
+spl_get_usage(const struct string_pool *spl, size_t *count, size_t *bytes)
+{
+	if (count)
+		*count = spl ? spl->count : 0;
+	if (bytes)
+		*bytes = spl ? spl->bytes : 0;
+}
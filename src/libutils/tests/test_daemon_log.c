@@ -0,0 +1,241 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atf-c.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../daemon_log.h"
+
+#define TC_DLOG_THREADS	4
+#define TC_DLOG_MESSAGES	1000
+
+/*
+ * collects messages delivered by the diagnostic log
+ */
+struct tc_dlog_sink {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	size_t count;
+	char last[DLOG_MSG_MAX];
+	/* last report of lost messages */
+	char lost[DLOG_MSG_MAX];
+	/* next sequence number expected per thread */
+	int next[TC_DLOG_THREADS];
+	bool outoforder;
+	/* block delivery until released */
+	bool hold;
+	bool holding;
+};
+
+void
+tc_dlog_collect(void *ctx, int level, const char *msg)
+{
+	struct tc_dlog_sink *sink = ctx;
+	int thread = 0, seq = 0;
+
+	pthread_mutex_lock(&sink->mtx);
+
+	sink->count++;
+	strlcpy(sink->last, msg, sizeof(sink->last));
+	if (!strncmp(msg, "Dropped", 7))
+		strlcpy(sink->lost, msg, sizeof(sink->lost));
+
+	if ((2 == sscanf(msg, "thread %d message %d", &thread, &seq)) &&
+	    (thread >= 0) && (thread < TC_DLOG_THREADS)) {
+		/* dropped messages leave gaps, but never reorder */
+		if (seq < sink->next[thread])
+			sink->outoforder = true;
+		sink->next[thread] = seq + 1;
+	}
+
+	sink->holding = sink->hold;
+	pthread_cond_broadcast(&sink->cond);
+	while (sink->hold)
+		pthread_cond_wait(&sink->cond, &sink->mtx);
+
+	pthread_mutex_unlock(&sink->mtx);
+}
+
+int
+tc_dlog_evaluated(int *counter)
+{
+	return ++*counter;
+}
+
+ATF_TC(tc_dlog_levels);
+ATF_TC_HEAD(tc_dlog_levels, tc)
+{
+}
+ATF_TC_BODY(tc_dlog_levels, tc)
+{
+	struct tc_dlog_sink sink = {
+		.mtx = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER
+	};
+	struct dlog_stats stats = {0};
+	int evaluated = 0;
+
+	ATF_REQUIRE_EQ(LOG_INFO, dlog_verbositylevel(0));
+	ATF_REQUIRE_EQ(LOG_DEBUG, dlog_verbositylevel(1));
+	ATF_REQUIRE_EQ(LOG_DEBUG, dlog_verbositylevel(5));
+
+	dlog_set_sink(tc_dlog_collect, &sink);
+	dlog_setlevel(LOG_NOTICE);
+
+	/* filtered messages do not even evaluate their arguments */
+	dlog(LOG_DEBUG, "debug %d", tc_dlog_evaluated(&evaluated));
+	dlog(LOG_INFO, "info %d", tc_dlog_evaluated(&evaluated));
+	ATF_REQUIRE_EQ(0, evaluated);
+	ATF_REQUIRE_EQ(0, sink.count);
+
+	/* without the drain thread, messages are delivered right away */
+	dlog(LOG_ERR, "error %d", tc_dlog_evaluated(&evaluated));
+	ATF_REQUIRE_EQ(1, evaluated);
+	ATF_REQUIRE_EQ(1, sink.count);
+	ATF_REQUIRE_STREQ("error 1", sink.last);
+
+	dlog_setlevel(LOG_DEBUG);
+	dlog(LOG_DEBUG, "debug %d", tc_dlog_evaluated(&evaluated));
+	ATF_REQUIRE_EQ(2, sink.count);
+	ATF_REQUIRE_STREQ("debug 2", sink.last);
+
+	dlog_getstats(&stats);
+	ATF_REQUIRE_EQ(2, stats.written);
+	ATF_REQUIRE_EQ(0, stats.dropped);
+
+	dlog_set_sink(NULL, NULL);
+}
+
+void *
+tc_dlog_writer(void *arg)
+{
+	int thread = (int) (intptr_t) arg, seq = 0;
+
+	for (seq = 0; seq < TC_DLOG_MESSAGES; seq++)
+		dlog(LOG_INFO, "thread %d message %d", thread, seq);
+
+	return NULL;
+}
+
+ATF_TC(tc_dlog_threads);
+ATF_TC_HEAD(tc_dlog_threads, tc)
+{
+}
+ATF_TC_BODY(tc_dlog_threads, tc)
+{
+	struct tc_dlog_sink sink = {
+		.mtx = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER
+	};
+	struct dlog_stats stats = {0};
+	pthread_t threads[TC_DLOG_THREADS];
+	intptr_t idx = 0;
+
+	dlog_set_sink(tc_dlog_collect, &sink);
+	dlog_setlevel(LOG_INFO);
+	ATF_REQUIRE_EQ(0, dlog_start());
+
+	for (idx = 0; idx < TC_DLOG_THREADS; idx++)
+		ATF_REQUIRE_EQ(0, pthread_create(&threads[idx], NULL, tc_dlog_writer,
+						 (void *) idx));
+	for (idx = 0; idx < TC_DLOG_THREADS; idx++)
+		pthread_join(threads[idx], NULL);
+
+	/* stopping delivers whatever is still buffered */
+	dlog_stop();
+
+	dlog_getstats(&stats);
+	ATF_REQUIRE_EQ(TC_DLOG_THREADS * TC_DLOG_MESSAGES,
+		       stats.written + stats.dropped);
+	ATF_REQUIRE(stats.written > 0);
+	ATF_REQUIRE(!sink.outoforder);
+
+	dlog_set_sink(NULL, NULL);
+}
+
+ATF_TC(tc_dlog_overflow);
+ATF_TC_HEAD(tc_dlog_overflow, tc)
+{
+}
+ATF_TC_BODY(tc_dlog_overflow, tc)
+{
+	struct tc_dlog_sink sink = {
+		.mtx = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.hold = true
+	};
+	struct dlog_stats stats = {0};
+	char expect[DLOG_MSG_MAX] = {0};
+	int seq = 0;
+
+	dlog_set_sink(tc_dlog_collect, &sink);
+	dlog_setlevel(LOG_INFO);
+	ATF_REQUIRE_EQ(0, dlog_start());
+
+	/* an error wakes the drain thread, which then blocks in the sink */
+	dlog(LOG_ERR, "blocking");
+	pthread_mutex_lock(&sink.mtx);
+	while (!sink.holding)
+		pthread_cond_wait(&sink.cond, &sink.mtx);
+	pthread_mutex_unlock(&sink.mtx);
+
+	/* the record being delivered still takes up its slot */
+	for (seq = 0; seq < TC_DLOG_MESSAGES; seq++)
+		dlog(LOG_INFO, "thread 0 message %d", seq);
+
+	pthread_mutex_lock(&sink.mtx);
+	sink.hold = false;
+	pthread_cond_broadcast(&sink.cond);
+	pthread_mutex_unlock(&sink.mtx);
+
+	dlog_stop();
+
+	dlog_getstats(&stats);
+	ATF_REQUIRE_EQ(DLOG_RING_SIZE, stats.written);
+	ATF_REQUIRE_EQ(TC_DLOG_MESSAGES - (DLOG_RING_SIZE - 1), stats.dropped);
+	/* the oldest messages are kept, the losses reported */
+	ATF_REQUIRE(!sink.outoforder);
+	ATF_REQUIRE_EQ(DLOG_RING_SIZE - 1, sink.next[0]);
+	snprintf(expect, sizeof(expect), "Dropped %d diagnostic messages",
+		 TC_DLOG_MESSAGES - (DLOG_RING_SIZE - 1));
+	ATF_REQUIRE_STREQ(expect, sink.lost);
+
+	dlog_set_sink(NULL, NULL);
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_dlog_levels);
+	ATF_TP_ADD_TC(testplan, tc_dlog_threads);
+	ATF_TP_ADD_TC(testplan, tc_dlog_overflow);
+
+	return atf_no_error();
+}
@@ -0,0 +1,167 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atf-c.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../memory_arena.h"
+
+#define TC_MA_CONFIGS	100000
+/* objects allocated for a parsed configuration */
+#define TC_MA_OBJECTS	16
+
+ATF_TC(tc_ma_alloc);
+ATF_TC_HEAD(tc_ma_alloc, tc)
+{
+}
+ATF_TC_BODY(tc_ma_alloc, tc)
+{
+	struct memory_arena *ma = NULL;
+	struct memory_arena_usage usage = {0};
+	char *first = NULL, *second = NULL, *copy = NULL;
+	size_t counter = 0;
+
+	ATF_REQUIRE(0 != (ma = ma_new(0)));
+
+	ATF_REQUIRE(0 != (first = ma_alloc(ma, 3)));
+	ATF_REQUIRE(0 != (second = ma_alloc(ma, 24)));
+	ATF_REQUIRE(first != second);
+
+	/* memory is zeroed and aligned for any type */
+	for (counter = 0; counter < 24; counter++)
+		ATF_REQUIRE_EQ(0, second[counter]);
+	ATF_REQUIRE_EQ(0, (uintptr_t) first % sizeof(max_align_t));
+	ATF_REQUIRE_EQ(0, (uintptr_t) second % sizeof(max_align_t));
+
+	ATF_REQUIRE(0 != (copy = ma_strdup(ma, "/vms/vm00000/config")));
+	ATF_REQUIRE_STREQ("/vms/vm00000/config", copy);
+	ATF_REQUIRE(ma_owns(ma, copy));
+	ATF_REQUIRE(!ma_owns(ma, "/vms/vm00000/config"));
+
+	ma_get_usage(ma, &usage);
+	ATF_REQUIRE_EQ(3, usage.allocations);
+	ATF_REQUIRE_EQ(3 + 24 + strlen(copy) + 1, usage.requested);
+	ATF_REQUIRE_EQ(1, usage.chunks);
+	ATF_REQUIRE(usage.bytes > MA_CHUNK_SIZE);
+
+	errno = 0;
+	ATF_REQUIRE_EQ(0, ma_alloc(NULL, 1));
+	ATF_REQUIRE_EQ(EINVAL, errno);
+	ATF_REQUIRE_EQ(0, ma_strdup(ma, NULL));
+
+	ma_free(ma);
+}
+
+ATF_TC(tc_ma_chunks);
+ATF_TC_HEAD(tc_ma_chunks, tc)
+{
+}
+ATF_TC_BODY(tc_ma_chunks, tc)
+{
+	struct memory_arena *ma = NULL;
+	struct memory_arena_usage usage = {0};
+	char *blocks[64] = {0};
+	char *large = NULL, *small = NULL;
+	size_t counter = 0;
+
+	ATF_REQUIRE(0 != (ma = ma_new(256)));
+
+	/* allocations spread over several chunks stay valid */
+	for (counter = 0; counter < 64; counter++) {
+		ATF_REQUIRE(0 != (blocks[counter] = ma_alloc(ma, 40)));
+		memset(blocks[counter], (int) counter, 40);
+	}
+	for (counter = 0; counter < 64; counter++)
+		ATF_REQUIRE_EQ((char) counter, blocks[counter][39]);
+
+	ma_get_usage(ma, &usage);
+	ATF_REQUIRE(usage.chunks > 1);
+
+	/* a large allocation does not retire the current chunk */
+	ATF_REQUIRE(0 != (small = ma_alloc(ma, 1)));
+	ATF_REQUIRE(0 != (large = ma_alloc(ma, 1024)));
+	ATF_REQUIRE(ma_owns(ma, large));
+	ATF_REQUIRE_EQ(small + sizeof(max_align_t), (char *) ma_alloc(ma, 1));
+
+	ma_free(ma);
+}
+
+ATF_TC(tc_ma_bench);
+ATF_TC_HEAD(tc_ma_bench, tc)
+{
+}
+ATF_TC_BODY(tc_ma_bench, tc)
+{
+	const size_t sizes[TC_MA_OBJECTS] = { 208, 32, 96, 16, 48, 8, 8, 24,
+		48, 8, 16, 64, 32, 8, 8, 40 };
+	struct memory_arena *ma = NULL;
+	struct timespec start = {0}, end = {0};
+	void *objects[TC_MA_OBJECTS] = {0};
+	double heap = 0, arena = 0;
+	size_t counter = 0, idx = 0;
+
+	/* allocate and release the objects of a configuration one by one */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (counter = 0; counter < TC_MA_CONFIGS; counter++) {
+		for (idx = 0; idx < TC_MA_OBJECTS; idx++)
+			ATF_REQUIRE(0 != (objects[idx] = calloc(1, sizes[idx])));
+		for (idx = 0; idx < TC_MA_OBJECTS; idx++)
+			free(objects[idx]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	heap = ((end.tv_sec - start.tv_sec) * 1e9 +
+		(end.tv_nsec - start.tv_nsec)) / TC_MA_CONFIGS;
+
+	/* allocate them from an arena released in one call */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (counter = 0; counter < TC_MA_CONFIGS; counter++) {
+		ATF_REQUIRE(0 != (ma = ma_new(1024)));
+		for (idx = 0; idx < TC_MA_OBJECTS; idx++)
+			ATF_REQUIRE(0 != (objects[idx] = ma_alloc(ma, sizes[idx])));
+		ma_free(ma);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	arena = ((end.tv_sec - start.tv_sec) * 1e9 +
+		 (end.tv_nsec - start.tv_nsec)) / TC_MA_CONFIGS;
+
+	printf("%d objects: heap %.1f ns, arena %.1f ns per configuration\n",
+	       TC_MA_OBJECTS, heap, arena);
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_ma_alloc);
+	ATF_TP_ADD_TC(testplan, tc_ma_chunks);
+	ATF_TP_ADD_TC(testplan, tc_ma_bench);
+
+	return atf_no_error();
+}
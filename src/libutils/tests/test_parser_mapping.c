@@ -0,0 +1,202 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atf-c.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../parser_mapping.h"
+
+#define TC_PMI_THREADS	8
+#define TC_PMI_ROUNDS	1000000
+
+/*
+ * the variable names of a vm configuration
+ */
+struct parser_mapping tc_pmi_mappings[] = {
+	{ .varname = "name" }, { .varname = "configfile" },
+	{ .varname = "scriptpath" }, { .varname = "os" },
+	{ .varname = "osversion" }, { .varname = "owner" },
+	{ .varname = "group" }, { .varname = "description" },
+	{ .varname = "maxrestart" }, { .varname = "maxrestarttime" },
+	{ .varname = "stoptimeout" }, { .varname = "scripttimeout" },
+	{ .varname = "restartdelay" }, { .varname = "priority" },
+	{ .varname = "autostart" }, { .varname = "bootrom" },
+	{ .varname = "memory" }, { .varname = "numcpus" },
+	{ .varname = "sockets" }, { .varname = "cores" },
+	{ .varname = "generate_acpi_tables" }, { .varname = "wire_memory" },
+	{ .varname = "vmexit_on_halt" }, { .varname = "hostbridge" }
+};
+
+#define TC_PMI_COUNT (sizeof(tc_pmi_mappings) / sizeof(struct parser_mapping))
+
+/*
+ * linear search as done before the index existed
+ */
+struct parser_mapping *
+tc_pmi_linear(const char *varname)
+{
+	size_t counter = 0;
+
+	for (counter = 0; counter < TC_PMI_COUNT; counter++)
+		if (!strcmp(tc_pmi_mappings[counter].varname, varname))
+			return &tc_pmi_mappings[counter];
+
+	return NULL;
+}
+
+/*
+ * look up every name of the table from another thread
+ */
+void *
+tc_pmi_lookupthread(void *ctx)
+{
+	struct parser_mapping_index *pmi = ctx;
+	size_t counter = 0;
+
+	for (counter = 0; counter < TC_PMI_COUNT; counter++)
+		if (pmi_lookup(pmi, tc_pmi_mappings[counter].varname) !=
+		    &tc_pmi_mappings[counter])
+			return pmi;
+
+	return NULL;
+}
+
+ATF_TC(tc_pmi_lookup);
+ATF_TC_HEAD(tc_pmi_lookup, tc)
+{
+}
+ATF_TC_BODY(tc_pmi_lookup, tc)
+{
+	struct parser_mapping_index pmi = PARSER_MAPPING_INDEX(tc_pmi_mappings);
+	size_t counter = 0;
+
+	for (counter = 0; counter < TC_PMI_COUNT; counter++)
+		ATF_REQUIRE_EQ(&tc_pmi_mappings[counter],
+			       pmi_lookup(&pmi, tc_pmi_mappings[counter].varname));
+
+	ATF_REQUIRE(!pmi.linear);
+	ATF_REQUIRE_EQ(TC_PMI_COUNT, pmi_get_count(&pmi));
+
+	/* names hashing into used slots still have to match */
+	ATF_REQUIRE_EQ(0, pmi_lookup(&pmi, "consoles"));
+	ATF_REQUIRE_EQ(0, pmi_lookup(&pmi, "hooks"));
+	ATF_REQUIRE_EQ(0, pmi_lookup(&pmi, ""));
+	ATF_REQUIRE_EQ(0, pmi_lookup(&pmi, "Name"));
+	ATF_REQUIRE_EQ(0, pmi_lookup(&pmi, "name "));
+
+	errno = 0;
+	ATF_REQUIRE_EQ(0, pmi_lookup(&pmi, NULL));
+	ATF_REQUIRE_EQ(EINVAL, errno);
+}
+
+ATF_TC(tc_pmi_duplicates);
+ATF_TC_HEAD(tc_pmi_duplicates, tc)
+{
+}
+ATF_TC_BODY(tc_pmi_duplicates, tc)
+{
+	struct parser_mapping duplicates[] = {
+		{ .varname = "memory", .size = 1 },
+		{ .varname = "cores" },
+		{ .varname = "memory", .size = 2 }
+	};
+	struct parser_mapping_index pmi = PARSER_MAPPING_INDEX(duplicates);
+
+	/* no perfect hash exists, the first mapping wins as before */
+	ATF_REQUIRE_EQ(&duplicates[0], pmi_lookup(&pmi, "memory"));
+	ATF_REQUIRE_EQ(&duplicates[1], pmi_lookup(&pmi, "cores"));
+	ATF_REQUIRE_EQ(0, pmi_lookup(&pmi, "numcpus"));
+	ATF_REQUIRE(pmi.linear);
+}
+
+ATF_TC(tc_pmi_threads);
+ATF_TC_HEAD(tc_pmi_threads, tc)
+{
+}
+ATF_TC_BODY(tc_pmi_threads, tc)
+{
+	struct parser_mapping_index pmi = PARSER_MAPPING_INDEX(tc_pmi_mappings);
+	pthread_t threads[TC_PMI_THREADS];
+	void *result = NULL;
+	size_t counter = 0;
+
+	/* the index is built by whichever thread comes first */
+	for (counter = 0; counter < TC_PMI_THREADS; counter++)
+		ATF_REQUIRE_EQ(0, pthread_create(&threads[counter], NULL,
+						 tc_pmi_lookupthread, &pmi));
+
+	for (counter = 0; counter < TC_PMI_THREADS; counter++) {
+		ATF_REQUIRE_EQ(0, pthread_join(threads[counter], &result));
+		ATF_REQUIRE_EQ(0, result);
+	}
+}
+
+ATF_TC(tc_pmi_bench);
+ATF_TC_HEAD(tc_pmi_bench, tc)
+{
+}
+ATF_TC_BODY(tc_pmi_bench, tc)
+{
+	struct parser_mapping_index pmi = PARSER_MAPPING_INDEX(tc_pmi_mappings);
+	struct timespec start = {0}, end = {0};
+	volatile uintptr_t sink = 0;
+	double linear = 0, hashed = 0;
+	size_t counter = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (counter = 0; counter < TC_PMI_ROUNDS; counter++)
+		sink += (uintptr_t) tc_pmi_linear(
+			tc_pmi_mappings[counter % TC_PMI_COUNT].varname);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	linear = ((end.tv_sec - start.tv_sec) * 1e9 +
+		  (end.tv_nsec - start.tv_nsec)) / TC_PMI_ROUNDS;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (counter = 0; counter < TC_PMI_ROUNDS; counter++)
+		sink += (uintptr_t) pmi_lookup(&pmi,
+			tc_pmi_mappings[counter % TC_PMI_COUNT].varname);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	hashed = ((end.tv_sec - start.tv_sec) * 1e9 +
+		  (end.tv_nsec - start.tv_nsec)) / TC_PMI_ROUNDS;
+
+	printf("%zu names: linear %.1f ns, hashed %.1f ns per lookup "
+	       "(%u slots)\n", TC_PMI_COUNT, linear, hashed, pmi.mask + 1);
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_pmi_lookup);
+	ATF_TP_ADD_TC(testplan, tc_pmi_duplicates);
+	ATF_TP_ADD_TC(testplan, tc_pmi_threads);
+	ATF_TP_ADD_TC(testplan, tc_pmi_bench);
+
+	return atf_no_error();
+}
@@ -0,0 +1,183 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atf-c.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../string_pool.h"
+
+ATF_TC(tc_spl_intern);
+ATF_TC_HEAD(tc_spl_intern, tc)
+{
+}
+ATF_TC_BODY(tc_spl_intern, tc)
+{
+	struct string_pool *spl = NULL;
+	const char *root = NULL, *wheel = NULL;
+	char buffer[16] = {0};
+	size_t count = 0, bytes = 0;
+
+	ATF_REQUIRE(0 != (spl = spl_new(NULL)));
+
+	ATF_REQUIRE(0 != (root = spl_intern(spl, "root")));
+	ATF_REQUIRE(0 != (wheel = spl_intern(spl, "wheel")));
+	ATF_REQUIRE_STREQ("root", root);
+	ATF_REQUIRE_STREQ("wheel", wheel);
+	ATF_REQUIRE_EQ(4, spl_length(root));
+	ATF_REQUIRE_EQ(5, spl_length(wheel));
+
+	/* equal strings share their storage */
+	strlcpy(buffer, "root", sizeof(buffer));
+	ATF_REQUIRE_EQ(root, spl_intern(spl, buffer));
+	ATF_REQUIRE(spl_owns(spl, root));
+	ATF_REQUIRE(!spl_owns(spl, buffer));
+
+	/* a prefix is a different string */
+	ATF_REQUIRE(root != spl_intern(spl, "roo"));
+	ATF_REQUIRE_EQ(0, spl_length(spl_intern(spl, "")));
+
+	spl_get_usage(spl, &count, &bytes);
+	ATF_REQUIRE_EQ(4, count);
+	ATF_REQUIRE(bytes > 0);
+
+	errno = 0;
+	ATF_REQUIRE_EQ(0, spl_intern(spl, NULL));
+	ATF_REQUIRE_EQ(EINVAL, errno);
+
+	spl_free(spl);
+}
+
+ATF_TC(tc_spl_chunks);
+ATF_TC_HEAD(tc_spl_chunks, tc)
+{
+}
+ATF_TC_BODY(tc_spl_chunks, tc)
+{
+	struct string_pool *spl = NULL;
+	const char *strings[256] = {0};
+	char buffer[SPL_CHUNK_SIZE * 4] = {0};
+	size_t counter = 0, count = 0, bytes = 0;
+
+	ATF_REQUIRE(0 != (spl = spl_new(NULL)));
+
+	/* strings spread over several chunks stay valid */
+	for (counter = 0; counter < 256; counter++) {
+		snprintf(buffer, sizeof(buffer), "/vms/vm%zu/config", counter);
+		ATF_REQUIRE(0 != (strings[counter] = spl_intern(spl, buffer)));
+	}
+
+	/* a string larger than a chunk gets a chunk of its own */
+	memset(buffer, 'x', sizeof(buffer) - 1);
+	ATF_REQUIRE(0 != spl_intern(spl, buffer));
+	ATF_REQUIRE_EQ(sizeof(buffer) - 1, spl_length(spl_intern(spl, buffer)));
+
+	for (counter = 0; counter < 256; counter++) {
+		snprintf(buffer, sizeof(buffer), "/vms/vm%zu/config", counter);
+		ATF_REQUIRE_STREQ(buffer, strings[counter]);
+		ATF_REQUIRE_EQ(strings[counter], spl_intern(spl, buffer));
+		ATF_REQUIRE_EQ(strlen(buffer), spl_length(strings[counter]));
+	}
+
+	spl_get_usage(spl, &count, &bytes);
+	ATF_REQUIRE_EQ(257, count);
+
+	spl_free(spl);
+}
+
+ATF_TC(tc_spl_reserve);
+ATF_TC_HEAD(tc_spl_reserve, tc)
+{
+}
+ATF_TC_BODY(tc_spl_reserve, tc)
+{
+	const char *values[] = { "vm00000", "vm.conf", "root", "wheel",
+		"/vms/vm00000/config" };
+	struct string_pool *spl = NULL;
+	size_t counter = 0, length = 0, bytes = 0, reserved = 0;
+
+	ATF_REQUIRE(0 != (spl = spl_new(NULL)));
+
+	for (counter = 0; counter < 5; counter++)
+		length += strlen(values[counter]);
+
+	ATF_REQUIRE_EQ(0, spl_reserve(spl, 5, length));
+	spl_get_usage(spl, NULL, &reserved);
+
+	/* everything fits into the reserved chunk */
+	for (counter = 0; counter < 5; counter++)
+		ATF_REQUIRE(0 != spl_intern(spl, values[counter]));
+	spl_get_usage(spl, NULL, &bytes);
+	ATF_REQUIRE_EQ(reserved, bytes);
+
+	spl_free(spl);
+}
+
+ATF_TC(tc_spl_arena);
+ATF_TC_HEAD(tc_spl_arena, tc)
+{
+}
+ATF_TC_BODY(tc_spl_arena, tc)
+{
+	struct memory_arena *ma = NULL;
+	struct memory_arena_usage usage = {0};
+	struct string_pool *spl = NULL;
+	const char *root = NULL, *large = NULL;
+	char buffer[SPL_CHUNK_SIZE * 4] = {0};
+
+	ATF_REQUIRE(0 != (ma = ma_new(0)));
+	ATF_REQUIRE(0 != (spl = spl_new(ma)));
+
+	ATF_REQUIRE(0 != (root = spl_intern(spl, "root")));
+	ATF_REQUIRE_EQ(root, spl_intern(spl, "root"));
+	ATF_REQUIRE(ma_owns(ma, root));
+
+	memset(buffer, 'x', sizeof(buffer) - 1);
+	ATF_REQUIRE(0 != (large = spl_intern(spl, buffer)));
+	ATF_REQUIRE(ma_owns(ma, large));
+	ATF_REQUIRE_STREQ(buffer, large);
+
+	/* the arena keeps the strings, releasing it releases the pool */
+	spl_free(spl);
+	ATF_REQUIRE_STREQ("root", root);
+
+	ma_get_usage(ma, &usage);
+	ATF_REQUIRE_EQ(3, usage.allocations);
+
+	ma_free(ma);
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_spl_intern);
+	ATF_TP_ADD_TC(testplan, tc_spl_chunks);
+	ATF_TP_ADD_TC(testplan, tc_spl_reserve);
+	ATF_TP_ADD_TC(testplan, tc_spl_arena);
+
+	return atf_no_error();
+}
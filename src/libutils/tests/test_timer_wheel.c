@@ -0,0 +1,289 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atf-c.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../timer_wheel.h"
+
+/*
+ * manually advanced clock for tests
+ */
+uint64_t tc_tw_clock_ms = 0;
+
+uint64_t
+tc_tw_clock(void *ctx)
+{
+	return tc_tw_clock_ms;
+}
+
+struct timer_wheel_clock tc_tw_testclock = {
+	.ctx = NULL,
+	.now_ms = tc_tw_clock
+};
+
+/*
+ * counts timer expiries
+ */
+void
+tc_tw_count(void *ctx)
+{
+	(*(int *) ctx)++;
+}
+
+ATF_TC(tc_tw_oneshot);
+ATF_TC_HEAD(tc_tw_oneshot, tc)
+{
+}
+ATF_TC_BODY(tc_tw_oneshot, tc)
+{
+	struct timer_wheel *tw = 0;
+	struct timer_wheel_timer twt = {0};
+	int counter = 0;
+
+	tc_tw_clock_ms = 1000;
+	ATF_REQUIRE(0 != (tw = tw_new(10, &tc_tw_testclock)));
+	ATF_REQUIRE_EQ(-1, tw_next_timeout(tw));
+
+	tw_timer_init(&twt, tc_tw_count, &counter);
+	ATF_REQUIRE_EQ(0, tw_arm(tw, &twt, 100, 0));
+	ATF_REQUIRE_EQ(1, tw_count(tw));
+	ATF_REQUIRE(tw_timer_pending(&twt));
+	ATF_REQUIRE_EQ(100, tw_next_timeout(tw));
+
+	tc_tw_clock_ms += 90;
+	ATF_REQUIRE_EQ(0, tw_advance(tw));
+	ATF_REQUIRE_EQ(0, counter);
+
+	tc_tw_clock_ms += 10;
+	ATF_REQUIRE_EQ(1, tw_advance(tw));
+	ATF_REQUIRE_EQ(1, counter);
+	ATF_REQUIRE(!tw_timer_pending(&twt));
+	ATF_REQUIRE_EQ(0, tw_count(tw));
+
+	tw_free(tw);
+}
+ATF_TC_CLEANUP(tc_tw_oneshot, tc)
+{
+}
+
+ATF_TC(tc_tw_cancel);
+ATF_TC_HEAD(tc_tw_cancel, tc)
+{
+}
+ATF_TC_BODY(tc_tw_cancel, tc)
+{
+	struct timer_wheel *tw = 0;
+	struct timer_wheel_timer twt = {0};
+	int counter = 0;
+
+	tc_tw_clock_ms = 0;
+	ATF_REQUIRE(0 != (tw = tw_new(10, &tc_tw_testclock)));
+
+	tw_timer_init(&twt, tc_tw_count, &counter);
+	ATF_REQUIRE_EQ(0, tw_arm(tw, &twt, 50, 0));
+	ATF_REQUIRE_EQ(1, tw_cancel(tw, &twt));
+	ATF_REQUIRE_EQ(0, tw_cancel(tw, &twt));
+	ATF_REQUIRE_EQ(0, tw_count(tw));
+
+	tc_tw_clock_ms += 100;
+	ATF_REQUIRE_EQ(0, tw_advance(tw));
+	ATF_REQUIRE_EQ(0, counter);
+
+	tw_free(tw);
+}
+ATF_TC_CLEANUP(tc_tw_cancel, tc)
+{
+}
+
+ATF_TC(tc_tw_cascade);
+ATF_TC_HEAD(tc_tw_cascade, tc)
+{
+}
+ATF_TC_BODY(tc_tw_cascade, tc)
+{
+	struct timer_wheel *tw = 0;
+	struct timer_wheel_timer *timers = 0;
+	uint64_t *delays = 0;
+	uint64_t *fired_at = 0;
+	int *counters = 0;
+	size_t count = 10000, i = 0;
+	int64_t timeout = 0;
+
+	tc_tw_clock_ms = 0;
+	ATF_REQUIRE(0 != (tw = tw_new(10, &tc_tw_testclock)));
+	ATF_REQUIRE(0 != (timers = calloc(count, sizeof(struct timer_wheel_timer))));
+	ATF_REQUIRE(0 != (delays = calloc(count, sizeof(uint64_t))));
+	ATF_REQUIRE(0 != (fired_at = calloc(count, sizeof(uint64_t))));
+	ATF_REQUIRE(0 != (counters = calloc(count, sizeof(int))));
+
+	/* spread deadlines across all levels of the wheel */
+	srandom(4711);
+	for (i = 0; i < count; i++) {
+		delays[i] = random() % (24 * 3600 * 1000);
+		tw_timer_init(&timers[i], tc_tw_count, &counters[i]);
+		ATF_REQUIRE_EQ(0, tw_arm(tw, &timers[i], delays[i], 0));
+	}
+	ATF_REQUIRE_EQ(count, tw_count(tw));
+
+	/* cancel every other timer */
+	for (i = 0; i < count; i += 2)
+		ATF_REQUIRE_EQ(1, tw_cancel(tw, &timers[i]));
+
+	/* sleep as an event loop would and record expiries */
+	while (tw_count(tw)) {
+		ATF_REQUIRE((timeout = tw_next_timeout(tw)) >= 0);
+		tc_tw_clock_ms += timeout ? timeout : 1;
+		tw_advance(tw);
+
+		for (i = 1; i < count; i += 2)
+			if (counters[i] && !fired_at[i])
+				fired_at[i] = tc_tw_clock_ms;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (i % 2) {
+			ATF_REQUIRE_EQ(1, counters[i]);
+			ATF_REQUIRE(fired_at[i] >= delays[i]);
+			/* precision is limited to the tick length */
+			ATF_REQUIRE(fired_at[i] <= delays[i] + 20);
+		} else
+			ATF_REQUIRE_EQ(0, counters[i]);
+	}
+
+	free(counters);
+	free(fired_at);
+	free(delays);
+	free(timers);
+	tw_free(tw);
+}
+ATF_TC_CLEANUP(tc_tw_cascade, tc)
+{
+}
+
+ATF_TC(tc_tw_periodic);
+ATF_TC_HEAD(tc_tw_periodic, tc)
+{
+}
+ATF_TC_BODY(tc_tw_periodic, tc)
+{
+	struct timer_wheel *tw = 0;
+	struct timer_wheel_timer twt = {0};
+	int counter = 0;
+	int i = 0;
+
+	tc_tw_clock_ms = 0;
+	ATF_REQUIRE(0 != (tw = tw_new(10, &tc_tw_testclock)));
+
+	tw_timer_init(&twt, tc_tw_count, &counter);
+	ATF_REQUIRE_EQ(0, tw_arm(tw, &twt, 100, 100));
+
+	for (i = 0; i < 100; i++) {
+		tc_tw_clock_ms += 10;
+		tw_advance(tw);
+	}
+	ATF_REQUIRE_EQ(10, counter);
+	ATF_REQUIRE(tw_timer_pending(&twt));
+
+	ATF_REQUIRE_EQ(1, tw_cancel(tw, &twt));
+	tc_tw_clock_ms += 1000;
+	tw_advance(tw);
+	ATF_REQUIRE_EQ(10, counter);
+
+	tw_free(tw);
+}
+ATF_TC_CLEANUP(tc_tw_periodic, tc)
+{
+}
+
+/*
+ * a periodic timer owned by the structure it releases
+ */
+struct tc_tw_selffree {
+	struct timer_wheel *tw;
+	struct timer_wheel_timer twt;
+	int *counter;
+};
+
+/*
+ * cancels and releases its own periodic timer
+ */
+void
+tc_tw_selffree_func(void *ctx)
+{
+	struct tc_tw_selffree *sf = ctx;
+
+	(*sf->counter)++;
+	ATF_REQUIRE_EQ(1, tw_cancel(sf->tw, &sf->twt));
+	free(sf);
+}
+
+ATF_TC(tc_tw_periodicfree);
+ATF_TC_HEAD(tc_tw_periodicfree, tc)
+{
+}
+ATF_TC_BODY(tc_tw_periodicfree, tc)
+{
+	struct timer_wheel *tw = 0;
+	struct tc_tw_selffree *sf = 0;
+	int counter = 0;
+
+	tc_tw_clock_ms = 0;
+	ATF_REQUIRE(0 != (tw = tw_new(10, &tc_tw_testclock)));
+
+	ATF_REQUIRE(0 != (sf = malloc(sizeof(struct tc_tw_selffree))));
+	sf->tw = tw;
+	sf->counter = &counter;
+	tw_timer_init(&sf->twt, tc_tw_selffree_func, sf);
+	ATF_REQUIRE_EQ(0, tw_arm(tw, &sf->twt, 100, 100));
+
+	/* the released timer is neither re-armed nor run again */
+	tc_tw_clock_ms += 100;
+	ATF_REQUIRE_EQ(1, tw_advance(tw));
+	ATF_REQUIRE_EQ(0, tw_count(tw));
+	tc_tw_clock_ms += 1000;
+	ATF_REQUIRE_EQ(0, tw_advance(tw));
+	ATF_REQUIRE_EQ(1, counter);
+
+	tw_free(tw);
+}
+
+ATF_TP_ADD_TCS(testplan)
+{
+	ATF_TP_ADD_TC(testplan, tc_tw_oneshot);
+	ATF_TP_ADD_TC(testplan, tc_tw_cancel);
+	ATF_TP_ADD_TC(testplan, tc_tw_cascade);
+	ATF_TP_ADD_TC(testplan, tc_tw_periodic);
+	ATF_TP_ADD_TC(testplan, tc_tw_periodicfree);
+
+	return atf_no_error();
+}
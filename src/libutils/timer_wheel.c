@@ -0,0 +1,602 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+
+/*
+ * hierarchical timer wheel
+ *
+ * Level 0 holds timers expiring within the next TW_SLOTS ticks, each
+ * following level covers TW_SLOTS times the range of the level below.
+ * Whenever level 0 wraps around, the matching slot of the next level
+ * is cascaded down. Arming and cancelling are O(1); advancing costs
+ * one step per elapsed tick only while level 0 holds timers.
+ */
+struct timer_wheel {
+	pthread_mutex_t mtx;
+	/* signalled when a running callback returns */
+	pthread_cond_t cond_idle;
+
+	struct timer_wheel_clock clock;
+	uint32_t tick_ms;
+	/* clock value at construction; tick 0 */
+	uint64_t base_ms;
+	/* next tick to be processed */
+	uint64_t current;
+	/* tick the owning event loop sleeps until */
+	uint64_t sleep_until;
+	/* number of pending timers */
+	size_t count;
+
+	/* timer whose callback is currently executed */
+	struct timer_wheel_timer *running;
+	pthread_t running_thread;
+
+	/* notifies the owning event loop about earlier deadlines */
+	void (*wakeup)(void *ctx);
+	void *wakeup_ctx;
+
+	/* bitmap of non-empty slots per level */
+	uint64_t occupied[TW_LEVELS];
+	LIST_HEAD(, timer_wheel_timer) slots[TW_LEVELS][TW_SLOTS];
+};
+
+/*
+ * default clock source
+ */
+static uint64_t
+tw_clock_monotonic(void *ctx)
+{
+	struct timespec ts = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*
+ * get the current tick from the clock source
+ */
+static uint64_t
+tw_nowtick(struct timer_wheel *tw)
+{
+	uint64_t now = tw->clock.now_ms(tw->clock.ctx);
+
+	if (now < tw->base_ms)
+		return 0;
+
+	return (now - tw->base_ms) / tw->tick_ms;
+}
+
+/*
+ * put a timer into the slot matching its expiry relative to the
+ * current tick; expects the wheel to be locked
+ */
+static void
+tw_place(struct timer_wheel *tw, struct timer_wheel_timer *twt)
+{
+	uint64_t expires = twt->expires;
+	uint64_t delta = 0;
+	unsigned int level = 0;
+	unsigned int slot = 0;
+
+	if (expires < tw->current)
+		expires = tw->current;
+
+	delta = expires - tw->current;
+
+	/* timers too far out are parked on the last slot of the top level
+	   and placed again once they cascade down */
+	if (delta >= ((uint64_t) 1 << (TW_LEVELS * TW_SLOTBITS))) {
+		delta = ((uint64_t) 1 << (TW_LEVELS * TW_SLOTBITS)) - 1;
+		expires = tw->current + delta;
+	}
+
+	while ((level < TW_LEVELS - 1) &&
+	       (delta >= ((uint64_t) 1 << ((level + 1) * TW_SLOTBITS))))
+		level++;
+
+	slot = (expires >> (level * TW_SLOTBITS)) & TW_SLOTMASK;
+
+	twt->level = level;
+	twt->slot = slot;
+	twt->pending = true;
+
+	LIST_INSERT_HEAD(&tw->slots[level][slot], twt, entries);
+	tw->occupied[level] |= ((uint64_t) 1 << slot);
+}
+
+/*
+ * take a timer out of its slot; expects the wheel to be locked
+ */
+static void
+tw_unlink(struct timer_wheel *tw, struct timer_wheel_timer *twt)
+{
+	LIST_REMOVE(twt, entries);
+	twt->pending = false;
+
+	if (LIST_EMPTY(&tw->slots[twt->level][twt->slot]))
+		tw->occupied[twt->level] &= ~((uint64_t) 1 << twt->slot);
+}
+
+/*
+ * move all timers of a slot one or more levels down
+ *
+ * returns the index of the cascaded slot.
+ */
+static unsigned int
+tw_cascade(struct timer_wheel *tw, unsigned int level)
+{
+	unsigned int slot = (tw->current >> (level * TW_SLOTBITS)) & TW_SLOTMASK;
+	struct timer_wheel_timer *twt = 0;
+
+	while (!LIST_EMPTY(&tw->slots[level][slot])) {
+		twt = LIST_FIRST(&tw->slots[level][slot]);
+		tw_unlink(tw, twt);
+		tw_place(tw, twt);
+	}
+
+	return slot;
+}
+
+/*
+ * find the first set bit in a slot bitmap, starting at slot start
+ * and wrapping around
+ *
+ * returns the distance to that slot.
+ */
+static unsigned int
+tw_nextslot(uint64_t occupied, unsigned int start)
+{
+	uint64_t rotated = 0;
+
+	if (!start)
+		rotated = occupied;
+	else
+		rotated = (occupied >> start) | (occupied << (TW_SLOTS - start));
+
+	return ffsll(rotated) - 1;
+}
+
+/*
+ * compute the next tick at which the wheel has to be advanced;
+ * expects the wheel to be locked
+ */
+static uint64_t
+tw_nexttick(struct timer_wheel *tw)
+{
+	uint64_t next = UINT64_MAX;
+	uint64_t base = 0, candidate = 0;
+	unsigned int level = 0, shift = 0, start = 0;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		if (!tw->occupied[level])
+			continue;
+
+		shift = level * TW_SLOTBITS;
+		if (level) {
+			/* higher levels only move when all lower bits
+			   wrap around to zero */
+			base = tw->current + ((uint64_t) 1 << shift) - 1;
+			base &= ~(((uint64_t) 1 << shift) - 1);
+		} else
+			base = tw->current;
+
+		start = (base >> shift) & TW_SLOTMASK;
+		candidate = base +
+			((uint64_t) tw_nextslot(tw->occupied[level], start) << shift);
+
+		if (candidate < next)
+			next = candidate;
+	}
+
+	return next;
+}
+
+/*
+ * initialize an embedded timer
+ */
+void
+tw_timer_init(struct timer_wheel_timer *twt,
+	      void (*func)(void *ctx), void *ctx)
+{
+	if (!twt)
+		return;
+
+	bzero(twt, sizeof(struct timer_wheel_timer));
+	twt->func = func;
+	twt->ctx = ctx;
+}
+
+/*
+ * check whether a timer is waiting for its expiry
+ */
+bool
+tw_timer_pending(const struct timer_wheel_timer *twt)
+{
+	if (!twt)
+		return false;
+
+	return twt->pending;
+}
+
+/*
+ * construct a new timer wheel with a tick length of tick_ms
+ * milliseconds; if clock is NULL, the monotonic system clock is used
+ *
+ * returns NULL on error.
+ */
+struct timer_wheel *
+tw_new(uint32_t tick_ms, const struct timer_wheel_clock *clock)
+{
+	struct timer_wheel *tw = 0;
+	unsigned int level = 0, slot = 0;
+
+	if (!tick_ms || (clock && !clock->now_ms)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(tw = malloc(sizeof(struct timer_wheel))))
+		return NULL;
+
+	bzero(tw, sizeof(struct timer_wheel));
+
+	if (clock)
+		tw->clock = *clock;
+	else
+		tw->clock.now_ms = tw_clock_monotonic;
+
+	tw->tick_ms = tick_ms;
+	tw->base_ms = tw->clock.now_ms(tw->clock.ctx);
+	tw->sleep_until = UINT64_MAX;
+
+	for (level = 0; level < TW_LEVELS; level++)
+		for (slot = 0; slot < TW_SLOTS; slot++)
+			LIST_INIT(&tw->slots[level][slot]);
+
+	if (pthread_mutex_init(&tw->mtx, NULL)) {
+		free(tw);
+		return NULL;
+	}
+
+	if (pthread_cond_init(&tw->cond_idle, NULL)) {
+		pthread_mutex_destroy(&tw->mtx);
+		free(tw);
+		return NULL;
+	}
+
+	return tw;
+}
+
+/*
+ * release a previously allocated timer wheel; pending timers are
+ * dropped without being called
+ */
+void
+tw_free(struct timer_wheel *tw)
+{
+	struct timer_wheel_timer *twt = 0;
+	unsigned int level = 0, slot = 0;
+
+	if (!tw)
+		return;
+
+	for (level = 0; level < TW_LEVELS; level++)
+		for (slot = 0; slot < TW_SLOTS; slot++)
+			while (!LIST_EMPTY(&tw->slots[level][slot])) {
+				twt = LIST_FIRST(&tw->slots[level][slot]);
+				tw_unlink(tw, twt);
+			}
+
+	pthread_cond_destroy(&tw->cond_idle);
+	pthread_mutex_destroy(&tw->mtx);
+
+	free(tw);
+}
+
+/*
+ * set a function to call whenever a timer is armed that expires
+ * before the owning event loop would wake up again
+ */
+int
+tw_set_wakeup(struct timer_wheel *tw, void (*wakeup)(void *ctx), void *ctx)
+{
+	if (!tw) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pthread_mutex_lock(&tw->mtx))
+		return -1;
+
+	tw->wakeup = wakeup;
+	tw->wakeup_ctx = ctx;
+
+	return pthread_mutex_unlock(&tw->mtx);
+}
+
+/*
+ * arm a timer to expire in delay_ms milliseconds; if period_ms is not
+ * zero, the timer is re-armed with that interval after each expiry.
+ * An already pending timer is moved to its new expiry.
+ *
+ * returns 0 on success.
+ */
+int
+tw_arm(struct timer_wheel *tw, struct timer_wheel_timer *twt,
+       uint64_t delay_ms, uint64_t period_ms)
+{
+	uint64_t ticks = 0;
+	bool wakeup = false;
+
+	if (!tw || !twt || !twt->func) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* round up, but at least one tick into the future */
+	ticks = (delay_ms + tw->tick_ms - 1) / tw->tick_ms;
+	if (!ticks)
+		ticks = 1;
+
+	if (pthread_mutex_lock(&tw->mtx))
+		return -1;
+
+	if (twt->pending) {
+		tw_unlink(tw, twt);
+		tw->count--;
+	}
+
+	/* an idle wheel may lag behind; no timer is pending, so it is
+	   safe to catch up before placing the new one */
+	if (!tw->count && (tw->current < tw_nowtick(tw)))
+		tw->current = tw_nowtick(tw);
+
+	twt->expires = tw_nowtick(tw) + ticks;
+	twt->period = (period_ms + tw->tick_ms - 1) / tw->tick_ms;
+
+	tw_place(tw, twt);
+	tw->count++;
+
+	if (tw->wakeup && (twt->expires < tw->sleep_until)) {
+		tw->sleep_until = twt->expires;
+		wakeup = true;
+	}
+
+	if (pthread_mutex_unlock(&tw->mtx))
+		return -1;
+
+	if (wakeup)
+		tw->wakeup(tw->wakeup_ctx);
+
+	return 0;
+}
+
+/*
+ * cancel a timer; if its callback is just being executed on another
+ * thread, wait for the callback to return. Afterwards, the memory of
+ * the timer may be released by the caller.
+ *
+ * returns 1 if the timer was pending, 0 if not, -1 on error.
+ */
+int
+tw_cancel(struct timer_wheel *tw, struct timer_wheel_timer *twt)
+{
+	int result = 0;
+
+	if (!tw || !twt) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pthread_mutex_lock(&tw->mtx))
+		return -1;
+
+	if (twt->pending) {
+		tw_unlink(tw, twt);
+		tw->count--;
+		result = 1;
+	}
+
+	if (tw->running == twt) {
+		/* a callback may cancel itself without waiting */
+		while ((tw->running == twt) &&
+		       !pthread_equal(tw->running_thread, pthread_self()))
+			pthread_cond_wait(&tw->cond_idle, &tw->mtx);
+	}
+
+	if (pthread_mutex_unlock(&tw->mtx))
+		return -1;
+
+	return result;
+}
+
+/*
+ * run callbacks of all timers that expired up to now. Callbacks are
+ * executed without the wheel lock held and may arm or cancel timers.
+ *
+ * returns the number of callbacks run.
+ */
+size_t
+tw_advance(struct timer_wheel *tw)
+{
+	struct timer_wheel_timer *twt = 0;
+	void (*func)(void *ctx) = 0;
+	void *ctx = 0;
+	uint64_t target = 0, boundary = 0;
+	unsigned int slot = 0, level = 0;
+	size_t fired = 0;
+
+	if (!tw) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (pthread_mutex_lock(&tw->mtx))
+		return 0;
+
+	target = tw_nowtick(tw);
+
+	while (tw->current <= target) {
+		if (!tw->count) {
+			/* nothing to do, just catch up */
+			tw->current = target + 1;
+			break;
+		}
+
+		slot = tw->current & TW_SLOTMASK;
+
+		/* level 0 wrapped around, cascade higher levels down */
+		for (level = 1; !slot && (level < TW_LEVELS); level++)
+			if (tw_cascade(tw, level))
+				break;
+
+		while (!LIST_EMPTY(&tw->slots[0][slot])) {
+			twt = LIST_FIRST(&tw->slots[0][slot]);
+			tw_unlink(tw, twt);
+			tw->count--;
+
+			func = twt->func;
+			ctx = twt->ctx;
+			tw->running = twt;
+			tw->running_thread = pthread_self();
+
+			/* periodic timers are re-armed before their callback
+			   runs, as any timer may be cancelled and released by
+			   its callback and is not touched afterwards */
+			if (twt->period) {
+				twt->expires += twt->period;
+				if (twt->expires <= tw->current)
+					twt->expires = tw->current + 1;
+				tw_place(tw, twt);
+				tw->count++;
+			}
+
+			pthread_mutex_unlock(&tw->mtx);
+			func(ctx);
+			pthread_mutex_lock(&tw->mtx);
+
+			fired++;
+			tw->running = NULL;
+
+			pthread_cond_broadcast(&tw->cond_idle);
+		}
+
+		tw->current++;
+
+		/* without level 0 timers, skip ahead to the next cascade */
+		if (!tw->occupied[0] && (tw->current & TW_SLOTMASK)) {
+			boundary = (tw->current | TW_SLOTMASK) + 1;
+			tw->current = (boundary > target + 1) ? target + 1 : boundary;
+		}
+	}
+
+	pthread_mutex_unlock(&tw->mtx);
+
+	return fired;
+}
+
+/*
+ * compute the time in milliseconds until tw_advance needs to be called
+ * again; the owning event loop uses this as its sleep timeout
+ *
+ * returns -1 if no timer is pending.
+ */
+int64_t
+tw_next_timeout(struct timer_wheel *tw)
+{
+	uint64_t next = 0, now = 0, deadline = 0;
+	int64_t result = -1;
+
+	if (!tw) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pthread_mutex_lock(&tw->mtx))
+		return -1;
+
+	next = tw->count ? tw_nexttick(tw) : UINT64_MAX;
+	tw->sleep_until = next;
+
+	if (UINT64_MAX != next) {
+		now = tw->clock.now_ms(tw->clock.ctx);
+		deadline = tw->base_ms + (next * tw->tick_ms);
+		result = (deadline > now) ? (int64_t) (deadline - now) : 0;
+	}
+
+	pthread_mutex_unlock(&tw->mtx);
+
+	return result;
+}
+
+/*
+ * get the number of pending timers
+ */
+size_t
+tw_count(struct timer_wheel *tw)
+{
+	size_t count = 0;
+
+	if (!tw) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (pthread_mutex_lock(&tw->mtx))
+		return 0;
+
+	count = tw->count;
+
+	pthread_mutex_unlock(&tw->mtx);
+
+	return count;
+}
+
+/*
+ * get the current time of the wheel's clock in milliseconds
+ */
+uint64_t
+tw_now(struct timer_wheel *tw)
+{
+	if (!tw) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return tw->clock.now_ms(tw->clock.ctx);
+}
@@ -0,0 +1,90 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2023 Christian Moerz. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <sys/queue.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* number of cascading wheel levels */
+#define TW_LEVELS	4
+/* slots per level as power of two */
+#define TW_SLOTBITS	6
+#define TW_SLOTS	(1 << TW_SLOTBITS)
+#define TW_SLOTMASK	(TW_SLOTS - 1)
+
+struct timer_wheel;
+
+/*
+ * clock source used by a timer wheel; returns monotonic milliseconds.
+ * Tests may provide their own clock to move time forward manually.
+ */
+struct timer_wheel_clock {
+	void *ctx;
+	uint64_t (*now_ms)(void *ctx);
+};
+
+/*
+ * a timer entry; it is embedded into the structure owning the timer,
+ * so arming and cancelling a timer never allocates memory.
+ */
+struct timer_wheel_timer {
+	/* tick at which the timer expires */
+	uint64_t expires;
+	/* re-arm interval in ticks, 0 for one shot timers */
+	uint64_t period;
+
+	void (*func)(void *ctx);
+	void *ctx;
+
+	/* location inside the wheel while pending */
+	uint8_t level;
+	uint8_t slot;
+	bool pending;
+
+	LIST_ENTRY(timer_wheel_timer) entries;
+};
+
+void tw_timer_init(struct timer_wheel_timer *twt,
+		   void (*func)(void *ctx), void *ctx);
+bool tw_timer_pending(const struct timer_wheel_timer *twt);
+
+struct timer_wheel *tw_new(uint32_t tick_ms, const struct timer_wheel_clock *clock);
+void tw_free(struct timer_wheel *tw);
+int tw_set_wakeup(struct timer_wheel *tw, void (*wakeup)(void *ctx), void *ctx);
+int tw_arm(struct timer_wheel *tw, struct timer_wheel_timer *twt,
+	   uint64_t delay_ms, uint64_t period_ms);
+int tw_cancel(struct timer_wheel *tw, struct timer_wheel_timer *twt);
+size_t tw_advance(struct timer_wheel *tw);
+int64_t tw_next_timeout(struct timer_wheel *tw);
+size_t tw_count(struct timer_wheel *tw);
+uint64_t tw_now(struct timer_wheel *tw);
+
+#endif /* __TIMER_WHEEL_H__ */
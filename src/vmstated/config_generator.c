@@ -49,12 +49,15 @@
 int
 vmstated_generate_config_file(const struct bhyve_configuration *bc,
 			      const char *filename);
+char **
+vmstated_generate_config_args(const struct bhyve_configuration *bc);
 
 /*
  * config generator definition
  */
 struct config_generator_object vmstated_cgo = {
-	.generate_config_file = vmstated_generate_config_file
+	.generate_config_file = vmstated_generate_config_file,
+	.generate_config_args = vmstated_generate_config_args
 };
 
 /*
@@ -99,3 +102,39 @@ vmstated_generate_config_file(const struct bhyve_configuration *bc,
 
 	return result;
 }
+
+/*
+ * Generates bhyve arguments merging settings of a bhyve_configuration
+ * into its preexisting bhyve_config file
+ */
+char **
+vmstated_generate_config_args(const struct bhyve_configuration *bc)
+{
+	struct param_translate_core *ptc = 0;
+	const struct bhyve_parameters_core *bpc = 0;
+	struct output_bhyve_core *obc = 0;
+	char **args = NULL;
+
+	if (!(ptc = ptc_new(bc)))
+		return NULL;
+
+	do {
+		if (ptc_translate(ptc))
+			break;
+
+		/* get set of core parameters after translation */
+		if (!(bpc = ptc_get_parameters(ptc)))
+			break;
+
+		if (!(obc = obc_new(NULL, bpc)))
+			break;
+
+		args = obc_get_args(obc, bc_get_configfile(bc));
+
+		obc_free(obc);
+	} while(0);
+
+	ptc_free(ptc);
+
+	return args;
+}
@@ -33,5 +33,7 @@ extern struct config_generator_object vmstated_cgo;
 int
 vmstated_generate_config_file(const struct bhyve_configuration *bc,
 			      const char *filename);
+char **
+vmstated_generate_config_args(const struct bhyve_configuration *bc);
 
 #endif /* __VMS_CONFIG_GENERATOR_H__ */
@@ -117,7 +117,8 @@ vmsms_onrecv_data(void *ctx, uid_t uid, pid_t pid, const char *cmd, const char *
 	struct bhyve_messagesub_replymgr bmr = {
 		.ctx = src,
 		.short_reply = (int (*)(void *, const char *)) src_short_reply,
-		.reply = (int (*)(void *, const void *, size_t)) src_reply
+		.reply = (int (*)(void *, const void *, size_t)) src_reply,
+		.stream = (int (*)(void *, const void *, size_t)) src_stream
 	};
 
 	return vmsms->on_data(vmsms->bd, uid, pid, cmd, buffer, bufferlen, &bmr);
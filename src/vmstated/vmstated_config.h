@@ -32,10 +32,12 @@
 #define DEFAULTPATH_SOCKET "/tmp/vmstated.sock"
 #define DEFAULTPATH_PIDFILE "/tmp/vmstated.pid"
 #define DEFAULTPATH_LOGDIR "/tmp"
+#define DEFAULTPATH_CONFIGCACHE "/tmp/vmstated.cache"
 #else /* !DEBUG */
 #define DEFAULTPATH_SOCKET "/var/run/vmstated.sock"
 #define DEFAULTPATH_PIDFILE "/var/run/vmstated.pid"
 #define DEFAULTPATH_LOGDIR "/var/log/vmstated"
+#define DEFAULTPATH_CONFIGCACHE "/var/db/vmstated.cache"
 #endif /* DEBUG */
 
 #endif /* __VMSTATED_CONFIG_H__ */
@@ -47,13 +47,20 @@
 #include "../libprocwatch/bhyve_config.h"
 #include "../libprocwatch/bhyve_config_object.h"
 #include "../libprocwatch/bhyve_director.h"
+#include "../libprocwatch/daemon_config.h"
+#include "../libprocwatch/hook_executor.h"
 
 #include "../libsocket/socket_handle.h"
 
+#include "../libutils/daemon_log.h"
+
 #include "config_generator.h"
 #include "subscriber.h"
 #include "vmstated_config.h"
 
+/* daemon settings file inside the configuration directory */
+#define DAEMON_CONFIGFILE "vmstated.conf"
+
 pthread_mutex_t vmstated_sigmtx;
 pthread_cond_t  vmstated_termcond;
 sig_t           vmstated_defaultsig = 0;
@@ -102,6 +109,7 @@ vmstated_recv_data(void *ctx, uid_t uid, pid_t pid, const char *cmd, const char
 int
 vmstated_launch(struct vmstated_opts *opts,
 		struct bhyve_configuration_store *bcs,
+		const struct daemon_config *dc,
 		int pipefd[2])
 {
 	struct log_director *ld = 0;
@@ -109,11 +117,29 @@ vmstated_launch(struct vmstated_opts *opts,
 	struct bhyve_director *bd = 0;
 	struct socket_handle *sh = 0;
 	struct vmstated_message_subscriber *vmsms = 0;
+	struct hook_executor *hke = 0;
 	int result = 0;
 
-	if (!(ld = ld_new(opts->verbose, opts->log_path))) {
+	/* fork the helper before any threads or log pipes exist */
+	if (dconf_get_hook_server(dc) && !(hke = hke_new()))
+		syslog(LOG_WARNING, "Failed to start hook executor, launching "
+		       "hook scripts directly");
+
+	/* diagnostics are buffered per thread from here on */
+	if (dlog_start())
+		syslog(LOG_WARNING, "Failed to start diagnostic log thread, "
+		       "logging synchronously");
+
+	if (!(ld = ld_new_shards(opts->verbose, opts->log_path,
+				 dconf_get_log_threads(dc)))) {
 	}
 
+	if (ld_set_rotation(ld, dconf_get_log_maxsize(dc), dconf_get_log_keep(dc),
+			    dconf_get_log_compress(dc)))
+		syslog(LOG_WARNING, "Failed to configure log rotation");
+	if (ld_set_ratelimit(ld, dconf_get_log_rate(dc), dconf_get_log_burst(dc)))
+		syslog(LOG_WARNING, "Failed to configure log rate limit");
+
 	if (!(bcso = bcsobj_frombcs(bcs))) {
 		ld_free(ld);
 		bcs_free(bcs);
@@ -126,6 +152,10 @@ vmstated_launch(struct vmstated_opts *opts,
 		vmstated_err(pipefd, errno, "Failed to construct bhyve director");
 	}
 
+	if (hke && bd_set_hookexecutor(bd, hke))
+		syslog(LOG_WARNING, "Failed to register hook executor, launching "
+		       "hook scripts directly");
+
 	/* assign a new cgo */
 	if (bd_set_cgo(bd, &vmstated_cgo)) {
 		bd_free(bd);
@@ -134,6 +164,11 @@ vmstated_launch(struct vmstated_opts *opts,
 		vmstated_err(pipefd, errno, "Failed to prepare configuration generator");
 	}
 
+	if (bd_set_configargs(bd, dconf_get_config_args(dc),
+			      dconf_get_config_keepfile(dc)))
+		syslog(LOG_WARNING, "Failed to configure generated arguments, "
+		       "using generated config files");
+
 	do {
 		/* remove any left over socket file */
 		if (unlink(opts->socket_path) < 0) {
@@ -196,6 +231,10 @@ vmstated_launch(struct vmstated_opts *opts,
 		if (pthread_mutex_unlock(&vmstated_sigmtx))
 			err(errno, "Failed to unlock signal mutex");
 
+		/* stop all vms, listener keeps answering status requests */
+		if (bd_shutdown(bd, dconf_get_shutdown_timeout(dc)))
+			syslog(LOG_WARNING, "Not all vms stopped in time");
+
 		/* stop listener */
 		sh_stop(sh);
 
@@ -207,7 +246,11 @@ vmstated_launch(struct vmstated_opts *opts,
 	sh_free(sh);
 	/* release resources */
 	bd_free(bd);
+	if (hke)
+		hke_free(hke);
 	ld_free(ld);
+	/* deliver what the other threads left behind */
+	dlog_stop();
 
 	if ((result < 0) && (pipefd[1] >= 0)) {
 		if (write(pipefd[1], &result, sizeof(result)) < 0)
@@ -384,6 +427,34 @@ check_already_running(struct vmstated_opts *default_opts)
 	return 0;
 }
 
+/*
+ * load optional daemon settings from the configuration directory
+ */
+struct daemon_config *
+load_daemon_config(struct vmstated_opts *default_opts)
+{
+	struct daemon_config *dc = 0;
+	char configfile[PATH_MAX] = {0};
+
+	if (!(dc = dconf_new()))
+		return NULL;
+
+	snprintf(configfile, PATH_MAX, "%s/%s",
+		 default_opts->configdir_path, DAEMON_CONFIGFILE);
+
+	/* missing file means defaults apply */
+	if (access(configfile, F_OK) < 0)
+		return dc;
+
+	if (dconf_parseucl(dc, configfile)) {
+		dconf_free(dc);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return dc;
+}
+
 /*
  * run actual program
  */
@@ -392,18 +463,29 @@ run_program(struct vmstated_opts *default_opts, int pipefd[2])
 {
 	int result = 0;
 	struct bhyve_configuration_store *bcs = 0;
+	struct daemon_config *dc = 0;
 	
 	syslog(LOG_INFO, "vmstated starting");
 
+	if (!(dc = load_daemon_config(default_opts))) {
+		vmstated_err(pipefd, errno, "Failed to load daemon configuration");
+	}
+
 	if (!(bcs = bcs_new(default_opts->configdir_path))) {
 		vmstated_err(pipefd, ENOMEM, "Failed to instantiate configuration store");
 	}
 
+	/* the cache is an optimization, parse everything without it */
+	if (bcs_set_cachefile(bcs, DEFAULTPATH_CONFIGCACHE))
+		syslog(LOG_WARNING, "Not using config cache \"%s\"",
+		       DEFAULTPATH_CONFIGCACHE);
+
 	syslog(LOG_INFO, "Loading config data");
 
 	/* walk configuration directory */
 	if (bcs_walkdir(bcs)) {
 		bcs_free(bcs);
+		dconf_free(dc);
 		vmstated_err(pipefd, errno, "Failed to walk configuration directory");
 	}
 
@@ -417,12 +499,13 @@ run_program(struct vmstated_opts *default_opts, int pipefd[2])
 		vmstated_err(pipefd, errno, "Failed to write pid file");
 	}
 	
-	result = vmstated_launch(default_opts, bcs, pipefd);
+	result = vmstated_launch(default_opts, bcs, dc, pipefd);
 	
 	syslog(LOG_INFO, "vmstated shutting down");
 
 	/* release store */
 	bcs_free(bcs);
+	dconf_free(dc);
 	
 	teardown_sighandler();
 	/* clear pid file */
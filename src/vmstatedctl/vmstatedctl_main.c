@@ -33,9 +33,11 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../libcommand/bhyve_command.h"
@@ -67,6 +69,8 @@ struct vmstatedctl_cmd {
 struct vmstatedctl_replyhandler {
 	char *command;
 	int (*func)(struct bhyve_usercommand *);
+	/* handles replies streamed until a final message, may be NULL */
+	int (*follow)(struct socket_connection *, struct bhyve_usercommand *);
 };
 
 int cmd_start(int, char**, struct bhyve_usercommand *);
@@ -75,6 +79,13 @@ int cmd_status(int argc, char **argv, struct bhyve_usercommand *buc);
 int cmd_default_reply(struct bhyve_usercommand *buc);
 int cmd_status_reply(struct bhyve_usercommand *buc);
 int cmd_failreset(int argc, char **argv, struct bhyve_usercommand *buc);
+int cmd_shutdownstatus(int argc, char **argv, struct bhyve_usercommand *buc);
+int cmd_waitstate(int argc, char **argv, struct bhyve_usercommand *buc);
+int cmd_waitstate_reply(struct bhyve_usercommand *buc);
+int cmd_logstats(int argc, char **argv, struct bhyve_usercommand *buc);
+int cmd_text_reply(struct bhyve_usercommand *buc);
+int cmd_logs(int argc, char **argv, struct bhyve_usercommand *buc);
+int cmd_follow_reply(struct socket_connection *sc, struct bhyve_usercommand *buc);
 
 /*
  * list of available commands
@@ -99,6 +110,26 @@ struct vmstatedctl_cmd commands[] = {
 		.command = "failreset",
 		.func = cmd_failreset,
 		.requires_vm_name = true
+	},
+	{
+		.command = "shutdownstatus",
+		.func = cmd_shutdownstatus,
+		.requires_vm_name = false
+	},
+	{
+		.command = "waitstate",
+		.func = cmd_waitstate,
+		.requires_vm_name = false
+	},
+	{
+		.command = "logstats",
+		.func = cmd_logstats,
+		.requires_vm_name = false
+	},
+	{
+		.command = "logs",
+		.func = cmd_logs,
+		.requires_vm_name = true
 	}
 };
 
@@ -118,6 +149,23 @@ struct vmstatedctl_replyhandler reply_handler[] = {
 	{
 		.command = "failreset",
 		.func = cmd_default_reply
+	},
+	{
+		.command = "shutdownstatus",
+		.func = cmd_default_reply
+	},
+	{
+		.command = "waitstate",
+		.func = cmd_waitstate_reply
+	},
+	{
+		.command = "logstats",
+		.func = cmd_text_reply
+	},
+	{
+		.command = "logs",
+		.func = cmd_text_reply,
+		.follow = cmd_follow_reply
 	}
 };
 
@@ -136,6 +184,70 @@ cmd_default_reply(struct bhyve_usercommand *buc)
 	return 0;
 }
 
+/*
+ * handle waitstate reply; fails unless all vms reached a state
+ */
+int
+cmd_waitstate_reply(struct bhyve_usercommand *buc)
+{
+	if (!buc)
+		return -1;
+
+	printf("%s\n", buc->reply);
+
+	/* replies start with the numeric result code */
+	return atoi(buc->reply) ? -1 : 0;
+}
+
+/*
+ * handle replies carrying text in a blob
+ */
+int
+cmd_text_reply(struct bhyve_usercommand *buc)
+{
+	if (!buc)
+		return -1;
+
+	if (!buc->blob) {
+		/* errors come back as short replies */
+		printf("%s\n", buc->reply);
+		return atoi(buc->reply) ? -1 : 0;
+	}
+
+	fwrite(buc->blob, 1, buc->bloblen, stdout);
+
+	return 0;
+}
+
+/*
+ * print text blobs as they arrive until the final reply
+ */
+int
+cmd_follow_reply(struct socket_connection *sc, struct bhyve_usercommand *buc)
+{
+	if (!sc || !buc)
+		return -1;
+
+	while (buc->blob) {
+		/* empty blobs only check that we are still listening */
+		fwrite(buc->blob, 1, buc->bloblen, stdout);
+		fflush(stdout);
+
+		free(buc->blob);
+		buc->blob = NULL;
+		buc->bloblen = 0;
+
+		if (sc_recv_frame(sc, buc->reply, buc->replylen, &buc->blob,
+				  &buc->bloblen))
+			return -1;
+	}
+
+	/* keep stdout to the log output itself */
+	fprintf(stderr, "%s\n", buc->reply);
+
+	return atoi(buc->reply) ? -1 : 0;
+}
+
 void
 cmd_printsep(char sepchar)
 {
@@ -222,6 +334,196 @@ cmd_failreset(int argc, char **argv, struct bhyve_usercommand *buc)
 	return 0;
 }
 
+int
+cmd_shutdownstatus(int argc, char **argv, struct bhyve_usercommand *buc)
+{
+	buc->cmd = strdup("shutdownstatus");
+	buc->vmname = NULL;
+
+	return 0;
+}
+
+/*
+ * logstats [vmname]
+ */
+int
+cmd_logstats(int argc, char **argv, struct bhyve_usercommand *buc)
+{
+	buc->cmd = strdup("logstats");
+	buc->vmname = *argv ? strdup(*argv) : NULL;
+
+	return 0;
+}
+
+/*
+ * parse a point in time given as @seconds since the epoch, as -N
+ * seconds, minutes, hours or days (s, m, h, d) ago or as local time
+ * YYYY-mm-dd[THH:MM[:SS]]
+ *
+ * returns 0 on success, -1 if arg is not a valid time.
+ */
+int
+cmd_parsetime(const char *arg, uint64_t *seconds)
+{
+	const char *formats[] = {
+		"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d"
+	};
+	struct tm tm = {0};
+	char *end = NULL;
+	unsigned long long value = 0;
+	time_t now = time(NULL), when = 0;
+	size_t idx = 0;
+
+	if ((*arg == '@') || (*arg == '-')) {
+		errno = 0;
+		value = strtoull(arg + 1, &end, 10);
+		if (errno || (end == arg + 1))
+			return -1;
+
+		if (*arg == '@') {
+			if (*end)
+				return -1;
+			*seconds = value;
+			return 0;
+		}
+
+		switch (*end) {
+		case 'd':
+			value *= 24;
+			/* FALLTHROUGH */
+		case 'h':
+			value *= 60;
+			/* FALLTHROUGH */
+		case 'm':
+			value *= 60;
+			/* FALLTHROUGH */
+		case 's':
+			end++;
+			break;
+		default:
+			return -1;
+		}
+		if (*end || (value > (unsigned long long) now))
+			return -1;
+		*seconds = now - value;
+		return 0;
+	}
+
+	for (idx = 0; idx < sizeof(formats) / sizeof(char *); idx++) {
+		bzero(&tm, sizeof(struct tm));
+		if (!(end = strptime(arg, formats[idx], &tm)) || *end)
+			continue;
+		tm.tm_isdst = -1;
+		if ((when = mktime(&tm)) < 0)
+			return -1;
+		*seconds = when;
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * logs vmname [--since time] [--until time] [--source name]
+ * logs vmname -f [--new] [--source name]
+ */
+int
+cmd_logs(int argc, char **argv, struct bhyve_usercommand *buc)
+{
+	bool onlynew = false;
+
+	buc->cmd = strdup("logs");
+	buc->vmname = strdup(*argv++);
+
+	for (; *argv; argv++) {
+		if (!strcmp(*argv, "-f")) {
+			buc->follow = true;
+			continue;
+		} else if (!strcmp(*argv, "--new")) {
+			onlynew = true;
+			continue;
+		}
+
+		if (!argv[1])
+			errx(EINVAL, "Missing value for \"%s\"", *argv);
+
+		if (!strcmp(*argv, "--since")) {
+			if (cmd_parsetime(*++argv, &buc->since))
+				errx(EINVAL, "Invalid time \"%s\"", *argv);
+		} else if (!strcmp(*argv, "--until")) {
+			if (cmd_parsetime(*++argv, &buc->until))
+				errx(EINVAL, "Invalid time \"%s\"", *argv);
+		} else if (!strcmp(*argv, "--source")) {
+			free(buc->source);
+			buc->source = strdup(*++argv);
+		} else {
+			errx(EINVAL, "Unknown option \"%s\"", *argv);
+		}
+	}
+
+	if (buc->until && (buc->until < buc->since))
+		errx(EINVAL, "--until lies before --since");
+
+	if (buc->follow && (buc->since || buc->until))
+		errx(EINVAL, "-f cannot be combined with --since or --until");
+	if (onlynew && !buc->follow)
+		errx(EINVAL, "--new requires -f");
+	/* following starts with recent output unless told otherwise */
+	buc->backlog = !onlynew;
+
+	return 0;
+}
+
+/*
+ * waitstate [-t seconds] state[,state...] [vmname ...]
+ *
+ * no vmname waits for all vms
+ */
+int
+cmd_waitstate(int argc, char **argv, struct bhyve_usercommand *buc)
+{
+	char *end = NULL;
+	char **ptr = NULL;
+	size_t len = 0;
+	unsigned long timeout = 0;
+
+	buc->cmd = strdup("waitstate");
+	buc->vmname = NULL;
+
+	if (*argv && !strcmp(*argv, "-t")) {
+		if (!*++argv)
+			errx(EINVAL, "Missing timeout");
+		errno = 0;
+		timeout = strtoul(*argv, &end, 10);
+		if (errno || *end || (timeout > UINT32_MAX))
+			errx(EINVAL, "Invalid timeout \"%s\"", *argv);
+		buc->timeout = timeout;
+		argv++;
+	}
+
+	if (!*argv)
+		errx(EINVAL, "Missing states");
+	buc->states = strdup(*argv++);
+
+	/* remaining arguments name the vms, joined by commas */
+	for (ptr = argv; *ptr; ptr++)
+		len += strlen(*ptr) + 1;
+
+	if (len) {
+		if (!(buc->vmname = malloc(len)))
+			err(ENOMEM, "Failed to allocate vm names");
+		*buc->vmname = 0;
+		for (ptr = argv; *ptr; ptr++) {
+			if (ptr != argv)
+				strlcat(buc->vmname, ",", len);
+			strlcat(buc->vmname, *ptr, len);
+		}
+	}
+
+	return 0;
+}
+
 /*
  * transmit data via socket function
  *
@@ -274,7 +576,12 @@ print_usage()
 	printf("Following vm commands are supported and require a vmname parameter:\n");
 	printf(" - start\n - stop\n - failreset\n\n");
 	printf("Following general commands are supported and do not require a vmname:\n");
-	printf(" - status\n\n");
+	printf(" - status\n - shutdownstatus\n - logstats [vmname]\n\n");
+	printf("Reading the recorded output of a vm:\n");
+	printf(" - logs vmname [--since time] [--until time] [--source name]\n");
+	printf(" - logs vmname -f [--new] [--source name]\n\n");
+	printf("Waiting for vms to reach a state:\n");
+	printf(" - waitstate [-t seconds] state[,state...] [vmname ...]\n\n");
 	exit(0);
 }
 
@@ -374,7 +681,9 @@ main(int argc, char **argv)
 		total = sizeof(reply_handler) / sizeof(struct vmstatedctl_replyhandler);
 		for (counter = 0; counter < total; counter++) {
 			if (!strcmp(reply_handler[counter].command, command_name)) {
-				if (reply_handler[counter].func) {
+				if (usrcmd.follow && reply_handler[counter].follow) {
+					result = reply_handler[counter].follow(sc, &usrcmd);
+				} else if (reply_handler[counter].func) {
 					result = reply_handler[counter].func(&usrcmd);
 				}
 			}
@@ -390,6 +699,8 @@ main(int argc, char **argv)
 	free(usrcmd.cmd);
 	free(usrcmd.vmname);
 	free(usrcmd.reply);
+	free(usrcmd.states);
+	free(usrcmd.source);
 	
-	return 0;
+	return (result ? 1 : 0);
 }